@@ -0,0 +1,260 @@
+#define _GNU_SOURCE
+#include "affinity.h"
+#include <ctype.h>
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+// The source workers and the destination workers each get the CPUs of a node, and the memory they
+// allocate once pinned comes from that node (first touch, preferred by set_mempolicy): the buffers of
+// an analyzer stay next to the cores hashing them. The topology is read in sysfs, without libnuma.
+
+/*!
+ * @brief parse_cpu_list converts a list of numbers and ranges, such as "0-3,8,10-11", to a bit mask
+ * @param text is the list
+ * @param mask is the mask to fill, of max_count bits
+ * @param max_count is the number of bits of the mask: larger numbers are invalid
+ * @return the number of bits set, -1 if the list is invalid
+ */
+int parse_cpu_list(const char *text, uint64_t *mask, int max_count) {
+    if (text == NULL || mask == NULL) {
+        return -1;
+    }
+    memset(mask, 0, (size_t) (max_count + 63) / 64 * sizeof(uint64_t));
+
+    int count = 0;
+    const char *cursor = text;
+    while (*cursor != '\0' && *cursor != '\n') {
+        char *end;
+        if (!isdigit((unsigned char) *cursor)) {
+            return -1;
+        }
+        long first = strtol(cursor, &end, 10);
+        long last = first;
+        if (*end == '-') {
+            if (!isdigit((unsigned char) end[1])) {
+                return -1;
+            }
+            last = strtol(end + 1, &end, 10);
+        }
+        if (first > last || last >= max_count) {
+            return -1;
+        }
+        for (long bit = first; bit <= last; ++bit) {
+            if ((mask[bit / 64] & (1ULL << (bit % 64))) == 0) {
+                mask[bit / 64] |= 1ULL << (bit % 64);
+                ++count;
+            }
+        }
+        if (*end == ',') {
+            ++end;
+        } else if (*end != '\0' && *end != '\n') {
+            return -1;
+        }
+        cursor = end;
+    }
+    return count;
+}
+
+/*!
+ * @brief read_list_file reads a list of numbers in a sysfs file (@see parse_cpu_list)
+ * @param path is the path of the file
+ * @param mask is the mask to fill, of max_count bits
+ * @param max_count is the number of bits of the mask
+ * @return the number of bits set, -1 if the file cannot be read
+ */
+static int read_list_file(const char *path, uint64_t *mask, int max_count) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        return -1;
+    }
+    char line[4096];
+    int count = -1;
+    if (fgets(line, sizeof(line), file) != NULL) {
+        count = parse_cpu_list(line, mask, max_count);
+    }
+    fclose(file);
+    return count;
+}
+
+/*!
+ * @brief read_node_cpus reads the CPUs of a NUMA node
+ * @param node is the number of the node
+ * @param cpus is the mask to fill (AFFINITY_MAX_CPUS bits)
+ * @return the number of CPUs of the node, -1 in case of error
+ */
+static int read_node_cpus(int node, uint64_t *cpus) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s/node%d/cpulist", NODES_DIRECTORY, node);
+    return read_list_file(path, cpus, AFFINITY_MAX_CPUS);
+}
+
+/*!
+ * @brief find_node finds the node holding all the CPUs of a placement
+ * @param placement is a pointer to the placement
+ * @return the number of the node, -1 if the CPUs are on several nodes or the topology is unknown
+ */
+static int find_node(placement_t *placement) {
+    uint64_t nodes[AFFINITY_MAX_NODES / 64];
+    if (read_list_file(NODES_DIRECTORY "/has_cpu", nodes, AFFINITY_MAX_NODES) <= 0) {
+        return -1;
+    }
+    for (int node = 0; node < AFFINITY_MAX_NODES; ++node) {
+        uint64_t node_cpus[AFFINITY_MAX_CPUS / 64];
+        if ((nodes[node / 64] & (1ULL << (node % 64))) == 0 || read_node_cpus(node, node_cpus) <= 0) {
+            continue;
+        }
+        bool is_inside = true;
+        for (int word = 0; word < AFFINITY_MAX_CPUS / 64 && is_inside; ++word) {
+            is_inside = (placement->cpus[word] & ~node_cpus[word]) == 0;
+        }
+        if (is_inside) {
+            return node;
+        }
+    }
+    return -1;
+}
+
+/*!
+ * @brief set_node_placement places a side on all the CPUs of a node
+ * @param placement is a pointer to the placement to set
+ * @param node is the number of the node
+ * @return 0 in case of success, -1 else
+ */
+static int set_node_placement(placement_t *placement, int node) {
+    if (read_node_cpus(node, placement->cpus) <= 0) {
+        return -1;
+    }
+    placement->is_pinned = true;
+    placement->node = node;
+    return 0;
+}
+
+/*!
+ * @brief init_placements computes where the workers of each side run
+ * With --source-cpus or --destination-cpus, the workers of a side run on the given CPUs (and those of
+ * a side without a list are not pinned). Else, on a host with several NUMA nodes having CPUs, the source
+ * workers run on the first node and the destination workers on the second one, unless --no-affinity
+ * is given. On a single node, no process is pinned.
+ * @param the_config is a pointer to the configuration
+ * @param source is a pointer to the placement of the source lister and analyzers
+ * @param destination is a pointer to the placement of the destination listers and analyzers
+ * @return 0 in case of success, -1 else
+ */
+int init_placements(configuration_t *the_config, placement_t *source, placement_t *destination) {
+    if (the_config == NULL || source == NULL || destination == NULL) {
+        return -1;
+    }
+    memset(source, 0, sizeof(placement_t));
+    memset(destination, 0, sizeof(placement_t));
+    source->node = -1;
+    destination->node = -1;
+
+    if (the_config->source_cpus[0] != '\0' || the_config->destination_cpus[0] != '\0') {
+        placement_t *placements[2] = {source, destination};
+        char *lists[2] = {the_config->source_cpus, the_config->destination_cpus};
+        for (int side = 0; side < 2; ++side) {
+            if (lists[side][0] == '\0') {
+                continue;
+            }
+            if (parse_cpu_list(lists[side], placements[side]->cpus, AFFINITY_MAX_CPUS) <= 0) {
+                fprintf(stderr, "Invalid CPU list %s\n", lists[side]);
+                return -1;
+            }
+            placements[side]->is_pinned = true;
+            placements[side]->node = find_node(placements[side]);
+        }
+        return 0;
+    }
+
+    if (!the_config->uses_affinity) {
+        return 0;
+    }
+    uint64_t nodes[AFFINITY_MAX_NODES / 64];
+    if (read_list_file(NODES_DIRECTORY "/has_cpu", nodes, AFFINITY_MAX_NODES) < 2) {
+        return 0;
+    }
+    int spread[2] = {-1, -1};
+    for (int node = 0, found = 0; node < AFFINITY_MAX_NODES && found < 2; ++node) {
+        if ((nodes[node / 64] & (1ULL << (node % 64))) != 0) {
+            spread[found++] = node;
+        }
+    }
+    if (set_node_placement(source, spread[0]) == -1 || set_node_placement(destination, spread[1]) == -1) {
+        // The workers float, as without a placement
+        source->is_pinned = false;
+        destination->is_pinned = false;
+    }
+    return 0;
+}
+
+/*!
+ * @brief apply_placement pins the current process to the CPUs of a placement, and makes its next
+ * allocations prefer the memory of their node
+ * It is called by the new processes, before they allocate their buffers (@see make_process).
+ * @param placement is a pointer to the placement (NULL or not pinned to leave the process as it is)
+ * @return 0 in case of success, -1 else
+ */
+int apply_placement(const placement_t *placement) {
+    if (placement == NULL || !placement->is_pinned) {
+        return 0;
+    }
+
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    for (int cpu = 0; cpu < AFFINITY_MAX_CPUS && cpu < CPU_SETSIZE; ++cpu) {
+        if ((placement->cpus[cpu / 64] & (1ULL << (cpu % 64))) != 0) {
+            CPU_SET(cpu, &cpus);
+        }
+    }
+    int result = 0;
+    if (sched_setaffinity(0, sizeof(cpu_set_t), &cpus) == -1) {
+        perror("Cannot set the CPU affinity");
+        result = -1;
+    }
+    if (placement->node >= 0) {
+        // set_mempolicy has no glibc wrapper (@see linux/mempolicy.h)
+        unsigned long nodemask[AFFINITY_MAX_NODES / (8 * sizeof(unsigned long))] = {0};
+        nodemask[placement->node / (8 * sizeof(unsigned long))] |= 1UL << (placement->node % (8 * sizeof(unsigned long)));
+        if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, nodemask, AFFINITY_MAX_NODES + 1) == -1) {
+            perror("Cannot set the memory policy");
+            result = -1;
+        }
+    }
+    return result;
+}
+
+/*!
+ * @brief display_placement displays where the workers of a side run
+ * @param side is the name of the side (source or destination)
+ * @param placement is a pointer to the placement of the side
+ */
+void display_placement(const char *side, const placement_t *placement) {
+    if (placement == NULL || !placement->is_pinned) {
+        printf("The %s workers are not pinned\n", side);
+        return;
+    }
+    printf("The %s workers run on the CPUs ", side);
+    const char *separator = "";
+    for (int cpu = 0; cpu < AFFINITY_MAX_CPUS; ++cpu) {
+        if ((placement->cpus[cpu / 64] & (1ULL << (cpu % 64))) == 0) {
+            continue;
+        }
+        int last = cpu;
+        while (last + 1 < AFFINITY_MAX_CPUS && (placement->cpus[(last + 1) / 64] & (1ULL << ((last + 1) % 64))) != 0) {
+            ++last;
+        }
+        printf((last > cpu) ? "%s%d-%d" : "%s%d", separator, cpu, last);
+        separator = ",";
+        cpu = last;
+    }
+    if (placement->node >= 0) {
+        printf(", with the memory of the node %d", placement->node);
+    }
+    printf("\n");
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "configuration.h"
+
+// Largest CPU number and NUMA node number handled by the placements
+#define AFFINITY_MAX_CPUS 1024
+#define AFFINITY_MAX_NODES 64
+#define NODES_DIRECTORY "/sys/devices/system/node"
+
+// Where the processes of one side (listers and analyzers) run, and which node their memory comes from
+typedef struct {
+    bool is_pinned; // Set when the processes are restricted to cpus
+    uint64_t cpus[AFFINITY_MAX_CPUS / 64]; // One bit per CPU
+    int node; // Node holding all the CPUs, whose memory is preferred, -1 for the default policy
+} placement_t;
+
+int parse_cpu_list(const char *text, uint64_t *mask, int max_count);
+int init_placements(configuration_t *the_config, placement_t *source, placement_t *destination);
+int apply_placement(const placement_t *placement);
+void display_placement(const char *side, const placement_t *placement);
@@ -0,0 +1,155 @@
+#include "autoscale.h"
+#include "utility.h"
+#include <stdio.h>
+
+// The controller does not decide faster than this, so that each measure covers enough requests
+#define AUTOSCALE_TICK_SECONDS 0.25
+// Relative throughput change under which two measures are considered equal
+#define AUTOSCALE_TOLERANCE 0.05
+// Number of converged ticks after which the controller probes a larger window again
+#define AUTOSCALE_PROBE_TICKS 8
+// An extra analyzer must add at least this fraction of the throughput of an analyzer
+#define AUTOSCALE_MIN_EFFICIENCY 0.25
+
+/*!
+ * @brief autoscaler_init initializes the analyzers pool controller of a lister
+ * @param scaler is a pointer to the controller to initialize
+ * @param label is the name of the side controlled (used in traces)
+ * @param initial_window is the number of analyzers active at start
+ * @param max_window is the size of the analyzers pool
+ * @param is_verbose enables the traces of the controller decisions on stderr
+ */
+void autoscaler_init(autoscaler_t *scaler, const char *label, int initial_window, int max_window, bool is_verbose) {
+    if (scaler == NULL) {
+        return;
+    }
+
+    scaler->label = label;
+    scaler->max_window = (max_window < 1) ? 1 : max_window;
+    scaler->window = (initial_window < 1) ? 1 : initial_window;
+    if (scaler->window > scaler->max_window) {
+        scaler->window = scaler->max_window;
+    }
+    scaler->direction = 1; // Start by probing a larger window
+    scaler->stable_ticks = 0;
+    scaler->last_rate = 0.0;
+    scaler->last_window = scaler->window;
+    scaler->last_per_analyzer = 0.0;
+    scaler->last_latency = 0.0;
+    scaler->last_completed = 0;
+    scaler->latency_sum = 0.0;
+    scaler->is_verbose = is_verbose;
+    clock_gettime(CLOCK_MONOTONIC, &scaler->start);
+    scaler->last_tick = scaler->start;
+}
+
+/*!
+ * @brief autoscaler_record_latency accounts the service time of a completed analysis request
+ * @param scaler is a pointer to the controller
+ * @param latency is the time (in seconds) between the request and its response
+ */
+void autoscaler_record_latency(autoscaler_t *scaler, double latency) {
+    if (scaler != NULL) {
+        scaler->latency_sum += latency;
+    }
+}
+
+/*!
+ * @brief autoscaler_update lets the controller adjust the window after some requests completed
+ * It is a hill climbing controller: it keeps moving the window in the same direction while the
+ * throughput improves, turns back when it degrades, and stops when it no longer changes. A larger
+ * window must also pay for its analyzers: when the extra ones add less than AUTOSCALE_MIN_EFFICIENCY
+ * of the throughput of an analyzer while the latency of the requests grows, the analyzers are
+ * saturating the device (or the CPUs) and queue behind each other, so the window steps back even
+ * if the total throughput improved a little. When the backlog is smaller than the window, the
+ * window is reduced to the backlog.
+ * @param scaler is a pointer to the controller
+ * @param completed is the total number of requests completed so far
+ * @param backlog is the number of entries not sent to analyzers yet
+ * @param in_flight is the number of requests currently processed by analyzers
+ * @return the new window
+ */
+int autoscaler_update(autoscaler_t *scaler, uint64_t completed, size_t backlog, int in_flight) {
+    if (scaler == NULL) {
+        return 1;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double interval = elapsed_seconds(&scaler->last_tick, &now);
+    uint64_t done = completed - scaler->last_completed;
+    if (interval < AUTOSCALE_TICK_SECONDS || done < (uint64_t) scaler->window) {
+        return scaler->window;
+    }
+
+    double rate = (double) done / interval;
+    double per_analyzer = rate / scaler->window;
+    double latency = scaler->latency_sum / (double) done;
+    int previous_window = scaler->window;
+    const char *decision;
+
+    if (backlog < (size_t) scaler->window) {
+        // Not enough work queued to keep every analyzer busy
+        scaler->window = (backlog < 1) ? 1 : (int) backlog;
+        decision = "draining";
+    } else if (scaler->last_rate == 0.0) {
+        decision = "probing";
+    } else if (previous_window > scaler->last_window && latency > scaler->last_latency * (1.0 + AUTOSCALE_TOLERANCE) &&
+               rate - scaler->last_rate < (previous_window - scaler->last_window) * scaler->last_per_analyzer * AUTOSCALE_MIN_EFFICIENCY) {
+        // The extra analyzers mostly wait: each request takes longer, for little more throughput
+        scaler->direction = -1;
+        decision = "contended";
+    } else if (rate > scaler->last_rate * (1.0 + AUTOSCALE_TOLERANCE)) {
+        // The last move paid off, keep going
+        if (scaler->direction == 0) {
+            scaler->direction = 1;
+        }
+        decision = "improving";
+    } else if (rate < scaler->last_rate * (1.0 - AUTOSCALE_TOLERANCE) && scaler->direction != 0) {
+        // The last move hurt, turn back
+        scaler->direction = -scaler->direction;
+        decision = "degrading";
+    } else if (scaler->direction > 0) {
+        // More analyzers did not bring more throughput: they only add I/O wait
+        scaler->direction = -1;
+        decision = "saturated";
+    } else {
+        scaler->direction = 0;
+        decision = "converged";
+    }
+
+    if (scaler->direction == 0) {
+        if (++scaler->stable_ticks >= AUTOSCALE_PROBE_TICKS) {
+            scaler->stable_ticks = 0;
+            scaler->direction = 1;
+        }
+    } else {
+        scaler->stable_ticks = 0;
+    }
+
+    if (scaler->window == previous_window) {
+        scaler->window += scaler->direction;
+        if (scaler->window < 1) {
+            scaler->window = 1;
+            scaler->direction = 0;
+        } else if (scaler->window > scaler->max_window) {
+            scaler->window = scaler->max_window;
+            scaler->direction = 0;
+        }
+    }
+
+    if (scaler->is_verbose) {
+        fprintf(stderr, "[autoscale] %s t=%.3fs window=%d in_flight=%d backlog=%zu rate=%.1f/s per_analyzer=%.1f/s latency=%.3fms %s -> window=%d\n",
+                scaler->label, elapsed_seconds(&scaler->start, &now), previous_window, in_flight, backlog,
+                rate, per_analyzer, latency * 1000.0, decision, scaler->window);
+    }
+
+    scaler->last_rate = rate;
+    scaler->last_window = previous_window;
+    scaler->last_per_analyzer = per_analyzer;
+    scaler->last_latency = latency;
+    scaler->last_completed = completed;
+    scaler->latency_sum = 0.0;
+    scaler->last_tick = now;
+    return scaler->window;
+}
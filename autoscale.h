@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+typedef struct {
+    const char *label; // Name of the side (source or destination), used in traces
+    int window; // Number of analysis requests allowed in flight (active analyzers)
+    int max_window; // Size of the analyzers pool, the window never goes above it
+    int direction; // +1 when growing, -1 when shrinking, 0 when converged
+    int stable_ticks; // Number of ticks spent converged, used to probe again
+    double last_rate; // Throughput (files/s) measured during the previous tick
+    int last_window; // Window during the previous tick
+    double last_per_analyzer; // Throughput of each active analyzer during the previous tick
+    double last_latency; // Mean latency (s) of the requests completed during the previous tick
+    uint64_t last_completed; // Completed requests at the previous tick
+    double latency_sum; // Sum of request latencies (s) since the previous tick
+    struct timespec start; // Start of the run, for trace timestamps
+    struct timespec last_tick; // Time of the previous tick
+    bool is_verbose; // Print one trace line per controller decision
+} autoscaler_t;
+
+void autoscaler_init(autoscaler_t *scaler, const char *label, int initial_window, int max_window, bool is_verbose);
+void autoscaler_record_latency(autoscaler_t *scaler, double latency);
+int autoscaler_update(autoscaler_t *scaler, uint64_t completed, size_t backlog, int in_flight);
@@ -0,0 +1,1394 @@
+#define _GNU_SOURCE
+#include "tree-generator.h"
+#include "../compress.h"
+#include "../configuration.h"
+#include "../delete.h"
+#include "../durability.h"
+#include "../file-properties.h"
+#include "../file-io.h"
+#include "../files-list.h"
+#include "../filters.h"
+#include "../instrumentation.h"
+#include "../messages.h"
+#include "../processes.h"
+#include "../receiver.h"
+#include "../remote.h"
+#include "../sync.h"
+#include "../trace.h"
+#include "../tree-stream.h"
+#include "../utility.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ipc.h>
+#include <sys/msg.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TRANSPORT_MESSAGES 20000
+// Rules of the filter harnesses: a few of them match the generated tree
+#define FILTER_RULES 4000
+// The sparse file has a data extent of SPARSE_EXTENT_SIZE bytes every SPARSE_STRIDE bytes
+#define SPARSE_EXTENT_SIZE (64 * 1024)
+#define SPARSE_STRIDE (4 * 1024 * 1024)
+// Largest chunk forwarded at once by the latency shim of the remote harnesses
+#define SHIM_CHUNK_SIZE (64 * 1024)
+// Entries of the single directory listed by the wide listing harnesses, and their memory limit
+#define WIDE_DIRECTORY_ENTRIES 100000
+#define WIDE_MEMORY_LIMIT (1024 * 1024)
+// Operations measured by the instrumentation harnesses: as many as the trace buffer of a process keeps
+#define INSTRUMENTED_EVENTS TRACE_EVENTS_PER_PROCESS
+
+typedef struct {
+    char work_dir[PATH_SIZE];
+    char source[PATH_SIZE];
+    char destination[PATH_SIZE];
+    char copy_target[PATH_SIZE];
+    char sparse_dir[PATH_SIZE]; // Holds the sparse file
+    char sparse_file[PATH_SIZE];
+    char sparse_copy[PATH_SIZE]; // Copy target of the sparse file
+    char compressed_copy[PATH_SIZE]; // Copy target of the compressed copy
+    char fanout_copy[PATH_SIZE]; // Second copy target of the fan-out copies
+    char restored_file[PATH_SIZE]; // Decompressed file checked against its source
+    long latency_ms; // One-way delay added by the latency shim of the remote harnesses
+    uint8_t compression_threads;
+    uint64_t sparse_size;
+    tree_spec_t spec;
+    tree_stats_t tree_stats;
+    bool is_cache_polite; // Set when the harnesses use the cache-polite I/O (@see file-io.c)
+} bench_context_t;
+
+typedef struct {
+    uint64_t items; // Number of elements processed (entries, files, messages...)
+    uint64_t bytes; // Amount of data processed
+    double seconds; // Measured time
+} bench_result_t;
+
+typedef int (*bench_harness_t)(bench_context_t *context, bench_result_t *result);
+
+typedef struct {
+    const char *name;
+    const char *unit; // Name of the items
+    bench_harness_t harness;
+    bool reads_trees; // Set to true when the page cache matters to the harness (cold runs)
+} bench_t;
+
+typedef enum { CACHE_WARM = 1, CACHE_COLD = 2, CACHE_BOTH = 3 } cache_mode_t;
+
+typedef enum {DEPTH, FANOUT, FILES, SIZE_DIST, MIN_SIZE, MAX_SIZE, CHANGE_RATIO, SEED, JSON, ONLY, KEEP, CACHE, CACHE_POLITE, SPARSE_SIZE, COMPRESS_THREADS, LATENCY} bench_opt_values;
+
+/*!
+ * @brief display_bench_help displays a brief manual for the benchmarks
+ * @param my_name is the name of the binary file
+ */
+static void display_bench_help(char *my_name) {
+    printf("%s [options] work_dir\n", my_name);
+    printf("Generates a source and a destination tree in work_dir and measures each stage of the backup\n");
+    printf("Options: \t--depth <levels>\tlevels of directories (default 3)\n");
+    printf("         \t--fanout <count>\tsubdirectories per directory (default 4)\n");
+    printf("         \t--files <count>\tfiles per directory (default 20)\n");
+    printf("         \t--size-dist <fixed|uniform|pareto>\tdistribution of the files sizes (default pareto)\n");
+    printf("         \t--min-size <bytes>\tsmallest file (default 4096, k, m and g suffixes accepted)\n");
+    printf("         \t--max-size <bytes>\tlargest file (default 4194304, k, m and g suffixes accepted)\n");
+    printf("         \t--change-ratio <ratio>\tpart of the files differing in the destination (default 0.1)\n");
+    printf("         \t--seed <value>\tseed of the generator (default 42)\n");
+    printf("         \t--only <name>\truns a single harness\n");
+    printf("         \t--json <file>\twrites the results as JSON (- for stdout)\n");
+    printf("         \t--keep\tkeeps the generated trees\n");
+    printf("         \t--cache <warm|cold|both>\truns the listing, hashing and copy harnesses with a warm page cache,\n");
+    printf("         \t\tafter evicting the trees from the page cache, or both (default warm)\n");
+    printf("         \t--sparse-size <bytes>\tsize of the sparse file of the sparse harnesses (default 1g)\n");
+    printf("         \t--compress-threads <count>\tthreads compressing each file in the compressed copy (default: one per CPU)\n");
+    printf("         \t--latency <ms>\tone-way delay added to the socket of the remote_latency harness (default 5)\n");
+    printf("         \t--cache-polite\thashes and copies without keeping the data in the page cache\n");
+}
+
+/*!
+ * @brief bench_clock returns the current monotonic time
+ */
+static struct timespec bench_clock(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now;
+}
+
+/*!
+ * @brief count_list counts the entries of a list and the bytes of its files
+ */
+static void count_list(files_list_t *list, bench_result_t *result) {
+    for (files_list_entry_t *cursor = list->head; cursor != NULL; cursor = cursor->next) {
+        ++result->items;
+        if (cursor->entry_type == FICHIER) {
+            result->bytes += cursor->size;
+        }
+    }
+}
+
+/*!
+ * @brief bench_make_files_list measures the listing of the source tree (without MD5)
+ */
+static int bench_make_files_list(bench_context_t *context, bench_result_t *result) {
+    files_list_t list = {0};
+    struct timespec start = bench_clock();
+    make_files_list(&list, context->source, false);
+    struct timespec end = bench_clock();
+    result->seconds = elapsed_seconds(&start, &end);
+    count_list(&list, result);
+    clear_files_list(&list);
+    return 0;
+}
+
+/*!
+ * @brief bench_compute_file_digest measures the digest computation of all the files of the source tree
+ */
+static int bench_compute_file_digest(bench_context_t *context, bench_result_t *result) {
+    files_list_t list = {0};
+    make_files_list(&list, context->source, false);
+
+    struct timespec start = bench_clock();
+    for (files_list_entry_t *cursor = list.head; cursor != NULL; cursor = cursor->next) {
+        if (cursor->entry_type == FICHIER && compute_file_digest(cursor) == 0) {
+            ++result->items;
+            result->bytes += cursor->size;
+        }
+    }
+    struct timespec end = bench_clock();
+    result->seconds = elapsed_seconds(&start, &end);
+    clear_files_list(&list);
+    return 0;
+}
+
+/*!
+ * @brief bench_transport measures the transfer of files list entries between two processes through a MQ
+ */
+static int bench_transport(bench_context_t *context, bench_result_t *result) {
+    (void) context;
+    int msg_queue = msgget(IPC_PRIVATE, 0600 | IPC_CREAT);
+    if (msg_queue == -1) {
+        perror("Cannot create the benchmark MQ");
+        return -1;
+    }
+
+    pid_t receiver = fork();
+    if (receiver == 0) {
+        any_message_t message;
+        for (int i = 0; i < TRANSPORT_MESSAGES; ++i) {
+            if (receive_message(msg_queue, &message, MSG_TYPE_TO_MAIN, 0) == -1) {
+                exit(EXIT_FAILURE);
+            }
+        }
+        exit(EXIT_SUCCESS);
+    }
+
+    files_list_entry_t entry;
+    memset(&entry, 0, sizeof(entry));
+    concat_path(entry.path_and_name, context->source, "dir-000/dir-001/file-0001.dat");
+    struct timespec start = bench_clock();
+    for (int i = 0; i < TRANSPORT_MESSAGES; ++i) {
+        if (send_files_list_element(msg_queue, MSG_TYPE_TO_MAIN, &entry) == -1) {
+            perror("Cannot send benchmark message");
+            break;
+        }
+        ++result->items;
+        result->bytes += sizeof(files_list_entry_transmit_t) - sizeof(long);
+    }
+    int status;
+    waitpid(receiver, &status, 0);
+    struct timespec end = bench_clock();
+    result->seconds = elapsed_seconds(&start, &end);
+    msgctl(msg_queue, IPC_RMID, NULL);
+    return (WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS) ? 0 : -1;
+}
+
+/*!
+ * @brief bench_mismatch measures the comparison of the source and destination lists
+ */
+static int bench_mismatch(bench_context_t *context, bench_result_t *result) {
+    configuration_t config;
+    init_configuration(&config);
+    strncpy(config.source, context->source, sizeof(config.source) - 1);
+    strncpy(config.destination, context->destination, sizeof(config.destination) - 1);
+
+    files_list_t src_list = {0}, dst_list = {0}, diff_list = {0};
+    make_files_list(&src_list, context->source, true);
+    make_files_list(&dst_list, context->destination, true);
+
+    struct timespec start = bench_clock();
+    make_differences_list(&diff_list, &src_list, &dst_list, &config);
+    struct timespec end = bench_clock();
+    result->seconds = elapsed_seconds(&start, &end);
+    count_list(&src_list, result);
+
+    clear_files_list(&src_list);
+    clear_files_list(&dst_list);
+    clear_files_list(&diff_list);
+    return 0;
+}
+
+/*!
+ * @brief bench_copy measures the copy of the whole source tree to an empty destination
+ */
+static int bench_copy(bench_context_t *context, bench_result_t *result) {
+    configuration_t config;
+    init_configuration(&config);
+    strncpy(config.source, context->source, sizeof(config.source) - 1);
+    strncpy(config.destination, context->copy_target, sizeof(config.destination) - 1);
+    config.is_cache_polite = context->is_cache_polite;
+
+    remove_tree(context->copy_target);
+    if (mkdir(context->copy_target, 0755) == -1) {
+        perror("Cannot create the copy target");
+        return -1;
+    }
+
+    files_list_t list = {0};
+    make_files_list(&list, context->source, false);
+    struct timespec start = bench_clock();
+    for (files_list_entry_t *cursor = list.head; cursor != NULL; cursor = cursor->next) {
+        copy_entry_to_destination(cursor, &config);
+    }
+    struct timespec end = bench_clock();
+    result->seconds = elapsed_seconds(&start, &end);
+    count_list(&list, result);
+    clear_files_list(&list);
+    return 0;
+}
+
+/*!
+ * @brief durable_copy measures the crash-safe copy of the whole source tree to an empty destination
+ * @param durability is the durable mode (@see durability.c)
+ */
+static int durable_copy(bench_context_t *context, bench_result_t *result, durability_t durability) {
+    configuration_t config;
+    init_configuration(&config);
+    strncpy(config.source, context->source, sizeof(config.source) - 1);
+    strncpy(config.destination, context->copy_target, sizeof(config.destination) - 1);
+    config.is_cache_polite = context->is_cache_polite;
+    config.durability = durability;
+
+    remove_tree(context->copy_target);
+    if (mkdir(context->copy_target, 0755) == -1) {
+        perror("Cannot create the copy target");
+        return -1;
+    }
+
+    files_list_t list = {0};
+    make_files_list(&list, context->source, false);
+    struct timespec start = bench_clock();
+    if (init_durability(&config) == -1) {
+        clear_files_list(&list);
+        return -1;
+    }
+    for (files_list_entry_t *cursor = list.head; cursor != NULL; cursor = cursor->next) {
+        copy_entry_to_destination(cursor, &config);
+    }
+    clean_durability(true);
+    struct timespec end = bench_clock();
+    result->seconds = elapsed_seconds(&start, &end);
+    count_list(&list, result);
+    clear_files_list(&list);
+    return 0;
+}
+
+/*!
+ * @brief bench_copy_fsync measures the copy with one fsync per file
+ */
+static int bench_copy_fsync(bench_context_t *context, bench_result_t *result) {
+    return durable_copy(context, result, DURABILITY_FSYNC);
+}
+
+/*!
+ * @brief bench_copy_fdatasync measures the copy with batches of fdatasync
+ */
+static int bench_copy_fdatasync(bench_context_t *context, bench_result_t *result) {
+    return durable_copy(context, result, DURABILITY_FDATASYNC);
+}
+
+/*!
+ * @brief bench_copy_syncfs measures the copy with one syncfs per batch
+ */
+static int bench_copy_syncfs(bench_context_t *context, bench_result_t *result) {
+    return durable_copy(context, result, DURABILITY_SYNCFS);
+}
+
+/*!
+ * @brief bench_sparse_digest measures the digest computation of a mostly sparse file
+ */
+static int bench_sparse_digest(bench_context_t *context, bench_result_t *result) {
+    files_list_entry_t entry;
+    memset(&entry, 0, sizeof(files_list_entry_t));
+    snprintf(entry.path_and_name, sizeof(entry.path_and_name), "%s", context->sparse_file);
+    if (get_file_metadata(&entry) == -1) {
+        return -1;
+    }
+
+    struct timespec start = bench_clock();
+    int status = compute_file_digest(&entry);
+    struct timespec end = bench_clock();
+    result->seconds = elapsed_seconds(&start, &end);
+    result->items = 1;
+    result->bytes = entry.size;
+    return status;
+}
+
+/*!
+ * @brief bench_sparse_copy measures the copy of a mostly sparse file, and how much its copy allocates
+ */
+static int bench_sparse_copy(bench_context_t *context, bench_result_t *result) {
+    configuration_t config;
+    init_configuration(&config);
+    strncpy(config.source, context->sparse_dir, sizeof(config.source) - 1);
+    strncpy(config.destination, context->sparse_copy, sizeof(config.destination) - 1);
+    config.is_cache_polite = context->is_cache_polite;
+
+    remove_tree(context->sparse_copy);
+    if (mkdir(context->sparse_copy, 0755) == -1) {
+        perror("Cannot create the sparse copy target");
+        return -1;
+    }
+    files_list_entry_t entry;
+    memset(&entry, 0, sizeof(files_list_entry_t));
+    snprintf(entry.path_and_name, sizeof(entry.path_and_name), "%s", context->sparse_file);
+    if (get_file_metadata(&entry) == -1) {
+        return -1;
+    }
+
+    struct timespec start = bench_clock();
+    copy_entry_to_destination(&entry, &config);
+    struct timespec end = bench_clock();
+    result->seconds = elapsed_seconds(&start, &end);
+    result->items = 1;
+    result->bytes = entry.size;
+
+    char copy_path[PATH_SIZE];
+    struct stat copy_stat;
+    if (concat_path(copy_path, context->sparse_copy, relative_path(context->sparse_file, context->sparse_dir)) != NULL &&
+        stat(copy_path, &copy_stat) == 0) {
+        printf("%-18s %.1f MiB allocated for %.1f MiB\n", "(sparse copy)",
+               (double) copy_stat.st_blocks * 512 / (1024.0 * 1024.0), (double) copy_stat.st_size / (1024.0 * 1024.0));
+    }
+    return 0;
+}
+
+/*!
+ * @brief bench_compressed_copy measures the compressed copy of the source tree (zlib, @see compress.c)
+ * Every copy is then decompressed and compared with its source, outside of the measure.
+ */
+static int bench_compressed_copy(bench_context_t *context, bench_result_t *result) {
+    configuration_t config;
+    init_configuration(&config);
+    strncpy(config.source, context->source, sizeof(config.source) - 1);
+    strncpy(config.destination, context->compressed_copy, sizeof(config.destination) - 1);
+    config.is_cache_polite = context->is_cache_polite;
+    config.compression = COMPRESSION_ZLIB;
+    config.compression_threads = context->compression_threads;
+
+    remove_tree(context->compressed_copy);
+    if (mkdir(context->compressed_copy, 0755) == -1) {
+        perror("Cannot create the compressed copy target");
+        return -1;
+    }
+
+    files_list_t list = {0};
+    make_files_list(&list, context->source, true);
+    struct timespec start = bench_clock();
+    for (files_list_entry_t *cursor = list.head; cursor != NULL; cursor = cursor->next) {
+        copy_entry_to_destination(cursor, &config);
+    }
+    struct timespec end = bench_clock();
+    result->seconds = elapsed_seconds(&start, &end);
+    count_list(&list, result);
+
+    // Round trip: the headers must give the source properties, and the decompressed data its MD5 sum
+    uint64_t compressed_bytes = 0, failures = 0;
+    for (files_list_entry_t *cursor = list.head; cursor != NULL; cursor = cursor->next) {
+        files_list_entry_t copy;
+        memset(&copy, 0, sizeof(files_list_entry_t));
+        if (cursor->entry_type != FICHIER ||
+            concat_path(copy.path_and_name, context->compressed_copy, relative_path(cursor->path_and_name, context->source)) == NULL) {
+            continue;
+        }
+        struct stat copy_stat;
+        if (stat(copy.path_and_name, &copy_stat) == 0) {
+            compressed_bytes += (uint64_t) copy_stat.st_size;
+        }
+
+        files_list_entry_t restored;
+        memset(&restored, 0, sizeof(files_list_entry_t));
+        snprintf(restored.path_and_name, sizeof(restored.path_and_name), "%s", context->restored_file);
+        if (get_compressed_file_stats(&copy) == -1 || mismatch(cursor, &copy, true) ||
+            decompress_file(copy.path_and_name, restored.path_and_name) == -1 ||
+            get_file_stats(&restored) == -1 || mismatch(cursor, &restored, true)) {
+            ++failures;
+        }
+    }
+    unlink(context->restored_file);
+    printf("%-18s %.1f MiB for %.1f MiB, %lu round trip failures\n", "(compressed copy)",
+           (double) compressed_bytes / (1024.0 * 1024.0), (double) result->bytes / (1024.0 * 1024.0), (unsigned long) failures);
+    clear_files_list(&list);
+    return (failures == 0) ? 0 : -1;
+}
+
+/*!
+ * @brief make_bench_rules makes the rules of the filter harnesses, in the format of the configuration
+ * Most rules are literal names, suffixes, anchored paths or globs that do not match the generated
+ * tree; the last ones exclude a directory and a tenth of the files.
+ * @param rules receives the rules ("- pattern" or "+ pattern")
+ * @return the number of rules, 0 in case of error
+ */
+static size_t make_bench_rules(char ***rules) {
+    *rules = calloc(FILTER_RULES, sizeof(char *));
+    if (*rules == NULL) {
+        return 0;
+    }
+    size_t count = 0;
+    char rule[PATH_SIZE];
+    while (count < FILTER_RULES) {
+        int i = (int) count / 4;
+        switch (count % 4) {
+            case 0:
+                snprintf(rule, sizeof(rule), "- cache-%d", i);
+                break;
+            case 1:
+                snprintf(rule, sizeof(rule), "- *.ext%d", i);
+                break;
+            case 2:
+                snprintf(rule, sizeof(rule), "- /dir-%03d/dir-%03d/file-%04d.tmp", i % 7, i % 5, i);
+                break;
+            default:
+                snprintf(rule, sizeof(rule), "- f?le-%04d.b[a-k]k", i);
+                break;
+        }
+        if (count == FILTER_RULES - 3) {
+            snprintf(rule, sizeof(rule), "+ /dir-000/dir-000/");
+        } else if (count == FILTER_RULES - 2) {
+            snprintf(rule, sizeof(rule), "- /dir-00[0-1]/dir-000/");
+        } else if (count == FILTER_RULES - 1) {
+            snprintf(rule, sizeof(rule), "- file-*[0].dat");
+        }
+        if (((*rules)[count] = strdup(rule)) == NULL) {
+            return 0;
+        }
+        ++count;
+    }
+    return count;
+}
+
+/*!
+ * @brief bench_filters measures the listing of the source tree with the compiled filter rules
+ * (@see filters.c): the excluded directories are not listed
+ */
+static int bench_filters(bench_context_t *context, bench_result_t *result) {
+    configuration_t config;
+    init_configuration(&config);
+    config.filter_rules_count = make_bench_rules(&config.filter_rules);
+    if (config.filter_rules_count == 0 || init_filters(&config) == -1) {
+        return -1;
+    }
+
+    files_list_t list = {0};
+    struct timespec start = bench_clock();
+    make_list(&list, context->source);
+    struct timespec end = bench_clock();
+    result->seconds = elapsed_seconds(&start, &end);
+    count_list(&list, result);
+    printf("%-18s %lu rules, %lu entries kept\n", "(filters)", (unsigned long) config.filter_rules_count, (unsigned long) result->items);
+    clear_files_list(&list);
+    clean_filters();
+    return 0;
+}
+
+/*!
+ * @brief naive_filter tells if an entry is included by testing each rule in turn with fnmatch
+ * @param rules are the rules
+ * @param count is the number of rules
+ * @param relative is the path of the entry relative to the root
+ * @param is_directory is true if the entry is a directory
+ * @return true if the entry is included
+ */
+static bool naive_filter(char **rules, size_t count, char *relative, bool is_directory) {
+    char *name = strrchr(relative, '/');
+    name = (name == NULL) ? relative : name + 1;
+    char pattern[PATH_SIZE];
+    for (size_t i = 0; i < count; ++i) {
+        size_t length = (size_t) snprintf(pattern, sizeof(pattern), "%s", rules[i] + 2);
+        bool is_directory_only = (length > 1 && pattern[length - 1] == '/');
+        if (is_directory_only) {
+            if (!is_directory) {
+                continue;
+            }
+            pattern[length - 1] = '\0';
+        }
+        bool matches = (strchr(pattern, '/') == NULL) ? fnmatch(pattern, name, 0) == 0 :
+                       fnmatch(pattern + (pattern[0] == '/'), relative, FNM_PATHNAME) == 0;
+        if (matches) {
+            return rules[i][0] == '+';
+        }
+    }
+    return true;
+}
+
+/*!
+ * @brief bench_filters_naive measures the listing of the whole source tree, then the test of each
+ * entry against each rule, as a reference for bench_filters
+ */
+static int bench_filters_naive(bench_context_t *context, bench_result_t *result) {
+    char **rules;
+    size_t count = make_bench_rules(&rules);
+    if (count == 0) {
+        return -1;
+    }
+
+    files_list_t list = {0};
+    struct timespec start = bench_clock();
+    make_list(&list, context->source);
+    char excluded[PATH_SIZE] = "";
+    size_t excluded_length = 0;
+    for (files_list_entry_t *cursor = list.head; cursor != NULL; cursor = cursor->next) {
+        char *relative = relative_path(cursor->path_and_name, context->source);
+        // The content of an excluded directory follows it in the list
+        if (excluded_length > 0 && strncmp(relative, excluded, excluded_length) == 0 && relative[excluded_length] == '/') {
+            continue;
+        }
+        if (naive_filter(rules, count, relative, cursor->entry_type == DOSSIER)) {
+            ++result->items;
+        } else if (cursor->entry_type == DOSSIER) {
+            excluded_length = (size_t) snprintf(excluded, sizeof(excluded), "%s", relative);
+        }
+    }
+    struct timespec end = bench_clock();
+    result->seconds = elapsed_seconds(&start, &end);
+    printf("%-18s %lu rules, %lu entries kept\n", "(filters naive)", (unsigned long) count, (unsigned long) result->items);
+    clear_files_list(&list);
+    for (size_t i = 0; i < count; ++i) {
+        free(rules[i]);
+    }
+    free(rules);
+    return 0;
+}
+
+/*!
+ * @brief fanout_copies copies the whole source tree to two empty destinations
+ * @param is_fanout is true to read each file once for both destinations (@see fanout_copy), false to
+ * copy the tree to one destination, then to the other
+ */
+static int fanout_copies(bench_context_t *context, bench_result_t *result, bool is_fanout) {
+    configuration_t config;
+    init_configuration(&config);
+    strncpy(config.source, context->source, sizeof(config.source) - 1);
+    strncpy(config.destination, context->copy_target, sizeof(config.destination) - 1);
+    strncpy(config.extra_destinations[0], context->fanout_copy, sizeof(config.extra_destinations[0]) - 1);
+    config.extra_destinations_count = 1;
+    config.is_cache_polite = context->is_cache_polite;
+
+    remove_tree(context->copy_target);
+    remove_tree(context->fanout_copy);
+    if (mkdir(context->copy_target, 0755) == -1 || mkdir(context->fanout_copy, 0755) == -1) {
+        perror("Cannot create the copy targets");
+        return -1;
+    }
+
+    files_list_t list = {0};
+    make_files_list(&list, context->source, false);
+    struct timespec start = bench_clock();
+    for (files_list_entry_t *cursor = list.head; cursor != NULL; cursor = cursor->next) {
+        copy_entry_to_destinations(cursor, &config, is_fanout ? 3 : 1);
+    }
+    if (!is_fanout) {
+        strncpy(config.destination, context->fanout_copy, sizeof(config.destination) - 1);
+        for (files_list_entry_t *cursor = list.head; cursor != NULL; cursor = cursor->next) {
+            copy_entry_to_destinations(cursor, &config, 1);
+        }
+    }
+    struct timespec end = bench_clock();
+    result->seconds = elapsed_seconds(&start, &end);
+    count_list(&list, result);
+    result->bytes *= 2;
+    clear_files_list(&list);
+    return 0;
+}
+
+/*!
+ * @brief bench_fanout_copy measures the copy of the source tree to two destinations, reading it once
+ */
+static int bench_fanout_copy(bench_context_t *context, bench_result_t *result) {
+    return fanout_copies(context, result, true);
+}
+
+/*!
+ * @brief bench_fanout_naive measures the copy of the source tree to two destinations, one after the other
+ */
+static int bench_fanout_naive(bench_context_t *context, bench_result_t *result) {
+    return fanout_copies(context, result, false);
+}
+
+/*!
+ * @brief make_deletion_tree creates, in the copy target, the directories of the source tree with an
+ * empty file for each of its files
+ * @return the number of entries created, -1 in case of error
+ */
+static int64_t make_deletion_tree(bench_context_t *context) {
+    remove_tree(context->copy_target);
+    if (mkdir(context->copy_target, 0755) == -1) {
+        perror("Cannot create the copy target");
+        return -1;
+    }
+
+    files_list_t list = {0};
+    make_list(&list, context->source);
+    int64_t count = 0;
+    for (files_list_entry_t *cursor = list.head; cursor != NULL; cursor = cursor->next) {
+        char path[PATH_SIZE];
+        if (concat_path(path, context->copy_target, relative_path(cursor->path_and_name, context->source)) == NULL) {
+            continue;
+        }
+        int fd = -1;
+        if ((cursor->entry_type == DOSSIER) ? mkdir(path, 0755) == 0 : (fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) != -1) {
+            ++count;
+        }
+        if (fd != -1) {
+            close(fd);
+        }
+    }
+    clear_files_list(&list);
+    return count;
+}
+
+/*!
+ * @brief bench_delete measures the deletion of a tree by the deletion threads (@see delete.c), its
+ * top-level entries being queued as --delete does for the destination entries missing from the source
+ */
+static int bench_delete(bench_context_t *context, bench_result_t *result) {
+    if (make_deletion_tree(context) == -1) {
+        return -1;
+    }
+
+    uint64_t deleted = get_deleted_count();
+    struct timespec start = bench_clock();
+    files_list_t top = {0};
+    list_directory(&top, context->copy_target);
+    for (files_list_entry_t *cursor = top.head; cursor != NULL; cursor = cursor->next) {
+        queue_deletion(cursor->path_and_name, cursor->entry_type == DOSSIER);
+    }
+    clean_deletions();
+    struct timespec end = bench_clock();
+    clear_files_list(&top);
+    result->seconds = elapsed_seconds(&start, &end);
+    result->items = get_deleted_count() - deleted;
+    return 0;
+}
+
+/*!
+ * @brief bench_delete_naive measures the deletion of the same tree by path, with a stat of each
+ * entry (nftw), as a reference for bench_delete
+ */
+static int bench_delete_naive(bench_context_t *context, bench_result_t *result) {
+    int64_t count = make_deletion_tree(context);
+    if (count == -1) {
+        return -1;
+    }
+
+    struct timespec start = bench_clock();
+    remove_tree(context->copy_target);
+    struct timespec end = bench_clock();
+    result->seconds = elapsed_seconds(&start, &end);
+    result->items = (uint64_t) count;
+    return 0;
+}
+
+// Bytes going one way through the latency shim, each chunk being released after the delay
+typedef struct shim_chunk_s {
+    struct timespec due;
+    size_t size;
+    struct shim_chunk_s *next;
+    unsigned char data[];
+} shim_chunk_t;
+
+typedef struct {
+    int from;
+    int to;
+    long latency_ms;
+    pthread_mutex_t lock;
+    pthread_cond_t has_chunk;
+    shim_chunk_t *head;
+    shim_chunk_t *tail;
+    bool is_closed; // Set when the sending side closed the connection
+} shim_direction_t;
+
+/*!
+ * @brief shim_reader is the function of the thread reading one side of the latency shim
+ * @param parameters is a pointer to the shim_direction_t
+ * @return NULL
+ */
+static void *shim_reader(void *parameters) {
+    shim_direction_t *direction = (shim_direction_t *) parameters;
+    while (true) {
+        shim_chunk_t *chunk = malloc(sizeof(shim_chunk_t) + SHIM_CHUNK_SIZE);
+        ssize_t received = (chunk == NULL) ? -1 : read(direction->from, chunk->data, SHIM_CHUNK_SIZE);
+        if (received <= 0) {
+            free(chunk);
+            break;
+        }
+        chunk->size = (size_t) received;
+        chunk->next = NULL;
+        chunk->due = bench_clock();
+        chunk->due.tv_sec += direction->latency_ms / 1000;
+        chunk->due.tv_nsec += (direction->latency_ms % 1000) * 1000000L;
+        if (chunk->due.tv_nsec >= 1000000000L) {
+            chunk->due.tv_sec += 1;
+            chunk->due.tv_nsec -= 1000000000L;
+        }
+        pthread_mutex_lock(&direction->lock);
+        if (direction->tail != NULL) {
+            direction->tail->next = chunk;
+        } else {
+            direction->head = chunk;
+        }
+        direction->tail = chunk;
+        pthread_cond_signal(&direction->has_chunk);
+        pthread_mutex_unlock(&direction->lock);
+    }
+    pthread_mutex_lock(&direction->lock);
+    direction->is_closed = true;
+    pthread_cond_signal(&direction->has_chunk);
+    pthread_mutex_unlock(&direction->lock);
+    return NULL;
+}
+
+/*!
+ * @brief shim_writer is the function of the thread writing the delayed chunks to the other side
+ * @param parameters is a pointer to the shim_direction_t
+ * @return NULL
+ */
+static void *shim_writer(void *parameters) {
+    shim_direction_t *direction = (shim_direction_t *) parameters;
+    while (true) {
+        pthread_mutex_lock(&direction->lock);
+        while (direction->head == NULL && !direction->is_closed) {
+            pthread_cond_wait(&direction->has_chunk, &direction->lock);
+        }
+        shim_chunk_t *chunk = direction->head;
+        if (chunk != NULL) {
+            direction->head = chunk->next;
+            if (direction->head == NULL) {
+                direction->tail = NULL;
+            }
+        }
+        pthread_mutex_unlock(&direction->lock);
+        if (chunk == NULL) {
+            break;
+        }
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &chunk->due, NULL) == EINTR);
+        size_t written = 0;
+        while (written < chunk->size) {
+            ssize_t result = write(direction->to, chunk->data + written, chunk->size - written);
+            if (result <= 0) {
+                break;
+            }
+            written += (size_t) result;
+        }
+        free(chunk);
+    }
+    shutdown(direction->to, SHUT_WR);
+    return NULL;
+}
+
+/*!
+ * @brief start_latency_shim forks a proxy delaying by latency_ms the bytes going each way between a
+ * client and a receiver, as a network link with this one-way latency would
+ * @param listen_address is the address of the proxy (unix:<socket path>), listening when it returns
+ * @param target_address is the address of the receiver
+ * @param latency_ms is the one-way delay
+ * @return the pid of the proxy, -1 in case of error
+ */
+static pid_t start_latency_shim(char *listen_address, char *target_address, long latency_ms) {
+    int listen_fd = open_remote_socket(listen_address, true);
+    if (listen_fd == -1) {
+        return -1;
+    }
+    pid_t shim = fork();
+    if (shim != 0) {
+        close(listen_fd);
+        return shim;
+    }
+    int client_fd = accept(listen_fd, NULL, NULL);
+    int receiver_fd = open_remote_socket(target_address, false);
+    if (client_fd == -1 || receiver_fd == -1) {
+        exit(EXIT_FAILURE);
+    }
+    shim_direction_t directions[2] = {
+            {client_fd, receiver_fd, latency_ms, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, NULL, false},
+            {receiver_fd, client_fd, latency_ms, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, NULL, false}
+    };
+    pthread_t threads[4];
+    for (int i = 0; i < 2; ++i) {
+        pthread_create(&threads[2 * i], NULL, shim_reader, &directions[i]);
+        pthread_create(&threads[2 * i + 1], NULL, shim_writer, &directions[i]);
+    }
+    for (int i = 0; i < 4; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    exit(EXIT_SUCCESS);
+}
+
+/*!
+ * @brief start_receiver forks a receiver serving the copy target (@see receiver.c)
+ * @param context is a pointer to the benchmark context
+ * @param address is the address of the receiver (unix:<socket path>)
+ * @param socket_path is the path of its socket, which exists when the function returns
+ * @return the pid of the receiver, -1 in case of error
+ */
+static pid_t start_receiver(bench_context_t *context, char *address, char *socket_path) {
+    unlink(socket_path);
+    pid_t receiver = fork();
+    if (receiver == 0) {
+        configuration_t config;
+        init_configuration(&config);
+        strncpy(config.destination, context->copy_target, sizeof(config.destination) - 1);
+        strncpy(config.serve_address, address, sizeof(config.serve_address) - 1);
+        if (freopen("/dev/null", "w", stdout) == NULL) {
+            exit(EXIT_FAILURE);
+        }
+        run_receiver(&config);
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; receiver != -1 && access(socket_path, F_OK) == -1 && i < 1000; ++i) {
+        usleep(1000);
+    }
+    // The socket listens right after it is bound
+    usleep(1000);
+    return receiver;
+}
+
+/*!
+ * @brief remote_copies synchronizes the whole source tree to an empty remote destination, served by
+ * a receiver on a Unix socket
+ * @param latency_ms is the one-way delay added by a latency shim between the client and the receiver, 0 for none
+ */
+static int remote_copies(bench_context_t *context, bench_result_t *result, long latency_ms) {
+    char socket_path[PATH_SIZE], shim_path[PATH_SIZE], address[PATH_SIZE + 8], shim_address[PATH_SIZE + 8];
+    if (concat_path(socket_path, context->work_dir, "remote.sock") == NULL ||
+        concat_path(shim_path, context->work_dir, "shim.sock") == NULL) {
+        return -1;
+    }
+    snprintf(address, sizeof(address), "%s%s", REMOTE_UNIX_PREFIX, socket_path);
+    snprintf(shim_address, sizeof(shim_address), "%s%s", REMOTE_UNIX_PREFIX, shim_path);
+    remove_tree(context->copy_target);
+    if (mkdir(context->copy_target, 0755) == -1) {
+        perror("Cannot create the copy target");
+        return -1;
+    }
+    pid_t receiver = start_receiver(context, address, socket_path);
+    pid_t shim = (latency_ms > 0 && receiver != -1) ? start_latency_shim(shim_address, address, latency_ms) : 0;
+    if (receiver == -1 || shim == -1) {
+        if (receiver > 0) {
+            kill(receiver, SIGTERM);
+            waitpid(receiver, NULL, 0);
+        }
+        return -1;
+    }
+
+    configuration_t config;
+    init_configuration(&config);
+    strncpy(config.source, context->source, sizeof(config.source) - 1);
+    strncpy(config.destination, (latency_ms > 0) ? shim_address : address, sizeof(config.destination) - 1);
+    config.is_parallel = false;
+    config.uses_md5 = false;
+    config.copiers_count = 0;
+    process_context_t p_context;
+    memset(&p_context, 0, sizeof(p_context));
+    struct timespec start = bench_clock();
+    synchronize(&config, &p_context);
+    struct timespec end = bench_clock();
+    result->seconds = elapsed_seconds(&start, &end);
+
+    if (shim > 0) {
+        waitpid(shim, NULL, 0);
+    }
+    kill(receiver, SIGTERM);
+    waitpid(receiver, NULL, 0);
+    unlink(socket_path);
+    unlink(shim_path);
+    files_list_t list = {0};
+    make_files_list(&list, context->source, false);
+    count_list(&list, result);
+    clear_files_list(&list);
+    return 0;
+}
+
+/*!
+ * @brief bench_remote measures the synchronization of the source tree to an empty remote destination
+ */
+static int bench_remote(bench_context_t *context, bench_result_t *result) {
+    return remote_copies(context, result, 0);
+}
+
+/*!
+ * @brief bench_remote_latency measures the same synchronization through the latency shim (--latency):
+ * the pipelined protocol pays the latency a few times, not once per entry
+ */
+static int bench_remote_latency(bench_context_t *context, bench_result_t *result) {
+    return remote_copies(context, result, context->latency_ms);
+}
+
+/*!
+ * @brief wide_listing creates, in the copy target, a directory of WIDE_DIRECTORY_ENTRIES empty files,
+ * then measures its listing by a tree stream (without analysis)
+ * @param memory_limit is the memory limit of the stream (@see set_stream_memory_limit), 0 for none
+ */
+static int wide_listing(bench_context_t *context, bench_result_t *result, size_t memory_limit) {
+    remove_tree(context->copy_target);
+    if (mkdir(context->copy_target, 0755) == -1) {
+        perror("Cannot create the copy target");
+        return -1;
+    }
+    for (int i = 0; i < WIDE_DIRECTORY_ENTRIES; ++i) {
+        char name[32], path[PATH_SIZE];
+        // The names are not created in their order
+        snprintf(name, sizeof(name), "entry-%08x", (unsigned) (i * 2654435761u));
+        if (concat_path(path, context->copy_target, name) == NULL) {
+            continue;
+        }
+        int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd == -1) {
+            perror("Cannot create an entry of the wide directory");
+            return -1;
+        }
+        close(fd);
+    }
+
+    struct timespec start = bench_clock();
+    tree_stream_t stream;
+    if (open_tree_stream(&stream, context->copy_target, NULL, NULL, NULL) == -1) {
+        return -1;
+    }
+    set_stream_memory_limit(&stream, memory_limit);
+    while (next_stream_entry(&stream) != NULL) {
+        ++result->items;
+    }
+    close_tree_stream(&stream);
+    struct timespec end = bench_clock();
+    result->seconds = elapsed_seconds(&start, &end);
+    remove_tree(context->copy_target);
+    return 0;
+}
+
+/*!
+ * @brief bench_wide_listing measures the listing of a large directory, held in memory
+ */
+static int bench_wide_listing(bench_context_t *context, bench_result_t *result) {
+    return wide_listing(context, result, 0);
+}
+
+/*!
+ * @brief bench_wide_listing_limited measures the listing of the same directory under a memory limit:
+ * its names are sorted in temporary files, and its entries are loaded by batches
+ */
+static int bench_wide_listing_limited(bench_context_t *context, bench_result_t *result) {
+    return wide_listing(context, result, WIDE_MEMORY_LIMIT);
+}
+
+/*!
+ * @brief instrumented_events measures the cost of instrument_begin and instrument_end around an empty
+ * operation, in the state left by the harness (disabled, counters only, or counters and trace)
+ */
+static int instrumented_events(bench_result_t *result) {
+    struct timespec start = bench_clock();
+    for (int i = 0; i < INSTRUMENTED_EVENTS; ++i) {
+        struct timespec event_start;
+        instrument_begin(&event_start);
+        instrument_end(STAGE_DIFF, &event_start, 0);
+    }
+    struct timespec end = bench_clock();
+    result->seconds = elapsed_seconds(&start, &end);
+    result->items = INSTRUMENTED_EVENTS;
+    return 0;
+}
+
+/*!
+ * @brief bench_instrumentation_off measures the instrumentation calls when it is disabled
+ */
+static int bench_instrumentation_off(bench_context_t *context, bench_result_t *result) {
+    (void) context;
+    return instrumented_events(result);
+}
+
+/*!
+ * @brief bench_instrumentation measures the instrumentation calls updating the shared counters (--stats)
+ */
+static int bench_instrumentation(bench_context_t *context, bench_result_t *result) {
+    (void) context;
+    if (init_instrumentation(false) == -1) {
+        return -1;
+    }
+    int status = instrumented_events(result);
+    clean_instrumentation();
+    return status;
+}
+
+/*!
+ * @brief bench_trace measures the instrumentation calls updating the counters and recording the events
+ * in the trace buffer of the process (--trace)
+ */
+static int bench_trace(bench_context_t *context, bench_result_t *result) {
+    (void) context;
+    if (init_instrumentation(false) == -1 || init_trace() == -1) {
+        return -1;
+    }
+    int status = instrumented_events(result);
+    clean_trace();
+    clean_instrumentation();
+    return status;
+}
+
+static bench_t benches[] = {
+        {"make_files_list", "entries", bench_make_files_list, true},
+        {"compute_file_digest", "files", bench_compute_file_digest, true},
+        {"transport", "messages", bench_transport, false},
+        {"mismatch", "entries", bench_mismatch, false},
+        {"copy", "entries", bench_copy, true},
+        {"copy_fsync", "entries", bench_copy_fsync, true},
+        {"copy_fdatasync", "entries", bench_copy_fdatasync, true},
+        {"copy_syncfs", "entries", bench_copy_syncfs, true},
+        {"sparse_digest", "files", bench_sparse_digest, true},
+        {"sparse_copy", "files", bench_sparse_copy, true},
+        {"compressed_copy", "entries", bench_compressed_copy, true},
+        {"filters", "entries", bench_filters, true},
+        {"filters_naive", "entries", bench_filters_naive, true},
+        {"fanout_copy", "entries", bench_fanout_copy, true},
+        {"fanout_naive", "entries", bench_fanout_naive, true},
+        {"delete", "entries", bench_delete, false},
+        {"delete_naive", "entries", bench_delete_naive, false},
+        {"remote", "entries", bench_remote, true},
+        {"remote_latency", "entries", bench_remote_latency, true},
+        {"wide_listing", "entries", bench_wide_listing, false},
+        {"wide_listing_limited", "entries", bench_wide_listing_limited, false},
+        {"instrumentation_off", "events", bench_instrumentation_off, false},
+        {"instrumentation", "events", bench_instrumentation, false},
+        {"trace", "events", bench_trace, false},
+};
+
+/*!
+ * @brief run_bench runs a harness in a child process, so that its peak RSS is its own
+ * @param bench is a pointer to the harness
+ * @param context is a pointer to the benchmark context
+ * @param result is a pointer to the result of the harness
+ * @param peak_rss_kb is a pointer to the peak RSS of the child process (in KiB)
+ * @return 0 in case of success, -1 else
+ */
+static int run_bench(bench_t *bench, bench_context_t *context, bench_result_t *result, long *peak_rss_kb) {
+    int result_pipe[2];
+    if (pipe(result_pipe) == -1) {
+        perror("Cannot create the results pipe");
+        return -1;
+    }
+
+    fflush(stdout); // The child must not flush the parent's buffered output again
+    pid_t child = fork();
+    if (child == -1) {
+        perror("Cannot fork the harness");
+        return -1;
+    }
+    if (child == 0) {
+        close(result_pipe[0]);
+        bench_result_t child_result = {0, 0, 0.0};
+        int status = bench->harness(context, &child_result);
+        if (write(result_pipe[1], &child_result, sizeof(child_result)) != sizeof(child_result)) {
+            status = -1;
+        }
+        close(result_pipe[1]);
+        exit(status == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    close(result_pipe[1]);
+    ssize_t received = read(result_pipe[0], result, sizeof(bench_result_t));
+    close(result_pipe[0]);
+    int status;
+    struct rusage usage;
+    wait4(child, &status, 0, &usage);
+    *peak_rss_kb = usage.ru_maxrss;
+    return (received == sizeof(bench_result_t) && WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS) ? 0 : -1;
+}
+
+/*!
+ * @brief evict_trees drops all the benchmark trees from the page cache before a cold run
+ * @param context is a pointer to the benchmark context
+ */
+static void evict_trees(bench_context_t *context) {
+    evict_tree_from_cache(context->source);
+    evict_tree_from_cache(context->destination);
+    evict_tree_from_cache(context->copy_target);
+    evict_tree_from_cache(context->sparse_dir);
+    evict_tree_from_cache(context->sparse_copy);
+    evict_tree_from_cache(context->compressed_copy);
+    evict_tree_from_cache(context->fanout_copy);
+
+    uint64_t resident_pages, total_pages;
+    if (measure_tree_residency(context->source, &resident_pages, &total_pages) == 0 && total_pages > 0) {
+        printf("%-18s evicted, %.1f%% of the source pages still cached\n", "(page cache)",
+               100.0 * (double) resident_pages / (double) total_pages);
+    }
+}
+
+/*!
+ * @brief report_residency displays how much of the trees read or written by a cold run is left in the
+ * page cache, which is what the cache-polite mode saves to the other processes of the host
+ * @param context is a pointer to the benchmark context
+ */
+static void report_residency(bench_context_t *context) {
+    uint64_t resident_pages, total_pages;
+    if (measure_tree_residency(context->source, &resident_pages, &total_pages) == 0 && total_pages > 0) {
+        printf("%-18s %.1f%% of the source pages cached after the run", "(page cache)",
+               100.0 * (double) resident_pages / (double) total_pages);
+        if (measure_tree_residency(context->copy_target, &resident_pages, &total_pages) == 0 && total_pages > 0) {
+            printf(", %.1f%% of the copy pages", 100.0 * (double) resident_pages / (double) total_pages);
+        }
+        printf("\n");
+    }
+}
+
+/*!
+ * @brief measure_bench runs a harness and reports its result
+ * @param bench is a pointer to the harness
+ * @param context is a pointer to the benchmark context
+ * @param cache_state is the state of the page cache during the run ("cold" or "warm")
+ * @param json is the JSON results file (NULL if none)
+ * @param first is a pointer to a flag set while no result was written in the JSON file
+ * @return 0 in case of success, -1 else
+ */
+static int measure_bench(bench_t *bench, bench_context_t *context, const char *cache_state, FILE *json, bool *first) {
+    bench_result_t result = {0, 0, 0.0};
+    long peak_rss_kb = 0;
+    if (run_bench(bench, context, &result, &peak_rss_kb) == -1) {
+        fprintf(stderr, "%s: failed\n", bench->name);
+        return -1;
+    }
+
+    double seconds = (result.seconds > 0.0) ? result.seconds : 1e-9;
+    printf("%-18s %-4s %10lu %-8s %9.3fs %12.1f %s/s %9.1f MiB/s  peak RSS %8.1f MiB\n",
+           bench->name, cache_state, (unsigned long) result.items, bench->unit, result.seconds,
+           (double) result.items / seconds, bench->unit,
+           (double) result.bytes / seconds / (1024.0 * 1024.0), (double) peak_rss_kb / 1024.0);
+    if (json != NULL) {
+        fprintf(json, "%s\n  {\"name\": \"%s\", \"cache\": \"%s\", \"items\": %lu, \"bytes\": %lu, \"seconds\": %.6f, \"items_per_s\": %.1f, \"bytes_per_s\": %.1f, \"peak_rss_kb\": %ld}",
+                *first ? "" : ",", bench->name, cache_state, (unsigned long) result.items, (unsigned long) result.bytes,
+                result.seconds, (double) result.items / seconds, (double) result.bytes / seconds, peak_rss_kb);
+        *first = false;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    bench_context_t context;
+    init_tree_spec(&context.spec);
+    char json_file[PATH_SIZE] = "";
+    char only[64] = "";
+    bool keep = false;
+    cache_mode_t cache_mode = CACHE_WARM;
+    context.is_cache_polite = false;
+    context.sparse_size = 1024ULL * 1024 * 1024;
+    context.compression_threads = 0;
+    context.latency_ms = 5;
+
+    static struct option long_options[] = {
+            {"depth", required_argument, 0, DEPTH},
+            {"fanout", required_argument, 0, FANOUT},
+            {"files", required_argument, 0, FILES},
+            {"size-dist", required_argument, 0, SIZE_DIST},
+            {"min-size", required_argument, 0, MIN_SIZE},
+            {"max-size", required_argument, 0, MAX_SIZE},
+            {"change-ratio", required_argument, 0, CHANGE_RATIO},
+            {"seed", required_argument, 0, SEED},
+            {"json", required_argument, 0, JSON},
+            {"only", required_argument, 0, ONLY},
+            {"keep", no_argument, 0, KEEP},
+            {"cache", required_argument, 0, CACHE},
+            {"cache-polite", no_argument, 0, CACHE_POLITE},
+            {"sparse-size", required_argument, 0, SPARSE_SIZE},
+            {"compress-threads", required_argument, 0, COMPRESS_THREADS},
+            {"latency", required_argument, 0, LATENCY},
+            {0, 0, 0, 0}
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case DEPTH:
+                context.spec.depth = atoi(optarg);
+                break;
+            case FANOUT:
+                context.spec.fanout = atoi(optarg);
+                break;
+            case FILES:
+                context.spec.files_per_dir = atoi(optarg);
+                break;
+            case SIZE_DIST:
+                if (parse_size_distribution(optarg, &context.spec.size_distribution) == -1) {
+                    fprintf(stderr, "Unknown size distribution %s\n", optarg);
+                    return -1;
+                }
+                break;
+            case MIN_SIZE:
+                if (parse_size(optarg, &context.spec.min_size) == -1) {
+                    fprintf(stderr, "Invalid minimum size %s\n", optarg);
+                    return -1;
+                }
+                break;
+            case MAX_SIZE:
+                if (parse_size(optarg, &context.spec.max_size) == -1) {
+                    fprintf(stderr, "Invalid maximum size %s\n", optarg);
+                    return -1;
+                }
+                break;
+            case CHANGE_RATIO:
+                context.spec.change_ratio = atof(optarg);
+                break;
+            case SEED:
+                context.spec.seed = strtoull(optarg, NULL, 10);
+                break;
+            case JSON:
+                snprintf(json_file, sizeof(json_file), "%s", optarg);
+                break;
+            case ONLY:
+                snprintf(only, sizeof(only), "%s", optarg);
+                break;
+            case KEEP:
+                keep = true;
+                break;
+            case CACHE:
+                if (strcmp(optarg, "warm") == 0) {
+                    cache_mode = CACHE_WARM;
+                } else if (strcmp(optarg, "cold") == 0) {
+                    cache_mode = CACHE_COLD;
+                } else if (strcmp(optarg, "both") == 0) {
+                    cache_mode = CACHE_BOTH;
+                } else {
+                    fprintf(stderr, "Unknown cache mode %s\n", optarg);
+                    return -1;
+                }
+                break;
+            case CACHE_POLITE:
+                context.is_cache_polite = true;
+                break;
+            case SPARSE_SIZE:
+                if (parse_size(optarg, &context.sparse_size) == -1) {
+                    fprintf(stderr, "Invalid sparse file size %s\n", optarg);
+                    return -1;
+                }
+                break;
+            case COMPRESS_THREADS:
+                context.compression_threads = (uint8_t) atoi(optarg);
+                break;
+            case LATENCY:
+                context.latency_ms = atol(optarg);
+                break;
+            case 'h':
+                display_bench_help(argv[0]);
+                return 0;
+            default:
+                display_bench_help(argv[0]);
+                return -1;
+        }
+    }
+    if (argc - optind < 1) {
+        display_bench_help(argv[0]);
+        return -1;
+    }
+
+    snprintf(context.work_dir, sizeof(context.work_dir), "%s", argv[optind]);
+    if ((mkdir(context.work_dir, 0755) == -1 && errno != EEXIST) ||
+        concat_path(context.source, context.work_dir, "source") == NULL ||
+        concat_path(context.destination, context.work_dir, "destination") == NULL ||
+        concat_path(context.copy_target, context.work_dir, "copy") == NULL ||
+        concat_path(context.sparse_dir, context.work_dir, "sparse") == NULL ||
+        concat_path(context.sparse_file, context.sparse_dir, "disk.img") == NULL ||
+        concat_path(context.sparse_copy, context.work_dir, "sparse-copy") == NULL ||
+        concat_path(context.compressed_copy, context.work_dir, "compressed-copy") == NULL ||
+        concat_path(context.fanout_copy, context.work_dir, "fanout-copy") == NULL ||
+        concat_path(context.restored_file, context.work_dir, "restored") == NULL) {
+        fprintf(stderr, "Cannot use work directory %s\n", context.work_dir);
+        return -1;
+    }
+
+    configuration_t io_config;
+    init_configuration(&io_config);
+    io_config.is_cache_polite = context.is_cache_polite;
+    init_file_io(&io_config);
+
+    remove_tree(context.source);
+    remove_tree(context.destination);
+    remove_tree(context.copy_target);
+    if (generate_trees(context.source, context.destination, &context.spec, &context.tree_stats) == -1) {
+        return -1;
+    }
+    remove_tree(context.sparse_dir);
+    remove_tree(context.sparse_copy);
+    remove_tree(context.compressed_copy);
+    remove_tree(context.fanout_copy);
+    if ((mkdir(context.sparse_dir, 0755) == -1 && errno != EEXIST) ||
+        generate_sparse_file(context.sparse_file, context.sparse_size, SPARSE_EXTENT_SIZE, SPARSE_STRIDE, context.spec.seed) == -1) {
+        return -1;
+    }
+    printf("tree: %lu directories, %lu files, %.1f MiB, %lu changed files\n",
+           (unsigned long) context.tree_stats.directories, (unsigned long) context.tree_stats.files,
+           (double) context.tree_stats.bytes / (1024.0 * 1024.0), (unsigned long) context.tree_stats.changed_files);
+
+    FILE *json = NULL;
+    if (json_file[0] != '\0') {
+        json = (strcmp(json_file, "-") == 0) ? stdout : fopen(json_file, "w");
+        if (json == NULL) {
+            perror("Cannot open the JSON results");
+            return -1;
+        }
+        fprintf(json, "{\"seed\": %lu, \"files\": %lu, \"bytes\": %lu, \"results\": [",
+                (unsigned long) context.spec.seed, (unsigned long) context.tree_stats.files, (unsigned long) context.tree_stats.bytes);
+    }
+
+    int status = 0;
+    bool first = true;
+    for (size_t i = 0; i < sizeof(benches) / sizeof(benches[0]); ++i) {
+        if (only[0] != '\0' && strcmp(only, benches[i].name) != 0) {
+            continue;
+        }
+        // Cold runs come first: the warm run that follows finds what the cold one loaded
+        if (benches[i].reads_trees && (cache_mode & CACHE_COLD) != 0) {
+            evict_trees(&context);
+            if (measure_bench(&benches[i], &context, "cold", json, &first) == -1) {
+                status = -1;
+            }
+            report_residency(&context);
+        }
+        if (!benches[i].reads_trees || (cache_mode & CACHE_WARM) != 0) {
+            if (measure_bench(&benches[i], &context, "warm", json, &first) == -1) {
+                status = -1;
+            }
+        }
+    }
+
+    if (json != NULL) {
+        fprintf(json, "\n]}\n");
+        if (json != stdout) {
+            fclose(json);
+        }
+    }
+    if (!keep) {
+        remove_tree(context.source);
+        remove_tree(context.destination);
+        remove_tree(context.copy_target);
+        remove_tree(context.sparse_dir);
+        remove_tree(context.sparse_copy);
+        remove_tree(context.compressed_copy);
+        remove_tree(context.fanout_copy);
+    }
+    return status;
+}
@@ -0,0 +1,375 @@
+#define _GNU_SOURCE
+#include "tree-generator.h"
+#include "../defines.h"
+#include "../utility.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// All the generated files get an mtime derived from this base, so that two generations with the same
+// seed give exactly the same trees (and unchanged files compare equal between source and destination)
+#define GENERATED_MTIME_BASE 1700000000
+#define GENERATOR_BLOCK_SIZE 65536
+
+/*!
+ * @brief next_random is a splitmix64 generator: small, fast and identical on every platform
+ * @param state is a pointer to the state of the generator
+ * @return the next pseudo-random value
+ */
+static uint64_t next_random(uint64_t *state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+/*!
+ * @brief init_tree_spec initializes a tree specification with default values
+ * @param spec is a pointer to the specification to initialize
+ */
+void init_tree_spec(tree_spec_t *spec) {
+    if (spec == NULL) {
+        return;
+    }
+
+    spec->depth = 3;
+    spec->fanout = 4;
+    spec->files_per_dir = 20;
+    spec->size_distribution = SIZE_PARETO;
+    spec->min_size = 4096;
+    spec->max_size = 4 * 1024 * 1024;
+    spec->change_ratio = 0.1;
+    spec->seed = 42;
+}
+
+/*!
+ * @brief parse_size_distribution converts the name of a sizes distribution
+ * @param name is the name (fixed, uniform or pareto)
+ * @param distribution is a pointer to the distribution to set
+ * @return 0 if the name is known, -1 else
+ */
+int parse_size_distribution(char *name, size_distribution_t *distribution) {
+    if (strcmp(name, "fixed") == 0) {
+        *distribution = SIZE_FIXED;
+    } else if (strcmp(name, "uniform") == 0) {
+        *distribution = SIZE_UNIFORM;
+    } else if (strcmp(name, "pareto") == 0) {
+        *distribution = SIZE_PARETO;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+/*!
+ * @brief draw_size draws the size of a file
+ * The pareto distribution doubles the size with a probability of 1/2 at each step, so that each size
+ * class (min, 2*min, 4*min...) holds half as many files as the previous one, as in real trees.
+ * @param spec is a pointer to the tree specification
+ * @param state is a pointer to the state of the generator
+ * @return the size of the file
+ */
+static uint64_t draw_size(tree_spec_t *spec, uint64_t *state) {
+    uint64_t span = (spec->max_size > spec->min_size) ? spec->max_size - spec->min_size : 0;
+    switch (spec->size_distribution) {
+        case SIZE_FIXED:
+            return spec->min_size;
+        case SIZE_UNIFORM:
+            return spec->min_size + next_random(state) % (span + 1);
+        case SIZE_PARETO: {
+            uint64_t size = (spec->min_size > 0) ? spec->min_size : 1;
+            uint64_t coin = next_random(state);
+            while ((coin & 1) != 0 && size < spec->max_size / 2) {
+                size *= 2;
+                coin >>= 1;
+            }
+            size += next_random(state) % size;
+            return (size > spec->max_size) ? spec->max_size : size;
+        }
+    }
+    return spec->min_size;
+}
+
+/*!
+ * @brief write_file writes a file with pseudo-random content
+ * @param path is the path of the file
+ * @param size is the size of the file
+ * @param content_seed is the seed of the content (same seed, same content)
+ * @param mtime is the modification time given to the file
+ * @return 0 in case of success, -1 else
+ */
+static int write_file(char *path, uint64_t size, uint64_t content_seed, time_t mtime) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        perror("Cannot create generated file");
+        return -1;
+    }
+
+    uint64_t buffer[GENERATOR_BLOCK_SIZE / sizeof(uint64_t)];
+    uint64_t state = content_seed;
+    uint64_t remaining = size;
+    while (remaining > 0) {
+        size_t block = (remaining < sizeof(buffer)) ? (size_t) remaining : sizeof(buffer);
+        for (size_t i = 0; i < (block + sizeof(uint64_t) - 1) / sizeof(uint64_t); ++i) {
+            buffer[i] = next_random(&state);
+        }
+        if (write(fd, buffer, block) != (ssize_t) block) {
+            perror("Cannot write generated file");
+            close(fd);
+            return -1;
+        }
+        remaining -= block;
+    }
+
+    struct timespec times[2] = {{mtime, 0}, {mtime, 0}};
+    futimens(fd, times);
+    close(fd);
+    return 0;
+}
+
+/*!
+ * @brief generate_level generates the files and subdirectories of a directory of both trees
+ * @param source_dir is the directory in the source tree
+ * @param destination_dir is the same directory in the destination tree
+ * @param level is the depth of the directory (0 for the roots)
+ * @param spec is a pointer to the tree specification
+ * @param state is a pointer to the state of the generator
+ * @param stats is a pointer to the statistics to update
+ * @return 0 in case of success, -1 else
+ */
+static int generate_level(char *source_dir, char *destination_dir, int level, tree_spec_t *spec, uint64_t *state, tree_stats_t *stats) {
+    char source_path[PATH_SIZE], destination_path[PATH_SIZE], name[32];
+
+    for (int i = 0; i < spec->files_per_dir; ++i) {
+        snprintf(name, sizeof(name), "file-%04d.dat", i);
+        concat_path(source_path, source_dir, name);
+        concat_path(destination_path, destination_dir, name);
+
+        uint64_t size = draw_size(spec, state);
+        uint64_t content_seed = next_random(state);
+        time_t mtime = GENERATED_MTIME_BASE + (time_t) (content_seed % 1000000);
+        if (write_file(source_path, size, content_seed, mtime) == -1) {
+            return -1;
+        }
+        ++stats->files;
+        stats->bytes += size;
+
+        // Half of the changed files are missing from the destination, the other half were modified
+        double draw = (double) (next_random(state) >> 11) / (double) (1ULL << 53);
+        if (draw < spec->change_ratio) {
+            ++stats->changed_files;
+            if (draw < spec->change_ratio / 2) {
+                continue;
+            }
+            content_seed = ~content_seed;
+            mtime -= 3600;
+        }
+        if (write_file(destination_path, size, content_seed, mtime) == -1) {
+            return -1;
+        }
+    }
+
+    if (level >= spec->depth) {
+        return 0;
+    }
+    for (int i = 0; i < spec->fanout; ++i) {
+        snprintf(name, sizeof(name), "dir-%03d", i);
+        concat_path(source_path, source_dir, name);
+        concat_path(destination_path, destination_dir, name);
+        if ((mkdir(source_path, 0755) == -1 && errno != EEXIST) || (mkdir(destination_path, 0755) == -1 && errno != EEXIST)) {
+            perror("Cannot create generated directory");
+            return -1;
+        }
+        ++stats->directories;
+        if (generate_level(source_path, destination_path, level + 1, spec, state, stats) == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*!
+ * @brief generate_trees generates a source tree and a destination tree that differs from it by change_ratio
+ * The generation is deterministic: the same specification always gives the same trees.
+ * @param source_root is the root of the source tree (created if needed)
+ * @param destination_root is the root of the destination tree (created if needed)
+ * @param spec is a pointer to the tree specification
+ * @param stats is a pointer to the statistics of the generated source tree
+ * @return 0 in case of success, -1 else
+ */
+int generate_trees(char *source_root, char *destination_root, tree_spec_t *spec, tree_stats_t *stats) {
+    if (source_root == NULL || destination_root == NULL || spec == NULL || stats == NULL) {
+        return -1;
+    }
+
+    memset(stats, 0, sizeof(tree_stats_t));
+    if ((mkdir(source_root, 0755) == -1 && errno != EEXIST) || (mkdir(destination_root, 0755) == -1 && errno != EEXIST)) {
+        perror("Cannot create generated tree root");
+        return -1;
+    }
+
+    uint64_t state = spec->seed;
+    return generate_level(source_root, destination_root, 0, spec, &state, stats);
+}
+
+/*!
+ * @brief generate_sparse_file writes a file made of holes, with an extent of pseudo-random data at the
+ * start of every stride (like a VM disk image that is mostly unused)
+ * @param path is the path of the file
+ * @param size is the size of the file
+ * @param extent_size is the size of each data extent
+ * @param stride is the distance between the starts of two extents
+ * @param seed is the seed of the content
+ * @return 0 in case of success, -1 else
+ */
+int generate_sparse_file(char *path, uint64_t size, uint64_t extent_size, uint64_t stride, uint64_t seed) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1 || ftruncate(fd, (off_t) size) == -1) {
+        perror("Cannot create sparse file");
+        if (fd != -1) {
+            close(fd);
+        }
+        return -1;
+    }
+
+    uint64_t buffer[GENERATOR_BLOCK_SIZE / sizeof(uint64_t)];
+    uint64_t state = seed;
+    for (uint64_t extent = 0; extent < size && stride > 0; extent += stride) {
+        for (uint64_t written = 0; written < extent_size && extent + written < size;) {
+            uint64_t remaining = extent_size - written;
+            remaining = (remaining < size - extent - written) ? remaining : size - extent - written;
+            size_t block = (remaining < sizeof(buffer)) ? (size_t) remaining : sizeof(buffer);
+            for (size_t i = 0; i < (block + sizeof(uint64_t) - 1) / sizeof(uint64_t); ++i) {
+                buffer[i] = next_random(&state);
+            }
+            if (pwrite(fd, buffer, block, (off_t) (extent + written)) != (ssize_t) block) {
+                perror("Cannot write sparse file");
+                close(fd);
+                return -1;
+            }
+            written += block;
+        }
+    }
+
+    struct timespec times[2] = {{GENERATED_MTIME_BASE, 0}, {GENERATED_MTIME_BASE, 0}};
+    futimens(fd, times);
+    close(fd);
+    return 0;
+}
+
+/*!
+ * @brief remove_entry is the nftw callback of remove_tree
+ */
+static int remove_entry(const char *path, const struct stat *statbuf, int type, struct FTW *ftw) {
+    (void) statbuf;
+    (void) type;
+    (void) ftw;
+    return remove(path);
+}
+
+/*!
+ * @brief remove_tree removes a directory and all its content
+ * @param root is the directory to remove
+ * @return 0 in case of success, -1 else
+ */
+int remove_tree(char *root) {
+    struct stat statbuf;
+    if (lstat(root, &statbuf) == -1) {
+        return 0;
+    }
+    return nftw(root, remove_entry, 64, FTW_DEPTH | FTW_PHYS);
+}
+
+/*!
+ * @brief evict_file is the nftw callback of evict_tree_from_cache
+ * Dirty pages cannot be dropped, so the file is synced before being evicted.
+ */
+static int evict_file(const char *path, const struct stat *statbuf, int type, struct FTW *ftw) {
+    (void) ftw;
+    if (type != FTW_F || !S_ISREG(statbuf->st_mode)) {
+        return 0;
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return 0;
+    }
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+    return 0;
+}
+
+/*!
+ * @brief evict_tree_from_cache drops the data of all the files of a tree from the page cache
+ * It uses posix_fadvise(POSIX_FADV_DONTNEED), which does not need any privilege. Directories and
+ * inodes stay cached (only root could drop them, for the whole host, with /proc/sys/vm/drop_caches).
+ * @param root is the root of the tree
+ * @return 0 in case of success, -1 else
+ */
+int evict_tree_from_cache(char *root) {
+    struct stat statbuf;
+    if (lstat(root, &statbuf) == -1) {
+        return 0;
+    }
+    return nftw(root, evict_file, 64, FTW_PHYS);
+}
+
+static uint64_t residency_resident_pages;
+static uint64_t residency_total_pages;
+
+/*!
+ * @brief count_resident_pages is the nftw callback of measure_tree_residency
+ */
+static int count_resident_pages(const char *path, const struct stat *statbuf, int type, struct FTW *ftw) {
+    (void) ftw;
+    if (type != FTW_F || !S_ISREG(statbuf->st_mode) || statbuf->st_size == 0) {
+        return 0;
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return 0;
+    }
+    void *mapping = mmap(NULL, statbuf->st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return 0;
+    }
+
+    long page_size = sysconf(_SC_PAGESIZE);
+    size_t pages = (statbuf->st_size + page_size - 1) / page_size;
+    unsigned char *vector = malloc(pages);
+    if (vector != NULL && mincore(mapping, statbuf->st_size, vector) == 0) {
+        for (size_t i = 0; i < pages; ++i) {
+            residency_resident_pages += vector[i] & 1;
+        }
+        residency_total_pages += pages;
+    }
+    free(vector);
+    munmap(mapping, statbuf->st_size);
+    return 0;
+}
+
+/*!
+ * @brief measure_tree_residency counts the pages of the files of a tree that are in the page cache
+ * @param root is the root of the tree
+ * @param resident_pages is a pointer to the number of pages in the page cache
+ * @param total_pages is a pointer to the number of pages of the files
+ * @return 0 in case of success, -1 else
+ */
+int measure_tree_residency(char *root, uint64_t *resident_pages, uint64_t *total_pages) {
+    residency_resident_pages = 0;
+    residency_total_pages = 0;
+    struct stat statbuf;
+    int result = (lstat(root, &statbuf) == -1) ? 0 : nftw(root, count_resident_pages, 64, FTW_PHYS);
+    *resident_pages = residency_resident_pages;
+    *total_pages = residency_total_pages;
+    return result;
+}
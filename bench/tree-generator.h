@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef enum { SIZE_FIXED, SIZE_UNIFORM, SIZE_PARETO } size_distribution_t;
+
+typedef struct {
+    int depth; // Levels of directories below the root
+    int fanout; // Subdirectories per directory
+    int files_per_dir; // Files in each directory
+    size_distribution_t size_distribution;
+    uint64_t min_size; // Size of the files for SIZE_FIXED, lower bound else
+    uint64_t max_size; // Upper bound of the sizes for SIZE_UNIFORM and SIZE_PARETO
+    double change_ratio; // Part of the files that differ (or are missing) in the destination tree
+    uint64_t seed;
+} tree_spec_t;
+
+typedef struct {
+    uint64_t directories;
+    uint64_t files;
+    uint64_t bytes;
+    uint64_t changed_files;
+} tree_stats_t;
+
+void init_tree_spec(tree_spec_t *spec);
+int parse_size_distribution(char *name, size_distribution_t *distribution);
+int generate_trees(char *source_root, char *destination_root, tree_spec_t *spec, tree_stats_t *stats);
+int generate_sparse_file(char *path, uint64_t size, uint64_t extent_size, uint64_t stride, uint64_t seed);
+int remove_tree(char *root);
+int evict_tree_from_cache(char *root);
+int measure_tree_residency(char *root, uint64_t *resident_pages, uint64_t *total_pages);
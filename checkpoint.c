@@ -0,0 +1,264 @@
+#define _GNU_SOURCE
+#include "checkpoint.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include "durability.h"
+#include "utility.h"
+
+/*
+ * A checkpoint records how far a run went, so that an interrupted run can be resumed (--resume)
+ * instead of listing and analyzing both trees again. The main process compares the source entries
+ * in order (@see path_compare); every CHECKPOINT_PERIOD seconds, it waits until the copies it
+ * already sent are completed (and committed in the durable modes), then records the relative path
+ * of the last source entry it compared: the cursor. Every source entry up to the cursor is then in
+ * the destination, so a resumed run skips them all (@see tree-stream.c).
+ * The checkpoint is a small text file, replaced atomically:
+ *     lp25-checkpoint 1
+ *     source <source root>
+ *     cursor <relative path>
+ *     links <size>
+ * It is removed at the end of a complete run.
+ * The entries skipped by a resumed run are never listed, so the destination files holding the hard
+ * links of the source (@see remember_copy) are appended to another file, one NUL-terminated record
+ * "<destination index> <device> <inode> <relative path>" each. The checkpoint records its size once
+ * its records are written: a resumed run loads those, and drops the ones after (their files may not
+ * be complete).
+ */
+
+typedef struct {
+    bool is_enabled;
+    char source[PATH_SIZE];
+    char path[PATH_SIZE];
+    char temporary_path[PATH_SIZE];
+    char links_path[PATH_SIZE];
+    FILE *links; // Records of the hard links, NULL when the checkpoints are disabled
+    long links_size; // Size of the records covered by the checkpoint
+    time_t next_checkpoint;
+} checkpoint_state_t;
+
+static checkpoint_state_t checkpoint = {.is_enabled = false, .links = NULL};
+
+/*!
+ * @brief monotonic_seconds gives the current time of the monotonic clock, in seconds
+ */
+static time_t monotonic_seconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec;
+}
+
+/*!
+ * @brief read_checkpoint reads the cursor of a checkpoint
+ * @param source is the source root of the run to resume
+ * @param cursor receives the cursor (PATH_SIZE bytes)
+ * @param links_size receives the size of the records of the hard links covered by the checkpoint
+ * @return 0 in case of success, -1 if there is no usable checkpoint
+ */
+static int read_checkpoint(char *source, char *cursor, long *links_size) {
+    FILE *file = fopen(checkpoint.path, "r");
+    if (file == NULL) {
+        printf("No checkpoint in %s, the run starts from the beginning\n", checkpoint.path);
+        return -1;
+    }
+    char line[PATH_SIZE + 16];
+    bool is_valid = fgets(line, sizeof(line), file) != NULL && strcmp(line, "lp25-checkpoint 1\n") == 0;
+    bool is_same_source = false;
+    cursor[0] = '\0';
+    *links_size = 0;
+    while (is_valid && fgets(line, sizeof(line), file) != NULL) {
+        line[strcspn(line, "\n")] = '\0';
+        if (strncmp(line, "source ", 7) == 0) {
+            is_same_source = (strcmp(line + 7, source) == 0);
+        } else if (strncmp(line, "cursor ", 7) == 0) {
+            snprintf(cursor, PATH_SIZE, "%s", line + 7);
+        } else if (strncmp(line, "links ", 6) == 0) {
+            *links_size = atol(line + 6);
+        }
+    }
+    fclose(file);
+    if (!is_valid || cursor[0] == '\0') {
+        printf("The checkpoint %s cannot be read, the run starts from the beginning\n", checkpoint.path);
+        return -1;
+    }
+    if (!is_same_source) {
+        printf("The checkpoint %s was made from another source, the run starts from the beginning\n", checkpoint.path);
+        cursor[0] = '\0';
+        return -1;
+    }
+    return 0;
+}
+
+/*!
+ * @brief init_checkpoint prepares the checkpoints of a run, and loads the cursor of the interrupted
+ * run to resume with --resume (the_config->resume_cursor, empty when the run starts from the beginning)
+ * There are no checkpoints in dry-run mode.
+ * @param the_config is a pointer to the configuration
+ * @return 0 in case of success, -1 else
+ */
+int init_checkpoint(configuration_t *the_config) {
+    the_config->resume_cursor[0] = '\0';
+    if (concat_path(checkpoint.path, the_config->destination, CHECKPOINT_NAME) == NULL ||
+        concat_path(checkpoint.temporary_path, the_config->destination, CHECKPOINT_NAME ".tmp") == NULL ||
+        concat_path(checkpoint.links_path, the_config->destination, CHECKPOINT_LINKS_NAME) == NULL) {
+        return -1;
+    }
+    snprintf(checkpoint.source, PATH_SIZE, "%s", the_config->source);
+
+    checkpoint.links_size = 0;
+    if (the_config->uses_resume) {
+        if (read_checkpoint(the_config->source, the_config->resume_cursor, &checkpoint.links_size) == 0) {
+            printf("Resuming after %s\n", the_config->resume_cursor);
+        }
+    } else if (access(checkpoint.path, F_OK) == 0 && !the_config->uses_dry_run) {
+        // Its records of the hard links are dropped below
+        printf("%s holds the checkpoint of an interrupted run, this run starts from the beginning (--resume continues it)\n",
+               the_config->destination);
+        unlink(checkpoint.path);
+    } else if (access(checkpoint.path, F_OK) == 0) {
+        printf("%s holds the checkpoint of an interrupted run, --resume continues it\n", the_config->destination);
+    }
+    // The processes forked later must not print the messages again
+    fflush(stdout);
+
+    checkpoint.is_enabled = !the_config->uses_dry_run;
+    if (checkpoint.is_enabled) {
+        // The records after the checkpoint are dropped, a run from the beginning drops them all
+        int fd = open(checkpoint.links_path, O_RDWR | O_CREAT, 0644);
+        if (fd == -1 || ftruncate(fd, (off_t) checkpoint.links_size) == -1 ||
+            (checkpoint.links = fdopen(fd, "a")) == NULL) {
+            perror("Cannot open the hard links of the checkpoint");
+            if (fd != -1) {
+                close(fd);
+            }
+            return -1;
+        }
+    }
+    checkpoint.next_checkpoint = monotonic_seconds() + CHECKPOINT_PERIOD;
+    return 0;
+}
+
+/*!
+ * @brief is_checkpoint_due tells if it is time to make a checkpoint
+ * @return true if the checkpoints are enabled and the last one is older than CHECKPOINT_PERIOD
+ */
+bool is_checkpoint_due(void) {
+    return checkpoint.is_enabled && monotonic_seconds() >= checkpoint.next_checkpoint;
+}
+
+/*!
+ * @brief write_checkpoint records the cursor of the run
+ * The caller must have completed the actions of all the source entries up to the cursor. The new
+ * checkpoint replaces the previous one with a rename; in the durable modes, it is synced first.
+ * @param cursor is the path, relative to the source root, of the last source entry compared
+ * @return 0 in case of success, -1 else
+ */
+int write_checkpoint(char *cursor) {
+    if (!checkpoint.is_enabled) {
+        return 0;
+    }
+    checkpoint.next_checkpoint = monotonic_seconds() + CHECKPOINT_PERIOD;
+
+    FILE *file = fopen(checkpoint.temporary_path, "w");
+    if (file == NULL) {
+        perror("Cannot write the checkpoint");
+        return -1;
+    }
+    // The hard links up to the cursor are recorded before the checkpoint refers to them
+    int result = (fflush(checkpoint.links) == 0) ? 0 : -1;
+    if (result == 0 && is_durability_enabled()) {
+        result = fdatasync(fileno(checkpoint.links));
+    }
+    long links_size = ftell(checkpoint.links);
+    fprintf(file, "lp25-checkpoint 1\nsource %s\ncursor %s\nlinks %ld\n", checkpoint.source, cursor, links_size);
+    if (fflush(file) != 0) {
+        result = -1;
+    }
+    if (result == 0 && is_durability_enabled()) {
+        result = fdatasync(fileno(file));
+    }
+    if (fclose(file) != 0) {
+        result = -1;
+    }
+    if (result == -1 || rename(checkpoint.temporary_path, checkpoint.path) == -1) {
+        perror("Cannot write the checkpoint");
+        unlink(checkpoint.temporary_path);
+        return -1;
+    }
+    return 0;
+}
+
+/*!
+ * @brief remove_checkpoint removes the checkpoint at the end of a complete run
+ */
+void remove_checkpoint(void) {
+    if (!checkpoint.is_enabled) {
+        return;
+    }
+    if (unlink(checkpoint.path) == -1 && errno != ENOENT) {
+        perror("Cannot remove the checkpoint");
+    }
+    fclose(checkpoint.links);
+    checkpoint.links = NULL;
+    checkpoint.is_enabled = false;
+    unlink(checkpoint.links_path);
+}
+
+/*!
+ * @brief record_checkpoint_link records the destination file holding an inode of the source with
+ * several hard links, for a resumed run
+ * @param destination is the index of the destination (@see get_destination)
+ * @param key is the inode key of the source file (@see make_inode_key)
+ * @param relative is the path of the file relative to the roots
+ */
+void record_checkpoint_link(int destination, uint64_t key[LINK_KEY_SIZE], char *relative) {
+    if (checkpoint.links != NULL) {
+        fprintf(checkpoint.links, "%d %llu %llu %s%c", destination, (unsigned long long) key[0],
+                (unsigned long long) key[1], relative, '\0');
+    }
+}
+
+/*!
+ * @brief load_checkpoint_links fills the tables of the hard links with the records of the checkpoint
+ * resumed (@see link_to_previous_copy)
+ * @param tables are the tables of the destinations, by source inode
+ * @param the_config is a pointer to the configuration
+ * @return 0 in case of success, -1 else
+ */
+int load_checkpoint_links(links_table_t *tables, configuration_t *the_config) {
+    if (checkpoint.links_size == 0 || the_config->resume_cursor[0] == '\0') {
+        return 0;
+    }
+    FILE *file = fopen(checkpoint.links_path, "r");
+    if (file == NULL) {
+        perror("Cannot read the hard links of the checkpoint");
+        return -1;
+    }
+    char *record = NULL;
+    size_t capacity = 0;
+    long position = 0;
+    ssize_t length;
+    while (position < checkpoint.links_size && (length = getdelim(&record, &capacity, '\0', file)) > 0) {
+        position += (long) length;
+        int destination, offset = 0;
+        unsigned long long device, inode;
+        char path[PATH_SIZE];
+        if (sscanf(record, "%d %llu %llu %n", &destination, &device, &inode, &offset) != 3 || offset == 0 ||
+            destination < 0 || destination >= get_destinations_count(the_config) ||
+            concat_path(path, get_destination(the_config, destination), record + offset) == NULL) {
+            continue;
+        }
+        uint64_t key[LINK_KEY_SIZE] = {(uint64_t) device, (uint64_t) inode, 0};
+        link_slot_t *slot = insert_link(&tables[destination], key);
+        if (slot != NULL && slot->path == NULL) {
+            slot->path = strdup(path);
+        }
+    }
+    free(record);
+    fclose(file);
+    return 0;
+}
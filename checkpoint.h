@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdbool.h>
+#include "configuration.h"
+#include "defines.h"
+#include "links-table.h"
+
+// Progress of the current run, in the destination root (@see RESERVED_NAME_PREFIX)
+#define CHECKPOINT_NAME ".lp25-checkpoint"
+// Hard links of the source already created by the current run, so that a resumed run keeps them
+#define CHECKPOINT_LINKS_NAME ".lp25-checkpoint-links"
+// Minimal delay between two checkpoints, in seconds
+#define CHECKPOINT_PERIOD 5
+
+int init_checkpoint(configuration_t *the_config);
+bool is_checkpoint_due(void);
+int write_checkpoint(char *cursor);
+void remove_checkpoint(void);
+void record_checkpoint_link(int destination, uint64_t key[LINK_KEY_SIZE], char *relative);
+int load_checkpoint_links(links_table_t *tables, configuration_t *the_config);
@@ -0,0 +1,487 @@
+#include "compress.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#include "defines.h"
+#include "file-io.h"
+#include "file-properties.h"
+
+/*
+ * A compressed destination file is made of a header and a sequence of frames:
+ * - the header (COMPRESSED_HEADER_SIZE bytes, little endian) records what the comparison needs
+ *   (@see get_compressed_file_stats), so the destination tree is analyzed without decompressing it:
+ *       0  magic "LP25CMP" and format version (1)    36  mode (u32)
+ *       8  codec (u32)                               40  digest of the source file (16 bytes)
+ *      12  frame size (u32)                          56  frames count (u64)
+ *      16  original size (u64)
+ *      24  mtime seconds (i64), 32  mtime nanoseconds (u32)
+ * - each frame holds the size of its data (u32) and its original size (u32), then its data. Frames are
+ *   compressed independently, by several threads. Incompressible frames are stored as is (both sizes
+ *   are then equal).
+ */
+static const unsigned char compressed_magic[8] = {'L', 'P', '2', '5', 'C', 'M', 'P', 1};
+#define FRAME_HEADER_SIZE 8
+
+// A frame to compress (or decompress) and its result
+typedef struct {
+    compression_t codec;
+    int level;
+    unsigned char *input;
+    size_t input_size;
+    unsigned char *output;
+    size_t output_capacity;
+    size_t output_size;
+    int result;
+} frame_job_t;
+
+static void put_le32(unsigned char *buffer, uint32_t value) {
+    for (int i = 0; i < 4; ++i) {
+        buffer[i] = (unsigned char) (value >> (8 * i));
+    }
+}
+
+static void put_le64(unsigned char *buffer, uint64_t value) {
+    for (int i = 0; i < 8; ++i) {
+        buffer[i] = (unsigned char) (value >> (8 * i));
+    }
+}
+
+static uint32_t get_le32(const unsigned char *buffer) {
+    uint32_t value = 0;
+    for (int i = 3; i >= 0; --i) {
+        value = (value << 8) | buffer[i];
+    }
+    return value;
+}
+
+static uint64_t get_le64(const unsigned char *buffer) {
+    uint64_t value = 0;
+    for (int i = 7; i >= 0; --i) {
+        value = (value << 8) | buffer[i];
+    }
+    return value;
+}
+
+/*!
+ * @brief compress_bound gives the largest size of a compressed frame
+ * @param codec is the codec used
+ * @param size is the original size of the frame
+ * @return the size of the buffer receiving the compressed frame
+ */
+static size_t compress_bound(compression_t codec, size_t size) {
+#ifdef HAVE_ZSTD
+    if (codec == COMPRESSION_ZSTD) {
+        return ZSTD_compressBound(size);
+    }
+#else
+    (void) codec;
+#endif
+    return (size_t) compressBound((uLong) size);
+}
+
+/*!
+ * @brief compress_frame_job compresses a frame, the thread function of the parallel compression
+ * A frame that does not get smaller is kept as is (output_size is then its original size).
+ * @param parameters is a pointer to the frame, to be cast to a frame_job_t
+ * @return NULL, the result is in the frame (0 in case of success, -1 else)
+ */
+static void *compress_frame_job(void *parameters) {
+    frame_job_t *job = (frame_job_t *) parameters;
+    job->result = -1;
+#ifdef HAVE_ZSTD
+    if (job->codec == COMPRESSION_ZSTD) {
+        size_t size = ZSTD_compress(job->output, job->output_capacity, job->input, job->input_size,
+                                    (job->level == 0) ? ZSTD_CLEVEL_DEFAULT : job->level);
+        if (!ZSTD_isError(size)) {
+            job->output_size = size;
+            job->result = 0;
+        }
+    }
+#endif
+    if (job->codec == COMPRESSION_ZLIB) {
+        uLongf size = (uLongf) job->output_capacity;
+        if (compress2(job->output, &size, job->input, (uLong) job->input_size,
+                      (job->level == 0) ? Z_DEFAULT_COMPRESSION : job->level) == Z_OK) {
+            job->output_size = (size_t) size;
+            job->result = 0;
+        }
+    }
+    if (job->result == 0 && job->output_size >= job->input_size) {
+        memcpy(job->output, job->input, job->input_size);
+        job->output_size = job->input_size;
+    }
+    return NULL;
+}
+
+/*!
+ * @brief decompress_frame decompresses a frame
+ * @param codec is the codec used
+ * @param data is the data of the frame
+ * @param size is the size of the data
+ * @param output is the buffer receiving the original data
+ * @param original_size is the original size of the frame
+ * @return 0 in case of success, -1 else
+ */
+static int decompress_frame(compression_t codec, unsigned char *data, size_t size, unsigned char *output, size_t original_size) {
+    if (size == original_size) {
+        memcpy(output, data, size);
+        return 0;
+    }
+#ifdef HAVE_ZSTD
+    if (codec == COMPRESSION_ZSTD) {
+        size_t result = ZSTD_decompress(output, original_size, data, size);
+        return (ZSTD_isError(result) || result != original_size) ? -1 : 0;
+    }
+#endif
+    if (codec == COMPRESSION_ZLIB) {
+        uLongf result = (uLongf) original_size;
+        return (uncompress(output, &result, data, (uLong) size) != Z_OK || result != original_size) ? -1 : 0;
+    }
+    return -1;
+}
+
+/*!
+ * @brief compress_frames compresses frames at the same time, one thread each
+ * The calling thread compresses the first frame. If a thread cannot be created, its frame is compressed
+ * by the calling thread.
+ * @param jobs is the array of the frames
+ * @param count is the number of frames
+ */
+static void compress_frames(frame_job_t *jobs, size_t count) {
+    pthread_t threads[MAX_COMPRESSION_THREADS];
+    bool is_started[MAX_COMPRESSION_THREADS];
+    for (size_t i = 1; i < count; ++i) {
+        is_started[i] = (pthread_create(&threads[i], NULL, compress_frame_job, &jobs[i]) == 0);
+    }
+    if (count > 0) {
+        compress_frame_job(&jobs[0]);
+    }
+    for (size_t i = 1; i < count; ++i) {
+        if (is_started[i]) {
+            pthread_join(threads[i], NULL);
+        } else {
+            compress_frame_job(&jobs[i]);
+        }
+    }
+}
+
+/*!
+ * @brief fill_frame reads the next frame of a file
+ * @param reader is a pointer to the reader of the file
+ * @param job is a pointer to the frame receiving the data
+ * @return the size of the frame (0 at the end of the file), -1 in case of error
+ */
+static ssize_t fill_frame(io_file_t *reader, frame_job_t *job) {
+    job->input_size = 0;
+    while (job->input_size + IO_BLOCK_SIZE <= COMPRESSION_FRAME_SIZE) {
+        ssize_t bytes_read = read_file_block(reader);
+        if (bytes_read <= 0) {
+            if (bytes_read == -1) {
+                return -1;
+            }
+            break;
+        }
+        memcpy(job->input + job->input_size, reader->buffer, (size_t) bytes_read);
+        job->input_size += (size_t) bytes_read;
+    }
+    return (ssize_t) job->input_size;
+}
+
+/*!
+ * @brief encode_header writes a header in the on-disk format
+ * @param buffer is the buffer of COMPRESSED_HEADER_SIZE bytes receiving it
+ * @param header is a pointer to the header
+ * @param frames_count is the number of frames of the file
+ */
+static void encode_header(unsigned char *buffer, compressed_header_t *header, uint64_t frames_count) {
+    memset(buffer, 0, COMPRESSED_HEADER_SIZE);
+    memcpy(buffer, compressed_magic, sizeof(compressed_magic));
+    put_le32(buffer + 8, (uint32_t) header->codec);
+    put_le32(buffer + 12, header->frame_size);
+    put_le64(buffer + 16, header->original_size);
+    put_le64(buffer + 24, (uint64_t) header->mtime.tv_sec);
+    put_le32(buffer + 32, (uint32_t) header->mtime.tv_nsec);
+    put_le32(buffer + 36, header->mode);
+    memcpy(buffer + 40, header->md5sum, sizeof(header->md5sum));
+    put_le64(buffer + 56, frames_count);
+}
+
+/*!
+ * @brief compress_file writes the compressed copy of a file (@see the format above)
+ * The file is read by frames of COMPRESSION_FRAME_SIZE bytes, as many at a time as there are compression
+ * threads, and the compressed frames are written in order. The header is written last, so a file whose
+ * copy was interrupted never looks complete. Access modes and mtime of the source are kept.
+ * @param source_entry is a pointer to the entry of the source file (its digest is recorded)
+ * @param dest_path is the path of the compressed file
+ * @param the_config is a pointer to the configuration (codec, level and threads)
+ * @return the number of bytes compressed, -1 in case of error
+ */
+int64_t compress_file(files_list_entry_t *source_entry, char *dest_path, configuration_t *the_config) {
+    size_t threads_count = the_config->compression_threads;
+    if (threads_count == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads_count = (cpus > 0) ? (size_t) cpus : 1;
+    }
+    if (threads_count > MAX_COMPRESSION_THREADS) {
+        threads_count = MAX_COMPRESSION_THREADS;
+    }
+
+    // Small files do not need more frames than they have
+    size_t needed_frames = (size_t) ((source_entry->size + COMPRESSION_FRAME_SIZE - 1) / COMPRESSION_FRAME_SIZE);
+    if (needed_frames == 0) {
+        needed_frames = 1;
+    }
+    if (threads_count > needed_frames) {
+        threads_count = needed_frames;
+    }
+
+    frame_job_t jobs[MAX_COMPRESSION_THREADS];
+    memset(jobs, 0, sizeof(jobs));
+    size_t output_capacity = compress_bound(the_config->compression, COMPRESSION_FRAME_SIZE);
+    for (size_t i = 0; i < threads_count; ++i) {
+        jobs[i].codec = the_config->compression;
+        jobs[i].level = the_config->compression_level;
+        jobs[i].input = malloc(COMPRESSION_FRAME_SIZE);
+        jobs[i].output = malloc(output_capacity);
+        jobs[i].output_capacity = output_capacity;
+        if (jobs[i].input == NULL || jobs[i].output == NULL) {
+            printf("Error when allocating memory in the function compress_file of the file compress.c\n");
+            for (size_t j = 0; j <= i; ++j) {
+                free(jobs[j].input);
+                free(jobs[j].output);
+            }
+            return -1;
+        }
+    }
+
+    int64_t result = -1;
+    io_file_t reader, writer;
+    if (open_file_reader(&reader, source_entry->path_and_name) == -1) {
+        perror("Cannot open source file");
+    } else {
+        if (open_file_writer(&writer, dest_path, source_entry->mode & 07777) == -1) {
+            perror("Cannot open destination file");
+        } else {
+            compressed_header_t header;
+            memset(&header, 0, sizeof(compressed_header_t));
+            header.codec = the_config->compression;
+            header.frame_size = COMPRESSION_FRAME_SIZE;
+            header.mtime = source_entry->mtime;
+            header.mode = (uint32_t) source_entry->mode;
+            memcpy(header.md5sum, source_entry->md5sum, sizeof(header.md5sum));
+
+            // The header is completed once all the frames are written
+            unsigned char buffer[COMPRESSED_HEADER_SIZE];
+            memset(buffer, 0, sizeof(buffer));
+            bool is_failed = (write_file_block(&writer, buffer, sizeof(buffer)) == -1);
+            uint64_t frames_count = 0;
+            bool is_end = false;
+            while (!is_failed && !is_end) {
+                size_t batch = 0;
+                while (batch < threads_count && !is_end) {
+                    ssize_t size = fill_frame(&reader, &jobs[batch]);
+                    if (size == -1) {
+                        is_failed = true;
+                        break;
+                    }
+                    if (size > 0) {
+                        ++batch;
+                    }
+                    is_end = (size == 0);
+                }
+                if (is_failed) {
+                    break;
+                }
+
+                compress_frames(jobs, batch);
+                for (size_t i = 0; i < batch && !is_failed; ++i) {
+                    unsigned char frame_header[FRAME_HEADER_SIZE];
+                    put_le32(frame_header, (uint32_t) jobs[i].output_size);
+                    put_le32(frame_header + 4, (uint32_t) jobs[i].input_size);
+                    is_failed = (jobs[i].result == -1 ||
+                                 write_file_block(&writer, frame_header, sizeof(frame_header)) == -1 ||
+                                 write_file_block(&writer, jobs[i].output, jobs[i].output_size) == -1);
+                    header.original_size += jobs[i].input_size;
+                    ++frames_count;
+                }
+            }
+
+            if (!is_failed) {
+                encode_header(buffer, &header, frames_count);
+                is_failed = (pwrite(writer.fd, buffer, sizeof(buffer), 0) != (ssize_t) sizeof(buffer) ||
+                             finish_file_writer(&writer) == -1);
+            }
+            if (is_failed) {
+                perror("Cannot compress file");
+            } else {
+                result = (int64_t) header.original_size;
+            }
+
+            // Keep access modes and mtime
+            fchmod(writer.fd, source_entry->mode & 07777);
+            struct timespec times[2] = {{0, UTIME_OMIT}, source_entry->mtime};
+            futimens(writer.fd, times);
+            close_io_file(&writer);
+        }
+        close_io_file(&reader);
+    }
+
+    for (size_t i = 0; i < threads_count; ++i) {
+        free(jobs[i].input);
+        free(jobs[i].output);
+    }
+    return result;
+}
+
+/*!
+ * @brief decode_header reads a header in the on-disk format
+ * @param buffer is the buffer of COMPRESSED_HEADER_SIZE bytes holding it
+ * @param header is a pointer to the header receiving its fields
+ * @param frames_count is a pointer to the number of frames of the file (can be NULL)
+ * @return 0 in case of success, -1 when the buffer is not a (complete) header
+ */
+static int decode_header(unsigned char *buffer, compressed_header_t *header, uint64_t *frames_count) {
+    if (memcmp(buffer, compressed_magic, sizeof(compressed_magic)) != 0) {
+        return -1;
+    }
+    header->codec = (compression_t) get_le32(buffer + 8);
+    header->frame_size = get_le32(buffer + 12);
+    header->original_size = get_le64(buffer + 16);
+    header->mtime.tv_sec = (time_t) get_le64(buffer + 24);
+    header->mtime.tv_nsec = (long) get_le32(buffer + 32);
+    header->mode = get_le32(buffer + 36);
+    memcpy(header->md5sum, buffer + 40, sizeof(header->md5sum));
+    if (frames_count != NULL) {
+        *frames_count = get_le64(buffer + 56);
+    }
+    return 0;
+}
+
+/*!
+ * @brief read_compressed_header reads the header of a compressed file
+ * @param path is the path of the file
+ * @param header is a pointer to the header receiving its fields
+ * @return 0 in case of success, -1 when the file cannot be read or is not a compressed file
+ */
+int read_compressed_header(char *path, compressed_header_t *header) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return -1;
+    }
+    unsigned char buffer[COMPRESSED_HEADER_SIZE];
+    ssize_t bytes_read = pread(fd, buffer, sizeof(buffer), 0);
+    close(fd);
+    if (bytes_read != (ssize_t) sizeof(buffer)) {
+        return -1;
+    }
+    return decode_header(buffer, header, NULL);
+}
+
+/*!
+ * @brief get_compressed_file_stats gets the properties of an entry of a compressed destination tree
+ * Files get the size, mtime and digest recorded in their header, so they compare with the source
+ * files without being decompressed. A file without a valid header (e.g. an uncompressed copy, or a copy
+ * that was interrupted) never compares equal: its size is set to UINT64_MAX.
+ * @param entry is a pointer to the entry
+ * @return -1 in case of error, 0 else
+ */
+int get_compressed_file_stats(files_list_entry_t *entry) {
+    if (get_file_metadata(entry) == -1) {
+        return -1;
+    }
+    if (entry->entry_type != FICHIER) {
+        return 0;
+    }
+
+    compressed_header_t header;
+    if (read_compressed_header(entry->path_and_name, &header) == -1) {
+        entry->size = UINT64_MAX;
+        return 0;
+    }
+    entry->size = header.original_size;
+    entry->mtime = header.mtime;
+    memcpy(entry->md5sum, header.md5sum, sizeof(entry->md5sum));
+    return 0;
+}
+
+/*!
+ * @brief decompress_file restores the original content of a compressed file
+ * The access modes are those of the compressed file: a run only updates them (@see update_metadata),
+ * the header keeps the ones of the first copy. The mtime is the recorded one.
+ * @param compressed_path is the path of the compressed file
+ * @param output_path is the path of the restored file
+ * @return the number of bytes restored, -1 in case of error
+ */
+int64_t decompress_file(char *compressed_path, char *output_path) {
+    FILE *input = fopen(compressed_path, "rb");
+    if (input == NULL) {
+        perror("Cannot open compressed file");
+        return -1;
+    }
+
+    compressed_header_t header;
+    uint64_t frames_count;
+    unsigned char buffer[COMPRESSED_HEADER_SIZE];
+    if (fread(buffer, 1, sizeof(buffer), input) != sizeof(buffer) ||
+        decode_header(buffer, &header, &frames_count) == -1) {
+        printf("%s is not a compressed file\n", compressed_path);
+        fclose(input);
+        return -1;
+    }
+
+    struct stat compressed_stat;
+    int output_fd = (fstat(fileno(input), &compressed_stat) == -1) ? -1 :
+                    open(output_path, O_WRONLY | O_CREAT | O_TRUNC, compressed_stat.st_mode & 07777);
+    unsigned char *data = malloc(compress_bound(header.codec, header.frame_size));
+    unsigned char *original = malloc(header.frame_size);
+    if (output_fd == -1 || data == NULL || original == NULL) {
+        perror("Cannot decompress file");
+        free(data);
+        free(original);
+        if (output_fd != -1) {
+            close(output_fd);
+        }
+        fclose(input);
+        return -1;
+    }
+
+    uint64_t restored = 0;
+    bool is_failed = false;
+    for (uint64_t i = 0; i < frames_count && !is_failed; ++i) {
+        unsigned char frame_header[FRAME_HEADER_SIZE];
+        is_failed = (fread(frame_header, 1, sizeof(frame_header), input) != sizeof(frame_header));
+        if (is_failed) {
+            break;
+        }
+        size_t size = get_le32(frame_header);
+        size_t original_size = get_le32(frame_header + 4);
+        is_failed = (original_size > header.frame_size || size > compress_bound(header.codec, header.frame_size) ||
+                     fread(data, 1, size, input) != size ||
+                     decompress_frame(header.codec, data, size, original, original_size) == -1 ||
+                     write(output_fd, original, original_size) != (ssize_t) original_size);
+        restored += original_size;
+    }
+    if (is_failed || restored != header.original_size) {
+        printf("Cannot decompress %s: the file is corrupted\n", compressed_path);
+        is_failed = true;
+    }
+
+    // The file may already exist with other access modes
+    fchmod(output_fd, compressed_stat.st_mode & 07777);
+    struct timespec times[2] = {{0, UTIME_OMIT}, header.mtime};
+    futimens(output_fd, times);
+    close(output_fd);
+    free(data);
+    free(original);
+    fclose(input);
+    return is_failed ? -1 : (int64_t) restored;
+}
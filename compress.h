@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include "configuration.h"
+#include "files-list.h"
+
+// Size of the independent frames of a compressed file: each one is compressed by one thread
+#define COMPRESSION_FRAME_SIZE (1024 * 1024)
+#define MAX_COMPRESSION_THREADS 64
+// Size of the header at the start of a compressed file (@see compress.c for its layout)
+#define COMPRESSED_HEADER_SIZE 64
+
+typedef struct {
+    compression_t codec;
+    uint32_t frame_size;
+    uint64_t original_size;
+    struct timespec mtime; // mtime of the source file
+    uint32_t mode;
+    uint8_t md5sum[16]; // MD5 sum of the source file (zeros when it was not computed)
+} compressed_header_t;
+
+int64_t compress_file(files_list_entry_t *source_entry, char *dest_path, configuration_t *the_config);
+int64_t decompress_file(char *compressed_path, char *output_path);
+int read_compressed_header(char *path, compressed_header_t *header);
+int get_compressed_file_stats(files_list_entry_t *entry);
@@ -1,11 +1,15 @@
 #include "configuration.h"
+#include "remote.h"
+#include "affinity.h"
+#include "utility.h"
 #include <stddef.h>
 #include <stdlib.h>
+#include <errno.h>
 #include <getopt.h>
 #include <stdio.h>
 #include <string.h>
 
-typedef enum {DATE_SIZE_ONLY, NO_PARALLEL, DRY_RUN} long_opt_values;
+typedef enum {DATE_SIZE_ONLY, NO_PARALLEL, DRY_RUN, ADAPTIVE, MAX_SOURCE_ANALYZERS, MAX_DESTINATION_ANALYZERS, STATS, CACHE_POLITE, READ_BANDWIDTH, WRITE_BANDWIDTH, READ_IOPS, WRITE_IOPS, IO_CLASS, NICE, COPY_WORKERS, DEDUP, REFLINK, COMPRESS, COMPRESS_THREADS, PACK, DURABLE, LINK_DEST, DELETE, RESUME, EXCLUDE, INCLUDE, FILTER_FILE, SERVE, DELTA, MEMORY_LIMIT, TRACE, SOURCE_CPUS, DESTINATION_CPUS, NO_AFFINITY, PLAN, MEASURE_THROUGHPUT, RESTORE} long_opt_values;
 
 /*!
  * @brief function display_help displays a brief manual for the program usage
@@ -13,13 +17,162 @@ typedef enum {DATE_SIZE_ONLY, NO_PARALLEL, DRY_RUN} long_opt_values;
  * This function is provided with its code, you don't have to implement nor modify it.
  */
 void display_help(char *my_name) {
-    printf("%s [options] source_dir destination_dir\n", my_name);
+    printf("%s [options] source_dir destination_dir [destination_dir...]\n", my_name);
+    printf("%s [options] --serve <address> destination_dir\n", my_name);
+    printf("%s [options] --restore backup_dir target_dir\n", my_name);
     printf("Options: \t-n <processes count>\tnumber of processes for file calculations\n");
     printf("         \t-h display help (this text)\n");
-    printf("         \t--date-size-only disables MD5 calculation for files\n");
+    printf("         \t--date-size-only compares the files by size and mtime only, without computing the digest of their content\n");
     printf("         \t--no-parallel disables parallel computing (cancels values of option -n)\n");
     printf("         \t--dry-run for test execution (just list the operations to do, do not actually make the copies)\n");
+    printf("         \t--plan <file> writes the actions of the dry run and the estimated time of the run to a file (- for stdout), implies --dry-run\n");
+    printf("         \t--measure-throughput records the throughput of the run in the cache directory, for the estimates of --plan\n");
     printf("         \t-v for verbose (display of the list and operations in details)\n");
+    printf("         \t--adaptive grows or shrinks each side's analyzers pool during the run, depending on its throughput\n");
+    printf("         \t--max-source-analyzers <count> maximum number of analyzers for the source tree\n");
+    printf("         \t--max-destination-analyzers <count> maximum number of analyzers for the destination tree\n");
+    printf("         \t--source-cpus <list> runs the source lister and analyzers on these CPUs (e.g. 0-7,16-23), with memory from their NUMA node\n");
+    printf("         \t--destination-cpus <list> runs the destination listers and analyzers on these CPUs\n");
+    printf("         \t--no-affinity lets the workers float, instead of running the source and destination ones on two NUMA nodes\n");
+    printf("         \t--copy-workers <count> number of processes copying files while the trees are compared (default 1, 0 to copy in the main process)\n");
+    printf("         \t--reflink clones the data of the files (copy-on-write filesystems), falls back to a copy when not supported\n");
+    printf("         \t--dedup <link|reflink> links (or clones) files identical to an already copied file instead of copying them (needs the digests)\n");
+    printf("         \t--compress <zlib|zstd>[:level] stores the destination files compressed, with their original size, mtime and digest\n");
+    printf("         \t--compress-threads <count> number of threads compressing each file (default: one per CPU)\n");
+    printf("         \t--durable[=syncfs|fdatasync|fsync] writes each file under a temporary name, then renames it once its data is on disk,\n");
+    printf("         \t\tsyncing the files of each directory by batches (syncfs by default) or one by one (fsync)\n");
+    printf("         \t--link-dest <dir> hard-links the files unchanged since a previous snapshot <dir> instead of copying them\n");
+    printf("         \t--delete removes the destination entries missing from the source (mirror mode), while the trees are compared\n");
+    printf("         \t--exclude <pattern> skips the entries matching a glob pattern (*, ?, [...], ** for any number of directories);\n");
+    printf("         \t\ta pattern with a / is anchored at the root, a trailing / only matches directories\n");
+    printf("         \t--include <pattern> keeps the entries matching a pattern: the first matching rule wins\n");
+    printf("         \t--filter-file <file> reads rules from a file, one per line (- pattern, + pattern, # comment)\n");
+    printf("         \t--resume continues an interrupted run from its last checkpoint, without listing the entries it already handled\n");
+    printf("         \t--serve <address> serves destination_dir to the runs whose destination is <address>: unix:<socket path> or tcp:<host>:<port>\n");
+    printf("         \t\t(no authentication nor encryption: use it on a trusted network)\n");
+    printf("         \t--restore rebuilds the tree of backup_dir (a destination of lp25) in target_dir: the compressed files\n");
+    printf("         \t\tare decompressed and the packed files extracted\n");
+    printf("         \t--delta sends only the modified blocks of the files replaced on a remote destination (unix:<socket path> or tcp:<host>:<port>)\n");
+    printf("         \t--memory-limit <bytes> bounds the memory of the listings: larger directories are sorted in temporary files\n");
+    printf("         \t\tof $TMPDIR, and the entries waiting to be compared are spilled to them (k, m and g suffixes accepted)\n");
+    printf("         \t--pack <bytes> stores the files smaller than this size in large pack files of the destination (k, m and g suffixes accepted)\n");
+    printf("         \t--stats <file> writes the counters of each stage as JSON at exit (- for stdout)\n");
+    printf("         \t--trace <file> writes the timeline of the operations of all the processes at exit, as a Chrome trace (Perfetto)\n");
+    printf("         \t--cache-polite reads and writes files data without keeping it in the page cache\n");
+    printf("         \t--read-bandwidth <bytes/s> limits the reads of all the processes (k, m and g suffixes accepted)\n");
+    printf("         \t--write-bandwidth <bytes/s> limits the writes of all the processes (k, m and g suffixes accepted)\n");
+    printf("         \t--read-iops <count> limits the read operations per second of all the processes\n");
+    printf("         \t--write-iops <count> limits the write operations per second of all the processes\n");
+    printf("         \t--io-class <idle|best-effort[:level]> sets the I/O scheduling class of all the processes\n");
+    printf("         \t--nice <level> sets the nice level of all the processes\n");
+}
+
+/*!
+ * @brief parse_io_class converts an I/O scheduling class (idle, best-effort or best-effort:<level>)
+ * @param text is the text to convert
+ * @param the_config is a pointer to the configuration receiving the class and the level
+ * @return 0 in case of success, -1 else
+ */
+static int parse_io_class(char *text, configuration_t *the_config) {
+    if (strcmp(text, "idle") == 0) {
+        the_config->io_class = IO_CLASS_IDLE;
+        return 0;
+    }
+    if (strncmp(text, "best-effort", strlen("best-effort")) != 0) {
+        return -1;
+    }
+    char *level = text + strlen("best-effort");
+    the_config->io_class = IO_CLASS_BEST_EFFORT;
+    the_config->io_level = 4; // Niveau par défaut du noyau
+    if (*level == '\0') {
+        return 0;
+    }
+    if (*level != ':' || level[1] < '0' || level[1] > '7' || level[2] != '\0') {
+        return -1;
+    }
+    the_config->io_level = (uint8_t) (level[1] - '0');
+    return 0;
+}
+
+/*!
+ * @brief add_filter_rule appends a filter rule, in the order of the command line (@see filters.c)
+ * @param the_config is a pointer to the configuration
+ * @param kind is '-' for an exclude rule, '+' for an include rule, '.' for a rules file
+ * @param pattern is the pattern (or the path of the rules file)
+ * @return 0 in case of success, -1 else
+ */
+static int add_filter_rule(configuration_t *the_config, char kind, char *pattern) {
+    char **new_rules = realloc(the_config->filter_rules, (the_config->filter_rules_count + 1) * sizeof(char *));
+    char *rule = malloc(strlen(pattern) + 3);
+    if (new_rules == NULL || rule == NULL) {
+        printf("Error when allocating memory in the function add_filter_rule of the file configuration.c\n");
+        free(rule);
+        if (new_rules != NULL) {
+            the_config->filter_rules = new_rules;
+        }
+        return -1;
+    }
+    sprintf(rule, "%c %s", kind, pattern);
+    the_config->filter_rules = new_rules;
+    the_config->filter_rules[the_config->filter_rules_count++] = rule;
+    return 0;
+}
+
+/*!
+ * @brief parse_compression converts a codec name (zlib or zstd) with an optional level (zlib:9)
+ * @param text is the text to convert
+ * @param the_config is a pointer to the configuration receiving the codec and the level
+ * @return 0 in case of success, -1 else
+ */
+static int parse_compression(char *text, configuration_t *the_config) {
+    char *level = strchr(text, ':');
+    size_t name_length = (level == NULL) ? strlen(text) : (size_t) (level - text);
+    if (name_length == strlen("zlib") && strncmp(text, "zlib", name_length) == 0) {
+        the_config->compression = COMPRESSION_ZLIB;
+    } else if (name_length == strlen("zstd") && strncmp(text, "zstd", name_length) == 0) {
+#ifdef HAVE_ZSTD
+        the_config->compression = COMPRESSION_ZSTD;
+#else
+        fprintf(stderr, "This build has no zstd support\n");
+        return -1;
+#endif
+    } else {
+        return -1;
+    }
+    the_config->compression_level = 0; // Niveau par défaut du codec
+    if (level == NULL) {
+        return 0;
+    }
+    char *end;
+    long value = strtol(level + 1, &end, 10);
+    long max_level = (the_config->compression == COMPRESSION_ZLIB) ? 9 : 22;
+    if (end == level + 1 || *end != '\0' || value < 1 || value > max_level) {
+        return -1;
+    }
+    the_config->compression_level = (int) value;
+    return 0;
+}
+
+/*!
+ * @brief parse_count converts a decimal count and checks it lies within bounds
+ * @param text is the text to convert (no sign, no suffix, no trailing characters)
+ * @param min is the smallest accepted value
+ * @param max is the largest accepted value
+ * @param value is a pointer to the converted count
+ * @return 0 in case of success, -1 else
+ */
+static int parse_count(char *text, unsigned long min, unsigned long max, unsigned long *value) {
+    if (text == NULL || *text < '0' || *text > '9') {
+        return -1;
+    }
+    char *end;
+    errno = 0;
+    unsigned long count = strtoul(text, &end, 10);
+    if (errno != 0 || *end != '\0' || count < min || count > max) {
+        return -1;
+    }
+    *value = count;
+    return 0;
 }
 
 /*!
@@ -30,11 +183,48 @@ void init_configuration(configuration_t *the_config) {
     if (the_config != NULL) {
         the_config->source[0] = '\0'; // Chemin source vide par défaut
         the_config->destination[0] = '\0'; // Chemin destination vide par défaut
+        the_config->extra_destinations_count = 0; // Une seule destination par défaut
+        the_config->serve_address[0] = '\0'; // Par défaut, synchroniser au lieu de servir la destination
+        the_config->uses_restore = false; // Par défaut, synchroniser au lieu de restaurer une sauvegarde
+        the_config->uses_delta = false; // Par défaut, les fichiers distants sont envoyés en entier
         the_config->processes_count = 1; // Un seul processus par défaut
         the_config->is_parallel = true; // Par défaut, exécuter en parallèle
         the_config->uses_md5 = true; // Par défaut, utiliser le calcul MD5
         the_config->uses_verbose = false; // Par défaut, ne pas utiliser verbose
         the_config->uses_dry_run = false; // Par défaut, ne pas utilsier dry-run
+        the_config->plan_file[0] = '\0'; // Pas de fichier de plan par défaut
+        the_config->measures_throughput = false; // Par défaut, le débit des étapes n'est pas enregistré
+        the_config->is_adaptive = false; // Par défaut, nombre d'analyseurs fixe
+        the_config->max_source_analyzers = 0; // 0 : déduit de l'option -n
+        the_config->max_destination_analyzers = 0; // 0 : déduit de l'option -n
+        the_config->source_cpus[0] = '\0'; // Par défaut, placement selon les nœuds NUMA
+        the_config->destination_cpus[0] = '\0';
+        the_config->uses_affinity = true; // Par défaut, source et destination sur deux nœuds s'il y en a plusieurs
+        the_config->copiers_count = 1; // Un processus de copie par défaut
+        the_config->uses_reflink = false; // Par défaut, les données sont copiées
+        the_config->dedup_mode = DEDUP_NONE; // Par défaut, chaque fichier est copié
+        the_config->compression = COMPRESSION_NONE; // Par défaut, les fichiers sont copiés tels quels
+        the_config->compression_level = 0;
+        the_config->compression_threads = 0; // 0 : un thread par processeur
+        the_config->durability = DURABILITY_NONE; // Par défaut, les copies ne sont pas synchronisées
+        the_config->memory_limit = 0; // 0 : chaque répertoire est listé en mémoire
+        the_config->pack_threshold = 0; // 0 : chaque fichier est copié dans l'arborescence
+        the_config->link_dest[0] = '\0'; // Pas d'instantané précédent par défaut
+        the_config->uses_delete = false; // Par défaut, les entrées en trop sont conservées
+        the_config->uses_resume = false; // Par défaut, l'exécution reprend depuis le début
+        the_config->resume_cursor[0] = '\0';
+        the_config->filter_rules = NULL; // Par défaut, aucune entrée n'est exclue
+        the_config->filter_rules_count = 0;
+        the_config->stats_file[0] = '\0'; // Pas de rapport des compteurs par défaut
+        the_config->trace_file[0] = '\0'; // Pas de trace des événements par défaut
+        the_config->is_cache_polite = false; // Par défaut, les données passent par le cache de pages
+        the_config->read_bandwidth = 0; // 0 : pas de limite
+        the_config->write_bandwidth = 0;
+        the_config->read_iops = 0;
+        the_config->write_iops = 0;
+        the_config->io_class = IO_CLASS_DEFAULT; // Classe d'E/S héritée du shell
+        the_config->io_level = 4;
+        the_config->nice_level = 0;
     }
 }
 
@@ -55,11 +245,46 @@ int set_configuration(configuration_t *the_config, int argc, char *argv[]) {
             {"date-size-only", no_argument, 0, DATE_SIZE_ONLY},
             {"no-parallel", no_argument, 0, NO_PARALLEL},
             {"dry-run", no_argument, 0, DRY_RUN},
+            {"adaptive", no_argument, 0, ADAPTIVE},
+            {"max-source-analyzers", required_argument, 0, MAX_SOURCE_ANALYZERS},
+            {"max-destination-analyzers", required_argument, 0, MAX_DESTINATION_ANALYZERS},
+            {"stats", required_argument, 0, STATS},
+            {"trace", required_argument, 0, TRACE},
+            {"plan", required_argument, 0, PLAN},
+            {"measure-throughput", no_argument, 0, MEASURE_THROUGHPUT},
+            {"cache-polite", no_argument, 0, CACHE_POLITE},
+            {"read-bandwidth", required_argument, 0, READ_BANDWIDTH},
+            {"write-bandwidth", required_argument, 0, WRITE_BANDWIDTH},
+            {"read-iops", required_argument, 0, READ_IOPS},
+            {"write-iops", required_argument, 0, WRITE_IOPS},
+            {"io-class", required_argument, 0, IO_CLASS},
+            {"nice", required_argument, 0, NICE},
+            {"copy-workers", required_argument, 0, COPY_WORKERS},
+            {"source-cpus", required_argument, 0, SOURCE_CPUS},
+            {"destination-cpus", required_argument, 0, DESTINATION_CPUS},
+            {"no-affinity", no_argument, 0, NO_AFFINITY},
+            {"dedup", required_argument, 0, DEDUP},
+            {"reflink", no_argument, 0, REFLINK},
+            {"compress", required_argument, 0, COMPRESS},
+            {"compress-threads", required_argument, 0, COMPRESS_THREADS},
+            {"pack", required_argument, 0, PACK},
+            {"durable", optional_argument, 0, DURABLE},
+            {"link-dest", required_argument, 0, LINK_DEST},
+            {"delete", no_argument, 0, DELETE},
+            {"resume", no_argument, 0, RESUME},
+            {"exclude", required_argument, 0, EXCLUDE},
+            {"include", required_argument, 0, INCLUDE},
+            {"filter-file", required_argument, 0, FILTER_FILE},
+            {"serve", required_argument, 0, SERVE},
+            {"restore", no_argument, 0, RESTORE},
+            {"delta", no_argument, 0, DELTA},
+            {"memory-limit", required_argument, 0, MEMORY_LIMIT},
             {0, 0, 0, 0}
     };
 
     int opt;
     int option_index = 0;
+    unsigned long count;
 
     while ((opt = getopt_long(argc, argv, "hvn:", long_options, &option_index)) != -1) {
         switch (opt) {
@@ -80,12 +305,206 @@ int set_configuration(configuration_t *the_config, int argc, char *argv[]) {
                 break;
             case DRY_RUN:
                 the_config->uses_dry_run = true;
+                break;
+            case PLAN:
+                strncpy(the_config->plan_file, optarg, sizeof(the_config->plan_file) - 1);
+                the_config->plan_file[sizeof(the_config->plan_file) - 1] = '\0';
+                the_config->uses_dry_run = true;
+                break;
+            case MEASURE_THROUGHPUT:
+                the_config->measures_throughput = true;
+                break;
+            case ADAPTIVE:
+                the_config->is_adaptive = true;
+                break;
+            case MAX_SOURCE_ANALYZERS:
+                if (parse_count(optarg, 0, UINT8_MAX, &count) == -1) {
+                    fprintf(stderr, "Invalid maximum source analyzers count %s\n", optarg);
+                    return -1;
+                }
+                the_config->max_source_analyzers = (uint8_t) count;
+                break;
+            case MAX_DESTINATION_ANALYZERS:
+                if (parse_count(optarg, 0, UINT8_MAX, &count) == -1) {
+                    fprintf(stderr, "Invalid maximum destination analyzers count %s\n", optarg);
+                    return -1;
+                }
+                the_config->max_destination_analyzers = (uint8_t) count;
+                break;
+            case STATS:
+                strncpy(the_config->stats_file, optarg, sizeof(the_config->stats_file) - 1);
+                the_config->stats_file[sizeof(the_config->stats_file) - 1] = '\0';
+                break;
+            case TRACE:
+                strncpy(the_config->trace_file, optarg, sizeof(the_config->trace_file) - 1);
+                the_config->trace_file[sizeof(the_config->trace_file) - 1] = '\0';
+                break;
+            case CACHE_POLITE:
+                the_config->is_cache_polite = true;
+                break;
+            case READ_BANDWIDTH:
+                if (parse_size(optarg, &the_config->read_bandwidth) == -1) {
+                    fprintf(stderr, "Invalid read bandwidth %s\n", optarg);
+                    return -1;
+                }
+                break;
+            case WRITE_BANDWIDTH:
+                if (parse_size(optarg, &the_config->write_bandwidth) == -1) {
+                    fprintf(stderr, "Invalid write bandwidth %s\n", optarg);
+                    return -1;
+                }
+                break;
+            case READ_IOPS:
+                if (parse_count(optarg, 1, UINT32_MAX, &count) == -1) {
+                    fprintf(stderr, "Invalid read IOPS %s\n", optarg);
+                    return -1;
+                }
+                the_config->read_iops = (uint32_t) count;
+                break;
+            case WRITE_IOPS:
+                if (parse_count(optarg, 1, UINT32_MAX, &count) == -1) {
+                    fprintf(stderr, "Invalid write IOPS %s\n", optarg);
+                    return -1;
+                }
+                the_config->write_iops = (uint32_t) count;
+                break;
+            case IO_CLASS:
+                if (parse_io_class(optarg, the_config) == -1) {
+                    fprintf(stderr, "Invalid I/O class %s\n", optarg);
+                    return -1;
+                }
+                break;
+            case NICE:
+                the_config->nice_level = atoi(optarg);
+                break;
+            case COPY_WORKERS:
+                if (parse_count(optarg, 0, UINT8_MAX, &count) == -1) {
+                    fprintf(stderr, "Invalid copy workers count %s\n", optarg);
+                    return -1;
+                }
+                the_config->copiers_count = (uint8_t) count;
+                break;
+            case SOURCE_CPUS:
+            case DESTINATION_CPUS: {
+                uint64_t cpus[AFFINITY_MAX_CPUS / 64];
+                if (parse_cpu_list(optarg, cpus, AFFINITY_MAX_CPUS) <= 0) {
+                    fprintf(stderr, "Invalid CPU list %s\n", optarg);
+                    return -1;
+                }
+                char *list = (opt == SOURCE_CPUS) ? the_config->source_cpus : the_config->destination_cpus;
+                strncpy(list, optarg, sizeof(the_config->source_cpus) - 1);
+                list[sizeof(the_config->source_cpus) - 1] = '\0';
+                break;
+            }
+            case NO_AFFINITY:
+                the_config->uses_affinity = false;
+                break;
+            case REFLINK:
+                the_config->uses_reflink = true;
+                break;
+            case DEDUP:
+                if (strcmp(optarg, "link") == 0) {
+                    the_config->dedup_mode = DEDUP_LINK;
+                } else if (strcmp(optarg, "reflink") == 0) {
+                    the_config->dedup_mode = DEDUP_REFLINK;
+                } else {
+                    fprintf(stderr, "Invalid dedup mode %s\n", optarg);
+                    return -1;
+                }
+                break;
+            case COMPRESS:
+                if (parse_compression(optarg, the_config) == -1) {
+                    fprintf(stderr, "Invalid compression %s\n", optarg);
+                    return -1;
+                }
+                break;
+            case COMPRESS_THREADS:
+                if (parse_count(optarg, 0, UINT8_MAX, &count) == -1) {
+                    fprintf(stderr, "Invalid compression threads count %s\n", optarg);
+                    return -1;
+                }
+                the_config->compression_threads = (uint8_t) count;
+                break;
+            case PACK:
+                if (parse_size(optarg, &the_config->pack_threshold) == -1) {
+                    fprintf(stderr, "Invalid pack threshold %s\n", optarg);
+                    return -1;
+                }
+                break;
+            case DURABLE:
+                if (optarg == NULL || strcmp(optarg, "syncfs") == 0) {
+                    the_config->durability = DURABILITY_SYNCFS;
+                } else if (strcmp(optarg, "fdatasync") == 0) {
+                    the_config->durability = DURABILITY_FDATASYNC;
+                } else if (strcmp(optarg, "fsync") == 0) {
+                    the_config->durability = DURABILITY_FSYNC;
+                } else {
+                    fprintf(stderr, "Invalid durability mode %s\n", optarg);
+                    return -1;
+                }
+                break;
+            case LINK_DEST:
+                strncpy(the_config->link_dest, optarg, sizeof(the_config->link_dest) - 1);
+                the_config->link_dest[sizeof(the_config->link_dest) - 1] = '\0';
+                break;
+            case DELETE:
+                the_config->uses_delete = true;
+                break;
+            case RESUME:
+                the_config->uses_resume = true;
+                break;
+            case EXCLUDE:
+            case INCLUDE:
+            case FILTER_FILE:
+                if (add_filter_rule(the_config, (opt == EXCLUDE) ? '-' : (opt == INCLUDE) ? '+' : '.', optarg) == -1) {
+                    return -1;
+                }
+                break;
+            case RESTORE:
+                the_config->uses_restore = true;
+                break;
+            case SERVE:
+                strncpy(the_config->serve_address, optarg, sizeof(the_config->serve_address) - 1);
+                the_config->serve_address[sizeof(the_config->serve_address) - 1] = '\0';
+                break;
+            case DELTA:
+                the_config->uses_delta = true;
+                break;
+            case MEMORY_LIMIT:
+                if (parse_size(optarg, &the_config->memory_limit) == -1) {
+                    fprintf(stderr, "Invalid memory limit %s\n", optarg);
+                    return -1;
+                }
+                break;
             default:
                 display_help(argv[0]);
                 return -1;
         }
     }
 
+    // La déduplication compare les sommes MD5
+    if (the_config->dedup_mode != DEDUP_NONE && !the_config->uses_md5) {
+        fprintf(stderr, "--dedup needs the digests of the files, it is ignored with --date-size-only\n");
+        the_config->dedup_mode = DEDUP_NONE;
+    }
+
+    // Les fichiers compressés ne peuvent pas partager les blocs de leur source
+    if (the_config->compression != COMPRESSION_NONE && the_config->uses_reflink) {
+        fprintf(stderr, "--reflink clones uncompressed data, it is ignored with --compress\n");
+        the_config->uses_reflink = false;
+    }
+
+    // Le récepteur ne sert qu'un dossier destination
+    if (the_config->serve_address[0] != '\0') {
+        if (argc - optind != 1 || !is_remote_address(the_config->serve_address)) {
+            fprintf(stderr, "--serve needs an address (unix:<socket path> or tcp:<host>:<port>) and a single destination directory.\n");
+            return -1;
+        }
+        strncpy(the_config->destination, argv[optind], sizeof(the_config->destination) - 1);
+        the_config->destination[sizeof(the_config->destination) - 1] = '\0';
+        return 0;
+    }
+
     // Vérifier si les dossiers source et destination sont spécifiés
     if (argc - optind < 2) {
         fprintf(stderr, "Source and destination directories are required.\n");
@@ -99,5 +518,85 @@ int set_configuration(configuration_t *the_config, int argc, char *argv[]) {
     strncpy(the_config->destination, argv[optind + 1], sizeof(the_config->destination) - 1);
     the_config->destination[sizeof(the_config->destination) - 1] = '\0';
 
+    // Les destinations supplémentaires reçoivent les mêmes lectures de la source
+    if (argc - optind - 2 > MAX_DESTINATIONS - 1) {
+        fprintf(stderr, "At most %d destination directories are supported.\n", MAX_DESTINATIONS);
+        return -1;
+    }
+    for (int i = optind + 2; i < argc; ++i) {
+        char *extra = the_config->extra_destinations[the_config->extra_destinations_count++];
+        strncpy(extra, argv[i], sizeof(the_config->extra_destinations[0]) - 1);
+        extra[sizeof(the_config->extra_destinations[0]) - 1] = '\0';
+    }
+    if (the_config->extra_destinations_count > 0) {
+        const char *unsupported = (the_config->compression != COMPRESSION_NONE) ? "--compress" :
+                                  (the_config->pack_threshold > 0) ? "--pack" :
+                                  (the_config->durability != DURABILITY_NONE) ? "--durable" :
+                                  (the_config->link_dest[0] != '\0') ? "--link-dest" :
+                                  the_config->uses_reflink ? "--reflink" : NULL;
+        if (unsupported != NULL) {
+            fprintf(stderr, "%s is not supported with several destination directories.\n", unsupported);
+            return -1;
+        }
+    }
+
+    // Une restauration lit une seule sauvegarde locale, et écrit son arborescence d'origine
+    if (the_config->uses_restore) {
+        const char *unsupported = (the_config->extra_destinations_count > 0) ? "Another destination" :
+                                  is_remote_address(the_config->destination) ? "A remote destination" :
+                                  (the_config->compression != COMPRESSION_NONE) ? "--compress" :
+                                  (the_config->pack_threshold > 0) ? "--pack" :
+                                  (the_config->durability != DURABILITY_NONE) ? "--durable" :
+                                  (the_config->dedup_mode != DEDUP_NONE) ? "--dedup" :
+                                  (the_config->link_dest[0] != '\0') ? "--link-dest" :
+                                  the_config->uses_delete ? "--delete" :
+                                  the_config->uses_resume ? "--resume" :
+                                  the_config->uses_dry_run ? "--dry-run" : NULL;
+        if (unsupported != NULL) {
+            fprintf(stderr, "%s is not supported with --restore.\n", unsupported);
+            return -1;
+        }
+        return 0;
+    }
+
+    // Une destination distante est écrite par son récepteur, à partir des commandes du processus principal
+    if (is_remote_address(the_config->destination)) {
+        const char *unsupported = (the_config->extra_destinations_count > 0) ? "Another destination" :
+                                  (the_config->compression != COMPRESSION_NONE) ? "--compress" :
+                                  (the_config->pack_threshold > 0) ? "--pack" :
+                                  (the_config->durability != DURABILITY_NONE) ? "--durable" :
+                                  (the_config->dedup_mode != DEDUP_NONE) ? "--dedup" :
+                                  (the_config->link_dest[0] != '\0') ? "--link-dest" :
+                                  the_config->uses_reflink ? "--reflink" :
+                                  the_config->uses_resume ? "--resume" : NULL;
+        if (unsupported != NULL) {
+            fprintf(stderr, "%s is not supported with a remote destination.\n", unsupported);
+            return -1;
+        }
+        the_config->copiers_count = 0;
+    } else if (the_config->uses_delta) {
+        fprintf(stderr, "--delta only applies to a remote destination, it is ignored\n");
+        the_config->uses_delta = false;
+    }
+
     return 0;
 }
+
+/*!
+ * @brief get_destinations_count gives the number of destination directories of a run
+ * @param the_config is a pointer to the configuration
+ * @return the number of destinations, at least 1
+ */
+int get_destinations_count(configuration_t *the_config) {
+    return 1 + the_config->extra_destinations_count;
+}
+
+/*!
+ * @brief get_destination gives a destination directory
+ * @param the_config is a pointer to the configuration
+ * @param index is the index of the destination, 0 for the first one (the_config->destination)
+ * @return the path of the destination
+ */
+char *get_destination(configuration_t *the_config, int index) {
+    return (index == 0) ? the_config->destination : the_config->extra_destinations[index - 1];
+}
@@ -2,16 +2,69 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include "defines.h"
+
+typedef enum {DEDUP_NONE, DEDUP_LINK, DEDUP_REFLINK} dedup_mode_t;
+
+typedef enum {IO_CLASS_DEFAULT, IO_CLASS_BEST_EFFORT, IO_CLASS_IDLE} io_class_t;
+
+typedef enum {COMPRESSION_NONE, COMPRESSION_ZLIB, COMPRESSION_ZSTD} compression_t;
+
+// Destinations of a run: the first one, and the extra ones given after it on the command line
+#define MAX_DESTINATIONS 8
+
+typedef enum {DURABILITY_NONE, DURABILITY_FSYNC, DURABILITY_FDATASYNC, DURABILITY_SYNCFS} durability_t;
 
 typedef struct {
     char source[1024];
     char destination[1024];
+    char extra_destinations[MAX_DESTINATIONS - 1][1024]; // Written from the same reads of the source (@see fanout.c)
+    int extra_destinations_count;
+    char serve_address[1024]; // Address on which the destination is served to remote clients (@see receiver.c), empty for a normal run
+    bool uses_delta; // Send only the modified blocks of the files of a remote destination (@see remote.c)
+    bool uses_restore; // Rebuild the tree backed up in source into destination (@see restore.c)
     uint8_t processes_count;
     bool is_parallel;
     bool uses_md5;
     bool uses_verbose;
     bool uses_dry_run;
+    char plan_file[1024]; // Actions planned by a dry run, with the estimated time of the run (@see plan.c), empty for none
+    bool measures_throughput; // Record the throughput of the run, to estimate the time of the next ones (@see plan.c)
+    bool is_adaptive;
+    uint8_t max_source_analyzers;
+    uint8_t max_destination_analyzers;
+    char source_cpus[256]; // CPUs of the source lister and analyzers, such as 0-7,16-23 (@see affinity.c), empty for the default
+    char destination_cpus[256]; // CPUs of the destination listers and analyzers
+    bool uses_affinity; // Spread the source and destination workers on two NUMA nodes when there are several
+    uint8_t copiers_count; // Copy workers processes (parallel mode only), 0 to copy in the main process
+    bool uses_reflink; // Clone the data of the files (FICLONE) when the filesystems allow it
+    dedup_mode_t dedup_mode; // How files with the same content as an already copied file are created
+    compression_t compression; // Codec of the destination files (@see compress.c)
+    int compression_level; // 0 for the default level of the codec
+    uint8_t compression_threads; // Threads compressing the frames of a file, 0 for one per CPU
+    durability_t durability; // How the copies are made crash-safe (@see durability.c)
+    char link_dest[PATH_SIZE]; // Previous snapshot whose unchanged files are linked instead of copied, empty for none
+    bool uses_delete; // Delete the destination entries missing from the source (@see delete.c)
+    bool uses_resume; // Continue the interrupted run recorded by the checkpoint (@see checkpoint.c)
+    char resume_cursor[PATH_SIZE]; // Relative path up to which the entries were handled, empty for a full run
+    char **filter_rules; // "- pattern", "+ pattern" or ". rules file", in the order of the command line (@see filters.c)
+    size_t filter_rules_count;
+    uint64_t memory_limit; // Bytes of the listed entries kept in memory by each process, 0 when unlimited (@see spill.c)
+    uint64_t pack_threshold; // Files smaller than this are stored in the pack store (@see pack-store.c), 0 for none
+    char stats_file[1024];
+    char trace_file[1024]; // Chrome trace of the events of all the processes (@see trace.c), empty for none
+    bool is_cache_polite;
+    uint64_t read_bandwidth; // Bytes per second for all the processes, 0 when unlimited
+    uint64_t write_bandwidth;
+    uint32_t read_iops; // Operations per second for all the processes, 0 when unlimited
+    uint32_t write_iops;
+    io_class_t io_class;
+    uint8_t io_level; // Level in the best-effort class, from 0 (highest) to 7
+    int nice_level;
 } configuration_t;
 
 void init_configuration(configuration_t *the_config);
-int set_configuration(configuration_t *the_config, int argc, char *argv[]);
\ No newline at end of file
+int set_configuration(configuration_t *the_config, int argc, char *argv[]);
+int get_destinations_count(configuration_t *the_config);
+char *get_destination(configuration_t *the_config, int index);
\ No newline at end of file
@@ -1,3 +1,6 @@
 #pragma once
 
-#define PATH_SIZE 4096
\ No newline at end of file
+#define PATH_SIZE 4096
+#define IO_BLOCK_SIZE 262144
+// Names of the entries holding the state of lp25 in a destination (@see pack-store.h), never listed
+#define RESERVED_NAME_PREFIX ".lp25-"
@@ -0,0 +1,328 @@
+#define _GNU_SOURCE
+#include "delete.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "defines.h"
+
+/*
+ * The extraneous entries of the destination are deleted by a pool of threads of the main process,
+ * while the comparison goes on. The main process queues the entries by batches of the same
+ * directory. A task deletes the entries of one directory relative to its fd (unlinkat); each
+ * sub-directory to remove becomes a task of its own, so a large subtree is spread over the
+ * threads. The type of the entries comes from readdir (d_type), so the deleted entries are not
+ * stat'ed. A directory is removed (AT_REMOVEDIR) by the last of its sub-directory tasks, bottom-up.
+ * The tasks are taken in LIFO order, depth first, which bounds the directories kept open.
+ */
+
+typedef struct delete_task {
+    struct delete_task *next; // Next task of the stack
+    struct delete_task *parent; // Directory task holding this one (NULL for a batch)
+    char *path; // Directory of a batch, or name of a sub-directory in its parent
+    bool is_batch; // A batch deletes some entries of a directory kept in place
+    char **names; // Entries of a batch
+    bool *is_directory;
+    size_t names_count;
+    int fd; // Directory, open until its sub-directories are removed
+    size_t pending; // Sub-directories not removed yet, plus one while the directory is read
+} delete_task_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t has_work;
+    pthread_cond_t is_idle;
+    pthread_t threads[DELETE_THREADS];
+    int threads_count;
+    delete_task_t *stack;
+    size_t tasks_count; // Tasks not finished, queued or not
+    bool is_stopping;
+    delete_task_t *batch; // Batch being filled by the main process
+    uint64_t deleted; // Entries deleted
+} delete_pool_t;
+
+static delete_pool_t pool = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER,
+                             {0}, 0, NULL, 0, false, NULL, 0};
+
+/*!
+ * @brief push_task queues a task (the lock must be held)
+ */
+static void push_task(delete_task_t *task) {
+    task->next = pool.stack;
+    pool.stack = task;
+    ++pool.tasks_count;
+    pthread_cond_signal(&pool.has_work);
+}
+
+/*!
+ * @brief free_task releases a task
+ */
+static void free_task(delete_task_t *task) {
+    for (size_t i = 0; i < task->names_count; ++i) {
+        free(task->names[i]);
+    }
+    free(task->names);
+    free(task->is_directory);
+    free(task->path);
+    free(task);
+}
+
+/*!
+ * @brief finish_task closes a directory whose content is deleted, removes it, and finishes its
+ * parent if it was its last pending sub-directory
+ * @param task is the task
+ */
+static void finish_task(delete_task_t *task) {
+    while (task != NULL) {
+        if (task->fd != -1) {
+            close(task->fd);
+        }
+        // The directory is removed once empty, relative to its parent (still open)
+        delete_task_t *parent = task->parent;
+        if (parent != NULL && task->fd != -1) {
+            if (unlinkat(parent->fd, task->path, AT_REMOVEDIR) == 0) {
+                __atomic_fetch_add(&pool.deleted, 1, __ATOMIC_RELAXED);
+            } else if (errno != ENOENT) {
+                printf("Cannot remove the directory %s: %s\n", task->path, strerror(errno));
+            }
+        }
+        free_task(task);
+
+        bool is_parent_done = false;
+        pthread_mutex_lock(&pool.lock);
+        --pool.tasks_count;
+        if (parent != NULL) {
+            is_parent_done = (--parent->pending == 0);
+        }
+        if (pool.tasks_count == 0) {
+            pthread_cond_broadcast(&pool.is_idle);
+        }
+        pthread_mutex_unlock(&pool.lock);
+        task = is_parent_done ? parent : NULL;
+    }
+}
+
+/*!
+ * @brief spawn_subtree queues the removal of a sub-directory and of its content
+ * @param parent is the task of the directory holding it
+ * @param name is the name of the sub-directory
+ */
+static void spawn_subtree(delete_task_t *parent, const char *name) {
+    delete_task_t *child = calloc(1, sizeof(delete_task_t));
+    if (child == NULL || (child->path = strdup(name)) == NULL) {
+        printf("Error when allocating memory in the function spawn_subtree of the file delete.c\n");
+        free(child);
+        return;
+    }
+    child->parent = parent;
+    child->fd = -1;
+    child->pending = 1;
+    pthread_mutex_lock(&pool.lock);
+    ++parent->pending;
+    push_task(child);
+    pthread_mutex_unlock(&pool.lock);
+}
+
+/*!
+ * @brief delete_entry deletes an entry of a directory, or queues its removal if it is a directory
+ * @param task is the task of the directory
+ * @param name is the name of the entry
+ * @param is_directory is true if the entry is known to be a directory
+ */
+static void delete_entry(delete_task_t *task, const char *name, bool is_directory) {
+    if (is_directory) {
+        spawn_subtree(task, name);
+    } else if (unlinkat(task->fd, name, 0) == 0) {
+        __atomic_fetch_add(&pool.deleted, 1, __ATOMIC_RELAXED);
+    } else if (errno == EISDIR || errno == EPERM) {
+        // The entry became a directory since it was listed
+        spawn_subtree(task, name);
+    } else if (errno != ENOENT) {
+        printf("Cannot delete %s: %s\n", name, strerror(errno));
+    }
+}
+
+/*!
+ * @brief run_task deletes the content of a directory (all of it, or the entries of a batch)
+ * @param task is the task
+ */
+static void run_task(delete_task_t *task) {
+    task->fd = (task->parent == NULL) ? open(task->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC) :
+               openat(task->parent->fd, task->path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (task->fd == -1 && task->parent != NULL && (errno == ENOTDIR || errno == ELOOP)) {
+        // A symbolic link to a directory (listed as a directory) is removed itself
+        delete_entry(task->parent, task->path, false);
+    } else if (task->fd == -1) {
+        printf("Cannot open the directory %s: %s\n", task->path, strerror(errno));
+    } else if (task->is_batch) {
+        for (size_t i = 0; i < task->names_count; ++i) {
+            delete_entry(task, task->names[i], task->is_directory[i]);
+        }
+    } else {
+        // The directory stream gets its own fd: the task keeps its fd for the removal of its sub-directories
+        int dir_fd = dup(task->fd);
+        DIR *dir = (dir_fd == -1) ? NULL : fdopendir(dir_fd);
+        if (dir == NULL) {
+            printf("Cannot read the directory %s: %s\n", task->path, strerror(errno));
+            if (dir_fd != -1) {
+                close(dir_fd);
+            }
+        } else {
+            struct dirent *entry;
+            while ((entry = readdir(dir)) != NULL) {
+                if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+                    continue;
+                }
+                bool is_directory = (entry->d_type == DT_DIR);
+                struct stat entry_stat;
+                if (entry->d_type == DT_UNKNOWN && fstatat(task->fd, entry->d_name, &entry_stat, AT_SYMLINK_NOFOLLOW) == 0) {
+                    is_directory = S_ISDIR(entry_stat.st_mode);
+                }
+                delete_entry(task, entry->d_name, is_directory);
+            }
+            closedir(dir);
+        }
+    }
+
+    // The task no longer reads its directory
+    pthread_mutex_lock(&pool.lock);
+    bool is_done = (--task->pending == 0);
+    pthread_mutex_unlock(&pool.lock);
+    if (is_done) {
+        finish_task(task);
+    }
+}
+
+/*!
+ * @brief delete_thread is the function of the threads of the pool
+ */
+static void *delete_thread(void *parameters) {
+    (void) parameters;
+    while (true) {
+        pthread_mutex_lock(&pool.lock);
+        while (pool.stack == NULL && !pool.is_stopping) {
+            pthread_cond_wait(&pool.has_work, &pool.lock);
+        }
+        delete_task_t *task = pool.stack;
+        if (task != NULL) {
+            pool.stack = task->next;
+        }
+        pthread_mutex_unlock(&pool.lock);
+        if (task == NULL) {
+            return NULL;
+        }
+        run_task(task);
+    }
+}
+
+/*!
+ * @brief submit_batch queues the batch being filled, and starts the threads at the first batch
+ * @return 0 in case of success, -1 else
+ */
+static int submit_batch(void) {
+    if (pool.batch == NULL) {
+        return 0;
+    }
+    while (pool.threads_count < DELETE_THREADS &&
+           pthread_create(&pool.threads[pool.threads_count], NULL, delete_thread, NULL) == 0) {
+        ++pool.threads_count;
+    }
+    if (pool.threads_count == 0) {
+        printf("Cannot start the deletion threads\n");
+        free_task(pool.batch);
+        pool.batch = NULL;
+        return -1;
+    }
+    pthread_mutex_lock(&pool.lock);
+    push_task(pool.batch);
+    pthread_mutex_unlock(&pool.lock);
+    pool.batch = NULL;
+    return 0;
+}
+
+/*!
+ * @brief queue_deletion queues the deletion of a destination entry (with all its content for a directory)
+ * The entries are deleted asynchronously, by batches of the same directory (@see wait_deletions).
+ * @param path is the path of the entry
+ * @param is_directory is true if the entry is a directory
+ * @return 0 in case of success, -1 else
+ */
+int queue_deletion(char *path, bool is_directory) {
+    char *slash = strrchr(path, '/');
+    if (slash == NULL || slash[1] == '\0') {
+        return -1;
+    }
+    size_t directory_length = (slash == path) ? 1 : (size_t) (slash - path);
+    if (pool.batch != NULL && (pool.batch->names_count == DELETE_BATCH_SIZE || strlen(pool.batch->path) != directory_length ||
+                               strncmp(pool.batch->path, path, directory_length) != 0)) {
+        if (submit_batch() == -1) {
+            return -1;
+        }
+    }
+    if (pool.batch == NULL) {
+        delete_task_t *batch = calloc(1, sizeof(delete_task_t));
+        if (batch != NULL) {
+            batch->path = strndup(path, directory_length);
+            batch->names = malloc(DELETE_BATCH_SIZE * sizeof(char *));
+            batch->is_directory = malloc(DELETE_BATCH_SIZE * sizeof(bool));
+        }
+        if (batch == NULL || batch->path == NULL || batch->names == NULL || batch->is_directory == NULL) {
+            printf("Error when allocating memory in the function queue_deletion of the file delete.c\n");
+            if (batch != NULL) {
+                free_task(batch);
+            }
+            return -1;
+        }
+        batch->is_batch = true;
+        batch->fd = -1;
+        batch->pending = 1;
+        pool.batch = batch;
+    }
+    if ((pool.batch->names[pool.batch->names_count] = strdup(slash + 1)) == NULL) {
+        return -1;
+    }
+    pool.batch->is_directory[pool.batch->names_count++] = is_directory;
+    return 0;
+}
+
+/*!
+ * @brief wait_deletions waits until all the queued entries are deleted
+ * @return 0 in case of success, -1 else
+ */
+int wait_deletions(void) {
+    int result = submit_batch();
+    pthread_mutex_lock(&pool.lock);
+    while (pool.tasks_count > 0) {
+        pthread_cond_wait(&pool.is_idle, &pool.lock);
+    }
+    pthread_mutex_unlock(&pool.lock);
+    return result;
+}
+
+/*!
+ * @brief clean_deletions waits for the queued deletions, then stops the threads
+ */
+void clean_deletions(void) {
+    wait_deletions();
+    pthread_mutex_lock(&pool.lock);
+    pool.is_stopping = true;
+    pthread_cond_broadcast(&pool.has_work);
+    pthread_mutex_unlock(&pool.lock);
+    for (int i = 0; i < pool.threads_count; ++i) {
+        pthread_join(pool.threads[i], NULL);
+    }
+    pool.threads_count = 0;
+    pool.is_stopping = false;
+}
+
+/*!
+ * @brief get_deleted_count gives the number of entries deleted so far
+ */
+uint64_t get_deleted_count(void) {
+    return __atomic_load_n(&pool.deleted, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Threads deleting the extraneous entries of the destination (--delete)
+#define DELETE_THREADS 8
+// Entries of the same directory deleted by one task
+#define DELETE_BATCH_SIZE 256
+
+int queue_deletion(char *path, bool is_directory);
+int wait_deletions(void);
+void clean_deletions(void);
+uint64_t get_deleted_count(void);
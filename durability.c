@@ -0,0 +1,441 @@
+#define _GNU_SOURCE
+#include "durability.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <time.h>
+#include "utility.h"
+
+/*
+ * In the durable modes, a file is written under a temporary name in its destination directory, then
+ * renamed over its final name, so a crash never leaves a half-written file under a final name.
+ * The renames are grouped by batches: the data of a batch is made durable with a single syncfs, or
+ * with one fdatasync per file, before its files are renamed, then the directory is synced once.
+ * A batch holds the files of a single directory: it is committed when the next file goes to another
+ * directory, or when it reaches DURABLE_BATCH_FILES files or DURABLE_BATCH_BYTES bytes. The fsync
+ * mode commits every file on its own, for comparison.
+ * Each process (main process, copy workers) has its own batch. They all append to the journal:
+ *     run <time>              a run starts
+ *     batch <directory>       a process starts writing temporary files in this directory
+ *     commit <count> <path>   a batch was made durable (path of its last file)
+ *     complete                the run ended normally
+ * The journal is removed once the run is complete. When a run is interrupted, the next one removes
+ * the temporary files left in the directories of its batches.
+ */
+
+typedef struct {
+    char *temporary_name; // Name of the written file, in the directory of the batch
+    char *dest_path;
+} durable_file_t;
+
+typedef struct {
+    durability_t mode;
+    char root[PATH_SIZE];
+    int root_fd; // Destination root, for syncfs
+    int journal_fd;
+    char directory[PATH_SIZE]; // Directory of the current batch (empty if none)
+    int directory_fd;
+    bool is_directory_dirty; // Set when entries of the directory were created since its last sync
+    durable_file_t files[DURABLE_BATCH_FILES];
+    size_t files_count;
+    uint64_t bytes;
+    uint64_t temporary_counter;
+} durability_state_t;
+
+static durability_state_t durability = {.mode = DURABILITY_NONE, .root_fd = -1, .journal_fd = -1, .directory_fd = -1};
+
+/*!
+ * @brief write_journal appends a line to the journal
+ * Each line is written by a single write on a file opened with O_APPEND, so the lines of the
+ * processes are not mixed.
+ * @param format is the printf format of the line
+ */
+static void write_journal(const char *format, ...) {
+    if (durability.journal_fd == -1) {
+        return;
+    }
+    char line[PATH_SIZE + 64];
+    va_list arguments;
+    va_start(arguments, format);
+    int length = vsnprintf(line, sizeof(line), format, arguments);
+    va_end(arguments);
+    if (length > 0 && (size_t) length < sizeof(line)) {
+        while (write(durability.journal_fd, line, (size_t) length) == -1 && errno == EINTR);
+    }
+}
+
+/*!
+ * @brief last_component gives the name of the last component of a path
+ */
+static char *last_component(char *path) {
+    char *slash = strrchr(path, '/');
+    return (slash == NULL) ? path : slash + 1;
+}
+
+/*!
+ * @brief remove_temporary_files removes the temporary files left in a directory by an interrupted run
+ * @param directory is the path of the directory
+ * @return the number of files removed
+ */
+static int remove_temporary_files(char *directory) {
+    int dir_fd = open(directory, O_RDONLY | O_DIRECTORY);
+    DIR *dir = (dir_fd == -1) ? NULL : fdopendir(dir_fd);
+    if (dir == NULL) {
+        if (dir_fd != -1) {
+            close(dir_fd);
+        }
+        return 0;
+    }
+    int removed = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strncmp(entry->d_name, TEMPORARY_PREFIX, strlen(TEMPORARY_PREFIX)) == 0 &&
+            unlinkat(dirfd(dir), entry->d_name, 0) == 0) {
+            ++removed;
+        }
+    }
+    closedir(dir);
+    return removed;
+}
+
+/*!
+ * @brief recover_journal cleans up after the run recorded in the journal, if it was interrupted
+ * @param journal_path is the path of the journal
+ */
+static void recover_journal(char *journal_path) {
+    FILE *journal = fopen(journal_path, "r");
+    if (journal == NULL) {
+        return;
+    }
+
+    // The directories of the batches are kept until the end of the journal tells if the run completed
+    char line[PATH_SIZE + 64];
+    char **directories = NULL;
+    size_t directories_count = 0, directories_capacity = 0;
+    bool is_complete = true;
+    while (fgets(line, sizeof(line), journal) != NULL) {
+        line[strcspn(line, "\n")] = '\0';
+        if (strncmp(line, "run ", 4) == 0) {
+            is_complete = false;
+        } else if (strcmp(line, "complete") == 0) {
+            is_complete = true;
+        } else if (strncmp(line, "batch ", 6) == 0) {
+            if (directories_count == directories_capacity) {
+                size_t new_capacity = (directories_capacity == 0) ? 64 : directories_capacity * 2;
+                char **new_directories = realloc(directories, new_capacity * sizeof(char *));
+                if (new_directories == NULL) {
+                    break;
+                }
+                directories = new_directories;
+                directories_capacity = new_capacity;
+            }
+            if ((directories[directories_count] = strdup(line + 6)) != NULL) {
+                ++directories_count;
+            }
+        }
+    }
+    fclose(journal);
+
+    int removed = 0;
+    for (size_t i = 0; i < directories_count; ++i) {
+        char directory[PATH_SIZE];
+        if (!is_complete && concat_path(directory, durability.root, directories[i]) != NULL) {
+            removed += remove_temporary_files(directory);
+        }
+        free(directories[i]);
+    }
+    free(directories);
+    if (!is_complete) {
+        printf("The previous run was interrupted, %d temporary files were removed\n", removed);
+        fflush(stdout); // Before the processes are forked
+    }
+}
+
+/*!
+ * @brief init_durability prepares the durable mode of the configuration, before the processes are forked
+ * It cleans up after an interrupted run, and starts a new journal.
+ * @param the_config is a pointer to the configuration
+ * @return 0 in case of success, -1 else
+ */
+int init_durability(configuration_t *the_config) {
+    if (the_config->durability == DURABILITY_NONE || the_config->uses_dry_run) {
+        return 0;
+    }
+    char journal_path[PATH_SIZE];
+    snprintf(durability.root, sizeof(durability.root), "%s", the_config->destination);
+    if (concat_path(journal_path, the_config->destination, JOURNAL_NAME) == NULL) {
+        printf("The path of the journal of %s is too long\n", the_config->destination);
+        return -1;
+    }
+    durability.root_fd = open(durability.root, O_RDONLY | O_DIRECTORY);
+    if (durability.root_fd == -1) {
+        perror("Cannot open the destination");
+        return -1;
+    }
+
+    recover_journal(journal_path);
+    durability.journal_fd = open(journal_path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if (durability.journal_fd == -1) {
+        perror("Cannot create the journal");
+        close(durability.root_fd);
+        durability.root_fd = -1;
+        return -1;
+    }
+    durability.mode = the_config->durability;
+    write_journal("run %ld\n", (long) time(NULL));
+    return 0;
+}
+
+/*!
+ * @brief is_durability_enabled tells if the files are written under a temporary name then committed
+ * @return true in the durable modes
+ */
+bool is_durability_enabled(void) {
+    return durability.mode != DURABILITY_NONE;
+}
+
+/*!
+ * @brief enter_directory makes a directory the directory of the current batch
+ * The batch of the previous directory is committed first.
+ * @param directory is the path of the directory
+ * @return 0 in case of success, -1 else
+ */
+static int enter_directory(char *directory) {
+    if (durability.directory_fd != -1 && strcmp(directory, durability.directory) == 0) {
+        return 0;
+    }
+    int result = flush_durable_batch();
+    if (durability.directory_fd != -1) {
+        close(durability.directory_fd);
+    }
+    durability.directory_fd = open(directory, O_RDONLY | O_DIRECTORY);
+    if (durability.directory_fd == -1) {
+        durability.directory[0] = '\0';
+        return -1;
+    }
+    snprintf(durability.directory, sizeof(durability.directory), "%s", directory);
+    // The temporary files of the batches can be found back from the journal
+    write_journal("batch %s\n", relative_path(durability.directory, durability.root));
+    return result;
+}
+
+/*!
+ * @brief parent_directory copies the directory part of a path
+ * @param result is the buffer (PATH_SIZE bytes) receiving the directory
+ * @param path is the path
+ */
+static void parent_directory(char *result, char *path) {
+    char *slash = strrchr(path, '/');
+    if (slash == NULL) {
+        strcpy(result, ".");
+        return;
+    }
+    // The parent of /name is /
+    size_t length = (slash == path) ? 1 : (size_t) (slash - path);
+    memcpy(result, path, length);
+    result[length] = '\0';
+}
+
+/*!
+ * @brief begin_durable_file gives the path a destination file must be written to
+ * @param dest_path is the final path of the file
+ * @param write_path is the buffer (PATH_SIZE bytes) receiving the path to write: a temporary name in the
+ * same directory in the durable modes, dest_path else
+ * @return 0 in case of success, -1 else
+ */
+int begin_durable_file(char *dest_path, char *write_path) {
+    if (durability.mode == DURABILITY_NONE) {
+        snprintf(write_path, PATH_SIZE, "%s", dest_path);
+        return 0;
+    }
+
+    char directory[PATH_SIZE];
+    parent_directory(directory, dest_path);
+    if (enter_directory(directory) == -1) {
+        return -1;
+    }
+    if ((durability.files_count == DURABLE_BATCH_FILES || durability.bytes >= DURABLE_BATCH_BYTES) &&
+        flush_durable_batch() == -1) {
+        return -1;
+    }
+    char name[64];
+    snprintf(name, sizeof(name), "%s%d-%lu", TEMPORARY_PREFIX, (int) getpid(), (unsigned long) ++durability.temporary_counter);
+    return (concat_path(write_path, directory, name) == NULL) ? -1 : 0;
+}
+
+/*!
+ * @brief commit_durable_file adds a written file to the current batch (@see begin_durable_file)
+ * In the fsync mode, the file is committed right away.
+ * @param write_path is the path the file was written to
+ * @param dest_path is the final path of the file
+ * @param size is the number of bytes written
+ * @param is_complete is false when the copy failed: the temporary file is removed
+ * @return 0 in case of success, -1 else
+ */
+int commit_durable_file(char *write_path, char *dest_path, uint64_t size, bool is_complete) {
+    if (durability.mode == DURABILITY_NONE) {
+        return 0;
+    }
+    if (!is_complete) {
+        unlink(write_path);
+        return 0;
+    }
+
+    durable_file_t *file = &durability.files[durability.files_count];
+    file->temporary_name = strdup(last_component(write_path));
+    file->dest_path = strdup(dest_path);
+    if (file->temporary_name == NULL || file->dest_path == NULL) {
+        printf("Error when allocating memory in the function commit_durable_file of the file durability.c\n");
+        free(file->temporary_name);
+        free(file->dest_path);
+        unlink(write_path);
+        return -1;
+    }
+    ++durability.files_count;
+    durability.bytes += size;
+    if (durability.mode == DURABILITY_FSYNC || durability.files_count == DURABLE_BATCH_FILES ||
+        durability.bytes >= DURABLE_BATCH_BYTES) {
+        return flush_durable_batch();
+    }
+    return 0;
+}
+
+/*!
+ * @brief commit_durable_directory records a created directory: its parent directory is synced with
+ * the next batch of this parent
+ * @param dest_path is the path of the directory
+ * @return 0 in case of success, -1 else
+ */
+int commit_durable_directory(char *dest_path) {
+    if (durability.mode == DURABILITY_NONE) {
+        return 0;
+    }
+    char directory[PATH_SIZE];
+    parent_directory(directory, dest_path);
+    if (enter_directory(directory) == -1) {
+        return -1;
+    }
+    durability.is_directory_dirty = true;
+    return (durability.mode == DURABILITY_FSYNC) ? flush_durable_batch() : 0;
+}
+
+/*!
+ * @brief is_durable_file_pending tells if a file is written but not committed yet by this process
+ * (e.g. before it is linked to)
+ * @param dest_path is the final path of the file
+ * @return true if the file is in the current batch
+ */
+bool is_durable_file_pending(char *dest_path) {
+    for (size_t i = 0; i < durability.files_count; ++i) {
+        if (strcmp(durability.files[i].dest_path, dest_path) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*!
+ * @brief sync_batch_data makes the data of the files of the current batch durable
+ * @return 0 in case of success, -1 else
+ */
+static int sync_batch_data(void) {
+    if (durability.mode == DURABILITY_SYNCFS) {
+        return syncfs(durability.root_fd);
+    }
+    int result = 0;
+    for (size_t i = 0; i < durability.files_count; ++i) {
+        int fd = openat(durability.directory_fd, durability.files[i].temporary_name, O_RDONLY);
+        if (fd == -1 || ((durability.mode == DURABILITY_FSYNC) ? fsync(fd) : fdatasync(fd)) == -1) {
+            result = -1;
+        }
+        if (fd != -1) {
+            close(fd);
+        }
+    }
+    return result;
+}
+
+/*!
+ * @brief flush_durable_batch commits the current batch: its data is synced, its files are renamed into
+ * place, then its directory is synced
+ * @return 0 in case of success, -1 else (the files of the batch are then removed)
+ */
+int flush_durable_batch(void) {
+    if (durability.mode == DURABILITY_NONE || durability.directory_fd == -1 ||
+        (durability.files_count == 0 && !durability.is_directory_dirty)) {
+        return 0;
+    }
+
+    int result = 0;
+    if (durability.files_count > 0 && sync_batch_data() == -1) {
+        perror("Cannot sync the copied files");
+        result = -1;
+    }
+    for (size_t i = 0; i < durability.files_count; ++i) {
+        durable_file_t *file = &durability.files[i];
+        if (result == 0) {
+            char *name = last_component(file->dest_path);
+            int renamed = renameat2(durability.directory_fd, file->temporary_name, durability.directory_fd, name, 0);
+            if (renamed == -1 && (errno == ENOSYS || errno == EINVAL)) {
+                renamed = renameat(durability.directory_fd, file->temporary_name, durability.directory_fd, name);
+            }
+            if (renamed == -1) {
+                perror("Cannot rename a copied file");
+                result = -1;
+            }
+        }
+        if (result == -1) {
+            unlinkat(durability.directory_fd, file->temporary_name, 0);
+        }
+    }
+    if (fsync(durability.directory_fd) == -1) {
+        perror("Cannot sync a destination directory");
+        result = -1;
+    }
+
+    if (result == 0 && durability.files_count > 0) {
+        write_journal("commit %lu %s\n", (unsigned long) durability.files_count,
+                      relative_path(durability.files[durability.files_count - 1].dest_path, durability.root));
+    }
+    for (size_t i = 0; i < durability.files_count; ++i) {
+        free(durability.files[i].temporary_name);
+        free(durability.files[i].dest_path);
+    }
+    durability.files_count = 0;
+    durability.bytes = 0;
+    durability.is_directory_dirty = false;
+    return result;
+}
+
+/*!
+ * @brief clean_durability commits the last batch of the process and releases the durable mode
+ * @param is_complete is true when the run ended normally (main process): the journal records it, then is removed
+ */
+void clean_durability(bool is_complete) {
+    if (durability.mode == DURABILITY_NONE) {
+        return;
+    }
+    flush_durable_batch();
+    if (is_complete) {
+        // The journal is complete before it is removed: a lost unlink still leaves nothing to recover
+        write_journal("complete\n");
+        fsync(durability.journal_fd);
+        if (unlinkat(durability.root_fd, JOURNAL_NAME, 0) == -1 && errno != ENOENT) {
+            perror("Cannot remove the journal");
+        }
+    }
+    if (durability.directory_fd != -1) {
+        close(durability.directory_fd);
+        durability.directory_fd = -1;
+    }
+    close(durability.journal_fd);
+    close(durability.root_fd);
+    durability.journal_fd = -1;
+    durability.root_fd = -1;
+    durability.mode = DURABILITY_NONE;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "configuration.h"
+#include "defines.h"
+
+// Journal of the durable copies, in the destination root (@see RESERVED_NAME_PREFIX)
+#define JOURNAL_NAME ".lp25-journal"
+// Files are written under a temporary name starting with this prefix, then renamed into place
+#define TEMPORARY_PREFIX ".lp25-tmp-"
+// A batch of durable files is committed when it reaches one of these limits, or changes directory
+#define DURABLE_BATCH_FILES 256
+#define DURABLE_BATCH_BYTES (64ULL * 1024 * 1024)
+
+int init_durability(configuration_t *the_config);
+bool is_durability_enabled(void);
+int begin_durable_file(char *dest_path, char *write_path);
+int commit_durable_file(char *write_path, char *dest_path, uint64_t size, bool is_complete);
+int commit_durable_directory(char *dest_path);
+bool is_durable_file_pending(char *dest_path);
+int flush_durable_batch(void);
+void clean_durability(bool is_complete);
@@ -0,0 +1,447 @@
+#define _GNU_SOURCE
+#include "fanout.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "defines.h"
+#include "file-io.h"
+
+/*
+ * A file needed by several destinations is read once, and each destination has its own writer thread
+ * consuming the data at its own pace. The reads only wait for the slowest writer when its buffer is
+ * full, so a slow destination does not stall the faster ones beyond that buffer.
+ * By default, the data never reaches user space: the pages of the source are spliced into a pipe, then
+ * duplicated (tee) into one pipe per destination, which its writer splices into the destination file.
+ * Cache-polite, throttled and sparse copies go through the blocks of file-io.c instead, kept in a
+ * ring until all the writers wrote them.
+ * A small file, or a single destination, is written by the reading thread itself.
+ */
+
+typedef struct {
+    unsigned char *data; // IO_BLOCK_SIZE bytes, aligned for O_DIRECT
+    size_t size; // Bytes of data
+    uint64_t hole_size; // Hole before the data (sparse files)
+} fanout_block_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t changed; // Signaled when a block is read or written
+    fanout_block_t blocks[FANOUT_RING_BLOCKS];
+    int blocks_count; // Blocks allocated
+    uint64_t produced; // Blocks read so far
+    bool is_finished; // Set when the reader reached the end of the file (or failed)
+} fanout_ring_t;
+
+typedef struct {
+    fanout_ring_t *ring;
+    io_file_t file;
+    char *path;
+    uint64_t consumed; // Blocks written so far
+    bool is_open;
+    bool is_failed;
+    bool is_threaded; // Set when the writer has its own thread, else the reader writes for it
+} fanout_writer_t;
+
+/*!
+ * @brief write_block writes a block of the ring to a destination (a failed writer skips it)
+ * @param writer is a pointer to the writer
+ * @param block is a pointer to the block
+ */
+static void write_block(fanout_writer_t *writer, fanout_block_t *block) {
+    if (writer->is_failed) {
+        return;
+    }
+    if ((block->hole_size > 0 && skip_file_hole(&writer->file, block->hole_size) == -1) ||
+        (block->size > 0 && write_file_block(&writer->file, block->data, block->size) == -1)) {
+        perror(writer->path);
+        writer->is_failed = true;
+    }
+}
+
+/*!
+ * @brief writer_thread writes the blocks of the ring to one destination, as they are read
+ * @param parameters is a pointer to the fanout_writer_t of the destination
+ */
+static void *writer_thread(void *parameters) {
+    fanout_writer_t *writer = (fanout_writer_t *) parameters;
+    fanout_ring_t *ring = writer->ring;
+    while (true) {
+        pthread_mutex_lock(&ring->lock);
+        while (writer->consumed == ring->produced && !ring->is_finished) {
+            pthread_cond_wait(&ring->changed, &ring->lock);
+        }
+        if (writer->consumed == ring->produced) {
+            pthread_mutex_unlock(&ring->lock);
+            return NULL;
+        }
+        fanout_block_t *block = &ring->blocks[writer->consumed % (uint64_t) ring->blocks_count];
+        pthread_mutex_unlock(&ring->lock);
+
+        write_block(writer, block);
+
+        pthread_mutex_lock(&ring->lock);
+        ++writer->consumed;
+        pthread_cond_broadcast(&ring->changed);
+        pthread_mutex_unlock(&ring->lock);
+    }
+}
+
+/*!
+ * @brief slowest_writer gives the number of blocks written by the latest writer (the lock must be held)
+ */
+static uint64_t slowest_writer(fanout_writer_t *writers, int count) {
+    uint64_t slowest = UINT64_MAX;
+    for (int i = 0; i < count; ++i) {
+        if (writers[i].is_open && writers[i].consumed < slowest) {
+            slowest = writers[i].consumed;
+        }
+    }
+    return slowest;
+}
+
+/*!
+ * @brief fanout_by_blocks copies a file to several destinations through the readers and writers of
+ * file-io.c, keeping the holes of a sparse source
+ * @param source_entry is a pointer to the entry of the source file
+ * @param dest_paths are the paths of the destination files
+ * @param count is the number of destination files
+ * @return the number of bytes copied to each destination, -1 if the copy failed for one of them
+ */
+static int64_t fanout_by_blocks(files_list_entry_t *source_entry, char **dest_paths, int count) {
+    io_file_t reader;
+    if (open_file_reader(&reader, source_entry->path_and_name) == -1) {
+        perror("Cannot open source file");
+        return -1;
+    }
+
+    fanout_ring_t ring;
+    memset(&ring, 0, sizeof(fanout_ring_t));
+    pthread_mutex_init(&ring.lock, NULL);
+    pthread_cond_init(&ring.changed, NULL);
+    // A single block is enough when the reader writes it to every destination itself
+    bool is_threaded = (count > 1 && source_entry->size > IO_BLOCK_SIZE);
+    int blocks_count = 0;
+    bool is_failed = false;
+    for (; blocks_count < (is_threaded ? FANOUT_RING_BLOCKS : 1); ++blocks_count) {
+        if (posix_memalign((void **) &ring.blocks[blocks_count].data, DIRECT_IO_ALIGNMENT, IO_BLOCK_SIZE) != 0) {
+            printf("Error when allocating memory in the function fanout_copy of the file fanout.c\n");
+            is_failed = true;
+            break;
+        }
+    }
+    ring.blocks_count = blocks_count;
+
+    fanout_writer_t writers[MAX_DESTINATIONS];
+    memset(writers, 0, sizeof(writers));
+    pthread_t threads[MAX_DESTINATIONS];
+    for (int i = 0; i < count && !is_failed; ++i) {
+        writers[i].ring = &ring;
+        writers[i].path = dest_paths[i];
+        if (open_file_writer(&writers[i].file, dest_paths[i], source_entry->mode & 07777) == -1) {
+            perror("Cannot open destination file");
+            is_failed = true;
+            continue;
+        }
+        writers[i].is_open = true;
+        writers[i].is_threaded = is_threaded && pthread_create(&threads[i], NULL, writer_thread, &writers[i]) == 0;
+    }
+
+    // The reader waits for the slowest writer when the ring is full
+    uint64_t hole_size;
+    ssize_t bytes_read = 0;
+    while (!is_failed) {
+        pthread_mutex_lock(&ring.lock);
+        while (ring.produced - slowest_writer(writers, count) == (uint64_t) blocks_count) {
+            pthread_cond_wait(&ring.changed, &ring.lock);
+        }
+        pthread_mutex_unlock(&ring.lock);
+
+        if ((bytes_read = read_file_data(&reader, &hole_size)) < 0) {
+            perror("Cannot copy file");
+            is_failed = true;
+            break;
+        }
+        if (bytes_read == 0 && hole_size == 0) {
+            break;
+        }
+        fanout_block_t *block = &ring.blocks[ring.produced % (uint64_t) blocks_count];
+        memcpy(block->data, reader.buffer, (size_t) bytes_read);
+        block->size = (size_t) bytes_read;
+        block->hole_size = hole_size;
+        for (int i = 0; i < count; ++i) {
+            if (writers[i].is_open && !writers[i].is_threaded) {
+                write_block(&writers[i], block);
+                ++writers[i].consumed;
+            }
+        }
+        pthread_mutex_lock(&ring.lock);
+        ++ring.produced;
+        pthread_cond_broadcast(&ring.changed);
+        pthread_mutex_unlock(&ring.lock);
+        if (bytes_read == 0) {
+            break;
+        }
+    }
+
+    pthread_mutex_lock(&ring.lock);
+    ring.is_finished = true;
+    pthread_cond_broadcast(&ring.changed);
+    pthread_mutex_unlock(&ring.lock);
+
+    int64_t copied = 0;
+    for (int i = 0; i < count; ++i) {
+        if (!writers[i].is_open) {
+            continue;
+        }
+        if (writers[i].is_threaded) {
+            pthread_join(threads[i], NULL);
+        }
+        if (writers[i].is_failed || finish_file_writer(&writers[i].file) == -1) {
+            is_failed = true;
+        }
+        // Keep access modes and mtime
+        fchmod(writers[i].file.fd, source_entry->mode & 07777);
+        struct timespec times[2] = {{0, UTIME_OMIT}, source_entry->mtime};
+        futimens(writers[i].file.fd, times);
+        copied = (int64_t) writers[i].file.offset;
+        close_io_file(&writers[i].file);
+    }
+    close_io_file(&reader);
+    for (int i = 0; i < blocks_count; ++i) {
+        free(ring.blocks[i].data);
+    }
+    pthread_cond_destroy(&ring.changed);
+    pthread_mutex_destroy(&ring.lock);
+    return is_failed ? -1 : copied;
+}
+
+typedef struct {
+    pthread_mutex_t *lock;
+    pthread_cond_t *changed; // Signaled when data is written from a pipe
+    int pipe[2];
+    size_t capacity; // Size of the pipe
+    int fd;
+    char *path;
+    uint64_t queued; // Bytes put in the pipe so far
+    uint64_t drained; // Bytes taken from the pipe so far
+    bool is_failed;
+    bool is_threaded;
+    pthread_t thread;
+} fanout_target_t;
+
+/*!
+ * @brief drain_pipe splices data of the pipe of a destination into its file
+ * When the destination failed, the data is discarded so that the reader never waits for it.
+ * @param target is a pointer to the destination
+ * @param size is the maximum number of bytes to take from the pipe
+ * @return the number of bytes taken from the pipe, 0 when it is closed and empty, -1 in case of error
+ */
+static ssize_t drain_pipe(fanout_target_t *target, size_t size) {
+    while (!target->is_failed) {
+        ssize_t drained = splice(target->pipe[0], NULL, target->fd, NULL, size, SPLICE_F_MOVE);
+        if (drained >= 0) {
+            return drained;
+        }
+        if (errno != EINTR) {
+            perror(target->path);
+            target->is_failed = true;
+        }
+    }
+    char discarded[4096];
+    ssize_t drained;
+    do {
+        drained = read(target->pipe[0], discarded, (size < sizeof(discarded)) ? size : sizeof(discarded));
+    } while (drained == -1 && errno == EINTR);
+    return drained;
+}
+
+/*!
+ * @brief target_thread writes the data of the pipe of a destination to its file, until the pipe is closed
+ * @param parameters is a pointer to the fanout_target_t of the destination
+ */
+static void *target_thread(void *parameters) {
+    fanout_target_t *target = (fanout_target_t *) parameters;
+    ssize_t drained;
+    while ((drained = drain_pipe(target, target->capacity)) > 0) {
+        pthread_mutex_lock(target->lock);
+        target->drained += (uint64_t) drained;
+        pthread_cond_broadcast(target->changed);
+        pthread_mutex_unlock(target->lock);
+    }
+    return NULL;
+}
+
+/*!
+ * @brief queue_chunk puts a chunk of the source, held by the hub pipe, in the pipe of a destination
+ * The chunk is duplicated (tee) for all the destinations but the last one, which takes it from the hub.
+ * tee cannot resume a partial copy: the reader waits for the pipe to have room for the whole chunk,
+ * counting a page for each buffer it holds, and one more for a partially written one.
+ * @param hub is the pipe holding the chunk
+ * @param target is a pointer to the destination
+ * @param size is the size of the chunk
+ * @param is_last is true to move the chunk instead of duplicating it
+ * @return 0 in case of success, -1 else
+ */
+static int queue_chunk(int hub, fanout_target_t *target, size_t size, bool is_last) {
+    size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+    pthread_mutex_lock(target->lock);
+    while (target->queued - target->drained + size + 2 * page_size > target->capacity) {
+        pthread_cond_wait(target->changed, target->lock);
+    }
+    pthread_mutex_unlock(target->lock);
+
+    size_t left = size;
+    while (left > 0) {
+        ssize_t queued = is_last ? splice(hub, NULL, target->pipe[1], NULL, left, SPLICE_F_MOVE) : tee(hub, target->pipe[1], left, 0);
+        if (queued == -1 && errno == EINTR) {
+            continue;
+        }
+        if (queued <= 0 || (!is_last && (size_t) queued != left)) {
+            perror("Cannot copy file");
+            return -1;
+        }
+        left -= (size_t) queued;
+    }
+    pthread_mutex_lock(target->lock);
+    target->queued += size;
+    pthread_mutex_unlock(target->lock);
+
+    // Without its own thread, the destination is written right away
+    while (!target->is_threaded && target->drained < target->queued) {
+        ssize_t drained = drain_pipe(target, (size_t) (target->queued - target->drained));
+        if (drained <= 0) {
+            return -1;
+        }
+        target->drained += (uint64_t) drained;
+    }
+    return 0;
+}
+
+/*!
+ * @brief fanout_by_splice copies a file to several destinations with splice and tee (the data does not
+ * go through user space)
+ * @param source_entry is a pointer to the entry of the source file
+ * @param dest_paths are the paths of the destination files
+ * @param count is the number of destination files
+ * @return the number of bytes copied to each destination, -1 if the copy failed for one of them
+ */
+static int64_t fanout_by_splice(files_list_entry_t *source_entry, char **dest_paths, int count) {
+    int source_fd = open(source_entry->path_and_name, O_RDONLY);
+    if (source_fd == -1) {
+        perror("Cannot open source file");
+        return -1;
+    }
+    // The source is read by chunks of a pipe: a larger readahead keeps its device busy
+    posix_fadvise(source_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    int hub[2];
+    if (pipe(hub) == -1) {
+        perror("Cannot copy file");
+        close(source_fd);
+        return -1;
+    }
+    // The pipes get FANOUT_PIPE_SIZE bytes when the limits of the system allow it
+    fcntl(hub[1], F_SETPIPE_SZ, FANOUT_PIPE_SIZE);
+    size_t chunk_size = (size_t) fcntl(hub[1], F_GETPIPE_SZ);
+
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    pthread_mutex_init(&lock, NULL);
+    pthread_cond_init(&changed, NULL);
+    fanout_target_t targets[MAX_DESTINATIONS];
+    memset(targets, 0, sizeof(targets));
+    bool is_failed = false;
+    int opened = 0;
+    for (; opened < count; ++opened) {
+        fanout_target_t *target = &targets[opened];
+        target->lock = &lock;
+        target->changed = &changed;
+        target->path = dest_paths[opened];
+        if (pipe(target->pipe) == -1) {
+            perror("Cannot copy file");
+            is_failed = true;
+            break;
+        }
+        fcntl(target->pipe[1], F_SETPIPE_SZ, FANOUT_PIPE_SIZE);
+        target->capacity = (size_t) fcntl(target->pipe[1], F_GETPIPE_SZ);
+        // Half of the pipe, so that a writer can drain a chunk while the next one is queued
+        if (target->capacity / 2 < chunk_size) {
+            chunk_size = target->capacity / 2;
+        }
+        target->fd = open(dest_paths[opened], O_WRONLY | O_CREAT | O_TRUNC, source_entry->mode & 07777);
+        if (target->fd == -1) {
+            perror("Cannot open destination file");
+            close(target->pipe[0]);
+            close(target->pipe[1]);
+            is_failed = true;
+            break;
+        }
+    }
+    bool is_threaded = (count > 1 && source_entry->size > chunk_size);
+    for (int i = 0; i < opened && is_threaded; ++i) {
+        targets[i].is_threaded = pthread_create(&targets[i].thread, NULL, target_thread, &targets[i]) == 0;
+    }
+
+    off_t offset = 0;
+    while (!is_failed && (uint64_t) offset < source_entry->size) {
+        size_t wanted = (source_entry->size - (uint64_t) offset < chunk_size) ? (size_t) (source_entry->size - (uint64_t) offset) : chunk_size;
+        ssize_t read_size = splice(source_fd, &offset, hub[1], NULL, wanted, SPLICE_F_MOVE);
+        if (read_size == -1 && errno == EINTR) {
+            continue;
+        }
+        if (read_size <= 0) {
+            if (read_size == -1) {
+                perror("Cannot copy file");
+                is_failed = true;
+            }
+            break;
+        }
+        for (int i = 0; i < count && !is_failed; ++i) {
+            is_failed = (queue_chunk(hub[0], &targets[i], (size_t) read_size, i == count - 1) == -1);
+        }
+    }
+
+    // Closing the pipes ends the writer threads once they wrote everything
+    for (int i = 0; i < opened; ++i) {
+        close(targets[i].pipe[1]);
+        if (targets[i].is_threaded) {
+            pthread_join(targets[i].thread, NULL);
+        }
+        close(targets[i].pipe[0]);
+        if (targets[i].is_failed || targets[i].drained != (uint64_t) offset) {
+            is_failed = true;
+        }
+        // Keep access modes and mtime
+        fchmod(targets[i].fd, source_entry->mode & 07777);
+        struct timespec times[2] = {{0, UTIME_OMIT}, source_entry->mtime};
+        futimens(targets[i].fd, times);
+        close(targets[i].fd);
+    }
+    close(hub[0]);
+    close(hub[1]);
+    close(source_fd);
+    pthread_cond_destroy(&changed);
+    pthread_mutex_destroy(&lock);
+    return is_failed ? -1 : (int64_t) offset;
+}
+
+/*!
+ * @brief fanout_copy copies a source file to several destinations, reading it once
+ * Like the copies of one destination, the files get the access modes and mtime of the source.
+ * @param source_entry is a pointer to the entry of the source file
+ * @param dest_paths are the paths of the destination files
+ * @param count is the number of destination files (at most MAX_DESTINATIONS)
+ * @param uses_blocks is true to copy through the blocks of file-io.c (cache-polite or throttled copies,
+ * sparse sources), false to splice the data
+ * @return the number of bytes copied to each destination, -1 if the copy failed for one of them
+ */
+int64_t fanout_copy(files_list_entry_t *source_entry, char **dest_paths, int count, bool uses_blocks) {
+    if (source_entry == NULL || dest_paths == NULL || count <= 0 || count > MAX_DESTINATIONS) {
+        return -1;
+    }
+    return uses_blocks ? fanout_by_blocks(source_entry, dest_paths, count) : fanout_by_splice(source_entry, dest_paths, count);
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "configuration.h"
+#include "files-list.h"
+
+// Blocks read from the source and not written to every destination yet: a slow destination stops the
+// reads (and the other destinations) only when it is this many blocks late
+#define FANOUT_RING_BLOCKS 16
+// Size asked for the pipes of the spliced copies (each destination has one)
+#define FANOUT_PIPE_SIZE (1024 * 1024)
+
+int64_t fanout_copy(files_list_entry_t *source_entry, char **dest_paths, int count, bool uses_blocks);
@@ -0,0 +1,349 @@
+#define _GNU_SOURCE
+#include "file-io.h"
+#include "defines.h"
+#include "throttle.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Functions in this file are the only ones reading and writing files data, so that the I/O policy
+// chosen in the configuration applies to both the hashing and the copy.
+
+static bool is_cache_polite = false;
+
+/*!
+ * @brief init_file_io sets the I/O policy of the process (inherited by the processes it forks)
+ * @param the_config is a pointer to the program configuration
+ */
+void init_file_io(configuration_t *the_config) {
+    if (the_config != NULL) {
+        is_cache_polite = the_config->is_cache_polite;
+    }
+}
+
+/*!
+ * @brief set_direct_io enables or disables O_DIRECT on an opened file
+ * @param file is a pointer to the file
+ * @param is_direct is true to enable O_DIRECT
+ * @return 0 in case of success, -1 else
+ */
+static int set_direct_io(io_file_t *file, bool is_direct) {
+    int flags = fcntl(file->fd, F_GETFL);
+    if (flags == -1 || fcntl(file->fd, F_SETFL, is_direct ? (flags | O_DIRECT) : (flags & ~O_DIRECT)) == -1) {
+        return -1;
+    }
+    file->is_direct = is_direct;
+    return 0;
+}
+
+/*!
+ * @brief record_window_residency records which pages of the window starting at the current offset
+ * are already in the page cache, so that only the pages loaded by the backup are dropped afterwards
+ * @param file is a pointer to a reader
+ */
+static void record_window_residency(io_file_t *file) {
+    size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+    size_t pages = POLITE_WINDOW_SIZE / page_size;
+    memset(file->window_residency, 0, pages);
+    if (file->offset >= file->size) {
+        return;
+    }
+
+    size_t length = (file->size - file->offset < POLITE_WINDOW_SIZE) ? (size_t) (file->size - file->offset) : POLITE_WINDOW_SIZE;
+    void *mapping = mmap(NULL, length, PROT_READ, MAP_SHARED, file->fd, (off_t) file->offset);
+    if (mapping == MAP_FAILED) {
+        return;
+    }
+    mincore(mapping, length, file->window_residency);
+    munmap(mapping, length);
+}
+
+/*!
+ * @brief drop_window drops from the page cache the pages read or written since the last drop
+ * Readers keep the pages that were cached before they were read (@see record_window_residency).
+ * Writers first wait for their pages to be written back, dirty pages cannot be dropped.
+ * @param file is a pointer to the file
+ */
+static void drop_window(io_file_t *file) {
+    if (!file->is_polite || file->offset <= file->window_start) {
+        return;
+    }
+    if (file->is_direct && !file->is_writer) {
+        file->window_start = file->offset; // Nothing was loaded in the page cache
+        return;
+    }
+
+    off_t start = (off_t) file->window_start;
+    off_t length = (off_t) (file->offset - file->window_start);
+    if (file->is_writer) {
+        sync_file_range(file->fd, start, length, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+        posix_fadvise(file->fd, start, length, POSIX_FADV_DONTNEED);
+    } else {
+        size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+        size_t pages = ((size_t) length + page_size - 1) / page_size;
+        size_t page = 0;
+        while (page < pages) {
+            // Drop each run of pages that were not cached before
+            while (page < pages && (file->window_residency[page] & 1) != 0) {
+                ++page;
+            }
+            size_t run_start = page;
+            while (page < pages && (file->window_residency[page] & 1) == 0) {
+                ++page;
+            }
+            if (page > run_start) {
+                posix_fadvise(file->fd, start + (off_t) (run_start * page_size), (off_t) ((page - run_start) * page_size), POSIX_FADV_DONTNEED);
+            }
+        }
+    }
+    file->window_start = file->offset;
+}
+
+/*!
+ * @brief open_file_reader opens a file to read its data by blocks of IO_BLOCK_SIZE
+ * In cache-polite mode, O_DIRECT is used when the filesystem supports it, else the pages loaded
+ * are dropped every POLITE_WINDOW_SIZE bytes.
+ * @param file is a pointer to the reader to open
+ * @param path is the path of the file
+ * @return 0 in case of success, -1 else
+ */
+int open_file_reader(io_file_t *file, char *path) {
+    memset(file, 0, sizeof(io_file_t));
+    file->is_polite = is_cache_polite;
+    file->fd = -1;
+    if (is_cache_polite) {
+        file->fd = open(path, O_RDONLY | O_DIRECT);
+        file->is_direct = (file->fd != -1);
+    }
+    if (file->fd == -1) {
+        file->fd = open(path, O_RDONLY);
+        if (file->fd == -1) {
+            return -1;
+        }
+    }
+
+    struct stat file_stat;
+    if (fstat(file->fd, &file_stat) == 0) {
+        file->size = (uint64_t) file_stat.st_size;
+        file->is_sparse = (uint64_t) file_stat.st_blocks * 512 < file->size;
+    }
+    file->data_end = file->is_sparse ? 0 : file->size;
+    if (posix_memalign((void **) &file->buffer, DIRECT_IO_ALIGNMENT, IO_BLOCK_SIZE) != 0) {
+        file->buffer = NULL;
+        close(file->fd);
+        return -1;
+    }
+    if (file->is_polite) {
+        file->window_residency = calloc(POLITE_WINDOW_SIZE / sysconf(_SC_PAGESIZE), 1);
+        if (file->window_residency == NULL) {
+            close_io_file(file);
+            return -1;
+        }
+        if (!file->is_direct) {
+            posix_fadvise(file->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+            record_window_residency(file);
+        }
+    }
+    return 0;
+}
+
+/*!
+ * @brief read_block reads the next bytes of a file into its buffer
+ * @param file is a pointer to the reader
+ * @param size is the number of bytes to read (IO_BLOCK_SIZE at most)
+ * @return the number of bytes read (0 at the end of the file), -1 in case of error
+ */
+static ssize_t read_block(io_file_t *file, size_t size) {
+    ssize_t bytes_read;
+    while ((bytes_read = read(file->fd, file->buffer, size)) == -1) {
+        if (errno == EINTR) {
+            continue;
+        }
+        // Some filesystems accept O_DIRECT at open time but not at read time
+        if (errno == EINVAL && file->is_direct && set_direct_io(file, false) == 0) {
+            file->window_start = file->offset;
+            record_window_residency(file);
+            continue;
+        }
+        return -1;
+    }
+
+    if (bytes_read > 0) {
+        throttle_read((uint64_t) bytes_read);
+    }
+    file->offset += (uint64_t) bytes_read;
+    if (file->is_polite && !file->is_direct && file->offset - file->window_start >= POLITE_WINDOW_SIZE) {
+        drop_window(file);
+        record_window_residency(file);
+    }
+    return bytes_read;
+}
+
+/*!
+ * @brief read_file_block reads the next block of a file into its buffer
+ * @param file is a pointer to the reader
+ * @return the number of bytes read (0 at the end of the file), -1 in case of error
+ */
+ssize_t read_file_block(io_file_t *file) {
+    return read_block(file, IO_BLOCK_SIZE);
+}
+
+/*!
+ * @brief read_file_data reads the next block of data of a file, skipping its holes (SEEK_DATA/SEEK_HOLE)
+ * Holes read as zeros: the caller gets their size instead of their content.
+ * @param file is a pointer to the reader
+ * @param hole_size is a pointer to the size of the hole skipped before the block (0 if none)
+ * @return the number of bytes read (0 at the end of the file), -1 in case of error
+ */
+ssize_t read_file_data(io_file_t *file, uint64_t *hole_size) {
+    *hole_size = 0;
+    if (file->is_sparse && file->offset >= file->data_end) {
+        off_t data = lseek(file->fd, (off_t) file->offset, SEEK_DATA);
+        if (data == -1 && errno != ENXIO) {
+            file->is_sparse = false; // SEEK_DATA is not supported: read the holes
+            file->data_end = file->size;
+        } else {
+            // ENXIO: the end of the file is a hole
+            uint64_t data_start = (data == -1) ? file->size : (uint64_t) data;
+            off_t hole = (data == -1) ? -1 : lseek(file->fd, data, SEEK_HOLE);
+            file->data_end = (hole == -1) ? file->size : (uint64_t) hole;
+            if (data_start > file->offset) {
+                drop_window(file);
+                *hole_size = data_start - file->offset;
+                file->offset = data_start;
+                file->window_start = data_start;
+                if (file->is_polite && !file->is_direct) {
+                    record_window_residency(file);
+                }
+            }
+            if (lseek(file->fd, (off_t) file->offset, SEEK_SET) == -1) {
+                return -1;
+            }
+            if (file->offset >= file->size) {
+                return 0;
+            }
+        }
+    }
+
+    // Rounded to the alignment of O_DIRECT: reading a bit of the next hole is harmless
+    uint64_t remaining = (file->data_end - file->offset + DIRECT_IO_ALIGNMENT - 1) / DIRECT_IO_ALIGNMENT * DIRECT_IO_ALIGNMENT;
+    return read_block(file, (remaining < IO_BLOCK_SIZE) ? (size_t) remaining : IO_BLOCK_SIZE);
+}
+
+/*!
+ * @brief is_sparse_file tells if a file has holes (less blocks allocated than its size)
+ * @param path is the path of the file
+ * @return true if the file has holes, false else
+ */
+bool is_sparse_file(char *path) {
+    struct stat file_stat;
+    return stat(path, &file_stat) == 0 && (uint64_t) file_stat.st_blocks * 512 < (uint64_t) file_stat.st_size;
+}
+
+/*!
+ * @brief open_file_writer creates (or truncates) a file to write its data
+ * In cache-polite mode, O_DIRECT is used when the filesystem supports it, else the pages written
+ * are dropped (once written back) every POLITE_WINDOW_SIZE bytes.
+ * @param file is a pointer to the writer to open
+ * @param path is the path of the file
+ * @param mode is the mode of the file if it is created
+ * @return 0 in case of success, -1 else
+ */
+int open_file_writer(io_file_t *file, char *path, mode_t mode) {
+    memset(file, 0, sizeof(io_file_t));
+    file->is_writer = true;
+    file->is_polite = is_cache_polite;
+    file->fd = -1;
+    if (is_cache_polite) {
+        file->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, mode);
+        file->is_direct = (file->fd != -1);
+    }
+    if (file->fd == -1) {
+        file->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, mode);
+    }
+    return (file->fd == -1) ? -1 : 0;
+}
+
+/*!
+ * @brief write_file_block writes a block of data at the end of a file
+ * With O_DIRECT, data must be aligned: the last (partial) block of a file is written without it.
+ * @param file is a pointer to the writer
+ * @param data is the data to write (aligned on DIRECT_IO_ALIGNMENT with O_DIRECT, e.g. a reader's buffer)
+ * @param size is the number of bytes to write
+ * @return 0 in case of success, -1 else
+ */
+int write_file_block(io_file_t *file, void *data, size_t size) {
+    if (file->is_direct && (size % DIRECT_IO_ALIGNMENT != 0 || (uintptr_t) data % DIRECT_IO_ALIGNMENT != 0)) {
+        set_direct_io(file, false);
+    }
+
+    throttle_write(size);
+    size_t written = 0;
+    while (written < size) {
+        ssize_t result = write(file->fd, (unsigned char *) data + written, size - written);
+        if (result == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EINVAL && file->is_direct && set_direct_io(file, false) == 0) {
+                continue;
+            }
+            return -1;
+        }
+        written += (size_t) result;
+    }
+
+    file->offset += size;
+    if (file->is_polite && file->offset - file->window_start >= POLITE_WINDOW_SIZE) {
+        drop_window(file);
+    }
+    return 0;
+}
+
+/*!
+ * @brief skip_file_hole leaves a hole in a file instead of writing zeros
+ * @param file is a pointer to the writer
+ * @param size is the size of the hole
+ * @return 0 in case of success, -1 else
+ */
+int skip_file_hole(io_file_t *file, uint64_t size) {
+    drop_window(file);
+    if (lseek(file->fd, (off_t) size, SEEK_CUR) == -1) {
+        return -1;
+    }
+    file->offset += size;
+    file->window_start = file->offset;
+    return 0;
+}
+
+/*!
+ * @brief finish_file_writer sets the size of a written file, so that a final hole is kept
+ * @param file is a pointer to the writer
+ * @return 0 in case of success, -1 else
+ */
+int finish_file_writer(io_file_t *file) {
+    return ftruncate(file->fd, (off_t) file->offset);
+}
+
+/*!
+ * @brief close_io_file closes a reader or a writer, dropping its last window in cache-polite mode
+ * @param file is a pointer to the file
+ * @return the result of close
+ */
+int close_io_file(io_file_t *file) {
+    if (file->is_polite) {
+        drop_window(file);
+    }
+    free(file->window_residency);
+    free(file->buffer);
+    file->window_residency = NULL;
+    file->buffer = NULL;
+    int result = (file->fd != -1) ? close(file->fd) : 0;
+    file->fd = -1;
+    return result;
+}
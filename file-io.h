@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "configuration.h"
+
+// Alignment of the buffers and offsets for O_DIRECT (covers the logical block size of most devices)
+#define DIRECT_IO_ALIGNMENT 4096
+// In cache-polite mode, the pages loaded by buffered I/O are dropped every POLITE_WINDOW_SIZE bytes
+#define POLITE_WINDOW_SIZE (8 * 1024 * 1024)
+
+typedef struct {
+    int fd;
+    bool is_writer;
+    bool is_direct; // Set when O_DIRECT is used: the page cache is bypassed
+    bool is_polite; // Set when the pages loaded by buffered I/O must be dropped
+    uint64_t size; // Size of the file when it was opened (readers)
+    uint64_t offset; // Bytes read or written so far
+    bool is_sparse; // Set when the file has holes: they are skipped (@see read_file_data)
+    uint64_t data_end; // End of the current data extent of a sparse reader
+    uint64_t window_start; // Start of the part of the file whose pages were not dropped yet
+    unsigned char *window_residency; // Pages of the current window cached before it was read (readers)
+    unsigned char *buffer; // Aligned buffer of IO_BLOCK_SIZE bytes (readers)
+} io_file_t;
+
+void init_file_io(configuration_t *the_config);
+int open_file_reader(io_file_t *file, char *path);
+ssize_t read_file_block(io_file_t *file);
+ssize_t read_file_data(io_file_t *file, uint64_t *hole_size);
+bool is_sparse_file(char *path);
+int open_file_writer(io_file_t *file, char *path, mode_t mode);
+int write_file_block(io_file_t *file, void *data, size_t size);
+int skip_file_hole(io_file_t *file, uint64_t size);
+int finish_file_writer(io_file_t *file);
+int close_io_file(io_file_t *file);
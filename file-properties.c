@@ -6,48 +6,49 @@
 #include <string.h>
 #include "defines.h"
 #include <fcntl.h>
+#include "instrumentation.h"
+#include "file-io.h"
+#include "links-table.h"
 
 #include <stdlib.h>
 
+// Digests of the inodes with several hard links hashed by this process
+static links_table_t hashed_inodes = {NULL, 0, 0};
+
 /*!
- * @brief get_file_stats gets all of the required information for a file (inc. directories)
+ * @brief get_file_metadata gets the information returned by stat for a file (inc. directories)
+ * It gets the same fields as get_file_stats, except the digest.
  * @param the files list entry
- * You must get:
- * - for files:
- *   - mode (permissions)
- *   - mtime (in nanoseconds)
- *   - size
- *   - entry type (FICHIER)
- *   - MD5 sum
- * - for directories:
- *   - mode
- *   - entry type (DOSSIER)
  * @return -1 in case of error, 0 else
  */
-int get_file_stats(files_list_entry_t *entry) {
+int get_file_metadata(files_list_entry_t *entry) {
     if (entry == NULL) {
         fprintf(stderr, "Error: Entry is NULL\n");
         return -1;
     }
 
     struct stat file_stat;
+    struct timespec start;
+    instrument_begin(&start);
     if (stat(entry->path_and_name, &file_stat) < 0) {
         perror("stat failed");
         return -1;
     }
+    // The bytes of the files listed give the cost of hashing them (@see plan.c)
+    instrument_end_path(STAGE_STAT, &start, S_ISREG(file_stat.st_mode) ? (uint64_t) file_stat.st_size : 0, entry->path_and_name);
 
     entry->mode = file_stat.st_mode;
-    entry->mtime.tv_sec = file_stat.st_mtime; // seconds
-    entry->mtime.tv_nsec = 0;
+    entry->mtime.tv_sec = file_stat.st_mtim.tv_sec; // seconds
+    entry->mtime.tv_nsec = file_stat.st_mtim.tv_nsec;
+    entry->device = file_stat.st_dev;
+    entry->inode = file_stat.st_ino;
+    entry->links_count = file_stat.st_nlink;
 
     if (S_ISREG(file_stat.st_mode)) {
         entry->size = file_stat.st_size;
         entry->entry_type = FICHIER;
-        if (compute_file_md5(entry) < 0) {
-            fprintf(stderr, "Error computing MD5 for file: %s\n", entry->path_and_name);
-            return -1;
-        }
     } else if (S_ISDIR(file_stat.st_mode)) {
+        entry->size = 0;
         entry->entry_type = DOSSIER;
     } else {
         fprintf(stderr, "Error: Not a file or directory: %s\n", entry->path_and_name);
@@ -58,45 +59,211 @@ int get_file_stats(files_list_entry_t *entry) {
 }
 
 /*!
- * @brief compute_file_md5 computes a file's MD5 sum
+ * @brief get_file_stats gets all of the required information for a file (inc. directories)
+ * @param the files list entry
+ * You must get:
+ * - for files:
+ *   - mode (permissions)
+ *   - mtime (in nanoseconds)
+ *   - size
+ *   - entry type (FICHIER)
+ *   - digest of the content (@see compute_file_digest)
+ * - for directories:
+ *   - mode
+ *   - entry type (DOSSIER)
+ * @return -1 in case of error, 0 else
+ */
+int get_file_stats(files_list_entry_t *entry) {
+    if (get_file_metadata(entry) == -1) {
+        return -1;
+    }
+
+    if (entry->entry_type != FICHIER) {
+        return 0;
+    }
+
+    // Hard links to an inode already hashed by this process are not read again
+    uint64_t key[LINK_KEY_SIZE];
+    link_slot_t *slot = NULL;
+    if (entry->links_count > 1) {
+        make_inode_key(key, entry);
+        slot = find_link(&hashed_inodes, key);
+        if (slot != NULL && slot->mtime.tv_sec == entry->mtime.tv_sec && slot->mtime.tv_nsec == entry->mtime.tv_nsec) {
+            memcpy(entry->md5sum, slot->md5sum, sizeof(entry->md5sum));
+            return 0;
+        }
+    }
+
+    if (compute_file_digest(entry) < 0) {
+        fprintf(stderr, "Error computing the digest of file: %s\n", entry->path_and_name);
+        return -1;
+    }
+
+    if (entry->links_count > 1 && (slot != NULL || (slot = insert_link(&hashed_inodes, key)) != NULL)) {
+        memcpy(slot->md5sum, entry->md5sum, sizeof(slot->md5sum));
+        slot->mtime = entry->mtime;
+    }
+    return 0;
+}
+
+// The content is hashed by blocks of SPARSE_DIGEST_BLOCK bytes, aligned on the start of the file.
+// Runs of zero blocks (holes or written zeros) are folded into the digest as their length only, so a
+// file hashes the same whether its zeros are holes or not, on any filesystem.
+#define SPARSE_DIGEST_BLOCK 4096
+
+typedef struct {
+    EVP_MD_CTX *context;
+    int status; // 1 while all the updates of the digest succeeded
+    uint64_t zero_run; // Zero bytes not folded into the digest yet
+    size_t filled; // Bytes of the current block received so far
+    unsigned char block[SPARSE_DIGEST_BLOCK];
+} sparse_digest_t;
+
+/*!
+ * @brief is_zero_block tells if a block only contains zeros
+ */
+static bool is_zero_block(const unsigned char *data, size_t size) {
+    return size == 0 || (data[0] == 0 && memcmp(data, data + 1, size - 1) == 0);
+}
+
+/*!
+ * @brief fold_record adds a record (type and little-endian length) to the digest
+ * Records make the encoding unambiguous: a zero run cannot be mistaken for data.
+ */
+static void fold_record(sparse_digest_t *digest, unsigned char type, uint64_t length) {
+    unsigned char record[9] = {type};
+    for (int i = 0; i < 8; ++i) {
+        record[1 + i] = (unsigned char) (length >> (8 * i));
+    }
+    if (digest->status == 1) {
+        digest->status = EVP_DigestUpdate(digest->context, record, sizeof(record));
+    }
+}
+
+/*!
+ * @brief fold_block adds a complete block (or the last partial block) to the digest
+ */
+static void fold_block(sparse_digest_t *digest, const unsigned char *data, size_t size) {
+    if (is_zero_block(data, size)) {
+        digest->zero_run += size;
+        return;
+    }
+    if (digest->zero_run > 0) {
+        fold_record(digest, 'H', digest->zero_run);
+        digest->zero_run = 0;
+    }
+    fold_record(digest, 'D', size);
+    if (digest->status == 1) {
+        digest->status = EVP_DigestUpdate(digest->context, data, size);
+    }
+}
+
+/*!
+ * @brief digest_data adds bytes read from the file to the digest
+ */
+static void digest_data(sparse_digest_t *digest, const unsigned char *data, size_t size) {
+    while (size > 0) {
+        if (digest->filled == 0 && size >= SPARSE_DIGEST_BLOCK) {
+            fold_block(digest, data, SPARSE_DIGEST_BLOCK);
+            data += SPARSE_DIGEST_BLOCK;
+            size -= SPARSE_DIGEST_BLOCK;
+            continue;
+        }
+        size_t part = (size < SPARSE_DIGEST_BLOCK - digest->filled) ? size : SPARSE_DIGEST_BLOCK - digest->filled;
+        memcpy(digest->block + digest->filled, data, part);
+        digest->filled += part;
+        data += part;
+        size -= part;
+        if (digest->filled == SPARSE_DIGEST_BLOCK) {
+            fold_block(digest, digest->block, SPARSE_DIGEST_BLOCK);
+            digest->filled = 0;
+        }
+    }
+}
+
+/*!
+ * @brief digest_hole adds the zeros of a hole to the digest, without reading nor hashing them
+ */
+static void digest_hole(sparse_digest_t *digest, uint64_t size) {
+    if (digest->filled > 0) {
+        size_t part = (size < SPARSE_DIGEST_BLOCK - digest->filled) ? (size_t) size : SPARSE_DIGEST_BLOCK - digest->filled;
+        memset(digest->block + digest->filled, 0, part);
+        digest->filled += part;
+        size -= part;
+        if (digest->filled < SPARSE_DIGEST_BLOCK) {
+            return;
+        }
+        fold_block(digest, digest->block, SPARSE_DIGEST_BLOCK);
+        digest->filled = 0;
+    }
+    digest->zero_run += size / SPARSE_DIGEST_BLOCK * SPARSE_DIGEST_BLOCK;
+    digest->filled = (size_t) (size % SPARSE_DIGEST_BLOCK);
+    memset(digest->block, 0, digest->filled);
+}
+
+/*!
+ * @brief compute_file_digest computes the digest of a file's content, stored in its md5sum field
  * @param the pointer to the files list entry
  * @return -1 in case of error, 0 else
  * Use libcrypto functions from openssl/evp.h
+ * The digest is an MD5 of the data blocks, where holes are skipped (@see read_file_data) and runs of
+ * zero blocks are folded as their length: it is not the sum of md5sum, but it only depends on the
+ * content of the file.
  */
-
-int compute_file_md5(files_list_entry_t *entry) {
+int compute_file_digest(files_list_entry_t *entry) {
     if (entry == NULL || entry->entry_type != FICHIER) { // Use entry_type
         return -1;
     }
-    OpenSSL_add_all_algorithms();
-    FILE *file = fopen(entry->path_and_name, "rb"); // Use path_and_name
-    if (!file) {
+    struct timespec start;
+    instrument_begin(&start);
+    io_file_t file;
+    if (open_file_reader(&file, entry->path_and_name) == -1) { // Use path_and_name
         return -1;
     }
 
     unsigned char md5_sum[EVP_MAX_MD_SIZE];
+    sparse_digest_t *digest = malloc(sizeof(sparse_digest_t));
     EVP_MD_CTX *mdctx = EVP_MD_CTX_new();
-    if (!mdctx) {
-        fclose(file);
+    if (!mdctx || !digest) {
+        EVP_MD_CTX_free(mdctx);
+        free(digest);
+        close_io_file(&file);
         return -1;
     }
+    digest->context = mdctx;
+    digest->zero_run = 0;
+    digest->filled = 0;
 
-    // Obtain file size
-    fseek(file, 0, SEEK_END);
-    long file_size = ftell(file);
-    fseek(file, 0, SEEK_SET);
-    int errorCode = EVP_DigestInit_ex(mdctx, EVP_md5(), NULL);
-    if ( errorCode != 1 ||
-        EVP_DigestUpdate(mdctx, file, file_size) != 1 ||
+    // Hash the data of the file by blocks, and the size of its holes
+    ssize_t bytes_read;
+    uint64_t hole_size;
+    uint64_t total_read = 0;
+    digest->status = EVP_DigestInit_ex(mdctx, EVP_md5(), NULL);
+    while (digest->status == 1 && (bytes_read = read_file_data(&file, &hole_size)) >= 0) {
+        digest_hole(digest, hole_size);
+        if (bytes_read == 0) {
+            break;
+        }
+        digest_data(digest, file.buffer, (size_t) bytes_read);
+        total_read += bytes_read;
+    }
+    fold_block(digest, digest->block, digest->filled);
+    if (digest->zero_run > 0) {
+        fold_record(digest, 'H', digest->zero_run);
+    }
+    if (digest->status != 1 || bytes_read < 0 ||
         EVP_DigestFinal_ex(mdctx, md5_sum, NULL) != 1) {
         EVP_MD_CTX_free(mdctx);
-        fclose(file);
+        free(digest);
+        close_io_file(&file);
         return -1;
     }
 
     EVP_MD_CTX_free(mdctx);
-    fclose(file);
-    memcpy(entry->md5sum, md5_sum, EVP_MAX_MD_SIZE); // Use md5sum
+    free(digest);
+    close_io_file(&file);
+    memcpy(entry->md5sum, md5_sum, sizeof(entry->md5sum)); // Use md5sum
+    instrument_end_path(STAGE_HASH, &start, total_read, entry->path_and_name);
 
     return 0;
 }
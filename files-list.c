@@ -5,6 +5,8 @@
 #include <stddef.h>
 #include <string.h>
 #include <stdio.h>
+#include "utility.h"
+
 /*!
  * @brief clear_files_list clears a files list
  * @param list is a pointer to the list to be cleared
@@ -16,16 +18,16 @@ void clear_files_list(files_list_t *list) {
         list->head = tmp->next;
         free(tmp);
     }
+    list->tail = NULL;
 }
 /*!
  *  @brief fill_entry fills the properties of a file entry
  *  It fills the properties of a file entry by calling stat on the file.
- *  @param list the list to add the file entry into
  *  @param file_path the full path (from the root of the considered tree) of the file
  *  @param new_entry the entry to fill
  *  @return 0 in case of success, -1 else
  */
-int fill_entry(files_list_t *list, char *file_path, files_list_entry_t *new_entry) {
+int fill_entry(char *file_path, files_list_entry_t *new_entry) {
 
     //  Filling "char path_and_name[4096]";
     strcpy(new_entry->path_and_name, file_path);
@@ -36,23 +38,16 @@ int fill_entry(files_list_t *list, char *file_path, files_list_entry_t *new_entr
         return -1;
     }
 
-    //  Filling "struct _files_list_entry *next"
+    //  The links are set when the entry is inserted in the list
     new_entry->next = NULL;
-
-    //  Filling "struct _files_list_entry *prev"
-    if (!list->tail) {
-        new_entry->prev = list->tail;
-    } else {
-        new_entry->prev = NULL;
-    }
-    list->tail = new_entry;
+    new_entry->prev = NULL;
 
     return 0;
 }
 
 /*!
  *  @brief add_file_entry adds a new file to the files list.
- *  It adds the file in an ordered manner (strcmp) and fills its properties
+ *  It adds the file in an ordered manner (path_compare) and fills its properties
  *  by calling stat on the file.
  *  Il the file already exists, it does nothing and returns 0
  *  @param list the list to add the file entry into
@@ -71,70 +66,52 @@ files_list_entry_t *add_file_entry(files_list_t *liste, char *file_path) {
             printf("The file_path is NULL\n");
         }
         return NULL;
-    } else if (liste->head == NULL || liste->tail == NULL) {
-        if (liste->head == NULL) {
-            printf("The head of the list is NULL\n");
-        }
-        if (liste->tail == NULL) {
-            printf("The tail of the list is NULL\n");
-        }
+    }
+
+    // We look for the first element that comes after file_path, the new entry is inserted before it
+    // Lists are mostly built in order, so we start from the tail
+    files_list_entry_t *cursor = liste->tail;
+    while (cursor != NULL && path_compare(cursor->path_and_name, file_path) > 0) {
+        cursor = cursor->prev;
+    }
+    // If the file already exists in the list, we do nothing
+    if (cursor != NULL && path_compare(cursor->path_and_name, file_path) == 0) {
+        return 0;
+    }
+
+    // we allocate memory for a variable of type files_list_entry_t named new_entry
+    files_list_entry_t *new_entry = malloc(sizeof(files_list_entry_t));
+    // We check if the allocation of memory was successful, if not we return NULL (out of memory)
+    if (!new_entry) {
+        printf("Error when allocating memory in the function add_file_entry of the file files-list.c\n");
         return NULL;
-    } else {
-        //we verify if the file already exists in the list
-        for (files_list_entry_t *cursor = liste->head; cursor != NULL; cursor = cursor->next) {
-            if (strcmp(cursor->path_and_name, file_path) == 0) {
-                return 0;
-            }
-        }
-        // If the file does not exist in the list, we will add it
-
-        // we allocate memory for a variable of type files_list_entry_t named new_entry
-        files_list_entry_t *new_entry = malloc(sizeof(files_list_entry_t));
-        // We check if the allocation of memory was successful, if not we return NULL (out of memory)
-        if (!new_entry) {
-            printf("Error when allocating memory in the function add_file_entry of the file files-list.c\n");
-            return NULL;
-        }
+    }
 
-        // We initialize the entire memory space allocated to new entry to 0;
-        memset(new_entry, 0, sizeof(files_list_entry_t));
+    // We initialize the entire memory space allocated to new entry to 0;
+    memset(new_entry, 0, sizeof(files_list_entry_t));
 
-        // We call the fill_entry function to fill the different elements of the structure of new_entry
-        if ((fill_entry(liste, file_path, new_entry)) == 0){
+    // We call the fill_entry function to fill the different elements of the structure of new_entry
+    if (fill_entry(file_path, new_entry) != 0) {
+        // If the fill_entry function failed we free the memory allocated to new_entry, and we return NULL,
+        // the error message is already displayed in the fill_entry function
+        free(new_entry);
+        return NULL;
+    }
 
-            // We add the new_entry to the list of files, but we have to add it in an ordered manner (with strcmp)
-            // We check if the list is empty, if it is we add the new_entry to the head of the list
-            // else we will add it in an ordered manner
-            if (liste->head == NULL) {
-                liste->head = new_entry;
-                return new_entry;
-            } else {
-                files_list_entry_t *cursor = liste->head;
-                while (cursor != NULL) {
-                    if (strcmp(cursor->path_and_name, file_path) > 0) {
-                        cursor = cursor->next;
-                    } else {
-                        if (cursor->prev) {
-                            cursor->prev->next = new_entry;
-                            new_entry->prev = cursor->prev;
-                        } else {
-                            liste->head = new_entry;
-                        }
-                        cursor->prev = new_entry;
-                        new_entry->next = cursor;
-                        return new_entry;
-                    }
-                }
-                liste->tail->next = new_entry;
-                return new_entry;
-            }
-        } else {
-            // If the fill_entry function failed we free the memory allocated to new_entry, and we return NULL,
-            // the error message is already displayed in the fill_entry function
-            free(new_entry);
-            return NULL;
-        }
+    // We insert new_entry after cursor (or at the head of the list when cursor is NULL)
+    new_entry->prev = cursor;
+    new_entry->next = (cursor != NULL) ? cursor->next : liste->head;
+    if (new_entry->next != NULL) {
+        new_entry->next->prev = new_entry;
+    } else {
+        liste->tail = new_entry;
+    }
+    if (cursor != NULL) {
+        cursor->next = new_entry;
+    } else {
+        liste->head = new_entry;
     }
+    return new_entry;
 }
 
 
@@ -178,6 +155,28 @@ int add_entry_to_tail(files_list_t *list, files_list_entry_t *entry) {
     }
 }
 
+/*!
+ * @brief remove_head_entry detaches the first entry of a list
+ * @param list is a pointer to the list
+ * @return a pointer to the detached entry (the caller becomes its owner), NULL if the list is empty
+ */
+files_list_entry_t *remove_head_entry(files_list_t *list) {
+    if (list == NULL || list->head == NULL) {
+        return NULL;
+    }
+
+    files_list_entry_t *entry = list->head;
+    list->head = entry->next;
+    if (list->head == NULL) {
+        list->tail = NULL;
+    } else {
+        list->head->prev = NULL;
+    }
+    entry->next = NULL;
+    entry->prev = NULL;
+    return entry;
+}
+
 /*!
  *  @brief find_entry_by_name looks up for a file in a list
  *  The function uses the ordering of the entries to interrupt its search
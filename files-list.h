@@ -13,6 +13,9 @@ typedef struct _files_list_entry {
   uint8_t md5sum[16];
   file_type_t entry_type;
   mode_t mode;
+  dev_t device; // Device and inode number identify hard links to a same file
+  ino_t inode;
+  nlink_t links_count;
   struct _files_list_entry *next;
   struct _files_list_entry *prev;
 } files_list_entry_t;
@@ -25,6 +28,7 @@ typedef struct {
 void clear_files_list(files_list_t *list);
 files_list_entry_t *add_file_entry(files_list_t *liste, char *file_path);
 int add_entry_to_tail(files_list_t *list, files_list_entry_t *entry);
+files_list_entry_t *remove_head_entry(files_list_t *list);
 files_list_entry_t *find_entry_by_name(files_list_t *list, char *file_path, size_t start_of_src, size_t start_of_dest);
 void display_files_list(files_list_t *list);
 void display_files_list_reversed(files_list_t *list);
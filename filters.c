@@ -0,0 +1,888 @@
+#include "filters.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "defines.h"
+
+// The suffix edges of a node are keyed by its index with this bit set
+#define SUFFIX_KEY(node) ((node) | 0x80000000U)
+
+/*
+ * The exclude/include rules are compiled into a trie of path segments, shared by all the rules:
+ * - a literal segment (e.g. node_modules) is an edge of the trie, found in a single hash table
+ *   keyed by the parent node and the name;
+ * - a star followed by a literal suffix (e.g. *.log, the most frequent glob) is an edge of the same
+ *   hash table, found by looking up each suffix of a name;
+ * - the glob segments (*, ?, [...]) of a node are matched all at once by a DFA, built lazily from
+ *   their positions as names are matched (at most FILTER_MAX_DFA_STATES states are cached);
+ * - a ** segment is a node matching any number of segments (it keeps itself in the state).
+ * A rule without / (except a trailing one) matches a name at any depth: it hangs below a ** node
+ * of the root. A rule with a leading or inner / is anchored at the root of the tree. A trailing /
+ * only matches directories.
+ * Each directory keeps the nodes reached by its path (filter_state_t), so each name is matched
+ * against the rules once, in a time independent of the number of rules. The first matching rule
+ * (in the order of the command line) tells if an entry is included or excluded; an entry matching
+ * no rule is included. An excluded directory is dropped from the list of its parent, so it is
+ * never opened.
+ */
+
+typedef enum {TOKEN_LITERAL, TOKEN_ANY, TOKEN_CLASS, TOKEN_STAR} token_kind_t;
+
+typedef struct {
+    token_kind_t kind;
+    unsigned char literal;
+    uint64_t class[4]; // Bytes matched by a TOKEN_CLASS
+} glob_token_t;
+
+typedef struct {
+    char *text; // Segment as written in the rules, to merge identical segments
+    glob_token_t *tokens;
+    uint32_t length;
+    uint32_t child;
+} glob_edge_t;
+
+typedef struct {
+    uint32_t *positions; // Sorted positions of the NFA: (glob << 16) | token
+    uint32_t count;
+    int32_t transitions[256]; // -1 until computed
+    uint32_t *accepted; // Globs matching a name that ends in this state
+    uint32_t accepted_count;
+} dfa_state_t;
+
+typedef struct {
+    dfa_state_t *states; // The start state is the first one
+    uint32_t count;
+    uint32_t capacity;
+    int32_t *table; // State of each set of positions (open addressing), -1 for the free slots
+    uint32_t table_capacity;
+    uint32_t *scratch; // Positions being computed
+} glob_automaton_t;
+
+typedef struct {
+    int32_t rule; // First rule ending at this node (-1 if none)
+    int32_t directory_rule; // First rule with a trailing / ending at this node, for directories only
+    uint32_t star_child; // Node of a ** segment following this node (0 if none, the root is never a child)
+    bool is_star; // A ** node matches any number of segments
+    bool has_suffixes; // Set when suffix edges (*literal) start from this node
+    glob_edge_t *globs;
+    uint32_t globs_count;
+    uint32_t globs_capacity;
+    glob_automaton_t *automaton; // Built at the first match
+} filter_node_t;
+
+typedef struct {
+    char *name; // NULL for the free slots
+    uint64_t hash;
+    uint32_t parent;
+    uint32_t child;
+} literal_edge_t;
+
+typedef struct {
+    filter_node_t *nodes; // The root is the first one
+    uint32_t nodes_count;
+    uint32_t nodes_capacity;
+    literal_edge_t *literals; // Hash table of the literal edges
+    size_t literals_count;
+    size_t literals_capacity;
+    bool *rule_includes; // Kind of each rule, in the order of the command line
+    size_t rules_count;
+    size_t rules_capacity;
+} filters_t;
+
+static filters_t filters = {NULL, 0, 0, NULL, 0, 0, NULL, 0, 0};
+
+/*!
+ * @brief hash_name computes the FNV-1a hash of a name
+ */
+static uint64_t hash_name(const char *name) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (const unsigned char *c = (const unsigned char *) name; *c != '\0'; ++c) {
+        hash = (hash ^ *c) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+/*!
+ * @brief hash_suffixes computes the hash of each suffix of a name, from its end (@see hash_suffix)
+ * @param name is the name
+ * @param hashes receives the hash of the suffix starting at each byte of the name
+ * @return the length of the name
+ */
+static size_t hash_suffixes(const char *name, uint64_t *hashes) {
+    size_t length = strlen(name);
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = length; i > 0; --i) {
+        hash = (hash ^ (unsigned char) name[i - 1]) * 1099511628211ULL;
+        hashes[i - 1] = hash;
+    }
+    return length;
+}
+
+/*!
+ * @brief hash_suffix computes the hash of a suffix, from its end, so that the hashes of all the
+ * suffixes of a name are computed in a single pass
+ */
+static uint64_t hash_suffix(const char *suffix) {
+    uint64_t hashes[PATH_SIZE];
+    return (hash_suffixes(suffix, hashes) > 0) ? hashes[0] : 14695981039346656037ULL;
+}
+
+/*!
+ * @brief literal_slot gives the first slot of a literal edge in the hash table
+ */
+static size_t literal_slot(uint32_t parent, uint64_t name_hash) {
+    return (size_t) ((name_hash ^ ((uint64_t) parent * 0x9E3779B97F4A7C15ULL)) & (filters.literals_capacity - 1));
+}
+
+/*!
+ * @brief find_literal finds the child of a node through a literal edge
+ * @param parent is the node
+ * @param name is the name of the edge
+ * @param name_hash is the hash of name (@see hash_name)
+ * @return the child node, 0 if there is no such edge
+ */
+static uint32_t find_literal(uint32_t parent, const char *name, uint64_t name_hash) {
+    if (filters.literals_capacity == 0) {
+        return 0;
+    }
+    for (size_t slot = literal_slot(parent, name_hash); filters.literals[slot].name != NULL;
+         slot = (slot + 1) & (filters.literals_capacity - 1)) {
+        literal_edge_t *edge = &filters.literals[slot];
+        if (edge->hash == name_hash && edge->parent == parent && strcmp(edge->name, name) == 0) {
+            return edge->child;
+        }
+    }
+    return 0;
+}
+
+/*!
+ * @brief grow_literals doubles the hash table of the literal edges
+ * @return 0 in case of success, -1 else
+ */
+static int grow_literals(void) {
+    size_t old_capacity = filters.literals_capacity;
+    literal_edge_t *old_literals = filters.literals;
+    size_t new_capacity = (old_capacity == 0) ? 256 : old_capacity * 2;
+    literal_edge_t *new_literals = calloc(new_capacity, sizeof(literal_edge_t));
+    if (new_literals == NULL) {
+        printf("Error when allocating memory in the function grow_literals of the file filters.c\n");
+        return -1;
+    }
+    filters.literals = new_literals;
+    filters.literals_capacity = new_capacity;
+    for (size_t i = 0; i < old_capacity; ++i) {
+        if (old_literals[i].name != NULL) {
+            size_t slot = literal_slot(old_literals[i].parent, old_literals[i].hash);
+            while (filters.literals[slot].name != NULL) {
+                slot = (slot + 1) & (new_capacity - 1);
+            }
+            filters.literals[slot] = old_literals[i];
+        }
+    }
+    free(old_literals);
+    return 0;
+}
+
+/*!
+ * @brief new_node adds a node to the trie
+ * @return the new node, 0 in case of error (except for the root)
+ */
+static uint32_t new_node(void) {
+    if (filters.nodes_count == filters.nodes_capacity) {
+        uint32_t new_capacity = (filters.nodes_capacity == 0) ? 64 : filters.nodes_capacity * 2;
+        filter_node_t *new_nodes = realloc(filters.nodes, new_capacity * sizeof(filter_node_t));
+        if (new_nodes == NULL) {
+            printf("Error when allocating memory in the function new_node of the file filters.c\n");
+            return 0;
+        }
+        filters.nodes = new_nodes;
+        filters.nodes_capacity = new_capacity;
+    }
+    filter_node_t *node = &filters.nodes[filters.nodes_count];
+    memset(node, 0, sizeof(filter_node_t));
+    node->rule = -1;
+    node->directory_rule = -1;
+    return filters.nodes_count++;
+}
+
+/*!
+ * @brief star_child_of gives the ** node following a node, created if needed
+ * @return the ** node, 0 in case of error
+ */
+static uint32_t star_child_of(uint32_t parent) {
+    if (filters.nodes[parent].star_child == 0) {
+        uint32_t child = new_node();
+        if (child == 0) {
+            return 0;
+        }
+        filters.nodes[child].is_star = true;
+        filters.nodes[parent].star_child = child;
+    }
+    return filters.nodes[parent].star_child;
+}
+
+/*!
+ * @brief literal_child_of gives the child of a node through a literal (or suffix) edge, created if needed
+ * @param parent is the node, or its SUFFIX_KEY for a suffix edge
+ * @param name is the name (or the suffix) of the edge
+ * @param name_hash is the hash of name (@see hash_name and hash_suffix)
+ * @return the child, 0 in case of error
+ */
+static uint32_t literal_child_of(uint32_t parent, char *name, uint64_t name_hash) {
+    uint32_t child = find_literal(parent, name, name_hash);
+    if (child != 0) {
+        return child;
+    }
+    if ((filters.literals_count + 1) * 2 > filters.literals_capacity && grow_literals() == -1) {
+        return 0;
+    }
+    char *name_copy = strdup(name);
+    if (name_copy == NULL || (child = new_node()) == 0) {
+        free(name_copy);
+        return 0;
+    }
+    size_t slot = literal_slot(parent, name_hash);
+    while (filters.literals[slot].name != NULL) {
+        slot = (slot + 1) & (filters.literals_capacity - 1);
+    }
+    filters.literals[slot] = (literal_edge_t) {name_copy, name_hash, parent, child};
+    ++filters.literals_count;
+    return child;
+}
+
+/*!
+ * @brief parse_class parses a bracket expression ([abc], [a-z], [!a-z]) of a glob segment
+ * @param text is the bracket expression, starting with [
+ * @param token receives the class
+ * @return the length of the expression, 0 if it is not closed (the [ is then a literal)
+ */
+static size_t parse_class(const char *text, glob_token_t *token) {
+    size_t i = 1;
+    bool is_negated = (text[i] == '!' || text[i] == '^');
+    if (is_negated) {
+        ++i;
+    }
+    memset(token->class, 0, sizeof(token->class));
+    bool is_first = true;
+    while (text[i] != '\0' && (text[i] != ']' || is_first)) {
+        unsigned char low = (unsigned char) text[i];
+        unsigned char high = low;
+        if (text[i + 1] == '-' && text[i + 2] != ']' && text[i + 2] != '\0') {
+            high = (unsigned char) text[i + 2];
+            i += 2;
+        }
+        for (unsigned int c = low; c <= high; ++c) {
+            token->class[c / 64] |= 1ULL << (c % 64);
+        }
+        ++i;
+        is_first = false;
+    }
+    if (text[i] != ']') {
+        return 0;
+    }
+    if (is_negated) {
+        for (int word = 0; word < 4; ++word) {
+            token->class[word] = ~token->class[word];
+        }
+    }
+    token->kind = TOKEN_CLASS;
+    return i + 1;
+}
+
+/*!
+ * @brief compile_glob compiles a glob segment into the tokens of a glob edge
+ * @param segment is the glob segment
+ * @param edge is the edge receiving the tokens
+ * @return 0 in case of success, -1 else
+ */
+static int compile_glob(char *segment, glob_edge_t *edge) {
+    size_t length = strlen(segment);
+    edge->tokens = calloc(length + 1, sizeof(glob_token_t));
+    edge->text = strdup(segment);
+    if (edge->tokens == NULL || edge->text == NULL || length >= 0xFFFF) {
+        printf("Error when compiling the glob %s in the file filters.c\n", segment);
+        free(edge->tokens);
+        free(edge->text);
+        return -1;
+    }
+    uint32_t count = 0;
+    for (size_t i = 0; i < length; ++i) {
+        glob_token_t *token = &edge->tokens[count];
+        size_t class_length;
+        if (segment[i] == '*') {
+            // Consecutive stars are a single one
+            if (count > 0 && edge->tokens[count - 1].kind == TOKEN_STAR) {
+                continue;
+            }
+            token->kind = TOKEN_STAR;
+        } else if (segment[i] == '?') {
+            token->kind = TOKEN_ANY;
+        } else if (segment[i] == '[' && (class_length = parse_class(segment + i, token)) > 0) {
+            i += class_length - 1;
+        } else {
+            if (segment[i] == '\\' && i + 1 < length) {
+                ++i;
+            }
+            token->kind = TOKEN_LITERAL;
+            token->literal = (unsigned char) segment[i];
+        }
+        ++count;
+    }
+    edge->length = count;
+    return 0;
+}
+
+/*!
+ * @brief glob_child_of gives the child of a node through a glob edge, created if needed
+ * @return the child, 0 in case of error
+ */
+static uint32_t glob_child_of(uint32_t parent, char *segment) {
+    filter_node_t *node = &filters.nodes[parent];
+    for (uint32_t i = 0; i < node->globs_count; ++i) {
+        if (strcmp(node->globs[i].text, segment) == 0) {
+            return node->globs[i].child;
+        }
+    }
+    if (node->globs_count == 0xFFFF) {
+        printf("Too many globs in the same place of the filter rules\n");
+        return 0;
+    }
+    if (node->globs_count == node->globs_capacity) {
+        uint32_t new_capacity = (node->globs_capacity == 0) ? 4 : node->globs_capacity * 2;
+        glob_edge_t *new_globs = realloc(node->globs, new_capacity * sizeof(glob_edge_t));
+        if (new_globs == NULL) {
+            printf("Error when allocating memory in the function glob_child_of of the file filters.c\n");
+            return 0;
+        }
+        node->globs = new_globs;
+        node->globs_capacity = new_capacity;
+    }
+    glob_edge_t edge;
+    uint32_t child;
+    if (compile_glob(segment, &edge) == -1 || (child = new_node()) == 0) {
+        return 0;
+    }
+    // new_node may move the nodes
+    node = &filters.nodes[parent];
+    edge.child = child;
+    node->globs[node->globs_count++] = edge;
+    return child;
+}
+
+/*!
+ * @brief add_rule compiles a rule into the trie
+ * @param pattern is the pattern of the rule
+ * @param is_include is true for an include rule, false for an exclude rule
+ * @return 0 in case of success, -1 else
+ */
+static int add_rule(char *pattern, bool is_include) {
+    char segments[PATH_SIZE];
+    size_t length = (size_t) snprintf(segments, sizeof(segments), "%s", pattern);
+    bool is_directory_only = false;
+    while (length > 1 && length < sizeof(segments) && segments[length - 1] == '/') {
+        segments[--length] = '\0';
+        is_directory_only = true;
+    }
+    if (length == 0 || length >= sizeof(segments) || strcmp(segments, "/") == 0) {
+        printf("Invalid filter rule '%s'\n", pattern);
+        return -1;
+    }
+
+    uint32_t node = 0;
+    if (strchr(segments, '/') == NULL && (node = star_child_of(0)) == 0) {
+        return -1;
+    }
+    char *saved;
+    for (char *segment = strtok_r(segments, "/", &saved); segment != NULL; segment = strtok_r(NULL, "/", &saved)) {
+        if (strcmp(segment, "**") == 0) {
+            node = star_child_of(node);
+        } else if (strpbrk(segment, "*?[\\") == NULL) {
+            node = literal_child_of(node, segment, hash_name(segment));
+        } else if (segment[0] == '*' && segment[1] != '\0' && strpbrk(segment + 1, "*?[\\") == NULL) {
+            uint32_t parent = node;
+            node = literal_child_of(SUFFIX_KEY(parent), segment + 1, hash_suffix(segment + 1));
+            filters.nodes[parent].has_suffixes = true;
+        } else {
+            node = glob_child_of(node, segment);
+        }
+        if (node == 0) {
+            return -1;
+        }
+    }
+
+    if (filters.rules_count == filters.rules_capacity) {
+        size_t new_capacity = (filters.rules_capacity == 0) ? 64 : filters.rules_capacity * 2;
+        bool *new_includes = realloc(filters.rule_includes, new_capacity * sizeof(bool));
+        if (new_includes == NULL) {
+            printf("Error when allocating memory in the function add_rule of the file filters.c\n");
+            return -1;
+        }
+        filters.rule_includes = new_includes;
+        filters.rules_capacity = new_capacity;
+    }
+    int32_t rule = (int32_t) filters.rules_count;
+    filters.rule_includes[filters.rules_count++] = is_include;
+    // The first rule ending at a node takes precedence
+    int32_t *node_rule = is_directory_only ? &filters.nodes[node].directory_rule : &filters.nodes[node].rule;
+    if (*node_rule == -1) {
+        *node_rule = rule;
+    }
+    return 0;
+}
+
+/*!
+ * @brief add_rules_file compiles the rules of a file
+ * Each line is a rule: "- pattern" excludes, "+ pattern" includes, a line without prefix excludes.
+ * The empty lines and the lines starting with # are ignored.
+ * @param path is the path of the rules file
+ * @return 0 in case of success, -1 else
+ */
+static int add_rules_file(char *path) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        perror("Cannot open the filter rules file");
+        return -1;
+    }
+    char line[PATH_SIZE + 4];
+    int result = 0;
+    while (result == 0 && fgets(line, sizeof(line), file) != NULL) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#') {
+            continue;
+        }
+        if ((line[0] == '+' || line[0] == '-') && line[1] == ' ') {
+            result = add_rule(line + 2, line[0] == '+');
+        } else {
+            result = add_rule(line, false);
+        }
+    }
+    fclose(file);
+    return result;
+}
+
+/*!
+ * @brief init_filters compiles the filter rules of the configuration (--exclude, --include and
+ * --filter-file, in their order)
+ * It must be called before the processes are forked, which share the compiled rules.
+ * @param the_config is a pointer to the configuration
+ * @return 0 in case of success, -1 else
+ */
+int init_filters(configuration_t *the_config) {
+    if (the_config->filter_rules_count == 0) {
+        return 0;
+    }
+    // The root is the first node
+    if (new_node() != 0 || filters.nodes_count != 1) {
+        return -1;
+    }
+    for (size_t i = 0; i < the_config->filter_rules_count; ++i) {
+        // Each rule is stored with its kind: "- pattern", "+ pattern" or ". rules file"
+        char *rule = the_config->filter_rules[i];
+        int result = (rule[0] == '.') ? add_rules_file(rule + 2) : add_rule(rule + 2, rule[0] == '+');
+        if (result == -1) {
+            clean_filters();
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*!
+ * @brief has_filters tells if entries may be excluded
+ * @return true if there is at least one rule
+ */
+bool has_filters(void) {
+    return filters.rules_count > 0;
+}
+
+/*!
+ * @brief add_to_state adds a node (and the ** node following it) to a state
+ */
+static void add_to_state(filter_state_t *state, uint32_t node) {
+    for (size_t i = 0; i < state->count; ++i) {
+        if (state->nodes[i] == node) {
+            return;
+        }
+    }
+    if (state->count == state->capacity) {
+        size_t new_capacity = (state->capacity == 0) ? 8 : state->capacity * 2;
+        uint32_t *new_nodes = realloc(state->nodes, new_capacity * sizeof(uint32_t));
+        if (new_nodes == NULL) {
+            printf("Error when allocating memory in the function add_to_state of the file filters.c\n");
+            return;
+        }
+        state->nodes = new_nodes;
+        state->capacity = new_capacity;
+    }
+    state->nodes[state->count++] = node;
+    if (filters.nodes[node].star_child != 0) {
+        add_to_state(state, filters.nodes[node].star_child);
+    }
+}
+
+/*!
+ * @brief init_filter_state makes the state of the root of a tree
+ * @param state is the state to initialize
+ * @return 0 in case of success, -1 else
+ */
+int init_filter_state(filter_state_t *state) {
+    memset(state, 0, sizeof(filter_state_t));
+    if (has_filters()) {
+        add_to_state(state, 0);
+        return (state->count > 0) ? 0 : -1;
+    }
+    return 0;
+}
+
+/*!
+ * @brief clear_filter_state releases a state
+ */
+void clear_filter_state(filter_state_t *state) {
+    free(state->nodes);
+    memset(state, 0, sizeof(filter_state_t));
+}
+
+/*!
+ * @brief compare_positions orders the positions of the NFA
+ */
+static int compare_positions(const void *lhs, const void *rhs) {
+    uint32_t left = *(const uint32_t *) lhs;
+    uint32_t right = *(const uint32_t *) rhs;
+    return (left > right) - (left < right);
+}
+
+/*!
+ * @brief close_positions adds the positions following the stars (a star may match nothing), then
+ * sorts the positions and removes the duplicates
+ * @param node is the node whose globs are matched
+ * @param positions is the array of positions (with room for twice their count)
+ * @param count is the number of positions
+ * @return the new number of positions
+ */
+static uint32_t close_positions(filter_node_t *node, uint32_t *positions, uint32_t count) {
+    uint32_t closed = count;
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t glob = positions[i] >> 16;
+        uint32_t token = positions[i] & 0xFFFF;
+        if (token < node->globs[glob].length && node->globs[glob].tokens[token].kind == TOKEN_STAR) {
+            positions[closed++] = positions[i] + 1;
+        }
+    }
+    qsort(positions, closed, sizeof(uint32_t), compare_positions);
+    uint32_t unique = 0;
+    for (uint32_t i = 0; i < closed; ++i) {
+        if (unique == 0 || positions[unique - 1] != positions[i]) {
+            positions[unique++] = positions[i];
+        }
+    }
+    return unique;
+}
+
+/*!
+ * @brief hash_positions computes the hash of a set of positions
+ */
+static uint64_t hash_positions(uint32_t *positions, uint32_t count) {
+    uint64_t hash = 14695981039346656037ULL ^ count;
+    for (uint32_t i = 0; i < count; ++i) {
+        hash = (hash ^ positions[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+/*!
+ * @brief find_state finds the DFA state of a set of positions, and adds it if needed
+ * @param node is the node whose globs are matched
+ * @param positions are the sorted positions
+ * @param count is the number of positions
+ * @return the index of the state, -1 if the DFA is full, -2 in case of error
+ */
+static int32_t find_state(filter_node_t *node, uint32_t *positions, uint32_t count) {
+    glob_automaton_t *automaton = node->automaton;
+    uint32_t mask = automaton->table_capacity - 1;
+    uint32_t slot = (uint32_t) hash_positions(positions, count) & mask;
+    while (automaton->table[slot] != -1) {
+        dfa_state_t *state = &automaton->states[automaton->table[slot]];
+        if (state->count == count && memcmp(state->positions, positions, count * sizeof(uint32_t)) == 0) {
+            return automaton->table[slot];
+        }
+        slot = (slot + 1) & mask;
+    }
+    if (automaton->count == FILTER_MAX_DFA_STATES) {
+        return -1;
+    }
+
+    dfa_state_t *state = &automaton->states[automaton->count];
+    memset(state, 0, sizeof(dfa_state_t));
+    memset(state->transitions, -1, sizeof(state->transitions));
+    state->positions = malloc((count + 1) * sizeof(uint32_t));
+    state->accepted = malloc((count + 1) * sizeof(uint32_t));
+    if (state->positions == NULL || state->accepted == NULL) {
+        printf("Error when allocating memory in the function find_state of the file filters.c\n");
+        free(state->positions);
+        free(state->accepted);
+        return -2;
+    }
+    memcpy(state->positions, positions, count * sizeof(uint32_t));
+    state->count = count;
+    for (uint32_t i = 0; i < count; ++i) {
+        if ((positions[i] & 0xFFFF) == node->globs[positions[i] >> 16].length) {
+            state->accepted[state->accepted_count++] = positions[i] >> 16;
+        }
+    }
+    automaton->table[slot] = (int32_t) automaton->count;
+    return (int32_t) automaton->count++;
+}
+
+/*!
+ * @brief reset_automaton drops the states of the DFA of a node, and adds its start state
+ * @return 0 in case of success, -1 else
+ */
+static int reset_automaton(filter_node_t *node) {
+    glob_automaton_t *automaton = node->automaton;
+    for (uint32_t i = 0; i < automaton->count; ++i) {
+        free(automaton->states[i].positions);
+        free(automaton->states[i].accepted);
+    }
+    automaton->count = 0;
+    memset(automaton->table, -1, automaton->table_capacity * sizeof(int32_t));
+
+    uint32_t count = 0;
+    for (uint32_t glob = 0; glob < node->globs_count; ++glob) {
+        automaton->scratch[count++] = glob << 16;
+    }
+    count = close_positions(node, automaton->scratch, count);
+    return (find_state(node, automaton->scratch, count) == 0) ? 0 : -1;
+}
+
+/*!
+ * @brief build_automaton allocates the DFA of the globs of a node
+ * @return 0 in case of success, -1 else
+ */
+static int build_automaton(filter_node_t *node) {
+    uint32_t positions_bound = 0;
+    for (uint32_t glob = 0; glob < node->globs_count; ++glob) {
+        positions_bound += node->globs[glob].length + 1;
+    }
+    glob_automaton_t *automaton = calloc(1, sizeof(glob_automaton_t));
+    if (automaton != NULL) {
+        automaton->table_capacity = 2 * FILTER_MAX_DFA_STATES;
+        automaton->states = malloc(FILTER_MAX_DFA_STATES * sizeof(dfa_state_t));
+        automaton->table = malloc(automaton->table_capacity * sizeof(int32_t));
+        automaton->scratch = malloc(2 * positions_bound * sizeof(uint32_t));
+    }
+    if (automaton == NULL || automaton->states == NULL || automaton->table == NULL || automaton->scratch == NULL) {
+        printf("Error when allocating memory in the function build_automaton of the file filters.c\n");
+        if (automaton != NULL) {
+            free(automaton->states);
+            free(automaton->table);
+            free(automaton->scratch);
+            free(automaton);
+        }
+        return -1;
+    }
+    node->automaton = automaton;
+    return reset_automaton(node);
+}
+
+/*!
+ * @brief step_state computes the DFA state following a state on a byte
+ * @return the index of the next state, -1 if the DFA is full, -2 in case of error
+ */
+static int32_t step_state(filter_node_t *node, int32_t from, unsigned char c) {
+    glob_automaton_t *automaton = node->automaton;
+    dfa_state_t *state = &automaton->states[from];
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < state->count; ++i) {
+        uint32_t position = state->positions[i];
+        glob_edge_t *glob = &node->globs[position >> 16];
+        uint32_t token_index = position & 0xFFFF;
+        if (token_index == glob->length) {
+            continue;
+        }
+        glob_token_t *token = &glob->tokens[token_index];
+        if (token->kind == TOKEN_STAR) {
+            automaton->scratch[count++] = position;
+        } else if (token->kind == TOKEN_ANY || (token->kind == TOKEN_LITERAL && token->literal == c) ||
+                   (token->kind == TOKEN_CLASS && (token->class[c / 64] & (1ULL << (c % 64))) != 0)) {
+            automaton->scratch[count++] = position + 1;
+        }
+    }
+    count = close_positions(node, automaton->scratch, count);
+    int32_t next = find_state(node, automaton->scratch, count);
+    if (next >= 0) {
+        automaton->states[from].transitions[c] = next;
+    }
+    return next;
+}
+
+/*!
+ * @brief match_globs runs the DFA of the globs of a node on a name
+ * @param node is the node
+ * @param name is the name of an entry
+ * @return the final state (its accepted globs match the name), NULL in case of error
+ */
+static dfa_state_t *match_globs(filter_node_t *node, const char *name) {
+    if (node->automaton == NULL && build_automaton(node) == -1) {
+        return NULL;
+    }
+    glob_automaton_t *automaton = node->automaton;
+    const unsigned char *bytes = (const unsigned char *) name;
+    int32_t state = 0;
+    for (size_t i = 0; bytes[i] != '\0' && automaton->states[state].count > 0; ++i) {
+        int32_t next = automaton->states[state].transitions[bytes[i]];
+        if (next == -1) {
+            next = step_state(node, state, bytes[i]);
+            if (next == -1) {
+                // The cached states are dropped, the name is matched again from the start state
+                if (reset_automaton(node) == -1) {
+                    return NULL;
+                }
+                state = 0;
+                i = (size_t) -1;
+                continue;
+            }
+            if (next < 0) {
+                return NULL;
+            }
+        }
+        state = next;
+    }
+    return &automaton->states[state];
+}
+
+/*!
+ * @brief reach_node records that an entry reaches a node of the trie
+ * @param node is the node
+ * @param is_directory is true if the entry is a directory
+ * @param best is the first rule matching the entry so far (-1 if none)
+ * @param child_state receives the nodes reached by a directory (NULL if not needed)
+ * @return the first rule matching the entry
+ */
+static int32_t reach_node(uint32_t node, bool is_directory, int32_t best, filter_state_t *child_state) {
+    int32_t rule = filters.nodes[node].rule;
+    int32_t directory_rule = filters.nodes[node].directory_rule;
+    if (is_directory && directory_rule != -1 && (rule == -1 || directory_rule < rule)) {
+        rule = directory_rule;
+    }
+    if (rule != -1 && (best == -1 || rule < best)) {
+        best = rule;
+    }
+    if (is_directory && child_state != NULL) {
+        add_to_state(child_state, node);
+    }
+    return best;
+}
+
+/*!
+ * @brief filter_entry tells if an entry of a directory is included
+ * @param state is the state of the directory
+ * @param name is the name of the entry
+ * @param is_directory is true if the entry is a directory
+ * @param child_state receives the state of the entry if it is a directory (NULL if not needed)
+ * @return true if the entry is included, false if it is excluded
+ */
+bool filter_entry(filter_state_t *state, char *name, bool is_directory, filter_state_t *child_state) {
+    if (child_state != NULL) {
+        child_state->count = 0;
+    }
+    if (state == NULL || state->count == 0) {
+        return true;
+    }
+
+    uint64_t name_hash = hash_name(name);
+    uint64_t suffix_hashes[PATH_SIZE];
+    size_t name_length = 0;
+    int32_t best = -1;
+    for (size_t i = 0; i < state->count; ++i) {
+        uint32_t index = state->nodes[i];
+        uint32_t literal = find_literal(index, name, name_hash);
+        if (literal != 0) {
+            best = reach_node(literal, is_directory, best, child_state);
+        }
+        filter_node_t *node = &filters.nodes[index];
+        if (node->has_suffixes) {
+            if (name_length == 0) {
+                name_length = hash_suffixes(name, suffix_hashes);
+            }
+            // A suffix edge needs at least one byte after the star
+            for (size_t start = 0; start < name_length; ++start) {
+                uint32_t suffix = find_literal(SUFFIX_KEY(index), name + start, suffix_hashes[start]);
+                if (suffix != 0) {
+                    best = reach_node(suffix, is_directory, best, child_state);
+                }
+            }
+        }
+        if (node->globs_count > 0) {
+            dfa_state_t *final = match_globs(node, name);
+            for (uint32_t j = 0; final != NULL && j < final->accepted_count; ++j) {
+                best = reach_node(node->globs[final->accepted[j]].child, is_directory, best, child_state);
+            }
+        }
+        if (node->is_star) {
+            best = reach_node(index, is_directory, best, child_state);
+        }
+    }
+    return best == -1 || filters.rule_includes[best];
+}
+
+/*!
+ * @brief filter_directory_content removes the excluded entries of a directory content
+ * @param children is the content of the directory
+ * @param state is the state of the directory
+ */
+void filter_directory_content(files_list_t *children, filter_state_t *state) {
+    if (children == NULL || state == NULL || state->count == 0) {
+        return;
+    }
+    files_list_entry_t *cursor = children->head;
+    while (cursor != NULL) {
+        files_list_entry_t *next = cursor->next;
+        char *name = strrchr(cursor->path_and_name, '/');
+        name = (name == NULL) ? cursor->path_and_name : name + 1;
+        if (!filter_entry(state, name, cursor->entry_type == DOSSIER, NULL)) {
+            if (cursor->prev != NULL) {
+                cursor->prev->next = next;
+            } else {
+                children->head = next;
+            }
+            if (next != NULL) {
+                next->prev = cursor->prev;
+            } else {
+                children->tail = cursor->prev;
+            }
+            free(cursor);
+        }
+        cursor = next;
+    }
+}
+
+/*!
+ * @brief clean_filters releases the compiled rules
+ */
+void clean_filters(void) {
+    for (uint32_t i = 0; i < filters.nodes_count; ++i) {
+        filter_node_t *node = &filters.nodes[i];
+        for (uint32_t j = 0; j < node->globs_count; ++j) {
+            free(node->globs[j].text);
+            free(node->globs[j].tokens);
+        }
+        free(node->globs);
+        if (node->automaton != NULL) {
+            for (uint32_t j = 0; j < node->automaton->count; ++j) {
+                free(node->automaton->states[j].positions);
+                free(node->automaton->states[j].accepted);
+            }
+            free(node->automaton->states);
+            free(node->automaton->table);
+            free(node->automaton->scratch);
+            free(node->automaton);
+        }
+    }
+    for (size_t i = 0; i < filters.literals_capacity; ++i) {
+        free(filters.literals[i].name);
+    }
+    free(filters.nodes);
+    free(filters.literals);
+    free(filters.rule_includes);
+    memset(&filters, 0, sizeof(filters_t));
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "configuration.h"
+#include "files-list.h"
+
+// A DFA of the glob segments of a trie node stops caching its states beyond this count
+#define FILTER_MAX_DFA_STATES 4096
+
+// Trie nodes reached by the path of a directory: they match the names of its content
+typedef struct {
+    uint32_t *nodes;
+    size_t count;
+    size_t capacity;
+} filter_state_t;
+
+int init_filters(configuration_t *the_config);
+bool has_filters(void);
+int init_filter_state(filter_state_t *state);
+bool filter_entry(filter_state_t *state, char *name, bool is_directory, filter_state_t *child_state);
+void filter_directory_content(files_list_t *children, filter_state_t *state);
+void clear_filter_state(filter_state_t *state);
+void clean_filters(void);
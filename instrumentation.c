@@ -0,0 +1,232 @@
+#include "instrumentation.h"
+#include "utility.h"
+#include "trace.h"
+#include <string.h>
+#include <sys/mman.h>
+
+// The counters live in an anonymous shared mapping created before the processes are forked,
+// so that listers, analyzers and the main process all add to the same counters.
+static instrumentation_t *counters = NULL;
+
+static const char *stages_names[STAGES_COUNT] = {"listing", "stat", "hash", "ipc_send", "ipc_receive", "diff", "copy", "metadata"};
+
+/*!
+ * @brief init_instrumentation enables the counters of all the stages
+ * It must be called before the processes are created (@see prepare)
+ * @param has_progress enables the periodic progress line (@see display_progress)
+ * @return 0 in case of success, -1 else
+ */
+int init_instrumentation(bool has_progress) {
+    if (counters != NULL) {
+        return 0;
+    }
+
+    void *mapping = mmap(NULL, sizeof(instrumentation_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED) {
+        perror("Cannot allocate the instrumentation counters");
+        return -1;
+    }
+    counters = (instrumentation_t *) mapping;
+    memset(counters, 0, sizeof(instrumentation_t));
+    counters->has_progress = has_progress;
+    clock_gettime(CLOCK_MONOTONIC, &counters->start);
+    counters->last_progress = counters->start;
+    return 0;
+}
+
+/*!
+ * @brief is_instrumentation_enabled tells if the counters are enabled
+ * @return true if init_instrumentation was called, false else
+ */
+bool is_instrumentation_enabled(void) {
+    return counters != NULL;
+}
+
+/*!
+ * @brief instrument_begin marks the beginning of a measured operation
+ * @param start is a pointer to the instant to set (left untouched when instrumentation is disabled)
+ */
+void instrument_begin(struct timespec *start) {
+    if (counters != NULL) {
+        clock_gettime(CLOCK_MONOTONIC, start);
+    }
+}
+
+/*!
+ * @brief instrument_end accounts a measured operation to a stage, and records it in the trace (@see trace.c)
+ * @param stage is the stage of the operation
+ * @param start is a pointer to the instant set by instrument_begin
+ * @param bytes is the amount of data processed by the operation (0 if not relevant)
+ */
+void instrument_end(stage_t stage, struct timespec *start, uint64_t bytes) {
+    instrument_end_path(stage, start, bytes, NULL);
+}
+
+/*!
+ * @brief instrument_end_path accounts a measured operation on a file to a stage, and records it in the
+ * trace with the path of the file
+ * @param stage is the stage of the operation
+ * @param start is a pointer to the instant set by instrument_begin
+ * @param bytes is the amount of data processed by the operation (0 if not relevant)
+ * @param path is the file (or directory) of the operation, NULL if none
+ */
+void instrument_end_path(stage_t stage, struct timespec *start, uint64_t bytes, const char *path) {
+    if (counters == NULL || stage >= STAGES_COUNT) {
+        return;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int64_t duration_ns = (int64_t) (now.tv_sec - start->tv_sec) * 1000000000LL + (now.tv_nsec - start->tv_nsec);
+    if (duration_ns < 0) {
+        duration_ns = 0;
+    }
+
+    int bucket = 0;
+    for (uint64_t microseconds = (uint64_t) duration_ns / 1000; microseconds > 0 && bucket < HISTOGRAM_BUCKETS - 1; microseconds >>= 1) {
+        ++bucket;
+    }
+
+    stage_counters_t *stage_counters = &counters->stages[stage];
+    __atomic_fetch_add(&stage_counters->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stage_counters->bytes, bytes, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stage_counters->total_ns, (uint64_t) duration_ns, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stage_counters->histogram[bucket], 1, __ATOMIC_RELAXED);
+    size_class_counters_t *size_class = &stage_counters->size_classes[get_size_class(bytes)];
+    __atomic_fetch_add(&size_class->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&size_class->bytes, bytes, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&size_class->total_ns, (uint64_t) duration_ns, __ATOMIC_RELAXED);
+    uint64_t max_ns = __atomic_load_n(&stage_counters->max_ns, __ATOMIC_RELAXED);
+    while ((uint64_t) duration_ns > max_ns &&
+           !__atomic_compare_exchange_n(&stage_counters->max_ns, &max_ns, (uint64_t) duration_ns, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    record_trace_event((uint32_t) stage, start, &now, bytes, path);
+}
+
+/*!
+ * @brief get_stage_name gives the name of a stage in the reports
+ * @param stage is the stage
+ * @return its name, "unknown" for an invalid stage
+ */
+const char *get_stage_name(stage_t stage) {
+    return (stage < STAGES_COUNT) ? stages_names[stage] : "unknown";
+}
+
+/*!
+ * @brief get_size_class gives the size class of an operation
+ * @param bytes is the amount of data processed by the operation
+ * @return the class, from 0 (less than 4 KiB) to SIZE_CLASSES - 1
+ */
+int get_size_class(uint64_t bytes) {
+    int size_class = 0;
+    for (uint64_t rest = bytes >> SMALLEST_SIZE_CLASS_BITS; rest > 0 && size_class < SIZE_CLASSES - 1; rest >>= 2) {
+        ++size_class;
+    }
+    return size_class;
+}
+
+/*!
+ * @brief get_stage_counters copies the counters of a stage, added up by all the processes
+ * @param stage is the stage
+ * @param result is a pointer to the counters to fill
+ * @return 0 in case of success, -1 if the instrumentation is disabled
+ */
+int get_stage_counters(stage_t stage, stage_counters_t *result) {
+    if (counters == NULL || stage >= STAGES_COUNT || result == NULL) {
+        return -1;
+    }
+    memcpy(result, &counters->stages[stage], sizeof(stage_counters_t));
+    return 0;
+}
+
+/*!
+ * @brief get_instrumented_seconds gives the time elapsed since init_instrumentation
+ * @return the time in seconds, 0 if the instrumentation is disabled
+ */
+double get_instrumented_seconds(void) {
+    if (counters == NULL) {
+        return 0.0;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return elapsed_seconds(&counters->start, &now);
+}
+
+/*!
+ * @brief display_progress displays a progress line on stderr, at most once per PROGRESS_PERIOD_SECONDS
+ * Nothing is displayed unless the progress line was enabled by init_instrumentation.
+ * @param force displays the line even if the period is not over
+ */
+void display_progress(bool force) {
+    if (counters == NULL || !counters->has_progress) {
+        return;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (!force && elapsed_seconds(&counters->last_progress, &now) < PROGRESS_PERIOD_SECONDS) {
+        return;
+    }
+    counters->last_progress = now;
+
+    stage_counters_t *stages = counters->stages;
+    fprintf(stderr, "[progress] t=%.1fs dirs=%lu stat=%lu hashed=%lu (%.1f MiB) compared=%lu copied=%lu (%.1f MiB) updated=%lu\n",
+            elapsed_seconds(&counters->start, &now),
+            (unsigned long) stages[STAGE_LISTING].count, (unsigned long) stages[STAGE_STAT].count,
+            (unsigned long) stages[STAGE_HASH].count, (double) stages[STAGE_HASH].bytes / (1024.0 * 1024.0),
+            (unsigned long) stages[STAGE_DIFF].count,
+            (unsigned long) stages[STAGE_COPY].count, (double) stages[STAGE_COPY].bytes / (1024.0 * 1024.0),
+            (unsigned long) stages[STAGE_METADATA].count);
+}
+
+/*!
+ * @brief write_instrumentation_report writes the counters of all the stages as a JSON document
+ * @param path is the path of the file to write, "-" for stdout
+ * @return 0 in case of success, -1 else
+ */
+int write_instrumentation_report(char *path) {
+    if (counters == NULL || path == NULL) {
+        return -1;
+    }
+
+    FILE *output = (strcmp(path, "-") == 0) ? stdout : fopen(path, "w");
+    if (output == NULL) {
+        perror("Cannot open the instrumentation report");
+        return -1;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    fprintf(output, "{\n  \"elapsed_s\": %.6f,\n  \"stages\": {\n", elapsed_seconds(&counters->start, &now));
+    for (int stage = 0; stage < STAGES_COUNT; ++stage) {
+        stage_counters_t *stage_counters = &counters->stages[stage];
+        double total_s = (double) stage_counters->total_ns / 1e9;
+        fprintf(output, "    \"%s\": {\"count\": %lu, \"bytes\": %lu, \"total_s\": %.6f, \"max_s\": %.6f, \"bytes_per_s\": %.1f, \"histogram_us_log2\": [",
+                stages_names[stage], (unsigned long) stage_counters->count, (unsigned long) stage_counters->bytes,
+                total_s, (double) stage_counters->max_ns / 1e9,
+                (total_s > 0.0) ? (double) stage_counters->bytes / total_s : 0.0);
+        int last_bucket = HISTOGRAM_BUCKETS - 1;
+        while (last_bucket > 0 && stage_counters->histogram[last_bucket] == 0) {
+            --last_bucket;
+        }
+        for (int bucket = 0; bucket <= last_bucket; ++bucket) {
+            fprintf(output, "%s%lu", (bucket > 0) ? ", " : "", (unsigned long) stage_counters->histogram[bucket]);
+        }
+        fprintf(output, "]}%s\n", (stage < STAGES_COUNT - 1) ? "," : "");
+    }
+    fprintf(output, "  }\n}\n");
+
+    if (output != stdout) {
+        fclose(output);
+    }
+    return 0;
+}
+
+/*!
+ * @brief clean_instrumentation releases the counters
+ */
+void clean_instrumentation(void) {
+    if (counters != NULL) {
+        munmap(counters, sizeof(instrumentation_t));
+        counters = NULL;
+    }
+}
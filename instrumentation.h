@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+// Latencies are counted in power of 2 buckets of microseconds: [0, 1us[, [1us, 2us[, [2us, 4us[...
+#define HISTOGRAM_BUCKETS 32
+#define PROGRESS_PERIOD_SECONDS 1.0
+// Operations are also counted by size in power of 4 classes: [0, 4 KiB[, [4 KiB, 16 KiB[, [16 KiB, 64 KiB[...
+#define SIZE_CLASSES 12
+#define SMALLEST_SIZE_CLASS_BITS 12
+
+typedef enum {
+    STAGE_LISTING, // One event per listed directory
+    STAGE_STAT, // With the size of the regular files as bytes
+    STAGE_HASH,
+    STAGE_IPC_SEND,
+    STAGE_IPC_RECEIVE,
+    STAGE_DIFF,
+    STAGE_COPY,
+    STAGE_METADATA, // Metadata-only updates of destination entries (mode, mtime)
+    STAGES_COUNT
+} stage_t;
+
+typedef struct {
+    uint64_t count;
+    uint64_t bytes;
+    uint64_t total_ns;
+} size_class_counters_t;
+
+typedef struct {
+    uint64_t count;
+    uint64_t bytes;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t histogram[HISTOGRAM_BUCKETS];
+    size_class_counters_t size_classes[SIZE_CLASSES]; // The cost of a file depends on its size (@see plan.c)
+} stage_counters_t;
+
+typedef struct {
+    bool has_progress;
+    struct timespec start;
+    struct timespec last_progress;
+    stage_counters_t stages[STAGES_COUNT];
+} instrumentation_t;
+
+int init_instrumentation(bool has_progress);
+bool is_instrumentation_enabled(void);
+void instrument_begin(struct timespec *start);
+void instrument_end(stage_t stage, struct timespec *start, uint64_t bytes);
+void instrument_end_path(stage_t stage, struct timespec *start, uint64_t bytes, const char *path);
+const char *get_stage_name(stage_t stage);
+int get_size_class(uint64_t bytes);
+int get_stage_counters(stage_t stage, stage_counters_t *result);
+double get_instrumented_seconds(void);
+void display_progress(bool force);
+int write_instrumentation_report(char *path);
+void clean_instrumentation(void);
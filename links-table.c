@@ -0,0 +1,139 @@
+#include "links-table.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LINKS_TABLE_INITIAL_CAPACITY 64
+
+/*!
+ * @brief make_inode_key builds the key of the inode of an entry (@see get_file_metadata)
+ * @param key is the key to build
+ * @param entry is a pointer to the entry
+ */
+void make_inode_key(uint64_t key[LINK_KEY_SIZE], files_list_entry_t *entry) {
+    key[0] = (uint64_t) entry->device;
+    key[1] = (uint64_t) entry->inode;
+    key[2] = 0;
+}
+
+/*!
+ * @brief make_content_key builds the key of the content of an entry, from its MD5 sum and its size
+ * @param key is the key to build
+ * @param entry is a pointer to the entry
+ */
+void make_content_key(uint64_t key[LINK_KEY_SIZE], files_list_entry_t *entry) {
+    memcpy(&key[0], entry->md5sum, sizeof(uint64_t));
+    memcpy(&key[1], entry->md5sum + sizeof(uint64_t), sizeof(uint64_t));
+    key[2] = entry->size;
+}
+
+/*!
+ * @brief hash_key mixes the words of a key (both MD5 sums and inode numbers are spread enough
+ * for a multiplicative hash)
+ */
+static size_t hash_key(uint64_t key[LINK_KEY_SIZE], size_t capacity) {
+    uint64_t hash = 0;
+    for (int i = 0; i < LINK_KEY_SIZE; ++i) {
+        hash = (hash ^ key[i]) * 0x9E3779B97F4A7C15ULL;
+    }
+    return (size_t) (hash >> 32) & (capacity - 1);
+}
+
+/*!
+ * @brief find_link looks for a key in a table
+ * @param table is a pointer to the table
+ * @param key is the key to look for
+ * @return a pointer to the slot of the key, NULL if it is not in the table
+ */
+link_slot_t *find_link(links_table_t *table, uint64_t key[LINK_KEY_SIZE]) {
+    if (table == NULL || table->capacity == 0) {
+        return NULL;
+    }
+
+    for (size_t index = hash_key(key, table->capacity);; index = (index + 1) & (table->capacity - 1)) {
+        link_slot_t *slot = &table->slots[index];
+        if (!slot->is_used) {
+            return NULL;
+        }
+        if (memcmp(slot->key, key, sizeof(slot->key)) == 0) {
+            return slot;
+        }
+    }
+}
+
+/*!
+ * @brief grow_table doubles the capacity of a table
+ * @param table is a pointer to the table
+ * @return 0 in case of success, -1 else
+ */
+static int grow_table(links_table_t *table) {
+    size_t new_capacity = (table->capacity == 0) ? LINKS_TABLE_INITIAL_CAPACITY : table->capacity * 2;
+    link_slot_t *new_slots = calloc(new_capacity, sizeof(link_slot_t));
+    if (new_slots == NULL) {
+        printf("Error when allocating memory in the function grow_table of the file links-table.c\n");
+        return -1;
+    }
+
+    for (size_t i = 0; i < table->capacity; ++i) {
+        if (table->slots[i].is_used) {
+            size_t index = hash_key(table->slots[i].key, new_capacity);
+            while (new_slots[index].is_used) {
+                index = (index + 1) & (new_capacity - 1);
+            }
+            new_slots[index] = table->slots[i];
+        }
+    }
+    free(table->slots);
+    table->slots = new_slots;
+    table->capacity = new_capacity;
+    return 0;
+}
+
+/*!
+ * @brief insert_link returns the slot of a key, adding it to the table if needed
+ * @param table is a pointer to the table
+ * @param key is the key to insert
+ * @return a pointer to the slot of the key (is_used is set, other fields are zeroed for a new key), NULL on error
+ */
+link_slot_t *insert_link(links_table_t *table, uint64_t key[LINK_KEY_SIZE]) {
+    if (table == NULL) {
+        return NULL;
+    }
+
+    link_slot_t *slot = find_link(table, key);
+    if (slot != NULL) {
+        return slot;
+    }
+    // Keep the load factor under 1/2
+    if ((table->count + 1) * 2 > table->capacity && grow_table(table) == -1) {
+        return NULL;
+    }
+
+    size_t index = hash_key(key, table->capacity);
+    while (table->slots[index].is_used) {
+        index = (index + 1) & (table->capacity - 1);
+    }
+    slot = &table->slots[index];
+    memcpy(slot->key, key, sizeof(slot->key));
+    slot->is_used = true;
+    ++table->count;
+    return slot;
+}
+
+/*!
+ * @brief clear_links_table frees all the slots of a table
+ * @param table is a pointer to the table
+ */
+void clear_links_table(links_table_t *table) {
+    if (table == NULL) {
+        return;
+    }
+
+    for (size_t i = 0; i < table->capacity; ++i) {
+        free(table->slots[i].path);
+    }
+    free(table->slots);
+    table->slots = NULL;
+    table->capacity = 0;
+    table->count = 0;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "files-list.h"
+
+// Keys are either an inode (device, inode number) or a content (MD5 sum, size)
+#define LINK_KEY_SIZE 3
+
+typedef struct {
+    uint64_t key[LINK_KEY_SIZE];
+    bool is_used;
+    char *path; // Path of the destination file holding this inode or content (NULL if none)
+    uint8_t md5sum[16]; // Known MD5 sum of the inode
+    mode_t mode;
+    timespec mtime;
+} link_slot_t;
+
+typedef struct {
+    link_slot_t *slots; // Open addressing, linear probing
+    size_t capacity; // Power of 2
+    size_t count;
+} links_table_t;
+
+void make_inode_key(uint64_t key[LINK_KEY_SIZE], files_list_entry_t *entry);
+void make_content_key(uint64_t key[LINK_KEY_SIZE], files_list_entry_t *entry);
+link_slot_t *find_link(links_table_t *table, uint64_t key[LINK_KEY_SIZE]);
+link_slot_t *insert_link(links_table_t *table, uint64_t key[LINK_KEY_SIZE]);
+void clear_links_table(links_table_t *table);
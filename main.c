@@ -4,6 +4,17 @@
 #include "configuration.h"
 #include "file-properties.h"
 #include "processes.h"
+#include "instrumentation.h"
+#include "trace.h"
+#include "file-io.h"
+#include "throttle.h"
+#include "durability.h"
+#include "checkpoint.h"
+#include "filters.h"
+#include "remote.h"
+#include "receiver.h"
+#include "plan.h"
+#include "restore.h"
 #include <unistd.h>
 
 /*!
@@ -25,26 +36,117 @@ int main(int argc, char *argv[]) {
         return -1;
     }
 
-    // Check directories
-    if (!directory_exists(my_config.source) || !directory_exists(my_config.destination)) {
+    // A receiver serves its destination until it is stopped
+    if (my_config.serve_address[0] != '\0') {
+        if (!directory_exists(my_config.destination) || !is_directory_writable(my_config.destination)) {
+            printf("Destination directory %s does not exist or is not writable\nAborting\n", my_config.destination);
+            return -1;
+        }
+        return run_receiver(&my_config);
+    }
+
+    // A restore rebuilds the tree of a backup, without the processes of a run
+    if (my_config.uses_restore) {
+        if (!directory_exists(my_config.source) || !directory_exists(my_config.destination) ||
+            !is_directory_writable(my_config.destination)) {
+            printf("Either backup or target directory do not exist, or the target is not writable\nAborting\n");
+            return -1;
+        }
+        return restore_backup(&my_config);
+    }
+
+    // Check directories (a remote destination is checked by its receiver)
+    bool is_remote = is_remote_address(my_config.destination);
+    if (!directory_exists(my_config.source) || (!is_remote && !directory_exists(my_config.destination))) {
         printf("Either source or destination directory do not exist\nAborting\n");
         return -1;
     }
+    for (int i = 1; i < get_destinations_count(&my_config); ++i) {
+        if (!directory_exists(get_destination(&my_config, i)) || !is_directory_writable(get_destination(&my_config, i))) {
+            printf("Destination directory %s does not exist or is not writable\nAborting\n", get_destination(&my_config, i));
+            return -1;
+        }
+    }
+    if (my_config.link_dest[0] != '\0' && !directory_exists(my_config.link_dest)) {
+        printf("The previous snapshot %s does not exist\nAborting\n", my_config.link_dest);
+        return -1;
+    }
     // Is destination writable?
-    if (!is_directory_writable(my_config.destination)) {
+    if (!is_remote && !is_directory_writable(my_config.destination)) {
         printf("Destination directory %s is not writable\n", my_config.destination);
         return -1;
     }
 
+    // A dry run compares the trees without hashing them, before the processes are forked and anything is displayed
+    if (init_plan(&my_config) == -1) {
+        return -1;
+    }
+
+    init_file_io(&my_config);
+    // The priority and the limits must be set before the processes are forked, to apply to all of them
+    if (init_throttle(&my_config) == -1) {
+        return -1;
+    }
+
+    // The journal is shared by the processes, and the temporary files of an interrupted run are removed
+    if (init_durability(&my_config) == -1) {
+        return -1;
+    }
+
+    // The listers share the compiled filter rules
+    if (init_filters(&my_config) == -1) {
+        return -1;
+    }
+
+    // The listers skip what the interrupted run already handled
+    if (!is_remote && init_checkpoint(&my_config) == -1) {
+        return -1;
+    }
+
+    // Counters must be shared before the processes are forked (a plan needs the sizes of the files scanned)
+    if (my_config.uses_verbose || my_config.stats_file[0] != '\0' || my_config.trace_file[0] != '\0' ||
+        my_config.uses_dry_run || my_config.measures_throughput) {
+        init_instrumentation(my_config.uses_verbose);
+    }
+    if (my_config.trace_file[0] != '\0' && init_trace() == 0) {
+        set_trace_process_name("main");
+    }
+
     // Prepare (fork, MQ) if parallel
     process_context_t processes_context;
-    prepare(&my_config, &processes_context);
+    if (prepare(&my_config, &processes_context) == -1) {
+        printf("Cannot create the processes of the run\nAborting\n");
+        // The processes already forked are stopped
+        clean_processes(&my_config, &processes_context);
+        return -1;
+    }
 
     // Run synchronize:
     synchronize(&my_config, &processes_context);
     
     // Clean resources
     clean_processes(&my_config, &processes_context);
+    clean_durability(true);
+    clean_filters();
+
+    // A dry run reports its plan, a run with --measure-throughput records its throughput
+    if (my_config.uses_dry_run) {
+        write_plan_report(&my_config);
+    } else {
+        save_throughput_profile(&my_config);
+    }
+
+    // Report the counters of each stage
+    display_progress(true);
+    if (my_config.stats_file[0] != '\0') {
+        write_instrumentation_report(my_config.stats_file);
+    }
+    if (my_config.trace_file[0] != '\0') {
+        write_trace(my_config.trace_file);
+    }
+    clean_trace();
+    clean_instrumentation();
+    clean_throttle();
 
     return 0;
 }
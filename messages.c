@@ -1,26 +1,82 @@
 #include "messages.h"
 #include <sys/msg.h>
 #include <string.h>
+#include <errno.h>
+#include "instrumentation.h"
 
 // Functions in this file are required for inter processes communication
 
 /*!
- * @brief send_file_entry sends a file entry, with a given command code
+ * @brief send_message sends a message and accounts the time spent in msgsnd
+ * @param msg_queue the MQ identifier through which to send the message
+ * @param message is a pointer to the message (starting with its mtype)
+ * @param size is the size of the whole message structure
+ * @param msg_flags are the flags passed to msgsnd
+ * @return the result of the msgsnd function
+ */
+static int send_message(int msg_queue, void *message, size_t size, int msg_flags) {
+    struct timespec start;
+    instrument_begin(&start);
+    int result = msgsnd(msg_queue, message, size - sizeof(long), msg_flags);
+    if (result != -1) {
+        instrument_end(STAGE_IPC_SEND, &start, size - sizeof(long));
+    }
+    return result;
+}
+
+/*!
+ * @brief receive_message waits for a message for a given recipient
+ * The wait is accounted, and interrupted calls are restarted.
+ * @param msg_queue the MQ identifier through which to receive the message
+ * @param message is a pointer to the buffer receiving the message
+ * @param recipient is the id of the recipient (as specified by mtype)
+ * @param msg_flags are the flags passed to msgrcv (e.g. IPC_NOWAIT)
+ * @return the result of the msgrcv function
+ */
+int receive_message(int msg_queue, any_message_t *message, int recipient, int msg_flags) {
+    struct timespec start;
+    instrument_begin(&start);
+    ssize_t result;
+    while ((result = msgrcv(msg_queue, message, sizeof(any_message_t) - sizeof(long), recipient, msg_flags)) == -1 && errno == EINTR);
+    if (result != -1) {
+        instrument_end(STAGE_IPC_RECEIVE, &start, (uint64_t) result);
+    }
+    return (int) result;
+}
+
+/*!
+ * @brief send_file_entry_from sends a file entry, with a given command code, on behalf of a given sender
  * @param msg_queue the MQ identifier through which to send the entry
  * @param recipient is the id of the recipient (as specified by mtype)
+ * @param sender is the id of the sender (its own mtype), stored in reply_to so that the recipient
+ * can tell apart entries from several senders (e.g. source and destination listers)
  * @param file_entry is a pointer to the entry to send (must be copied)
  * @param cmd_code is the cmd code to process the entry.
+ * @param msg_flags are the flags passed to msgsnd (e.g. IPC_NOWAIT)
  * @return the result of the msgsnd function
- * Used by the specialized functions send_analyze*
  */
-int send_file_entry(int msg_queue, int recipient, files_list_entry_t *file_entry, int cmd_code) {
+int send_file_entry_from(int msg_queue, int recipient, int sender, files_list_entry_t *file_entry, int cmd_code, int msg_flags) {
     files_list_entry_transmit_t message;
     message.mtype = recipient;
     message.op_code = cmd_code;
     memcpy(&message.payload, file_entry, sizeof(files_list_entry_t));
-    message.reply_to = msg_queue;
+    message.reply_to = sender;
+    message.destinations = 0;
 
-    return msgsnd(msg_queue, &message, sizeof(files_list_entry_transmit_t) - sizeof(long), 0);
+    return send_message(msg_queue, &message, sizeof(files_list_entry_transmit_t), msg_flags);
+}
+
+/*!
+ * @brief send_file_entry sends a file entry, with a given command code
+ * @param msg_queue the MQ identifier through which to send the entry
+ * @param recipient is the id of the recipient (as specified by mtype)
+ * @param file_entry is a pointer to the entry to send (must be copied)
+ * @param cmd_code is the cmd code to process the entry.
+ * @return the result of the msgsnd function
+ * Used by the specialized functions send_analyze*
+ */
+int send_file_entry(int msg_queue, int recipient, files_list_entry_t *file_entry, int cmd_code) {
+    return send_file_entry_from(msg_queue, recipient, msg_queue, file_entry, cmd_code, 0);
 }
 
 /*!
@@ -37,7 +93,7 @@ int send_analyze_dir_command(int msg_queue, int recipient, char *target_dir) {
     strncpy(message.target, target_dir, PATH_SIZE);
     message.target[PATH_SIZE - 1] = '\0';
 
-    return msgsnd(msg_queue, &message, sizeof(analyze_dir_command_t) - sizeof(long), 0);
+    return send_message(msg_queue, &message, sizeof(analyze_dir_command_t), 0);
 }
 
 // The 3 following functions are one-liners
@@ -89,7 +145,57 @@ int send_list_end(int msg_queue, int recipient) {
     message.mtype = recipient;
     message.message = COMMAND_CODE_LIST_COMPLETE;
 
-    return msgsnd(msg_queue, &message, sizeof(simple_command_t) - sizeof(long), 0);
+    return send_message(msg_queue, &message, sizeof(simple_command_t), 0);
+}
+
+/*!
+ * @brief send_list_end_from sends the end of list message on behalf of a given sender
+ * It has the layout of a file entry message, so that the recipient can tell which list ended from reply_to.
+ * @param msg_queue is the id of the MQ used to send the message
+ * @param recipient is the destination of the message
+ * @param sender is the id of the sender (its own mtype)
+ * @return the result of msgsnd
+ */
+int send_list_end_from(int msg_queue, int recipient, int sender) {
+    files_list_entry_t empty_entry;
+    memset(&empty_entry, 0, sizeof(files_list_entry_t));
+    return send_file_entry_from(msg_queue, recipient, sender, &empty_entry, COMMAND_CODE_LIST_COMPLETE, 0);
+}
+
+/*!
+ * @brief send_copy_command sends an entry to copy to the copy workers
+ * @param msg_queue is the id of the MQ used to send the command
+ * @param recipient is the recipient of the message (mtype)
+ * @param file_entry is a pointer to the entry to copy
+ * @param destinations is the set of the destinations needing the entry, one bit each
+ * @param msg_flags are the flags passed to msgsnd (e.g. IPC_NOWAIT)
+ * @return the result of msgsnd
+ */
+int send_copy_command(int msg_queue, int recipient, files_list_entry_t *file_entry, int destinations, int msg_flags) {
+    files_list_entry_transmit_t message;
+    message.mtype = recipient;
+    message.op_code = COMMAND_CODE_COPY_ENTRY;
+    memcpy(&message.payload, file_entry, sizeof(files_list_entry_t));
+    message.reply_to = MSG_TYPE_TO_MAIN;
+    message.destinations = destinations;
+
+    return send_message(msg_queue, &message, sizeof(files_list_entry_transmit_t), msg_flags);
+}
+
+/*!
+ * @brief send_checkpoint_message sends one of the messages synchronizing a checkpoint (@see checkpoint.c)
+ * @param msg_queue is the id of the MQ used to send the message
+ * @param recipient is the destination of the message
+ * @param cmd_code is COMMAND_CODE_CHECKPOINT, COMMAND_CODE_CHECKPOINT_OK or COMMAND_CODE_CHECKPOINT_DONE
+ * @param msg_flags are the flags passed to msgsnd (e.g. IPC_NOWAIT)
+ * @return the result of msgsnd
+ */
+int send_checkpoint_message(int msg_queue, int recipient, char cmd_code, int msg_flags) {
+    simple_command_t message;
+    message.mtype = recipient;
+    message.message = cmd_code;
+
+    return send_message(msg_queue, &message, sizeof(simple_command_t), msg_flags);
 }
 
 /*!
@@ -103,7 +209,7 @@ int send_terminate_command(int msg_queue, int recipient) {
     message.mtype = recipient;
     message.message = COMMAND_CODE_TERMINATE;
 
-    return msgsnd(msg_queue, &message, sizeof(simple_command_t) - sizeof(long), 0);
+    return send_message(msg_queue, &message, sizeof(simple_command_t), 0);
 }
 
 
@@ -118,5 +224,5 @@ int send_terminate_confirm(int msg_queue, int recipient) {
     message.mtype = recipient;
     message.message = COMMAND_CODE_TERMINATE_OK;
 
-    return msgsnd(msg_queue, &message, sizeof(simple_command_t) - sizeof(long), 0);
+    return send_message(msg_queue, &message, sizeof(simple_command_t), 0);
 }
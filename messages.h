@@ -10,12 +10,19 @@
 #define COMMAND_CODE_ANALYZE_DIR 0x02
 #define COMMAND_CODE_FILE_ENTRY 0x12
 #define COMMAND_CODE_LIST_COMPLETE 0x22
+#define COMMAND_CODE_COPY_ENTRY 0x03
+#define COMMAND_CODE_CHECKPOINT 0x04
+#define COMMAND_CODE_CHECKPOINT_OK 0x14
+#define COMMAND_CODE_CHECKPOINT_DONE 0x24
 
 #define MSG_TYPE_TO_MAIN 1
 #define MSG_TYPE_TO_SOURCE_LISTER 2
 #define MSG_TYPE_TO_DESTINATION_LISTER 3
 #define MSG_TYPE_TO_SOURCE_ANALYZERS 4
 #define MSG_TYPE_TO_DESTINATION_ANALYZERS 5
+#define MSG_TYPE_TO_COPIERS 6
+#define MSG_TYPE_TO_HELD_COPIERS 7 // Copy workers waiting for the end of a checkpoint
+#define MSG_TYPE_TO_EXTRA_LISTERS 8 // Plus the index of the extra destination (@see get_destination)
 
 typedef struct {
     long mtype;
@@ -33,6 +40,7 @@ typedef struct {
     char op_code; // Contains the analyze file opcode
     files_list_entry_t payload;
     int reply_to; // MQ id of the sender, to build either source or destination list
+    int destinations; // Copy commands: bit i is set when the destination i needs the entry (@see get_destination)
 } files_list_entry_transmit_t;
 
 typedef struct {
@@ -48,11 +56,16 @@ typedef union {
     files_list_entry_transmit_t list_entry;
 } any_message_t;
 
+int receive_message(int msg_queue, any_message_t *message, int recipient, int msg_flags);
 int send_analyze_dir_command(int msg_queue, int recipient, char *target_dir);
+int send_file_entry_from(int msg_queue, int recipient, int sender, files_list_entry_t *file_entry, int cmd_code, int msg_flags);
 int send_file_entry(int msg_queue, int recipient, files_list_entry_t *file_entry, int cmd_code);
 int send_analyze_file_command(int msg_queue, int recipient, files_list_entry_t *file_entry);
 int send_analyze_file_response(int msg_queue, int recipient, files_list_entry_t *file_entry);
 int send_files_list_element(int msg_queue, int recipient, files_list_entry_t *file_entry);
 int send_list_end(int msg_queue, int recipient);
+int send_list_end_from(int msg_queue, int recipient, int sender);
+int send_copy_command(int msg_queue, int recipient, files_list_entry_t *file_entry, int destinations, int msg_flags);
+int send_checkpoint_message(int msg_queue, int recipient, char cmd_code, int msg_flags);
 int send_terminate_command(int msg_queue, int recipient);
 int send_terminate_confirm(int msg_queue, int recipient);
\ No newline at end of file
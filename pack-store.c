@@ -0,0 +1,707 @@
+#include "pack-store.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "file-io.h"
+#include "throttle.h"
+#include "utility.h"
+
+/*
+ * The pack store keeps the small files of a destination in a few large append-only pack files
+ * (pack-<number>.dat), so that copying them costs no create, no fsync and no metadata update per file.
+ * The index maps each relative path to its data (pack, offset, length) and to what the comparison
+ * needs (digest, mtime, mode). It is made of a header, the records sorted by path (@see path_compare)
+ * and the NUL-terminated paths, and is mapped as is: a lookup is a binary search in the mapping.
+ * A run appends the new versions of the files to the packs, then writes a new index (merging the
+ * previous one with its records) and renames it over the previous one: an interrupted run leaves the
+ * previous index, and some unreferenced data at the end of the packs.
+ */
+
+typedef struct {
+    char magic[8];
+    uint64_t count; // Number of records, following the header
+    uint64_t strings_offset; // Position of the paths in the file
+    uint64_t strings_size;
+} pack_index_header_t;
+
+static const char index_magic[8] = {'L', 'P', '2', '5', 'P', 'I', 'X', 1};
+
+// An index being built: its records and their paths
+typedef struct {
+    pack_index_record_t *records;
+    size_t count;
+    size_t capacity;
+    char *strings;
+    size_t strings_size;
+    size_t strings_capacity;
+} index_builder_t;
+
+/*!
+ * @brief make_store_path builds the path of a file of the pack store
+ * @param result is the buffer (PATH_SIZE bytes) receiving the path
+ * @param store is a pointer to the store
+ * @param name is the name of the file
+ * @return result, NULL if the path is too long
+ */
+static char *make_store_path(char *result, pack_store_t *store, char *name) {
+    return concat_path(result, store->directory, name);
+}
+
+/*!
+ * @brief make_pack_path builds the path of a pack file
+ * @param result is the buffer (PATH_SIZE bytes) receiving the path
+ * @param store is a pointer to the store
+ * @param pack is the number of the pack file
+ * @return result, NULL if the path is too long
+ */
+static char *make_pack_path(char *result, pack_store_t *store, uint32_t pack) {
+    char name[32];
+    snprintf(name, sizeof(name), "pack-%08u.dat", pack);
+    return make_store_path(result, store, name);
+}
+
+/*!
+ * @brief index_path gives the string of a record of the mapped index
+ */
+static char *index_path(pack_store_t *store, const pack_index_record_t *record) {
+    pack_index_header_t *header = (pack_index_header_t *) store->index_map;
+    return (char *) store->index_map + header->strings_offset + record->path_offset;
+}
+
+/*!
+ * @brief map_index maps the index of the store, when it exists and is valid
+ * @param store is a pointer to the store
+ */
+static void map_index(pack_store_t *store) {
+    char path[PATH_SIZE];
+    if (make_store_path(path, store, "index") == NULL) {
+        return;
+    }
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return;
+    }
+    struct stat index_stat;
+    if (fstat(fd, &index_stat) == -1 || (size_t) index_stat.st_size < sizeof(pack_index_header_t)) {
+        close(fd);
+        return;
+    }
+    void *map = mmap(NULL, (size_t) index_stat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("Cannot map the pack index");
+        return;
+    }
+
+    // Records and paths must lie in the file, and the paths must end with a NUL
+    pack_index_header_t *header = (pack_index_header_t *) map;
+    uint64_t size = (uint64_t) index_stat.st_size;
+    uint64_t records_end = sizeof(pack_index_header_t) + header->count * sizeof(pack_index_record_t);
+    if (memcmp(header->magic, index_magic, sizeof(index_magic)) != 0 ||
+        header->count > size / sizeof(pack_index_record_t) || records_end > header->strings_offset ||
+        header->strings_offset > size || header->strings_size > size - header->strings_offset ||
+        (header->count > 0 && (header->strings_size == 0 ||
+                               ((char *) map)[header->strings_offset + header->strings_size - 1] != '\0'))) {
+        printf("The pack index of %s is corrupted, its files will be packed again\n", store->directory);
+        munmap(map, (size_t) index_stat.st_size);
+        return;
+    }
+    store->index_map = map;
+    store->index_size = (size_t) index_stat.st_size;
+    store->index_count = header->count;
+}
+
+/*!
+ * @brief open_pack_store opens the pack store of a destination (it is created when a file is packed)
+ * @param store is a pointer to the store to open
+ * @param destination is the destination root
+ * @return 0 in case of success, -1 else
+ */
+int open_pack_store(pack_store_t *store, char *destination) {
+    memset(store, 0, sizeof(pack_store_t));
+    store->pack_fd = -1;
+    if (concat_path(store->directory, destination, PACK_STORE_NAME) == NULL) {
+        printf("The path of the pack store of %s is too long\n", destination);
+        return -1;
+    }
+
+    DIR *dir = opendir(store->directory);
+    if (dir == NULL) {
+        return (errno == ENOENT) ? 0 : -1;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        unsigned int pack;
+        char path[PATH_SIZE];
+        struct stat pack_stat;
+        if (sscanf(entry->d_name, "pack-%8u.dat", &pack) != 1 || make_pack_path(path, store, pack) == NULL ||
+            stat(path, &pack_stat) == -1) {
+            continue;
+        }
+        if (!store->has_packs || pack < store->first_pack) {
+            store->first_pack = pack;
+        }
+        if (!store->has_packs || pack > store->last_pack) {
+            store->last_pack = pack;
+        }
+        store->has_packs = true;
+        store->packs_size += (uint64_t) pack_stat.st_size;
+    }
+    closedir(dir);
+
+    map_index(store);
+    return 0;
+}
+
+/*!
+ * @brief find_index_record looks for a path in the mapped index (binary search)
+ * @param store is a pointer to the store
+ * @param relative is the path relative to the destination root
+ * @return a pointer to the record in the mapping, NULL if the path is not packed
+ */
+static const pack_index_record_t *find_index_record(pack_store_t *store, char *relative) {
+    if (store->index_map == NULL) {
+        return NULL;
+    }
+
+    const pack_index_record_t *records = (const pack_index_record_t *) (store->index_map + sizeof(pack_index_header_t));
+    pack_index_header_t *header = (pack_index_header_t *) store->index_map;
+    uint64_t low = 0, high = store->index_count;
+    while (low < high) {
+        uint64_t middle = low + (high - low) / 2;
+        if (records[middle].path_offset >= header->strings_size) {
+            return NULL;
+        }
+        int comparison = path_compare(index_path(store, &records[middle]), relative);
+        if (comparison == 0) {
+            return &records[middle];
+        }
+        if (comparison < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return NULL;
+}
+
+/*!
+ * @brief find_packed_file gets the properties of a packed file, as recorded in the index
+ * @param store is a pointer to the store
+ * @param relative is the path relative to the destination root
+ * @param entry is a pointer to the entry receiving the type, size, mtime, mode and digest of the file
+ * @return 0 if the file is packed, -1 else
+ */
+int find_packed_file(pack_store_t *store, char *relative, files_list_entry_t *entry) {
+    const pack_index_record_t *record = find_index_record(store, relative);
+    if (record == NULL) {
+        return -1;
+    }
+    entry->entry_type = FICHIER;
+    entry->size = record->length;
+    entry->mtime.tv_sec = (time_t) record->mtime_sec;
+    entry->mtime.tv_nsec = (long) record->mtime_nsec;
+    entry->mode = (mode_t) record->mode;
+    memcpy(entry->md5sum, record->md5sum, sizeof(entry->md5sum));
+    return 0;
+}
+
+/*!
+ * @brief open_next_pack opens the pack file receiving the data of a file
+ * The last pack file is completed before a new one is started.
+ * @param store is a pointer to the store
+ * @param size is the size of the data to pack
+ * @return 0 in case of success, -1 else
+ */
+static int open_next_pack(pack_store_t *store, uint64_t size) {
+    if (store->pack_fd != -1) {
+        if (store->pack_size == 0 || store->pack_size + size <= PACK_MAX_SIZE) {
+            return 0;
+        }
+        // The full pack must be on disk before the index refers to it
+        fsync(store->pack_fd);
+        close(store->pack_fd);
+        store->pack_fd = -1;
+        ++store->last_pack;
+    } else if (mkdir(store->directory, 0755) == -1 && errno != EEXIST) {
+        perror("Cannot create the pack store");
+        return -1;
+    }
+
+    if (!store->has_packs) {
+        store->has_packs = true;
+        store->first_pack = 0;
+        store->last_pack = 0;
+    }
+    char path[PATH_SIZE];
+    if (make_pack_path(path, store, store->last_pack) == NULL) {
+        return -1;
+    }
+    store->pack_fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    struct stat pack_stat;
+    if (store->pack_fd == -1 || fstat(store->pack_fd, &pack_stat) == -1) {
+        perror("Cannot open a pack file");
+        return -1;
+    }
+    store->pack_size = (uint64_t) pack_stat.st_size;
+    return open_next_pack(store, size);
+}
+
+/*!
+ * @brief write_all writes a buffer completely
+ * @return 0 in case of success, -1 else
+ */
+static int write_all(int fd, unsigned char *data, size_t size) {
+    while (size > 0) {
+        ssize_t written = write(fd, data, size);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        data += written;
+        size -= (size_t) written;
+    }
+    return 0;
+}
+
+/*!
+ * @brief pack_file appends the data of a file to the packs, and records it for the next index
+ * @param store is a pointer to the store
+ * @param source_entry is a pointer to the entry of the source file (its digest is recorded)
+ * @param relative is the path of the file relative to the source root
+ * @return the number of bytes packed, -1 in case of error
+ */
+int64_t pack_file(pack_store_t *store, files_list_entry_t *source_entry, char *relative) {
+    if (store->records_count == store->records_capacity) {
+        size_t new_capacity = (store->records_capacity == 0) ? 1024 : store->records_capacity * 2;
+        pack_record_t *new_records = realloc(store->records, new_capacity * sizeof(pack_record_t));
+        if (new_records == NULL) {
+            printf("Error when allocating memory in the function pack_file of the file pack-store.c\n");
+            return -1;
+        }
+        store->records = new_records;
+        store->records_capacity = new_capacity;
+    }
+
+    io_file_t reader;
+    if (open_next_pack(store, source_entry->size) == -1) {
+        return -1;
+    }
+    if (open_file_reader(&reader, source_entry->path_and_name) == -1) {
+        perror("Cannot open source file");
+        return -1;
+    }
+
+    uint64_t offset = store->pack_size;
+    ssize_t bytes_read;
+    while ((bytes_read = read_file_block(&reader)) > 0) {
+        throttle_write((uint64_t) bytes_read);
+        if (write_all(store->pack_fd, reader.buffer, (size_t) bytes_read) == -1) {
+            bytes_read = -1;
+            break;
+        }
+        store->pack_size += (uint64_t) bytes_read;
+        store->packs_size += (uint64_t) bytes_read;
+    }
+    close_io_file(&reader);
+    if (bytes_read == -1) {
+        perror("Cannot pack file");
+        return -1;
+    }
+
+    pack_record_t *record = &store->records[store->records_count];
+    record->path = strdup(relative);
+    if (record->path == NULL) {
+        printf("Error when allocating memory in the function pack_file of the file pack-store.c\n");
+        return -1;
+    }
+    memset(&record->record, 0, sizeof(pack_index_record_t));
+    record->record.pack = store->last_pack;
+    record->record.mode = (uint32_t) source_entry->mode;
+    record->record.offset = offset;
+    record->record.length = store->pack_size - offset;
+    record->record.mtime_sec = (int64_t) source_entry->mtime.tv_sec;
+    record->record.mtime_nsec = (int64_t) source_entry->mtime.tv_nsec;
+    memcpy(record->record.md5sum, source_entry->md5sum, sizeof(record->record.md5sum));
+    ++store->records_count;
+    return (int64_t) record->record.length;
+}
+
+/*!
+ * @brief add_index_record appends a record and its path to an index being built
+ * @param builder is a pointer to the index being built
+ * @param record is a pointer to the record (its path offset is set by this function)
+ * @param path is its relative path
+ * @return 0 in case of success, -1 else
+ */
+static int add_index_record(index_builder_t *builder, const pack_index_record_t *record, char *path) {
+    size_t path_size = strlen(path) + 1;
+    if (builder->count == builder->capacity) {
+        size_t new_capacity = (builder->capacity == 0) ? 1024 : builder->capacity * 2;
+        pack_index_record_t *new_records = realloc(builder->records, new_capacity * sizeof(pack_index_record_t));
+        if (new_records == NULL) {
+            return -1;
+        }
+        builder->records = new_records;
+        builder->capacity = new_capacity;
+    }
+    if (builder->strings_size + path_size > builder->strings_capacity) {
+        size_t new_capacity = (builder->strings_capacity == 0) ? 65536 : builder->strings_capacity * 2;
+        while (builder->strings_size + path_size > new_capacity) {
+            new_capacity *= 2;
+        }
+        char *new_strings = realloc(builder->strings, new_capacity);
+        if (new_strings == NULL) {
+            return -1;
+        }
+        builder->strings = new_strings;
+        builder->strings_capacity = new_capacity;
+    }
+
+    builder->records[builder->count] = *record;
+    builder->records[builder->count].path_offset = builder->strings_size;
+    memcpy(builder->strings + builder->strings_size, path, path_size);
+    builder->strings_size += path_size;
+    ++builder->count;
+    return 0;
+}
+
+/*!
+ * @brief write_index writes an index and renames it over the index of the store
+ * @param store is a pointer to the store
+ * @param builder is a pointer to the index
+ * @return 0 in case of success, -1 else
+ */
+static int write_index(pack_store_t *store, index_builder_t *builder) {
+    char temporary_path[PATH_SIZE], path[PATH_SIZE];
+    if (make_store_path(temporary_path, store, "index.tmp") == NULL || make_store_path(path, store, "index") == NULL) {
+        return -1;
+    }
+    int fd = open(temporary_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        perror("Cannot write the pack index");
+        return -1;
+    }
+
+    pack_index_header_t header;
+    memcpy(header.magic, index_magic, sizeof(index_magic));
+    header.count = builder->count;
+    header.strings_offset = sizeof(pack_index_header_t) + builder->count * sizeof(pack_index_record_t);
+    header.strings_size = builder->strings_size;
+    int result = (write_all(fd, (unsigned char *) &header, sizeof(header)) == -1 ||
+                  write_all(fd, (unsigned char *) builder->records, builder->count * sizeof(pack_index_record_t)) == -1 ||
+                  write_all(fd, (unsigned char *) builder->strings, builder->strings_size) == -1 ||
+                  fsync(fd) == -1) ? -1 : 0;
+    close(fd);
+    if (result == -1 || rename(temporary_path, path) == -1) {
+        perror("Cannot write the pack index");
+        unlink(temporary_path);
+        return -1;
+    }
+
+    // The rename must be durable too
+    int dir_fd = open(store->directory, O_RDONLY | O_DIRECTORY);
+    if (dir_fd != -1) {
+        fsync(dir_fd);
+        close(dir_fd);
+    }
+    return 0;
+}
+
+/*!
+ * @brief compare_records compares two records of the current run by path, for qsort
+ */
+static int compare_records(const void *lhs, const void *rhs) {
+    return path_compare(((const pack_record_t *) lhs)->path, ((const pack_record_t *) rhs)->path);
+}
+
+/*!
+ * @brief merge_index builds the new index: the records of the previous index, replaced or completed
+ * by the records of the current run
+ * @param store is a pointer to the store
+ * @param builder is a pointer to the index being built
+ * @param live_bytes is a pointer to the size of the data referenced by the new index
+ * @return 0 in case of success, -1 else
+ */
+static int merge_index(pack_store_t *store, index_builder_t *builder, uint64_t *live_bytes) {
+    qsort(store->records, store->records_count, sizeof(pack_record_t), compare_records);
+    const pack_index_record_t *previous = (store->index_map == NULL) ? NULL :
+            (const pack_index_record_t *) (store->index_map + sizeof(pack_index_header_t));
+    uint64_t previous_index = 0;
+    size_t current_index = 0;
+    *live_bytes = 0;
+    while (previous_index < store->index_count || current_index < store->records_count) {
+        int comparison;
+        if (previous_index == store->index_count) {
+            comparison = 1;
+        } else if (current_index == store->records_count) {
+            comparison = -1;
+        } else {
+            comparison = path_compare(index_path(store, &previous[previous_index]), store->records[current_index].path);
+        }
+
+        int result;
+        if (comparison < 0) {
+            result = add_index_record(builder, &previous[previous_index], index_path(store, &previous[previous_index]));
+            *live_bytes += previous[previous_index].length;
+        } else {
+            // The current run packed a new version of the file
+            result = add_index_record(builder, &store->records[current_index].record, store->records[current_index].path);
+            *live_bytes += store->records[current_index].record.length;
+            ++current_index;
+        }
+        if (comparison <= 0) {
+            ++previous_index;
+        }
+        if (result == -1) {
+            printf("Error when allocating memory in the function merge_index of the file pack-store.c\n");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*!
+ * @brief compact_packs copies the live data of the packs to new packs, then removes the previous packs
+ * The new index is written before the previous packs are removed, so an interruption loses nothing.
+ * @param store is a pointer to the store (its current pack is closed)
+ * @param builder is a pointer to the new index, whose records are moved to the new packs
+ * @return 0 in case of success, -1 else
+ */
+static int compact_packs(pack_store_t *store, index_builder_t *builder) {
+    uint32_t first_pack = store->first_pack, last_pack = store->last_pack;
+    store->last_pack = last_pack + 1;
+    store->pack_size = 0;
+    unsigned char *buffer = malloc(IO_BLOCK_SIZE);
+    if (buffer == NULL) {
+        printf("Error when allocating memory in the function compact_packs of the file pack-store.c\n");
+        return -1;
+    }
+
+    int source_fd = -1;
+    uint32_t source_pack = 0;
+    int result = 0;
+    for (size_t i = 0; i < builder->count && result == 0; ++i) {
+        pack_index_record_t *record = &builder->records[i];
+        if (source_fd == -1 || source_pack != record->pack) {
+            char path[PATH_SIZE];
+            if (source_fd != -1) {
+                close(source_fd);
+            }
+            source_pack = record->pack;
+            source_fd = (make_pack_path(path, store, source_pack) == NULL) ? -1 : open(path, O_RDONLY);
+            if (source_fd == -1) {
+                result = -1;
+                break;
+            }
+        }
+        if (open_next_pack(store, record->length) == -1) {
+            result = -1;
+            break;
+        }
+
+        uint64_t offset = store->pack_size;
+        for (uint64_t copied = 0; copied < record->length && result == 0;) {
+            size_t size = (record->length - copied < IO_BLOCK_SIZE) ? (size_t) (record->length - copied) : IO_BLOCK_SIZE;
+            ssize_t bytes_read = pread(source_fd, buffer, size, (off_t) (record->offset + copied));
+            if (bytes_read <= 0 || write_all(store->pack_fd, buffer, (size_t) bytes_read) == -1) {
+                result = -1;
+                break;
+            }
+            copied += (uint64_t) bytes_read;
+            store->pack_size += (uint64_t) bytes_read;
+        }
+        record->pack = store->last_pack;
+        record->offset = offset;
+    }
+    if (source_fd != -1) {
+        close(source_fd);
+    }
+    free(buffer);
+    if (store->pack_fd != -1) {
+        if (fsync(store->pack_fd) == -1) {
+            result = -1;
+        }
+        close(store->pack_fd);
+        store->pack_fd = -1;
+    }
+    if (result == -1 || write_index(store, builder) == -1) {
+        perror("Cannot compact the packs");
+        return -1;
+    }
+
+    for (uint32_t pack = first_pack; pack <= last_pack; ++pack) {
+        char path[PATH_SIZE];
+        if (make_pack_path(path, store, pack) != NULL) {
+            unlink(path);
+        }
+    }
+    return 0;
+}
+
+/*!
+ * @brief close_pack_store saves the index of the files packed by the current run, and releases the store
+ * The packs are compacted when most of their data is dead (older versions of the files).
+ * @param store is a pointer to the store
+ * @return 0 in case of success, -1 else
+ */
+int close_pack_store(pack_store_t *store) {
+    int result = 0;
+    if (store->records_count > 0) {
+        // The data must be on disk before the index refers to it
+        if (store->pack_fd != -1 && fsync(store->pack_fd) == -1) {
+            perror("Cannot write the packs");
+            result = -1;
+        }
+        if (store->pack_fd != -1) {
+            close(store->pack_fd);
+            store->pack_fd = -1;
+        }
+
+        index_builder_t builder;
+        memset(&builder, 0, sizeof(index_builder_t));
+        uint64_t live_bytes = 0;
+        if (result == 0 && (merge_index(store, &builder, &live_bytes) == -1 || write_index(store, &builder) == -1)) {
+            result = -1;
+        }
+        uint64_t dead_bytes = (store->packs_size > live_bytes) ? store->packs_size - live_bytes : 0;
+        if (result == 0 && dead_bytes > live_bytes && dead_bytes >= PACK_COMPACTION_MIN_DEAD) {
+            result = compact_packs(store, &builder);
+        }
+        free(builder.records);
+        free(builder.strings);
+    }
+
+    for (size_t i = 0; i < store->records_count; ++i) {
+        free(store->records[i].path);
+    }
+    free(store->records);
+    store->records = NULL;
+    store->records_count = 0;
+    store->records_capacity = 0;
+    if (store->pack_fd != -1) {
+        close(store->pack_fd);
+        store->pack_fd = -1;
+    }
+    if (store->index_map != NULL) {
+        munmap(store->index_map, store->index_size);
+        store->index_map = NULL;
+    }
+    return result;
+}
+
+/*!
+ * @brief extract_record restores the data of a record of the mapped index
+ * @param store is a pointer to the store
+ * @param record is a pointer to the record
+ * @param output_path is the path of the restored file (created with the recorded access modes and mtime)
+ * @return the number of bytes restored, -1 in case of error
+ */
+static int64_t extract_record(pack_store_t *store, const pack_index_record_t *record, char *output_path) {
+    char path[PATH_SIZE];
+    int pack_fd = (make_pack_path(path, store, record->pack) == NULL) ? -1 : open(path, O_RDONLY);
+    if (pack_fd == -1) {
+        perror("Cannot open the pack file");
+        return -1;
+    }
+    int output_fd = open(output_path, O_WRONLY | O_CREAT | O_TRUNC, record->mode & 07777);
+    unsigned char *buffer = malloc(IO_BLOCK_SIZE);
+    int64_t result = (output_fd == -1 || buffer == NULL) ? -1 : 0;
+    while (result != -1 && (uint64_t) result < record->length) {
+        uint64_t remaining = record->length - (uint64_t) result;
+        size_t size = (remaining < IO_BLOCK_SIZE) ? (size_t) remaining : IO_BLOCK_SIZE;
+        ssize_t bytes_read = pread(pack_fd, buffer, size, (off_t) (record->offset + (uint64_t) result));
+        if (bytes_read <= 0 || write_all(output_fd, buffer, (size_t) bytes_read) == -1) {
+            result = -1;
+            break;
+        }
+        result += bytes_read;
+    }
+    if (result == -1) {
+        perror("Cannot extract the packed file");
+    }
+
+    if (output_fd != -1) {
+        // The file may already exist with other access modes
+        fchmod(output_fd, record->mode & 07777);
+        struct timespec times[2] = {{0, UTIME_OMIT}, {(time_t) record->mtime_sec, (long) record->mtime_nsec}};
+        futimens(output_fd, times);
+        close(output_fd);
+    }
+    free(buffer);
+    close(pack_fd);
+    return result;
+}
+
+/*!
+ * @brief extract_packed_file restores a packed file
+ * @param destination is the destination root holding the pack store
+ * @param relative is the path of the file relative to the destination root
+ * @param output_path is the path of the restored file (created with the recorded access modes and mtime)
+ * @return the number of bytes restored, -1 in case of error
+ */
+int64_t extract_packed_file(char *destination, char *relative, char *output_path) {
+    pack_store_t store;
+    if (open_pack_store(&store, destination) == -1) {
+        return -1;
+    }
+    const pack_index_record_t *record = find_index_record(&store, relative);
+    if (record == NULL) {
+        printf("%s is not packed in %s\n", relative, destination);
+        close_pack_store(&store);
+        return -1;
+    }
+    int64_t result = extract_record(&store, record, output_path);
+    close_pack_store(&store);
+    return result;
+}
+
+/*!
+ * @brief extract_pack_store restores every file of the pack store of a destination
+ * The directories of the files must exist in the output tree (packed files are small files of the
+ * destination tree, whose directories are copied as usual).
+ * @param destination is the destination root holding the pack store
+ * @param output_root is the directory receiving the files, at their path relative to the destination root
+ * @param is_verbose is true to display each restored file
+ * @param restored_bytes is a pointer to the counter of the bytes restored
+ * @return the number of files restored, -1 in case of error
+ */
+int64_t extract_pack_store(char *destination, char *output_root, bool is_verbose, uint64_t *restored_bytes) {
+    pack_store_t store;
+    if (open_pack_store(&store, destination) == -1) {
+        return -1;
+    }
+    const pack_index_record_t *records = (store.index_map == NULL) ? NULL :
+                                         (const pack_index_record_t *) (store.index_map + sizeof(pack_index_header_t));
+    pack_index_header_t *header = (pack_index_header_t *) store.index_map;
+    int64_t count = 0;
+    for (uint64_t i = 0; i < store.index_count; ++i) {
+        char output_path[PATH_SIZE];
+        if (records[i].path_offset >= header->strings_size ||
+            concat_path(output_path, output_root, index_path(&store, &records[i])) == NULL) {
+            printf("The pack index of %s is corrupted\n", destination);
+            count = -1;
+            break;
+        }
+        if (is_verbose) {
+            printf("unpack %s\n", index_path(&store, &records[i]));
+        }
+        int64_t extracted = extract_record(&store, &records[i], output_path);
+        if (extracted == -1) {
+            count = -1;
+            break;
+        }
+        *restored_bytes += (uint64_t) extracted;
+        ++count;
+    }
+    close_pack_store(&store);
+    return count;
+}
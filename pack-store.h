@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include "defines.h"
+#include "files-list.h"
+
+// Directory of the pack store, in the destination root (@see RESERVED_NAME_PREFIX)
+#define PACK_STORE_NAME ".lp25-pack"
+// A new pack file is started when the current one would grow beyond this size
+#define PACK_MAX_SIZE (1024ULL * 1024 * 1024)
+// The packs are compacted when their dead bytes exceed both their live bytes and this size
+#define PACK_COMPACTION_MIN_DEAD (16ULL * 1024 * 1024)
+
+// Index record, as mapped from the index file (native byte order)
+typedef struct {
+    uint64_t path_offset; // Offset of the relative path (NUL-terminated) in the strings of the index
+    uint32_t pack; // Number of the pack file holding the data
+    uint32_t mode;
+    uint64_t offset; // Position of the data in the pack file
+    uint64_t length;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint8_t md5sum[16];
+} pack_index_record_t;
+
+// Record of a file packed by the current run
+typedef struct {
+    char *path; // Relative path
+    pack_index_record_t record;
+} pack_record_t;
+
+typedef struct {
+    char directory[PATH_SIZE];
+    unsigned char *index_map; // Index of the previous runs, mapped read-only (NULL if none)
+    size_t index_size;
+    uint64_t index_count;
+    pack_record_t *records; // Files packed by the current run
+    size_t records_count;
+    size_t records_capacity;
+    bool has_packs; // Set when pack files exist
+    uint32_t first_pack; // Lowest and highest numbers of the existing pack files
+    uint32_t last_pack;
+    uint64_t packs_size; // Total size of the pack files
+    int pack_fd; // Pack file receiving the data of this run, -1 until the first file is packed
+    uint64_t pack_size;
+} pack_store_t;
+
+int open_pack_store(pack_store_t *store, char *destination);
+int find_packed_file(pack_store_t *store, char *relative, files_list_entry_t *entry);
+int64_t pack_file(pack_store_t *store, files_list_entry_t *source_entry, char *relative);
+int close_pack_store(pack_store_t *store);
+int64_t extract_packed_file(char *destination, char *relative, char *output_path);
+int64_t extract_pack_store(char *destination, char *output_root, bool is_verbose, uint64_t *restored_bytes);
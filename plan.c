@@ -0,0 +1,456 @@
+#include "plan.h"
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "instrumentation.h"
+#include "remote.h"
+#include "utility.h"
+
+/*
+ * A dry run plans the run instead of making it. The trees are compared by the metadata of their
+ * entries only (stat), even with -s: hashing both trees is the most expensive part of a run, and a
+ * planned copy of a file whose size or mtime changed is at worst a metadata update in the real run.
+ * The actions are written to the plan file (--plan), one per line:
+ *     lp25-plan 1
+ *     source <source root>
+ *     destination <index> <destination root>
+ *     <copy|update|delete|pack> <destination index> <f|d> <bytes> <relative path>
+ *     total <action> <count> <bytes>
+ *     estimate_s <seconds, or unknown>
+ * Backslashes and newlines of the paths are escaped (\\ and \n).
+ * The time of the real run is estimated from the throughput of each stage measured by the previous
+ * runs with --measure-throughput. The profile of a destination is kept out of the backup, in the cache
+ * directory of the user ($XDG_CACHE_HOME/lp25, ~/.cache/lp25 by default), in a file named after a
+ * hash of the absolute path of the destination. A small file
+ * costs its latency, a large one its bytes: the operations are measured by size class (@see
+ * get_size_class), and each class keeps its last measure until a run uses it again. The processes
+ * overlap their operations: the time of a stage is divided by the average number of processes busy
+ * with it during the last run using it (its total time over the time of the run, at least 1).
+ *     lp25-throughput 1
+ *     destination <absolute path of the destination>
+ *     <stage> <size class> <count> <bytes> <total seconds>
+ *     <stage> workers <average busy processes>
+ */
+
+// Measures of the operations of a stage in a size class, in the throughput profile
+typedef struct {
+    uint64_t count;
+    uint64_t bytes;
+    double total_s;
+} class_profile_t;
+
+typedef struct {
+    class_profile_t classes[STAGES_COUNT][SIZE_CLASSES];
+    double workers[STAGES_COUNT];
+} throughput_profile_t;
+
+// Operations of a stage planned by the dry run, by size class
+typedef struct {
+    uint64_t counts[SIZE_CLASSES];
+    uint64_t bytes[SIZE_CLASSES];
+} planned_work_t;
+
+typedef struct {
+    bool is_enabled; // Set in a dry run
+    bool has_md5; // Set when the real run would hash the files (-s)
+    FILE *file; // Plan file, NULL when it is not written
+    uint64_t counts[PLAN_ACTIONS_COUNT];
+    uint64_t bytes[PLAN_ACTIONS_COUNT];
+    planned_work_t copies; // Files copied or packed
+    char destination[PATH_SIZE]; // Absolute path of the destination
+    char profile_directory[PATH_SIZE];
+    char profile_path[PATH_SIZE + 32]; // Empty for a remote destination, or without a cache directory
+    char temporary_path[PATH_SIZE + 40];
+} plan_state_t;
+
+static plan_state_t plan = {.is_enabled = false, .file = NULL};
+
+static const char *actions_names[PLAN_ACTIONS_COUNT] = {"copy", "update", "delete", "pack"};
+
+/*!
+ * @brief locate_throughput_profile finds the path of the throughput profile of the destination
+ * @param the_config is a pointer to the configuration
+ * @return 0 in case of success (the path is empty for a remote destination, or without a cache
+ * directory), -1 else
+ */
+static int locate_throughput_profile(configuration_t *the_config) {
+    plan.profile_path[0] = '\0';
+    if (is_remote_address(the_config->destination)) {
+        return 0;
+    }
+    char destination[PATH_MAX];
+    if (realpath(the_config->destination, destination) == NULL) {
+        perror("Cannot find the destination");
+        return -1;
+    }
+    snprintf(plan.destination, PATH_SIZE, "%s", destination);
+
+    char *cache = getenv("XDG_CACHE_HOME");
+    char *home = getenv("HOME");
+    if (cache != NULL && cache[0] != '\0') {
+        snprintf(plan.profile_directory, PATH_SIZE, "%s/lp25", cache);
+    } else if (home != NULL && home[0] != '\0') {
+        snprintf(plan.profile_directory, PATH_SIZE, "%s/.cache/lp25", home);
+    } else {
+        return 0;
+    }
+    // FNV-1a hash of the path
+    uint64_t hash = 14695981039346656037ULL;
+    for (char *cursor = destination; *cursor != '\0'; ++cursor) {
+        hash = (hash ^ (unsigned char) *cursor) * 1099511628211ULL;
+    }
+    snprintf(plan.profile_path, sizeof(plan.profile_path), "%s/throughput-%016llx", plan.profile_directory, (unsigned long long) hash);
+    snprintf(plan.temporary_path, sizeof(plan.temporary_path), "%s.tmp", plan.profile_path);
+    return 0;
+}
+
+/*!
+ * @brief init_plan prepares the planning of a dry run, and locates the throughput profile of the destination
+ * It must be called before the processes are created (@see prepare): the dry run analyzes the
+ * entries without their MD5 sums. With the plan on stdout, it must be called before anything is
+ * displayed.
+ * @param the_config is a pointer to the configuration
+ * @return 0 in case of success, -1 else
+ */
+int init_plan(configuration_t *the_config) {
+    if (locate_throughput_profile(the_config) == -1) {
+        return -1;
+    }
+    if (!the_config->uses_dry_run) {
+        return 0;
+    }
+
+    plan.is_enabled = true;
+    plan.has_md5 = the_config->uses_md5;
+    the_config->uses_md5 = false;
+    if (the_config->plan_file[0] == '\0') {
+        return 0;
+    }
+    if (strcmp(the_config->plan_file, "-") == 0) {
+        // The plan keeps stdout for itself: the messages of all the processes (the actions, the summary,
+        // -v) go to stderr, so that the plan can be parsed
+        fflush(stdout);
+        int plan_fd = dup(STDOUT_FILENO);
+        if (plan_fd == -1 || dup2(STDERR_FILENO, STDOUT_FILENO) == -1 || (plan.file = fdopen(plan_fd, "w")) == NULL) {
+            perror("Cannot write the plan to stdout");
+            return -1;
+        }
+    } else {
+        plan.file = fopen(the_config->plan_file, "w");
+    }
+    if (plan.file == NULL) {
+        perror("Cannot open the plan file");
+        return -1;
+    }
+    fprintf(plan.file, "lp25-plan 1\nsource %s\n", the_config->source);
+    for (int d = 0; d < get_destinations_count(the_config); ++d) {
+        fprintf(plan.file, "destination %d %s\n", d, get_destination(the_config, d));
+    }
+    // The processes forked later must not write the header again
+    fflush(plan.file);
+    return 0;
+}
+
+/*!
+ * @brief write_escaped_path writes a path on a line of the plan
+ * @param path is the path
+ */
+static void write_escaped_path(char *path) {
+    for (char *cursor = path; *cursor != '\0'; ++cursor) {
+        if (*cursor == '\\') {
+            fputs("\\\\", plan.file);
+        } else if (*cursor == '\n') {
+            fputs("\\n", plan.file);
+        } else {
+            fputc(*cursor, plan.file);
+        }
+    }
+    fputc('\n', plan.file);
+}
+
+/*!
+ * @brief record_planned_action adds an action of the dry run to the plan
+ * @param action is the action
+ * @param destination is the index of the destination (@see get_destination)
+ * @param entry is a pointer to the entry (the source entry, or the destination entry for a deletion)
+ * @param relative is the path of the entry relative to its root
+ */
+void record_planned_action(plan_action_t action, int destination, files_list_entry_t *entry, char *relative) {
+    if (!plan.is_enabled || action >= PLAN_ACTIONS_COUNT || entry == NULL) {
+        return;
+    }
+    // An updated file keeps its data, and the content of a deleted directory is not listed
+    uint64_t bytes = (entry->entry_type == FICHIER && action != PLAN_UPDATE) ? entry->size : 0;
+    ++plan.counts[action];
+    plan.bytes[action] += bytes;
+    if (action == PLAN_COPY || action == PLAN_PACK) {
+        ++plan.copies.counts[get_size_class(bytes)];
+        plan.copies.bytes[get_size_class(bytes)] += bytes;
+    }
+    if (plan.file != NULL) {
+        fprintf(plan.file, "%s %d %c %lu ", actions_names[action], destination,
+                (entry->entry_type == DOSSIER) ? 'd' : 'f', (unsigned long) bytes);
+        write_escaped_path(relative);
+    }
+}
+
+/*!
+ * @brief read_throughput_profile reads the measures of the previous runs
+ * @param profile receives the measures of each stage and size class (zero for those never measured)
+ * @return 0 in case of success, -1 if there is no usable profile
+ */
+static int read_throughput_profile(throughput_profile_t *profile) {
+    memset(profile, 0, sizeof(throughput_profile_t));
+    for (int stage = 0; stage < STAGES_COUNT; ++stage) {
+        profile->workers[stage] = 1.0;
+    }
+    if (plan.profile_path[0] == '\0') {
+        return -1;
+    }
+    FILE *file = fopen(plan.profile_path, "r");
+    if (file == NULL) {
+        return -1;
+    }
+    char line[PATH_SIZE + 16];
+    bool is_valid = fgets(line, sizeof(line), file) != NULL && strcmp(line, "lp25-throughput 1\n") == 0;
+    while (is_valid && fgets(line, sizeof(line), file) != NULL) {
+        if (strncmp(line, "destination ", 12) == 0) {
+            // Another destination with the same hash
+            line[strcspn(line, "\n")] = '\0';
+            is_valid = strcmp(line + 12, plan.destination) == 0;
+            continue;
+        }
+        char name[32];
+        int size_class;
+        unsigned long count, bytes;
+        double total_s, workers;
+        bool is_measure = sscanf(line, "%31s %d %lu %lu %lf", name, &size_class, &count, &bytes, &total_s) == 5 &&
+                          size_class >= 0 && size_class < SIZE_CLASSES;
+        bool is_workers = !is_measure && sscanf(line, "%31s workers %lf", name, &workers) == 2 && workers >= 1.0;
+        for (int stage = 0; stage < STAGES_COUNT && (is_measure || is_workers); ++stage) {
+            if (strcmp(name, get_stage_name((stage_t) stage)) != 0) {
+                continue;
+            }
+            if (is_measure) {
+                profile->classes[stage][size_class].count = count;
+                profile->classes[stage][size_class].bytes = bytes;
+                profile->classes[stage][size_class].total_s = total_s;
+            } else {
+                profile->workers[stage] = workers;
+            }
+        }
+    }
+    fclose(file);
+    return is_valid ? 0 : -1;
+}
+
+/*!
+ * @brief estimate_stage_time estimates the time a stage takes to process some work
+ * Each size class is estimated from its measures, or from the nearest measured class: by the bytes for
+ * the files of 4 KiB or more, by the operations for the smaller ones.
+ * @param profile is the array of the measures of the stage, by size class
+ * @param work is a pointer to the work planned for the stage
+ * @param workers is the average number of processes sharing the work
+ * @return the time in seconds, -1 if the stage was never measured
+ */
+static double estimate_stage_time(class_profile_t *profile, planned_work_t *work, double workers) {
+    double total_s = 0.0;
+    for (int size_class = 0; size_class < SIZE_CLASSES; ++size_class) {
+        if (work->counts[size_class] == 0) {
+            continue;
+        }
+        int measured = -1;
+        for (int distance = 0; distance < SIZE_CLASSES && measured == -1; ++distance) {
+            if (size_class - distance >= 0 && profile[size_class - distance].count > 0) {
+                measured = size_class - distance;
+            } else if (size_class + distance < SIZE_CLASSES && profile[size_class + distance].count > 0) {
+                measured = size_class + distance;
+            }
+        }
+        if (measured == -1) {
+            return -1.0;
+        }
+        class_profile_t *measure = &profile[measured];
+        if (size_class > 0 && measured > 0 && measure->bytes > 0) {
+            total_s += measure->total_s * (double) work->bytes[size_class] / (double) measure->bytes;
+        } else {
+            total_s += measure->total_s * (double) work->counts[size_class] / (double) measure->count;
+        }
+    }
+    return total_s / ((workers > 1.0) ? workers : 1.0);
+}
+
+/*!
+ * @brief limit_time applies a bandwidth limit to the time of a transfer (@see throttle.c)
+ * @param seconds is the estimated time, -1 if unknown
+ * @param bytes is the amount of data
+ * @param bandwidth is the limit in bytes per second, 0 when unlimited
+ * @return the time needed under the limit
+ */
+static double limit_time(double seconds, uint64_t bytes, uint64_t bandwidth) {
+    if (seconds < 0.0 || bandwidth == 0) {
+        return seconds;
+    }
+    double limited_s = (double) bytes / (double) bandwidth;
+    return (limited_s > seconds) ? limited_s : seconds;
+}
+
+/*!
+ * @brief write_plan_report displays the summary of the plan with the estimated time of the real run,
+ * and completes the plan file
+ * The real run scans the trees like the dry run did, and also hashes them (-s), copies the data and
+ * updates the metadata. With several processes, these stages overlap: the slowest one gives the time.
+ * It must be called once the other processes have exited (@see clean_processes).
+ * @param the_config is a pointer to the configuration
+ * @return 0 in case of success, -1 else
+ */
+int write_plan_report(configuration_t *the_config) {
+    if (!plan.is_enabled) {
+        return 0;
+    }
+
+    stage_counters_t scanned;
+    if (get_stage_counters(STAGE_STAT, &scanned) == -1) {
+        memset(&scanned, 0, sizeof(stage_counters_t));
+    }
+    double scan_s = get_instrumented_seconds();
+    throughput_profile_t profile;
+    bool has_profile = read_throughput_profile(&profile) == 0;
+
+    uint64_t copy_bytes = plan.bytes[PLAN_COPY] + plan.bytes[PLAN_PACK];
+    // The real run hashes every entry the dry run scanned
+    planned_work_t hashes;
+    for (int size_class = 0; size_class < SIZE_CLASSES; ++size_class) {
+        hashes.counts[size_class] = scanned.size_classes[size_class].count;
+        hashes.bytes[size_class] = scanned.size_classes[size_class].bytes;
+    }
+    double hash_s = plan.has_md5 ? estimate_stage_time(profile.classes[STAGE_HASH], &hashes, profile.workers[STAGE_HASH]) : 0.0;
+    hash_s = limit_time(hash_s, scanned.bytes, the_config->read_bandwidth);
+    double copy_s = estimate_stage_time(profile.classes[STAGE_COPY], &plan.copies, profile.workers[STAGE_COPY]);
+    copy_s = limit_time(limit_time(copy_s, copy_bytes, the_config->read_bandwidth), copy_bytes, the_config->write_bandwidth);
+    // An update is a chmod and a utimensat: until updates are measured, it costs about a stat
+    planned_work_t updates = {{plan.counts[PLAN_UPDATE]}, {0}};
+    stage_t metadata_stage = (profile.classes[STAGE_METADATA][0].count > 0) ? STAGE_METADATA : STAGE_STAT;
+    double metadata_s = estimate_stage_time(profile.classes[metadata_stage], &updates, 1.0);
+    bool is_estimated = has_profile && hash_s >= 0.0 && copy_s >= 0.0 && metadata_s >= 0.0;
+    double total_s = scan_s + hash_s + copy_s + metadata_s;
+    if (the_config->is_parallel) {
+        total_s = scan_s;
+        if (hash_s > total_s) {
+            total_s = hash_s;
+        }
+        if (copy_s + metadata_s > total_s) {
+            total_s = copy_s + metadata_s;
+        }
+    }
+
+    printf("Plan: %lu copies (%.1f MiB), %lu updates, %lu deletions, %lu packed files (%.1f MiB)\n",
+           (unsigned long) plan.counts[PLAN_COPY], (double) plan.bytes[PLAN_COPY] / (1024.0 * 1024.0),
+           (unsigned long) plan.counts[PLAN_UPDATE], (unsigned long) plan.counts[PLAN_DELETE],
+           (unsigned long) plan.counts[PLAN_PACK], (double) plan.bytes[PLAN_PACK] / (1024.0 * 1024.0));
+    printf("Scanned %lu entries (%.1f MiB) in %.2fs\n", (unsigned long) scanned.count,
+           (double) scanned.bytes / (1024.0 * 1024.0), scan_s);
+    if (plan.profile_path[0] == '\0') {
+        printf("The time of a run to a remote destination (or without a cache directory) is not estimated\n");
+    } else if (!has_profile) {
+        printf("No run to %s measured its throughput yet (--measure-throughput), the time of the run is not estimated\n", plan.destination);
+    } else if (!is_estimated) {
+        printf("The stages needed by the run (%s%s%s) were never measured in %s, the time of the run is not estimated\n",
+               (hash_s < 0.0) ? "hash " : "", (copy_s < 0.0) ? "copy " : "", (metadata_s < 0.0) ? "metadata" : "",
+               plan.profile_path);
+    } else {
+        printf("Estimated time of the run: %.2fs (scan %.2fs, hash %.2fs, copy %.2fs, metadata %.2fs)\n",
+               total_s, scan_s, hash_s, copy_s, metadata_s);
+    }
+    fflush(stdout);
+
+    if (plan.file == NULL) {
+        return 0;
+    }
+    for (int action = 0; action < PLAN_ACTIONS_COUNT; ++action) {
+        fprintf(plan.file, "total %s %lu %lu\n", actions_names[action], (unsigned long) plan.counts[action], (unsigned long) plan.bytes[action]);
+    }
+    if (is_estimated) {
+        fprintf(plan.file, "estimate_s %.3f\n", total_s);
+    } else {
+        fprintf(plan.file, "estimate_s unknown\n");
+    }
+    int result = (fflush(plan.file) == 0) ? 0 : -1;
+    if (fclose(plan.file) != 0) {
+        result = -1;
+    }
+    plan.file = NULL;
+    if (result == -1) {
+        perror("Cannot write the plan file");
+    }
+    return result;
+}
+
+/*!
+ * @brief save_throughput_profile records the throughput of the stages used by the run, for the next plans
+ * The size classes of the stages the run did not use keep their previous measures. The profile is replaced with a rename.
+ * Nothing is recorded without --measure-throughput, by a dry run, or for a remote destination.
+ * @param the_config is a pointer to the configuration
+ * @return 0 in case of success, -1 else
+ */
+int save_throughput_profile(configuration_t *the_config) {
+    if (!the_config->measures_throughput || the_config->uses_dry_run || plan.profile_path[0] == '\0' ||
+        !is_instrumentation_enabled()) {
+        return 0;
+    }
+    // The cache directory may not exist yet ($HOME/.cache and its lp25 directory)
+    char parent[PATH_SIZE];
+    snprintf(parent, PATH_SIZE, "%s", plan.profile_directory);
+    *strrchr(parent, '/') = '\0';
+    if ((mkdir(parent, 0700) == -1 && errno != EEXIST) || (mkdir(plan.profile_directory, 0700) == -1 && errno != EEXIST)) {
+        perror("Cannot create the directory of the throughput profile");
+        return -1;
+    }
+
+    throughput_profile_t profile;
+    read_throughput_profile(&profile);
+    double elapsed_s = get_instrumented_seconds();
+    for (int stage = 0; stage < STAGES_COUNT; ++stage) {
+        stage_counters_t counters;
+        if (get_stage_counters((stage_t) stage, &counters) == -1 || counters.count == 0) {
+            continue;
+        }
+        for (int size_class = 0; size_class < SIZE_CLASSES; ++size_class) {
+            size_class_counters_t *measure = &counters.size_classes[size_class];
+            if (measure->count > 0) {
+                profile.classes[stage][size_class].count = measure->count;
+                profile.classes[stage][size_class].bytes = measure->bytes;
+                profile.classes[stage][size_class].total_s = (double) measure->total_ns / 1e9;
+            }
+        }
+        double workers = (elapsed_s > 0.0) ? (double) counters.total_ns / 1e9 / elapsed_s : 1.0;
+        profile.workers[stage] = (workers > 1.0) ? workers : 1.0;
+    }
+
+    FILE *file = fopen(plan.temporary_path, "w");
+    if (file == NULL) {
+        perror("Cannot write the throughput profile");
+        return -1;
+    }
+    fprintf(file, "lp25-throughput 1\ndestination %s\n", plan.destination);
+    for (int stage = 0; stage < STAGES_COUNT; ++stage) {
+        for (int size_class = 0; size_class < SIZE_CLASSES; ++size_class) {
+            class_profile_t *measure = &profile.classes[stage][size_class];
+            if (measure->count > 0) {
+                fprintf(file, "%s %d %lu %lu %.9f\n", get_stage_name((stage_t) stage), size_class,
+                        (unsigned long) measure->count, (unsigned long) measure->bytes, measure->total_s);
+            }
+        }
+        fprintf(file, "%s workers %.3f\n", get_stage_name((stage_t) stage), profile.workers[stage]);
+    }
+    if (fclose(file) != 0 || rename(plan.temporary_path, plan.profile_path) == -1) {
+        perror("Cannot write the throughput profile");
+        unlink(plan.temporary_path);
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "configuration.h"
+#include "files-list.h"
+
+// Actions of a dry run, written to the plan file (@see record_planned_action)
+typedef enum {PLAN_COPY, PLAN_UPDATE, PLAN_DELETE, PLAN_PACK, PLAN_ACTIONS_COUNT} plan_action_t;
+
+int init_plan(configuration_t *the_config);
+void record_planned_action(plan_action_t action, int destination, files_list_entry_t *entry, char *relative);
+int write_plan_report(configuration_t *the_config);
+int save_throughput_profile(configuration_t *the_config);
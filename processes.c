@@ -11,6 +11,43 @@
 #include <signal.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <time.h>
+#include "autoscale.h"
+#include "utility.h"
+#include "tree-stream.h"
+#include "compress.h"
+#include "durability.h"
+#include "remote.h"
+#include "trace.h"
+/*!
+ * @brief analyzers_pool_size computes the number of analyzers to fork for one side (source or destination)
+ * @param the_config is a pointer to the program configuration
+ * @param side_max is the maximum set for this side with --max-*-analyzers (0 when not set)
+ * @return the number of analyzers of the side (at least 1)
+ * Without an explicit maximum, the processes count (-n) is shared between both sides, minus the listers.
+ * In adaptive mode, each side may use the whole processes count, its active part follows its throughput.
+ */
+static int analyzers_pool_size(configuration_t *the_config, uint8_t side_max) {
+    int pool_size = side_max;
+    if (pool_size == 0) {
+        pool_size = the_config->is_adaptive ? the_config->processes_count - 2 : (the_config->processes_count - 2) / 2;
+    }
+    return (pool_size < 1) ? 1 : pool_size;
+}
+
+/*!
+ * @brief release_pids frees the arrays of the PIDs of the workers
+ * @param p_context is a pointer to the processes context
+ */
+static void release_pids(process_context_t *p_context) {
+    free(p_context->source_analyzers_pids);
+    free(p_context->destination_analyzers_pids);
+    free(p_context->copiers_pids);
+    p_context->source_analyzers_pids = NULL;
+    p_context->destination_analyzers_pids = NULL;
+    p_context->copiers_pids = NULL;
+}
+
 /*!
  * @brief prepare prepares (only when parallel is enabled) the processes used for the synchronization.
  * @param the_config is a pointer to the program configuration
@@ -23,78 +60,150 @@ int prepare(configuration_t *the_config, process_context_t *p_context) {
     }
 
     // Initialize process context
-    p_context->processes_count = the_config->processes_count;
+    p_context->processes_count = 0;
     p_context->main_process_pid = getpid();
     p_context->source_lister_pid = -1;
     p_context->destination_lister_pid = -1;
-    p_context->source_analyzers_pids = malloc(sizeof(pid_t) * the_config->processes_count);
-    p_context->destination_analyzers_pids = malloc(sizeof(pid_t) * the_config->processes_count);
+    p_context->extra_listers_count = 0;
+    p_context->source_analyzers_pids = NULL;
+    p_context->destination_analyzers_pids = NULL;
+    p_context->source_analyzers_count = 0;
+    p_context->destination_analyzers_count = 0;
+    p_context->copiers_pids = NULL;
+    p_context->copiers_count = 0;
+    p_context->message_queue_id = -1;
 
-    if (p_context->source_analyzers_pids == NULL || p_context->destination_analyzers_pids == NULL) {
-        free(p_context->source_analyzers_pids);
-        free(p_context->destination_analyzers_pids);
-        return -1;
+    if (!the_config->is_parallel) {
+        return 0;
     }
 
-    // Setup message queue
-    p_context->shared_key = ftok("/tmp", 'a'); // Or any other key generation method
-    p_context->message_queue_id = msgget(p_context->shared_key, 0644 | IPC_CREAT);
+    int source_pool_size = analyzers_pool_size(the_config, the_config->max_source_analyzers);
+    int destination_pool_size = analyzers_pool_size(the_config, the_config->max_destination_analyzers);
+    p_context->source_analyzers_pids = malloc(sizeof(pid_t) * source_pool_size);
+    p_context->destination_analyzers_pids = malloc(sizeof(pid_t) * destination_pool_size);
+    p_context->copiers_pids = malloc(sizeof(pid_t) * (the_config->copiers_count > 0 ? the_config->copiers_count : 1));
 
+    if (p_context->source_analyzers_pids == NULL || p_context->destination_analyzers_pids == NULL || p_context->copiers_pids == NULL) {
+        printf("Error when allocating memory in the function prepare of the file processes.c\n");
+        release_pids(p_context);
+        return -1;
+    }
+
+    // Setup message queue: each run has its own private MQ, whose id is inherited by the processes
+    // forked below, so that concurrent runs never share (or delete) each other's queue
+    p_context->message_queue_id = msgget(IPC_PRIVATE, 0600 | IPC_CREAT);
     if (p_context->message_queue_id == -1) {
-        free(p_context->source_analyzers_pids);
-        free(p_context->destination_analyzers_pids);
+        perror("Cannot create the MQ");
+        release_pids(p_context);
         return -1;
     }
 
+    // The workers of each side are pinned to their CPUs (@see affinity.c), the copy workers float
+    placement_t source_placement, destination_placement;
+    if (init_placements(the_config, &source_placement, &destination_placement) == -1) {
+        return -1;
+    }
+    if (the_config->uses_verbose) {
+        display_placement("source", &source_placement);
+        display_placement("destination", &destination_placement);
+        fflush(stdout); // Before the processes are forked
+    }
+
     // Create source lister process :
     lister_configuration_t src_lister_parameters;
-    src_lister_parameters.analyzers_count = (the_config->processes_count-2)/2;
+    src_lister_parameters.analyzers_count = source_pool_size;
     src_lister_parameters.my_recipient_id = MSG_TYPE_TO_SOURCE_ANALYZERS;
     src_lister_parameters.my_receiver_id = MSG_TYPE_TO_SOURCE_LISTER;
-    src_lister_parameters.mq_key = p_context->shared_key;
-    p_context->source_lister_pid = make_process(p_context, lister_process_loop, &src_lister_parameters);
+    src_lister_parameters.msg_queue = p_context->message_queue_id;
+    src_lister_parameters.is_adaptive = the_config->is_adaptive;
+    src_lister_parameters.is_verbose = the_config->uses_verbose;
+    src_lister_parameters.label = "source";
+    src_lister_parameters.resume_after = the_config->resume_cursor;
+    src_lister_parameters.counterpart_root = NULL;
+    src_lister_parameters.memory_limit = (size_t) the_config->memory_limit;
+    p_context->source_lister_pid = make_process(p_context, lister_process_loop, &src_lister_parameters, &source_placement);
     if (p_context->source_lister_pid == -1) {
         perror("Failed to create source lister process");
         return -1;
     }
 
-    // Create destination lister process :
+    // Create destination lister process (a remote destination is listed and analyzed by its receiver, @see receiver.c) :
     lister_configuration_t  dst_lister_parameters;
-    dst_lister_parameters.analyzers_count = (the_config->processes_count-2)/2;
-    dst_lister_parameters.my_recipient_id = MSG_TYPE_TO_SOURCE_ANALYZERS;
-    dst_lister_parameters.my_receiver_id = MSG_TYPE_TO_SOURCE_LISTER;
-    dst_lister_parameters.mq_key = p_context->shared_key;
-    p_context->destination_lister_pid = make_process(p_context, lister_process_loop, &dst_lister_parameters);
-    if (p_context->destination_lister_pid == -1) {
-        perror("Failed to create destination lister process");
-        return -1;
+    dst_lister_parameters.analyzers_count = destination_pool_size;
+    dst_lister_parameters.my_recipient_id = MSG_TYPE_TO_DESTINATION_ANALYZERS;
+    dst_lister_parameters.my_receiver_id = MSG_TYPE_TO_DESTINATION_LISTER;
+    dst_lister_parameters.msg_queue = p_context->message_queue_id;
+    dst_lister_parameters.is_adaptive = the_config->is_adaptive;
+    dst_lister_parameters.is_verbose = the_config->uses_verbose;
+    dst_lister_parameters.label = "destination";
+    dst_lister_parameters.resume_after = the_config->resume_cursor;
+    dst_lister_parameters.counterpart_root = the_config->source;
+    dst_lister_parameters.memory_limit = (size_t) the_config->memory_limit;
+    if (!is_remote_address(the_config->destination)) {
+        p_context->destination_lister_pid = make_process(p_context, lister_process_loop, &dst_lister_parameters, &destination_placement);
+        if (p_context->destination_lister_pid == -1) {
+            perror("Failed to create destination lister process");
+            return -1;
+        }
+    }
+
+    // Create the listers of the extra destinations: their entries are analyzed by the destination analyzers
+    lister_configuration_t extra_lister_parameters = dst_lister_parameters;
+    for (int i = 0; i < the_config->extra_destinations_count; ++i) {
+        extra_lister_parameters.my_receiver_id = MSG_TYPE_TO_EXTRA_LISTERS + i;
+        p_context->extra_listers_pids[i] = make_process(p_context, lister_process_loop, &extra_lister_parameters, &destination_placement);
+        if (p_context->extra_listers_pids[i] == -1) {
+            perror("Failed to create destination lister process");
+            return -1;
+        }
+        p_context->extra_listers_count++;
     }
 
     // Create source analyzers processes
     analyzer_configuration_t src_analyzer_parameters;
     src_analyzer_parameters.my_recipient_id = MSG_TYPE_TO_SOURCE_LISTER;
     src_analyzer_parameters.my_receiver_id = MSG_TYPE_TO_SOURCE_ANALYZERS;
-    src_analyzer_parameters.mq_key = p_context->shared_key;
-    for (int i = 0; i < src_lister_parameters.analyzers_count; ++i) {
-        p_context->source_analyzers_pids[i] = make_process(p_context, analyzer_process_loop, &src_analyzer_parameters);
+    src_analyzer_parameters.msg_queue = p_context->message_queue_id;
+    src_analyzer_parameters.use_md5 = the_config->uses_md5;
+    src_analyzer_parameters.is_compressed = false;
+    for (int i = 0; i < source_pool_size; ++i) {
+        p_context->source_analyzers_pids[i] = make_process(p_context, analyzer_process_loop, &src_analyzer_parameters, &source_placement);
         if (p_context->source_analyzers_pids[i] == -1) {
             perror("Failed to create source analyzer process");
             return -1;
         }
+        p_context->source_analyzers_count++;
     }
 
 
     // Create destination analyzers processes
     analyzer_configuration_t dst_analyzer_parameters;
-    dst_analyzer_parameters.my_recipient_id = MSG_TYPE_TO_SOURCE_LISTER;
-    dst_analyzer_parameters.my_receiver_id = MSG_TYPE_TO_SOURCE_ANALYZERS;
-    dst_analyzer_parameters.mq_key = p_context->shared_key;
-    for (int i = 0; i < src_lister_parameters.analyzers_count; ++i) {
-        p_context->destination_analyzers_pids[i] = make_process(p_context, analyzer_process_loop, &dst_analyzer_parameters);
+    dst_analyzer_parameters.my_recipient_id = MSG_TYPE_TO_DESTINATION_LISTER;
+    dst_analyzer_parameters.my_receiver_id = MSG_TYPE_TO_DESTINATION_ANALYZERS;
+    dst_analyzer_parameters.msg_queue = p_context->message_queue_id;
+    dst_analyzer_parameters.use_md5 = the_config->uses_md5;
+    dst_analyzer_parameters.is_compressed = (the_config->compression != COMPRESSION_NONE);
+    for (int i = 0; i < destination_pool_size && !is_remote_address(the_config->destination); ++i) {
+        p_context->destination_analyzers_pids[i] = make_process(p_context, analyzer_process_loop, &dst_analyzer_parameters, &destination_placement);
         if (p_context->destination_analyzers_pids[i] == -1) {
             perror("Failed to create destination analyzer process");
             return -1;
         }
+        p_context->destination_analyzers_count++;
+    }
+
+    // Create copy workers processes
+    copier_configuration_t copier_parameters;
+    copier_parameters.my_receiver_id = MSG_TYPE_TO_COPIERS;
+    copier_parameters.msg_queue = p_context->message_queue_id;
+    copier_parameters.the_config = the_config;
+    for (int i = 0; i < the_config->copiers_count; ++i) {
+        p_context->copiers_pids[i] = make_process(p_context, copier_process_loop, &copier_parameters, NULL);
+        if (p_context->copiers_pids[i] == -1) {
+            perror("Failed to create copy worker process");
+            return -1;
+        }
+        p_context->copiers_count++;
     }
 
     return 0;
@@ -105,19 +214,143 @@ int prepare(configuration_t *the_config, process_context_t *p_context) {
  * @param p_context is a pointer to the processes context
  * @param func is the function executed by the new process
  * @param parameters is a pointer to the parameters of func
+ * @param placement is a pointer to the CPUs and memory node of the process (NULL to leave it floating)
  * @return the PID of the child process (it never returns in the child process)
  */
 
-int make_process(process_context_t *p_context, process_loop_t func, void *parameters) {
+int make_process(process_context_t *p_context, process_loop_t func, void *parameters, const placement_t *placement) {
     pid_t pid = fork();
 
-
     if (pid == 0) { // Child process
+        // Pinned before func allocates its buffers, so that they come from the memory of its node
+        apply_placement(placement);
         func(parameters);
-    }else{
+        exit(EXIT_SUCCESS);
+    } else if (pid > 0) {
         p_context->processes_count++;
-        return pid;
     }
+    return pid;
+}
+
+/*!
+ * @brief request_element_details sends an entry to the analyzers of a lister
+ * The request is not blocking: when the MQ is full, the lister must first receive some responses
+ * @param msg_queue is the id of the MQ used to send the request
+ * @param entry is the entry to analyze
+ * @param cfg is a pointer to the lister configuration
+ * @param current_analyzers is a pointer to the number of requests in flight, incremented on success
+ * @return 0 if the request was sent, -1 else (errno is EAGAIN when the MQ is full)
+ */
+int request_element_details(int msg_queue, files_list_entry_t *entry, lister_configuration_t *cfg, int *current_analyzers) {
+    if (send_file_entry_from(msg_queue, cfg->my_recipient_id, cfg->my_receiver_id, entry, COMMAND_CODE_ANALYZE_FILE, IPC_NOWAIT) == -1) {
+        return -1;
+    }
+    ++(*current_analyzers);
+    return 0;
+}
+
+// State of a lister, kept from one directory to the next
+typedef struct {
+    int msg_queue;
+    lister_configuration_t *config;
+    autoscaler_t scaler;
+    uint64_t completed; // Analysis requests completed since the beginning of the listing
+} lister_state_t;
+
+/*!
+ * @brief analyze_list gets the properties of all the entries of a list through the analyzers of a lister
+ * At most one request per active analyzer is in flight. In adaptive mode, the number of active analyzers
+ * is driven by the autoscaler, else all the analyzers of the pool are active.
+ * It is called for the content of each directory (@see tree-stream.c), so the autoscaler and the count of
+ * completed requests are kept in the state of the lister.
+ * @param list is a pointer to the list whose entries must be analyzed
+ * @param parameters is a pointer to the lister_state_t of the lister
+ */
+static void analyze_list(files_list_t *list, void *parameters) {
+    lister_state_t *state = (lister_state_t *) parameters;
+    lister_configuration_t *config = state->config;
+    int msg_queue = state->msg_queue;
+    int pool_size = config->analyzers_count;
+    files_list_entry_t **pending = calloc(pool_size, sizeof(files_list_entry_t *));
+    struct timespec *sent_at = calloc(pool_size, sizeof(struct timespec));
+    if (pending == NULL || sent_at == NULL) {
+        printf("Error when allocating memory in the function analyze_list of the file processes.c\n");
+        free(pending);
+        free(sent_at);
+        return;
+    }
+
+    size_t backlog = 0;
+    for (files_list_entry_t *cursor = list->head; cursor != NULL; cursor = cursor->next) {
+        ++backlog;
+    }
+
+    autoscaler_t *scaler = &state->scaler;
+    int current_analyzers = 0;
+    files_list_entry_t *next = list->head;
+    any_message_t message;
+    while (next != NULL || current_analyzers > 0) {
+        // Keep the active analyzers busy
+        while (next != NULL && current_analyzers < scaler->window) {
+            int slot = 0;
+            while (pending[slot] != NULL) {
+                ++slot;
+            }
+            if (request_element_details(msg_queue, next, config, &current_analyzers) == -1) {
+                if (errno == EAGAIN || errno == EINTR) {
+                    break;
+                }
+                perror("Cannot send an analyze file command");
+                next = next->next;
+                --backlog;
+                continue;
+            }
+            pending[slot] = next;
+            clock_gettime(CLOCK_MONOTONIC, &sent_at[slot]);
+            next = next->next;
+            --backlog;
+        }
+
+        if (current_analyzers == 0) {
+            // The MQ is full of messages for other processes, let them consume it
+            usleep(1000);
+            continue;
+        }
+
+        if (receive_message(msg_queue, &message, config->my_receiver_id, 0) == -1) {
+            perror("Cannot receive an analyzed file");
+            break;
+        }
+        if (message.list_entry.op_code != COMMAND_CODE_FILE_ANALYZED) {
+            continue;
+        }
+
+        // Responses come back in any order, look for the request among the ones in flight
+        for (int slot = 0; slot < pool_size; ++slot) {
+            if (pending[slot] != NULL && strcmp(pending[slot]->path_and_name, message.list_entry.payload.path_and_name) == 0) {
+                files_list_entry_t *entry = pending[slot];
+                files_list_entry_t *next_entry = entry->next, *prev_entry = entry->prev;
+                memcpy(entry, &message.list_entry.payload, sizeof(files_list_entry_t));
+                entry->next = next_entry;
+                entry->prev = prev_entry;
+
+                struct timespec now;
+                clock_gettime(CLOCK_MONOTONIC, &now);
+                autoscaler_record_latency(scaler, elapsed_seconds(&sent_at[slot], &now));
+                pending[slot] = NULL;
+                --current_analyzers;
+                ++state->completed;
+                break;
+            }
+        }
+
+        if (config->is_adaptive) {
+            autoscaler_update(scaler, state->completed, backlog, current_analyzers);
+        }
+    }
+
+    free(pending);
+    free(sent_at);
 }
 
 /*!
@@ -126,7 +359,44 @@ int make_process(process_context_t *p_context, process_loop_t func, void *parame
  */
 void lister_process_loop(void *parameters) {
     lister_configuration_t *config = (lister_configuration_t *)parameters;
-    // Logique de listage (par exemple, lister des fichiers dans un répertoire)
+    int msg_queue = config->msg_queue;
+    char trace_name[TRACE_NAME_SIZE];
+    snprintf(trace_name, sizeof(trace_name), "%s lister", config->label);
+    set_trace_process_name(trace_name);
+
+    any_message_t message;
+    while (true) {
+        if (receive_message(msg_queue, &message, config->my_receiver_id, 0) == -1) {
+            perror("Lister cannot receive a command");
+            return;
+        }
+
+        if (message.simple_command.message == COMMAND_CODE_TERMINATE) {
+            send_terminate_confirm(msg_queue, MSG_TYPE_TO_MAIN);
+            return;
+        }
+
+        if (message.analyze_dir_command.op_code == COMMAND_CODE_ANALYZE_DIR) {
+            // Stream the (ordered) entries to the main process while the tree is being listed
+            lister_state_t state;
+            state.msg_queue = msg_queue;
+            state.config = config;
+            state.completed = 0;
+            autoscaler_init(&state.scaler, config->label, config->is_adaptive ? 1 : config->analyzers_count, config->analyzers_count, config->is_verbose);
+
+            tree_stream_t stream;
+            if (open_tree_stream(&stream, message.analyze_dir_command.target, analyze_list, &state, config->resume_after) == 0) {
+                set_stream_counterpart(&stream, config->counterpart_root);
+                set_stream_memory_limit(&stream, config->memory_limit);
+                files_list_entry_t *entry;
+                while ((entry = next_stream_entry(&stream)) != NULL) {
+                    while (send_file_entry_from(msg_queue, MSG_TYPE_TO_MAIN, config->my_receiver_id, entry, COMMAND_CODE_FILE_ENTRY, 0) == -1 && errno == EINTR);
+                }
+                close_tree_stream(&stream);
+            }
+            while (send_list_end_from(msg_queue, MSG_TYPE_TO_MAIN, config->my_receiver_id) == -1 && errno == EINTR);
+        }
+    }
 }
 
 /*!
@@ -135,10 +405,79 @@ void lister_process_loop(void *parameters) {
  */
 void analyzer_process_loop(void *parameters) {
     analyzer_configuration_t *config = (analyzer_configuration_t *)parameters;
-    // Logique d'analyse (par exemple, comparer des propriétés de fichiers)
+    int msg_queue = config->msg_queue;
+    set_trace_process_name((config->my_receiver_id == MSG_TYPE_TO_SOURCE_ANALYZERS) ? "source analyzer" : "destination analyzer");
+
+    any_message_t message;
+    while (true) {
+        if (receive_message(msg_queue, &message, config->my_receiver_id, 0) == -1) {
+            perror("Analyzer cannot receive a command");
+            return;
+        }
+
+        if (message.simple_command.message == COMMAND_CODE_TERMINATE) {
+            send_terminate_confirm(msg_queue, MSG_TYPE_TO_MAIN);
+            return;
+        }
+
+        if (message.analyze_file_command.op_code == COMMAND_CODE_ANALYZE_FILE) {
+            files_list_entry_t *entry = &message.analyze_file_command.payload;
+            if (config->is_compressed) {
+                get_compressed_file_stats(entry);
+            } else if (config->use_md5) {
+                get_file_stats(entry);
+            } else {
+                get_file_metadata(entry);
+            }
+            // Several listers may share the analyzers: the response goes back to the sender
+            int recipient = (message.list_entry.reply_to > 0) ? message.list_entry.reply_to : config->my_recipient_id;
+            while (send_analyze_file_response(msg_queue, recipient, entry) == -1 && errno == EINTR);
+        }
+    }
 }
 
-// Fonction make_process inchangée...
+/*!
+ * @brief copier_process_loop is the copy worker process function
+ * The main process creates the directories itself before sending their content, so the copy workers
+ * only receive files.
+ * @param parameters is a pointer to its parameters, to be cast to a copier_configuration_t
+ */
+void copier_process_loop(void *parameters) {
+    copier_configuration_t *config = (copier_configuration_t *)parameters;
+    int msg_queue = config->msg_queue;
+    set_trace_process_name("copy worker");
+
+    any_message_t message;
+    while (true) {
+        if (receive_message(msg_queue, &message, config->my_receiver_id, 0) == -1) {
+            perror("Copy worker cannot receive a command");
+            return;
+        }
+
+        if (message.simple_command.message == COMMAND_CODE_TERMINATE) {
+            // The last batch of durable copies is committed before the main process records the end of the run
+            clean_durability(false);
+            send_terminate_confirm(msg_queue, MSG_TYPE_TO_MAIN);
+            return;
+        }
+
+        if (message.simple_command.message == COMMAND_CODE_CHECKPOINT) {
+            // The copies received before are completed: they are committed, then no copy starts
+            // until the main process has written the checkpoint
+            flush_durable_batch();
+            send_checkpoint_message(msg_queue, MSG_TYPE_TO_MAIN, COMMAND_CODE_CHECKPOINT_OK, 0);
+            if (receive_message(msg_queue, &message, MSG_TYPE_TO_HELD_COPIERS, 0) == -1) {
+                perror("Copy worker cannot receive the end of a checkpoint");
+                return;
+            }
+            continue;
+        }
+
+        if (message.list_entry.op_code == COMMAND_CODE_COPY_ENTRY) {
+            copy_entry_to_destinations(&message.list_entry.payload, config->the_config, message.list_entry.destinations);
+        }
+    }
+}
 
 /*!
  * @brief clean_processes cleans the processes by sending them a terminate command and waiting for confirmation
@@ -146,34 +485,58 @@ void analyzer_process_loop(void *parameters) {
  * @param p_context is a pointer to the processes context
  */
 void clean_processes(configuration_t *the_config, process_context_t *p_context) {
-    if (the_config == NULL || p_context == NULL) {
+    if (the_config == NULL || p_context == NULL || !the_config->is_parallel) {
         return;
     }
 
-    // Envoyer un signal de terminaison aux processus enfants
-    for (int i = 0; i < the_config->processes_count; i++) {
-        if (p_context->source_analyzers_pids[i] > 0) {
-            kill(p_context->source_analyzers_pids[i], SIGTERM);
-        }
-        if (p_context->destination_analyzers_pids[i] > 0) {
-            kill(p_context->destination_analyzers_pids[i], SIGTERM);
-        }
+    // Envoyer une commande de terminaison aux processus enfants
+    // (chaque analyseur d'un côté consomme une des commandes envoyées à ce côté)
+    if (p_context->source_lister_pid > 0) {
+        send_terminate_command(p_context->message_queue_id, MSG_TYPE_TO_SOURCE_LISTER);
+    }
+    if (p_context->destination_lister_pid > 0) {
+        send_terminate_command(p_context->message_queue_id, MSG_TYPE_TO_DESTINATION_LISTER);
+    }
+    for (int i = 0; i < p_context->extra_listers_count; i++) {
+        send_terminate_command(p_context->message_queue_id, MSG_TYPE_TO_EXTRA_LISTERS + i);
+    }
+    for (int i = 0; i < p_context->source_analyzers_count; i++) {
+        send_terminate_command(p_context->message_queue_id, MSG_TYPE_TO_SOURCE_ANALYZERS);
+    }
+    for (int i = 0; i < p_context->destination_analyzers_count; i++) {
+        send_terminate_command(p_context->message_queue_id, MSG_TYPE_TO_DESTINATION_ANALYZERS);
+    }
+    // Les copies en attente sont reçues avant la commande de terminaison
+    for (int i = 0; i < p_context->copiers_count; i++) {
+        send_terminate_command(p_context->message_queue_id, MSG_TYPE_TO_COPIERS);
     }
 
-    // Attendre la confirmation de terminaison
-    for (int i = 0; i < the_config->processes_count; i++) {
-        if (p_context->source_analyzers_pids[i] > 0) {
-            waitpid(p_context->source_analyzers_pids[i], NULL, 0);
-        }
-        if (p_context->destination_analyzers_pids[i] > 0) {
-            waitpid(p_context->destination_analyzers_pids[i], NULL, 0);
-        }
+    // Attendre la terminaison
+    if (p_context->source_lister_pid > 0) {
+        waitpid(p_context->source_lister_pid, NULL, 0);
+    }
+    if (p_context->destination_lister_pid > 0) {
+        waitpid(p_context->destination_lister_pid, NULL, 0);
+    }
+    for (int i = 0; i < p_context->extra_listers_count; i++) {
+        waitpid(p_context->extra_listers_pids[i], NULL, 0);
+    }
+    for (int i = 0; i < p_context->source_analyzers_count; i++) {
+        waitpid(p_context->source_analyzers_pids[i], NULL, 0);
+    }
+    for (int i = 0; i < p_context->destination_analyzers_count; i++) {
+        waitpid(p_context->destination_analyzers_pids[i], NULL, 0);
+    }
+    for (int i = 0; i < p_context->copiers_count; i++) {
+        waitpid(p_context->copiers_pids[i], NULL, 0);
     }
 
     // Libérer la mémoire allouée
-    free(p_context->source_analyzers_pids);
-    free(p_context->destination_analyzers_pids);
+    release_pids(p_context);
 
     // Supprimer la file de messages
-    msgctl(p_context->message_queue_id, IPC_RMID, NULL);
-}
\ No newline at end of file
+    if (p_context->message_queue_id != -1) {
+        msgctl(p_context->message_queue_id, IPC_RMID, NULL);
+        p_context->message_queue_id = -1;
+    }
+}
@@ -5,15 +5,21 @@
 #include <sys/types.h>
 #include "files-list.h"
 #include <stdbool.h>
+#include "affinity.h"
 
 typedef struct {
     uint8_t processes_count;
     pid_t main_process_pid;
     pid_t source_lister_pid;
     pid_t destination_lister_pid;
+    pid_t extra_listers_pids[MAX_DESTINATIONS - 1]; // Listers of the extra destinations, sharing the destination analyzers
+    int extra_listers_count;
     pid_t *source_analyzers_pids;
     pid_t *destination_analyzers_pids;
-    key_t shared_key;
+    int source_analyzers_count;
+    int destination_analyzers_count;
+    pid_t *copiers_pids;
+    int copiers_count;
     int message_queue_id;
 } process_context_t;
 
@@ -21,21 +27,35 @@ typedef struct {
     int my_recipient_id; // Id of analyzers' MQ topic
     int my_receiver_id; // Id of MQ topic to listen to
     int analyzers_count; // Number of analyzers available
-    key_t mq_key;
+    int msg_queue; // Id of the private MQ of the run, inherited from the main process
+    bool is_adaptive; // Set to true when the number of active analyzers follows the throughput
+    bool is_verbose; // Set to true to trace the decisions of the adaptive mode
+    char *label; // Name of the side (source or destination)
+    char *resume_after; // Entries up to this relative path are not listed (@see checkpoint.c)
+    char *counterpart_root; // Root of the other tree, for the destination only (@see set_stream_counterpart)
+    size_t memory_limit; // Bytes of the listed entries kept in memory, 0 when unlimited (@see set_stream_memory_limit)
 } lister_configuration_t;
 
 typedef struct {
     int my_recipient_id; // Id of my lister
     int my_receiver_id; // Id I must listen to
-    key_t mq_key;
+    int msg_queue; // Id of the private MQ of the run, inherited from the main process
     bool use_md5; // Set to true when computing MD5sum for files
+    bool is_compressed; // Set to true to read the properties of compressed files in their headers
 } analyzer_configuration_t;
 
+typedef struct {
+    int my_receiver_id; // Id I must listen to
+    int msg_queue; // Id of the private MQ of the run, inherited from the main process
+    configuration_t *the_config; // Source and destination roots, and I/O options of the copy
+} copier_configuration_t;
+
 typedef void (*process_loop_t)(void *);
 
 int prepare(configuration_t *the_config, process_context_t *p_context);
-int make_process(process_context_t *p_context, process_loop_t func, void *parameters);
+int make_process(process_context_t *p_context, process_loop_t func, void *parameters, const placement_t *placement);
 void lister_process_loop(void *parameters);
 void analyzer_process_loop(void *parameters);
+void copier_process_loop(void *parameters);
 void clean_processes(configuration_t *the_config, process_context_t *p_context);
-void request_element_details(int msg_queue, files_list_entry_t *entry, lister_configuration_t *cfg, int *current_analyzers);
\ No newline at end of file
+int request_element_details(int msg_queue, files_list_entry_t *entry, lister_configuration_t *cfg, int *current_analyzers);
\ No newline at end of file
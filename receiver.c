@@ -0,0 +1,647 @@
+#define _GNU_SOURCE
+#include "receiver.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include "remote.h"
+#include "tree-stream.h"
+#include "file-properties.h"
+#include "filters.h"
+#include "delete.h"
+#include "durability.h"
+#include "instrumentation.h"
+#include "utility.h"
+
+// State of a connection served by a receiver process
+typedef struct {
+    remote_channel_t channel;
+    char *root; // Destination directory
+    bool has_md5;
+    size_t memory_limit; // Bytes of the listed entries kept in memory, 0 when unlimited (@see tree-stream.c)
+    pthread_mutex_t output_lock; // The entries and the answers share the output buffer
+    uint64_t failures; // Commands that could not be applied
+} receiver_t;
+
+/*!
+ * @brief analyze_entries gets the properties of the content of a destination directory
+ * @param children is a pointer to the list of the entries of the directory
+ * @param parameters is a pointer to the receiver
+ */
+static void analyze_entries(files_list_t *children, void *parameters) {
+    receiver_t *receiver = (receiver_t *) parameters;
+    for (files_list_entry_t *cursor = children->head; cursor != NULL; cursor = cursor->next) {
+        int result = receiver->has_md5 ? get_file_stats(cursor) : get_file_metadata(cursor);
+        if (result == -1) {
+            printf("Cannot get the properties of %s\n", cursor->path_and_name);
+        }
+    }
+}
+
+/*!
+ * @brief list_destination is the function of the thread sending the destination entries, while the
+ * commands are applied
+ * The buffered entries are written after each directory, whose content is listed and analyzed next.
+ * @param parameters is a pointer to the receiver
+ * @return NULL
+ */
+static void *list_destination(void *parameters) {
+    receiver_t *receiver = (receiver_t *) parameters;
+    tree_stream_t stream;
+    if (open_tree_stream(&stream, receiver->root, analyze_entries, receiver, NULL) == 0) {
+        set_stream_memory_limit(&stream, receiver->memory_limit);
+        files_list_entry_t *entry;
+        while ((entry = next_stream_entry(&stream)) != NULL && !receiver->channel.is_broken) {
+            pthread_mutex_lock(&receiver->output_lock);
+            put_remote_entry(&receiver->channel, relative_path(entry->path_and_name, receiver->root), entry, receiver->has_md5);
+            if (entry->entry_type == DOSSIER) {
+                flush_remote_channel(&receiver->channel);
+            }
+            pthread_mutex_unlock(&receiver->output_lock);
+        }
+        close_tree_stream(&stream);
+    }
+    // The list ends even if it is incomplete: the client would wait for it forever
+    pthread_mutex_lock(&receiver->output_lock);
+    if (begin_remote_frame(&receiver->channel, REMOTE_LIST_END, 0) == 0) {
+        end_remote_frame(&receiver->channel);
+        flush_remote_channel(&receiver->channel);
+    }
+    pthread_mutex_unlock(&receiver->output_lock);
+    return NULL;
+}
+
+/*!
+ * @brief resolve_path gives the destination path of a path received from the client
+ * @param receiver is a pointer to the receiver
+ * @param relative is the received path, relative to the destination root
+ * @param path receives the destination path
+ * @return 0 in case of success, -1 for a path outside of the destination
+ */
+static int resolve_path(receiver_t *receiver, char *relative, char *path) {
+    if (relative[0] == '\0' || relative[0] == '/') {
+        return -1;
+    }
+    for (char *component = relative; component != NULL; component = strchr(component, '/')) {
+        component += (*component == '/') ? 1 : 0;
+        if (strncmp(component, "..", 2) == 0 && (component[2] == '/' || component[2] == '\0')) {
+            return -1;
+        }
+    }
+    return (concat_path(path, receiver->root, relative) == NULL) ? -1 : 0;
+}
+
+/*!
+ * @brief fail_command counts a command that could not be applied
+ * @param receiver is a pointer to the receiver
+ * @param message is the message printed with errno
+ * @param path is the path of the command
+ */
+static void fail_command(receiver_t *receiver, char *message, char *path) {
+    fprintf(stderr, "%s %s: %s\n", message, path, strerror(errno));
+    ++receiver->failures;
+}
+
+/*!
+ * @brief write_all writes a buffer to a file
+ * @return 0 in case of success, -1 else
+ */
+static int write_all(int fd, const unsigned char *data, size_t size) {
+    while (size > 0) {
+        ssize_t written = write(fd, data, size);
+        if (written == -1 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return -1;
+        }
+        data += written;
+        size -= (size_t) written;
+    }
+    return 0;
+}
+
+// Properties of a received file, decoded from its REMOTE_FILE or REMOTE_DELTA_FILE frame
+typedef struct {
+    char path[PATH_SIZE];
+    mode_t mode;
+    struct timespec mtime;
+    uint64_t size;
+} received_file_t;
+
+/*!
+ * @brief decode_file decodes the frame announcing a file
+ * @return 0 in case of success, -1 for an invalid frame
+ */
+static int decode_file(receiver_t *receiver, remote_frame_t *frame, received_file_t *file) {
+    char relative[PATH_SIZE];
+    get_remote_string(frame, relative, sizeof(relative));
+    file->mode = (mode_t) get_remote_u32(frame);
+    file->mtime.tv_sec = (time_t) get_remote_u64(frame);
+    file->mtime.tv_nsec = (long) get_remote_u32(frame);
+    file->size = get_remote_u64(frame);
+    if (frame->is_invalid || resolve_path(receiver, relative, file->path) == -1) {
+        printf("Invalid file received\n");
+        return -1;
+    }
+    return 0;
+}
+
+/*!
+ * @brief read_file_end reads the end of a file
+ * @return 1 if all the data of the source file was read, 0 if it was not, -1 for an invalid frame
+ */
+static int read_file_end(receiver_t *receiver) {
+    remote_frame_t frame;
+    if (read_remote_frame(&receiver->channel, &frame) == -1 || frame.type != REMOTE_FILE_END) {
+        printf("Invalid end of file received\n");
+        return -1;
+    }
+    uint8_t is_complete = get_remote_u8(&frame);
+    return frame.is_invalid ? -1 : (is_complete != 0);
+}
+
+/*!
+ * @brief commit_file gives a received file its mode and mtime, or removes it when it is incomplete
+ * @param receiver is a pointer to the receiver
+ * @param fd is the written file, closed
+ * @param file is a pointer to the properties of the file
+ * @param is_complete is true when all the data of the file was written
+ * @param write_path is the path of the written file
+ * @return 0 if the file is complete, -1 else
+ */
+static int commit_file(receiver_t *receiver, int fd, received_file_t *file, bool is_complete, char *write_path) {
+    struct timespec times[2] = {{0, UTIME_OMIT}, file->mtime};
+    if (is_complete && (fchmod(fd, file->mode & 07777) == -1 || futimens(fd, times) == -1)) {
+        fail_command(receiver, "Cannot set the metadata of", file->path);
+    }
+    close(fd);
+    if (!is_complete) {
+        unlink(write_path);
+        printf("%s was not completely received\n", file->path);
+        ++receiver->failures;
+        return -1;
+    }
+    return 0;
+}
+
+/*!
+ * @brief receive_file writes a file sent with all its data (REMOTE_FILE)
+ * Its data follows its frame: it is read even when the file cannot be written.
+ * @param receiver is a pointer to the receiver
+ * @param frame is a pointer to the frame announcing the file
+ * @return 0 in case of success (or when the file could not be written), -1 if the connection failed
+ */
+static int receive_file(receiver_t *receiver, remote_frame_t *frame) {
+    received_file_t file;
+    if (decode_file(receiver, frame, &file) == -1) {
+        return -1;
+    }
+    struct timespec start;
+    instrument_begin(&start);
+    // A destination file with several links must not be overwritten in place
+    struct stat dest_stat;
+    if (lstat(file.path, &dest_stat) == 0 && S_ISREG(dest_stat.st_mode) && dest_stat.st_nlink > 1) {
+        unlink(file.path);
+    }
+    int fd = open(file.path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd == -1) {
+        fail_command(receiver, "Cannot create", file.path);
+    }
+
+    uint64_t remaining = file.size;
+    bool is_written = (fd != -1);
+    while (remaining > 0) {
+        unsigned char *data;
+        ssize_t received = read_remote_raw(&receiver->channel, (remaining < RECEIVER_WRITE_SIZE) ? remaining : RECEIVER_WRITE_SIZE, &data);
+        if (received == -1) {
+            if (fd != -1) {
+                close(fd);
+                unlink(file.path);
+            }
+            return -1;
+        }
+        if (is_written && write_all(fd, data, (size_t) received) == -1) {
+            fail_command(receiver, "Cannot write", file.path);
+            is_written = false;
+        }
+        remaining -= (uint64_t) received;
+    }
+    int is_complete = read_file_end(receiver);
+    if (is_complete == -1) {
+        if (fd != -1) {
+            close(fd);
+            unlink(file.path);
+        }
+        return -1;
+    }
+    if (fd != -1 && commit_file(receiver, fd, &file, is_written && is_complete == 1, file.path) == 0) {
+        instrument_end_path(STAGE_COPY, &start, file.size, file.path);
+    }
+    return 0;
+}
+
+/*!
+ * @brief copy_blocks copies blocks of the current destination file into its new version
+ * @return 0 in case of success, -1 else
+ */
+static int copy_blocks(int old_fd, int fd, uint64_t first_block, uint32_t count) {
+    off_t offset = (off_t) (first_block * REMOTE_DELTA_BLOCK_SIZE);
+    size_t remaining = (size_t) count * REMOTE_DELTA_BLOCK_SIZE;
+    while (remaining > 0) {
+        ssize_t copied = copy_file_range(old_fd, &offset, fd, NULL, remaining, 0);
+        if (copied == -1 && (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP)) {
+            break;
+        }
+        if (copied == -1 && errno == EINTR) {
+            continue;
+        }
+        if (copied <= 0) {
+            // The last block may be short
+            return (copied == 0) ? 0 : -1;
+        }
+        remaining -= (size_t) copied;
+    }
+    // Fallback through a buffer
+    unsigned char buffer[REMOTE_DELTA_BLOCK_SIZE / 4];
+    while (remaining > 0) {
+        ssize_t read_size = pread(old_fd, buffer, (remaining < sizeof(buffer)) ? remaining : sizeof(buffer), offset);
+        if (read_size == -1 && errno == EINTR) {
+            continue;
+        }
+        if (read_size <= 0) {
+            return (read_size == 0) ? 0 : -1;
+        }
+        if (write_all(fd, buffer, (size_t) read_size) == -1) {
+            return -1;
+        }
+        offset += read_size;
+        remaining -= (size_t) read_size;
+    }
+    return 0;
+}
+
+/*!
+ * @brief receive_delta_file writes a delta-encoded file (REMOTE_DELTA_FILE)
+ * The new version is made of the blocks kept from the current file (REMOTE_COPY) and of the received
+ * data (REMOTE_DATA), in a temporary file renamed over the current one.
+ * @param receiver is a pointer to the receiver
+ * @param frame is a pointer to the frame announcing the file
+ * @return 0 in case of success (or when the file could not be written), -1 if the connection failed
+ */
+static int receive_delta_file(receiver_t *receiver, remote_frame_t *frame) {
+    received_file_t file;
+    if (decode_file(receiver, frame, &file) == -1) {
+        return -1;
+    }
+    struct timespec start;
+    instrument_begin(&start);
+    char write_path[PATH_SIZE];
+    char *name = strrchr(file.path, '/') + 1;
+    int name_offset = (int) (name - file.path);
+    int old_fd = open(file.path, O_RDONLY);
+    int fd = -1;
+    if (snprintf(write_path, sizeof(write_path), "%.*s%s%s", name_offset, file.path, TEMPORARY_PREFIX, name) >= (int) sizeof(write_path)) {
+        errno = ENAMETOOLONG;
+    } else {
+        fd = open(write_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    }
+    if (fd == -1) {
+        fail_command(receiver, "Cannot create", file.path);
+    }
+
+    bool is_written = (fd != -1);
+    uint64_t received = 0;
+    remote_frame_t data_frame;
+    while (true) {
+        if (read_remote_frame(&receiver->channel, &data_frame) == -1) {
+            is_written = false;
+            break;
+        }
+        if (data_frame.type == REMOTE_DATA) {
+            size_t size = (size_t) (data_frame.end - data_frame.cursor);
+            if (is_written && write_all(fd, data_frame.cursor, size) == -1) {
+                fail_command(receiver, "Cannot write", file.path);
+                is_written = false;
+            }
+            received += size;
+        } else if (data_frame.type == REMOTE_COPY) {
+            uint64_t first_block = get_remote_u64(&data_frame);
+            uint32_t count = get_remote_u32(&data_frame);
+            if (is_written && (old_fd == -1 || copy_blocks(old_fd, fd, first_block, count) == -1)) {
+                fail_command(receiver, "Cannot copy the blocks of", file.path);
+                is_written = false;
+            }
+        } else {
+            break;
+        }
+    }
+    if (old_fd != -1) {
+        close(old_fd);
+    }
+    if (data_frame.type != REMOTE_FILE_END || receiver->channel.is_broken) {
+        if (fd != -1) {
+            close(fd);
+            unlink(write_path);
+        }
+        printf("Invalid delta-encoded file received\n");
+        return -1;
+    }
+    bool is_complete = is_written && get_remote_u8(&data_frame) != 0 && !data_frame.is_invalid;
+    if (fd == -1) {
+        return 0;
+    }
+    if (commit_file(receiver, fd, &file, is_complete, write_path) == 0) {
+        if (rename(write_path, file.path) == -1) {
+            fail_command(receiver, "Cannot replace", file.path);
+            unlink(write_path);
+        } else {
+            instrument_end_path(STAGE_COPY, &start, received, file.path);
+        }
+    }
+    return 0;
+}
+
+/*!
+ * @brief send_signatures sends the MD5 sums of the blocks of a destination file to delta-encode
+ * A file that cannot be read has no blocks: the client sends all its data.
+ * @param receiver is a pointer to the receiver
+ * @param frame is a pointer to the REMOTE_SIGNATURES_REQUEST frame
+ * @return 0 in case of success, -1 if the connection failed
+ */
+static int send_signatures(receiver_t *receiver, remote_frame_t *frame) {
+    char relative[PATH_SIZE], path[PATH_SIZE];
+    get_remote_string(frame, relative, sizeof(relative));
+    if (frame->is_invalid || resolve_path(receiver, relative, path) == -1) {
+        printf("Invalid signatures request received\n");
+        return -1;
+    }
+    int fd = open(path, O_RDONLY);
+    unsigned char *block = malloc(REMOTE_DELTA_BLOCK_SIZE);
+    uint8_t *sums = malloc(REMOTE_SIGNATURES_PER_FRAME * 16);
+    if (block == NULL || sums == NULL) {
+        printf("Error when allocating memory in the function send_signatures of the file receiver.c\n");
+    }
+    struct timespec start;
+    instrument_begin(&start);
+    uint32_t count = 0;
+    uint64_t hashed = 0;
+    int result = 0;
+    bool is_last = false;
+    while (!is_last && result == 0) {
+        ssize_t read_size = 0;
+        if (fd != -1 && block != NULL && sums != NULL) {
+            size_t filled = 0;
+            while (filled < REMOTE_DELTA_BLOCK_SIZE && (read_size = read(fd, block + filled, REMOTE_DELTA_BLOCK_SIZE - filled)) > 0) {
+                filled += (size_t) read_size;
+            }
+            read_size = (read_size == -1) ? -1 : (ssize_t) filled;
+        }
+        if (read_size > 0) {
+            digest_remote_block(block, (size_t) read_size, sums + count * 16);
+            ++count;
+            hashed += (uint64_t) read_size;
+        }
+        is_last = read_size < REMOTE_DELTA_BLOCK_SIZE;
+        if (count == REMOTE_SIGNATURES_PER_FRAME || is_last) {
+            pthread_mutex_lock(&receiver->output_lock);
+            result = begin_remote_frame(&receiver->channel, REMOTE_SIGNATURES, 5 + count * 16);
+            if (result == 0) {
+                put_remote_u32(&receiver->channel, count);
+                put_remote_u8(&receiver->channel, is_last);
+                put_remote_bytes(&receiver->channel, sums, count * 16);
+                end_remote_frame(&receiver->channel);
+                // The client waits for them
+                if (is_last) {
+                    result = flush_remote_channel(&receiver->channel);
+                }
+            }
+            pthread_mutex_unlock(&receiver->output_lock);
+            count = 0;
+        }
+    }
+    instrument_end_path(STAGE_HASH, &start, hashed, path);
+    if (fd != -1) {
+        close(fd);
+    }
+    free(block);
+    free(sums);
+    return result;
+}
+
+/*!
+ * @brief apply_command applies a command of the client
+ * @param receiver is a pointer to the receiver
+ * @param frame is a pointer to the frame of the command
+ * @return 0 in case of success (or when the command failed on the destination), -1 if the connection failed
+ */
+static int apply_command(receiver_t *receiver, remote_frame_t *frame) {
+    if (frame->type == REMOTE_FILE) {
+        return receive_file(receiver, frame);
+    }
+    if (frame->type == REMOTE_DELTA_FILE) {
+        return receive_delta_file(receiver, frame);
+    }
+    if (frame->type == REMOTE_SIGNATURES_REQUEST) {
+        return send_signatures(receiver, frame);
+    }
+
+    char relative[PATH_SIZE], path[PATH_SIZE];
+    get_remote_string(frame, relative, sizeof(relative));
+    if (frame->type == REMOTE_MKDIR) {
+        mode_t mode = (mode_t) get_remote_u32(frame);
+        if (frame->is_invalid || resolve_path(receiver, relative, path) == -1) {
+            return -1;
+        }
+        if (mkdir(path, mode & 07777) == -1 && errno != EEXIST) {
+            fail_command(receiver, "Cannot create directory", path);
+        } else {
+            chmod(path, mode & 07777);
+        }
+    } else if (frame->type == REMOTE_METADATA) {
+        mode_t mode = (mode_t) get_remote_u32(frame);
+        bool has_mtime = get_remote_u8(frame) != 0;
+        struct timespec times[2] = {{0, UTIME_OMIT}, {0, 0}};
+        times[1].tv_sec = (time_t) get_remote_u64(frame);
+        times[1].tv_nsec = (long) get_remote_u32(frame);
+        if (frame->is_invalid || resolve_path(receiver, relative, path) == -1) {
+            return -1;
+        }
+        struct timespec start;
+        instrument_begin(&start);
+        if (fchmodat(AT_FDCWD, path, mode & 07777, 0) == -1 || (has_mtime && utimensat(AT_FDCWD, path, times, 0) == -1)) {
+            fail_command(receiver, "Cannot update the metadata of", path);
+        }
+        instrument_end(STAGE_METADATA, &start, 0);
+    } else if (frame->type == REMOTE_DELETE) {
+        bool is_directory = get_remote_u8(frame) != 0;
+        bool is_replaced = get_remote_u8(frame) != 0;
+        if (frame->is_invalid || resolve_path(receiver, relative, path) == -1) {
+            return -1;
+        }
+        if (queue_deletion(path, is_directory) == -1) {
+            printf("Cannot delete %s\n", path);
+            ++receiver->failures;
+        }
+        if (is_replaced) {
+            wait_deletions();
+        }
+    } else {
+        printf("Unexpected frame %d received\n", frame->type);
+        return -1;
+    }
+    return 0;
+}
+
+/*!
+ * @brief read_options reads the filter rules and the options sent by the client, before its commands
+ * @param receiver is a pointer to the receiver
+ * @param rules is a pointer to the configuration receiving the filter rules
+ * @return 0 in case of success, -1 else
+ */
+static int read_options(receiver_t *receiver, configuration_t *rules) {
+    remote_frame_t frame;
+    while (read_remote_frame(&receiver->channel, &frame) == 0) {
+        if (frame.type == REMOTE_HELLO) {
+            uint32_t version = get_remote_u32(&frame);
+            receiver->has_md5 = get_remote_u8(&frame) != 0;
+            if (frame.is_invalid || version != REMOTE_PROTOCOL_VERSION) {
+                printf("Unsupported protocol version %u\n", version);
+                return -1;
+            }
+            return 0;
+        }
+        char rule[PATH_SIZE + 8];
+        get_remote_string(&frame, rule, sizeof(rule));
+        // Rules files are expanded by the client
+        if (frame.type != REMOTE_RULE || frame.is_invalid || (rule[0] != '+' && rule[0] != '-') || rule[1] != ' ') {
+            printf("Invalid filter rule received\n");
+            return -1;
+        }
+        char **new_rules = realloc(rules->filter_rules, (rules->filter_rules_count + 1) * sizeof(char *));
+        if (new_rules == NULL || (new_rules[rules->filter_rules_count] = strdup(rule)) == NULL) {
+            printf("Error when allocating memory in the function read_options of the file receiver.c\n");
+            if (new_rules != NULL) {
+                rules->filter_rules = new_rules;
+            }
+            return -1;
+        }
+        rules->filter_rules = new_rules;
+        ++rules->filter_rules_count;
+    }
+    return -1;
+}
+
+/*!
+ * @brief serve_connection serves a client: it lists and analyzes the destination while it applies the
+ * commands, until the client says goodbye
+ * @param fd is the connected socket
+ * @param root is the destination directory
+ * @param memory_limit is the limit of the memory of the listing in bytes, 0 when unlimited
+ * @return 0 in case of success, -1 else
+ */
+static int serve_connection(int fd, char *root, uint64_t memory_limit) {
+    receiver_t receiver;
+    memset(&receiver, 0, sizeof(receiver_t));
+    receiver.root = root;
+    receiver.memory_limit = (size_t) memory_limit;
+    if (init_remote_channel(&receiver.channel, fd, false) == -1) {
+        close(fd);
+        return -1;
+    }
+    pthread_mutex_init(&receiver.output_lock, NULL);
+
+    configuration_t rules;
+    memset(&rules, 0, sizeof(configuration_t));
+    int result = read_options(&receiver, &rules);
+    if (result == 0) {
+        result = init_filters(&rules);
+    }
+    for (size_t i = 0; i < rules.filter_rules_count; ++i) {
+        free(rules.filter_rules[i]);
+    }
+    free(rules.filter_rules);
+
+    pthread_t lister;
+    if (result == 0 && pthread_create(&lister, NULL, list_destination, &receiver) != 0) {
+        perror("Cannot start the destination listing");
+        result = -1;
+    }
+    bool is_listing = (result == 0);
+    while (result == 0) {
+        remote_frame_t frame;
+        if (read_remote_frame(&receiver.channel, &frame) == -1) {
+            result = -1;
+        } else if (frame.type == REMOTE_BYE) {
+            break;
+        } else {
+            result = apply_command(&receiver, &frame);
+        }
+    }
+    if (is_listing) {
+        if (result == -1) {
+            // The lister stops at its next entry
+            receiver.channel.is_broken = true;
+            shutdown(fd, SHUT_RDWR);
+        }
+        pthread_join(lister, NULL);
+    }
+    clean_deletions();
+    if (result == 0) {
+        if (begin_remote_frame(&receiver.channel, REMOTE_BYE_OK, 16) == 0) {
+            put_remote_u64(&receiver.channel, receiver.failures);
+            put_remote_u64(&receiver.channel, get_deleted_count());
+            end_remote_frame(&receiver.channel);
+        }
+        result = flush_remote_channel(&receiver.channel);
+    }
+    clean_filters();
+    pthread_mutex_destroy(&receiver.output_lock);
+    clear_remote_channel(&receiver.channel);
+    return result;
+}
+
+/*!
+ * @brief run_receiver serves a destination to the clients connecting to an address (--serve)
+ * Each connection is served by its own process, until the receiver is stopped by a signal.
+ * @param the_config is a pointer to the configuration (serve_address, and destination is the served directory)
+ * @return -1 when the address cannot be served (the function does not return else)
+ */
+int run_receiver(configuration_t *the_config) {
+    int listen_fd = open_remote_socket(the_config->serve_address, true);
+    if (listen_fd == -1) {
+        return -1;
+    }
+    // The children are not waited for, and a lost client is seen as a write error
+    signal(SIGCHLD, SIG_IGN);
+    signal(SIGPIPE, SIG_IGN);
+    printf("Serving %s on %s\n", the_config->destination, the_config->serve_address);
+    fflush(stdout);
+
+    while (true) {
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            perror("Cannot accept a connection");
+            close(listen_fd);
+            return -1;
+        }
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(listen_fd);
+            exit((serve_connection(fd, the_config->destination, the_config->memory_limit) == 0) ? 0 : 1);
+        }
+        if (pid == -1) {
+            perror("Cannot serve the connection");
+        }
+        close(fd);
+    }
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+#include "configuration.h"
+
+// Size of the writes of the received file data
+#define RECEIVER_WRITE_SIZE (256 * 1024)
+
+int run_receiver(configuration_t *the_config);
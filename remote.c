@@ -0,0 +1,1142 @@
+#define _GNU_SOURCE
+#include "remote.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <sys/un.h>
+#include <openssl/evp.h>
+#include "instrumentation.h"
+#include "utility.h"
+
+/*
+ * A remote destination is served by a receiver (@see receiver.c), which lists and analyzes its tree
+ * next to the data, and applies the commands of the client. Only the compact entries of the
+ * destination, the commands and the data of the copied files cross the socket.
+ * The protocol is pipelined: the receiver streams its entries while the client streams its commands,
+ * and neither side waits for an answer, except the signatures of the delta-encoded files. The frames
+ * are gathered in a buffer (batches), written when it is full or when the writer has nothing more to
+ * send for a while. The client never blocks on a write without reading what the receiver sends, so
+ * that both sides cannot wait for each other.
+ */
+
+struct remote_delta_s {
+    files_list_entry_t entry; // Source file
+    uint8_t *sums; // MD5 sums of the blocks of the destination file, 16 bytes each
+    uint32_t sums_count;
+    bool is_ready; // Set when all the sums were received
+    remote_delta_t *next;
+};
+
+/*!
+ * @brief is_remote_address tells if a destination is a receiver address instead of a directory
+ * @param path is the destination given on the command line
+ * @return true for unix:<socket path> and tcp:<host>:<port>
+ */
+bool is_remote_address(char *path) {
+    return path != NULL && (strncmp(path, REMOTE_UNIX_PREFIX, strlen(REMOTE_UNIX_PREFIX)) == 0 ||
+                            strncmp(path, REMOTE_TCP_PREFIX, strlen(REMOTE_TCP_PREFIX)) == 0);
+}
+
+/*!
+ * @brief open_unix_socket opens a Unix socket, bound to its path (receiver) or connected to it (client)
+ * @param path is the path of the socket
+ * @param is_server is true to listen on the socket
+ * @return the socket, -1 in case of error
+ */
+static int open_unix_socket(char *path, bool is_server) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        printf("The socket path %s is too long\n", path);
+        return -1;
+    }
+    strcpy(address.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        perror("Cannot create the socket");
+        return -1;
+    }
+    if (is_server) {
+        // The socket of a previous receiver is replaced
+        unlink(path);
+        if (bind(fd, (struct sockaddr *) &address, sizeof(address)) == -1 || listen(fd, SOMAXCONN) == -1) {
+            perror(path);
+            close(fd);
+            return -1;
+        }
+    } else if (connect(fd, (struct sockaddr *) &address, sizeof(address)) == -1) {
+        perror(path);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*!
+ * @brief open_tcp_socket opens a TCP socket, listening on a port (receiver) or connected to a receiver (client)
+ * @param host_and_port is <host>:<port>, the host may be empty (or *) for a receiver listening on every address
+ * @param is_server is true to listen on the socket
+ * @return the socket, -1 in case of error
+ */
+static int open_tcp_socket(char *host_and_port, bool is_server) {
+    char host[PATH_SIZE];
+    char *port = strrchr(host_and_port, ':');
+    if (port == NULL || (size_t) (port - host_and_port) >= sizeof(host)) {
+        printf("Invalid address tcp:%s, tcp:<host>:<port> is expected\n", host_and_port);
+        return -1;
+    }
+    // IPv6 addresses are given in brackets
+    char *host_start = host_and_port;
+    size_t host_length = (size_t) (port - host_and_port);
+    if (host_length >= 2 && host_start[0] == '[' && host_start[host_length - 1] == ']') {
+        ++host_start;
+        host_length -= 2;
+    }
+    memcpy(host, host_start, host_length);
+    host[host_length] = '\0';
+    ++port;
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = is_server ? AI_PASSIVE : 0;
+    struct addrinfo *addresses;
+    bool is_any = (host[0] == '\0' || strcmp(host, "*") == 0);
+    int error = getaddrinfo((is_server && is_any) ? NULL : host, port, &hints, &addresses);
+    if (error != 0) {
+        printf("Cannot resolve %s: %s\n", host_and_port, gai_strerror(error));
+        return -1;
+    }
+    int fd = -1;
+    for (struct addrinfo *cursor = addresses; cursor != NULL && fd == -1; cursor = cursor->ai_next) {
+        fd = socket(cursor->ai_family, cursor->ai_socktype | SOCK_CLOEXEC, cursor->ai_protocol);
+        if (fd == -1) {
+            continue;
+        }
+        int enabled = 1;
+        if (is_server) {
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &enabled, sizeof(enabled));
+            if (bind(fd, cursor->ai_addr, cursor->ai_addrlen) == -1 || listen(fd, SOMAXCONN) == -1) {
+                close(fd);
+                fd = -1;
+            }
+        } else if (connect(fd, cursor->ai_addr, cursor->ai_addrlen) == -1) {
+            close(fd);
+            fd = -1;
+        }
+        // The frames are already batched
+        if (fd != -1) {
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enabled, sizeof(enabled));
+        }
+    }
+    freeaddrinfo(addresses);
+    if (fd == -1) {
+        perror(host_and_port);
+    }
+    return fd;
+}
+
+/*!
+ * @brief open_remote_socket opens the socket of a receiver address
+ * @param address is unix:<socket path> or tcp:<host>:<port>
+ * @param is_server is true for the receiver (the socket listens), false for the client (it is connected)
+ * @return the socket, -1 in case of error
+ */
+int open_remote_socket(char *address, bool is_server) {
+    if (strncmp(address, REMOTE_UNIX_PREFIX, strlen(REMOTE_UNIX_PREFIX)) == 0) {
+        return open_unix_socket(address + strlen(REMOTE_UNIX_PREFIX), is_server);
+    }
+    if (strncmp(address, REMOTE_TCP_PREFIX, strlen(REMOTE_TCP_PREFIX)) == 0) {
+        return open_tcp_socket(address + strlen(REMOTE_TCP_PREFIX), is_server);
+    }
+    printf("Invalid address %s, unix:<socket path> or tcp:<host>:<port> is expected\n", address);
+    return -1;
+}
+
+/*!
+ * @brief init_remote_channel prepares the buffers of a connection
+ * @param channel is a pointer to the channel
+ * @param fd is the connected socket (closed with the channel)
+ * @param drains_input is true to make the socket non-blocking, and read it while waiting to write
+ * @return 0 in case of success, -1 else (the socket is not closed)
+ */
+int init_remote_channel(remote_channel_t *channel, int fd, bool drains_input) {
+    memset(channel, 0, sizeof(remote_channel_t));
+    channel->fd = fd;
+    channel->drains_input = drains_input;
+    channel->input_capacity = REMOTE_BUFFER_SIZE;
+    channel->output = malloc(REMOTE_BUFFER_SIZE);
+    channel->input = malloc(channel->input_capacity);
+    if (channel->output == NULL || channel->input == NULL) {
+        printf("Error when allocating memory in the function init_remote_channel of the file remote.c\n");
+        free(channel->output);
+        free(channel->input);
+        return -1;
+    }
+    if (drains_input) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    }
+    return 0;
+}
+
+/*!
+ * @brief clear_remote_channel closes a connection and frees its buffers
+ * @param channel is a pointer to the channel
+ */
+void clear_remote_channel(remote_channel_t *channel) {
+    free(channel->output);
+    free(channel->input);
+    channel->output = NULL;
+    channel->input = NULL;
+    if (channel->fd != -1) {
+        close(channel->fd);
+        channel->fd = -1;
+    }
+}
+
+/*!
+ * @brief receive_input reads the bytes available on the socket into the input buffer
+ * The bytes not decoded yet are moved to the start of the buffer first: the frames previously read
+ * (@see read_remote_frame) are no longer valid.
+ * @param channel is a pointer to the channel
+ * @return 0 if bytes were read, 1 if there was nothing to read (non-blocking socket), -1 in case of error
+ */
+static int receive_input(remote_channel_t *channel) {
+    if (channel->input_start > 0) {
+        memmove(channel->input, channel->input + channel->input_start, channel->input_end - channel->input_start);
+        channel->input_end -= channel->input_start;
+        channel->input_start = 0;
+    }
+    if (channel->input_end == channel->input_capacity) {
+        unsigned char *input = realloc(channel->input, channel->input_capacity * 2);
+        if (input == NULL) {
+            printf("Error when allocating memory in the function receive_input of the file remote.c\n");
+            channel->is_broken = true;
+            return -1;
+        }
+        channel->input = input;
+        channel->input_capacity *= 2;
+    }
+    ssize_t received;
+    while ((received = read(channel->fd, channel->input + channel->input_end, channel->input_capacity - channel->input_end)) == -1 &&
+           errno == EINTR);
+    if (received > 0) {
+        channel->input_end += (size_t) received;
+        return 0;
+    }
+    if (received == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return 1;
+    }
+    if (received == 0) {
+        printf("The connection was closed by the remote side\n");
+    } else {
+        perror("Cannot read from the remote side");
+    }
+    channel->is_broken = true;
+    return -1;
+}
+
+/*!
+ * @brief wait_socket waits for a socket to be readable or writable
+ * @param fd is the socket
+ * @param events are the poll events to wait for
+ * @return the events received, -1 in case of error
+ */
+static int wait_socket(int fd, short events) {
+    struct pollfd descriptor = {fd, events, 0};
+    while (poll(&descriptor, 1, -1) == -1) {
+        if (errno != EINTR) {
+            perror("Cannot wait for the remote side");
+            return -1;
+        }
+    }
+    return descriptor.revents;
+}
+
+/*!
+ * @brief wait_for_input reads at least one byte into the input buffer, waiting for it if needed
+ * @param channel is a pointer to the channel
+ * @return 0 in case of success, -1 else
+ */
+static int wait_for_input(remote_channel_t *channel) {
+    int result;
+    while ((result = receive_input(channel)) == 1) {
+        if (wait_socket(channel->fd, POLLIN) == -1) {
+            channel->is_broken = true;
+            return -1;
+        }
+    }
+    return result;
+}
+
+/*!
+ * @brief wait_for_output waits until the socket can be written, reading it meanwhile when the channel
+ * drains its input (the remote side may be waiting for its own writes to complete)
+ * @param channel is a pointer to the channel
+ * @return 0 in case of success, -1 else
+ */
+static int wait_for_output(remote_channel_t *channel) {
+    int events = wait_socket(channel->fd, POLLOUT | (channel->drains_input ? POLLIN : 0));
+    if (events == -1 || ((events & POLLIN) != 0 && receive_input(channel) == -1)) {
+        channel->is_broken = true;
+        return -1;
+    }
+    return 0;
+}
+
+/*!
+ * @brief send_raw writes bytes to the socket, after the frames already buffered
+ * @param channel is a pointer to the channel
+ * @param data is a pointer to the bytes
+ * @param size is the number of bytes
+ * @return 0 in case of success, -1 else
+ */
+static int send_raw(remote_channel_t *channel, const unsigned char *data, size_t size) {
+    size_t written = 0;
+    while (written < size && !channel->is_broken) {
+        ssize_t result = send(channel->fd, data + written, size - written, MSG_NOSIGNAL);
+        if (result >= 0) {
+            written += (size_t) result;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            wait_for_output(channel);
+        } else if (errno != EINTR) {
+            perror("Cannot write to the remote side");
+            channel->is_broken = true;
+        }
+    }
+    return channel->is_broken ? -1 : 0;
+}
+
+/*!
+ * @brief flush_remote_channel writes the buffered frames to the socket
+ * @param channel is a pointer to the channel
+ * @return 0 in case of success, -1 else
+ */
+int flush_remote_channel(remote_channel_t *channel) {
+    if (channel->output_size == 0 || channel->is_broken) {
+        return channel->is_broken ? -1 : 0;
+    }
+    struct timespec start;
+    instrument_begin(&start);
+    if (send_raw(channel, channel->output, channel->output_size) == -1) {
+        return -1;
+    }
+    instrument_end(STAGE_IPC_SEND, &start, channel->output_size);
+    channel->output_size = 0;
+    return 0;
+}
+
+/*!
+ * @brief begin_remote_frame starts a frame in the output buffer, writing the buffer first if the frame does not fit
+ * @param channel is a pointer to the channel
+ * @param type is the type of the frame (@see remote_frame_type_t)
+ * @param payload_size is the maximum size of the fields of the frame
+ * @return 0 in case of success, -1 else
+ */
+int begin_remote_frame(remote_channel_t *channel, uint8_t type, size_t payload_size) {
+    if (channel->output_size + REMOTE_HEADER_SIZE + payload_size > REMOTE_BUFFER_SIZE && flush_remote_channel(channel) == -1) {
+        return -1;
+    }
+    channel->frame_start = channel->output_size;
+    channel->output[channel->frame_start + 4] = type;
+    channel->output_size += REMOTE_HEADER_SIZE;
+    return 0;
+}
+
+/*!
+ * @brief put_remote_bytes appends bytes to the frame being built
+ * @param channel is a pointer to the channel
+ * @param data is a pointer to the bytes
+ * @param size is the number of bytes (within the payload size given to begin_remote_frame)
+ */
+void put_remote_bytes(remote_channel_t *channel, const void *data, size_t size) {
+    if (channel->output_size + size > REMOTE_BUFFER_SIZE) {
+        channel->is_broken = true;
+        return;
+    }
+    memcpy(channel->output + channel->output_size, data, size);
+    channel->output_size += size;
+}
+
+/*!
+ * @brief put_remote_u8 appends a byte to the frame being built
+ */
+void put_remote_u8(remote_channel_t *channel, uint8_t value) {
+    put_remote_bytes(channel, &value, 1);
+}
+
+/*!
+ * @brief put_remote_u32 appends a 32 bits integer (big-endian) to the frame being built
+ */
+void put_remote_u32(remote_channel_t *channel, uint32_t value) {
+    unsigned char bytes[4] = {(unsigned char) (value >> 24), (unsigned char) (value >> 16), (unsigned char) (value >> 8), (unsigned char) value};
+    put_remote_bytes(channel, bytes, sizeof(bytes));
+}
+
+/*!
+ * @brief put_remote_u64 appends a 64 bits integer (big-endian) to the frame being built
+ */
+void put_remote_u64(remote_channel_t *channel, uint64_t value) {
+    put_remote_u32(channel, (uint32_t) (value >> 32));
+    put_remote_u32(channel, (uint32_t) value);
+}
+
+/*!
+ * @brief put_remote_string appends a string (its 32 bits length, then its characters) to the frame being built
+ */
+void put_remote_string(remote_channel_t *channel, const char *text) {
+    size_t length = strlen(text);
+    put_remote_u32(channel, (uint32_t) length);
+    put_remote_bytes(channel, text, length);
+}
+
+/*!
+ * @brief end_remote_frame completes the frame being built with its size
+ * @param channel is a pointer to the channel
+ */
+void end_remote_frame(remote_channel_t *channel) {
+    uint32_t size = (uint32_t) (channel->output_size - channel->frame_start - REMOTE_HEADER_SIZE);
+    unsigned char *header = channel->output + channel->frame_start;
+    header[0] = (unsigned char) (size >> 24);
+    header[1] = (unsigned char) (size >> 16);
+    header[2] = (unsigned char) (size >> 8);
+    header[3] = (unsigned char) size;
+}
+
+/*!
+ * @brief buffered_frame_size gives the size of the next frame when it was completely received
+ * @param channel is a pointer to the channel
+ * @return the size of the frame with its header, 0 if it is not complete, -1 if it is invalid
+ */
+static ssize_t buffered_frame_size(remote_channel_t *channel) {
+    size_t available = channel->input_end - channel->input_start;
+    if (available < REMOTE_HEADER_SIZE) {
+        return 0;
+    }
+    unsigned char *header = channel->input + channel->input_start;
+    uint32_t size = ((uint32_t) header[0] << 24) | ((uint32_t) header[1] << 16) | ((uint32_t) header[2] << 8) | header[3];
+    if (size > REMOTE_MAX_PAYLOAD) {
+        printf("Invalid frame received from the remote side\n");
+        channel->is_broken = true;
+        return -1;
+    }
+    return (available >= REMOTE_HEADER_SIZE + size) ? (ssize_t) (REMOTE_HEADER_SIZE + size) : 0;
+}
+
+/*!
+ * @brief read_remote_frame reads the next frame, waiting for it if needed
+ * The frame points into the input buffer: it is valid until the next read on the channel.
+ * @param channel is a pointer to the channel
+ * @param frame is a pointer to the frame to decode
+ * @return 0 in case of success, -1 else
+ */
+int read_remote_frame(remote_channel_t *channel, remote_frame_t *frame) {
+    struct timespec start;
+    instrument_begin(&start);
+    ssize_t size;
+    while ((size = buffered_frame_size(channel)) == 0) {
+        if (wait_for_input(channel) == -1) {
+            return -1;
+        }
+    }
+    if (size == -1) {
+        return -1;
+    }
+    unsigned char *header = channel->input + channel->input_start;
+    frame->type = header[4];
+    frame->cursor = header + REMOTE_HEADER_SIZE;
+    frame->end = header + size;
+    frame->is_invalid = false;
+    channel->input_start += (size_t) size;
+    instrument_end(STAGE_IPC_RECEIVE, &start, (uint64_t) size);
+    return 0;
+}
+
+/*!
+ * @brief read_remote_raw reads bytes following a frame (the data of a file), waiting for them if needed
+ * @param channel is a pointer to the channel
+ * @param size is the maximum number of bytes to read
+ * @param data receives a pointer to the bytes, valid until the next read on the channel
+ * @return the number of bytes read, -1 in case of error
+ */
+ssize_t read_remote_raw(remote_channel_t *channel, size_t size, unsigned char **data) {
+    if (channel->input_end == channel->input_start && wait_for_input(channel) == -1) {
+        return -1;
+    }
+    size_t available = channel->input_end - channel->input_start;
+    size_t read_size = (available < size) ? available : size;
+    *data = channel->input + channel->input_start;
+    channel->input_start += read_size;
+    return (ssize_t) read_size;
+}
+
+/*!
+ * @brief get_remote_bytes decodes bytes of a frame
+ * @param frame is a pointer to the frame
+ * @param data receives the bytes (zeroed when the frame is too short)
+ * @param size is the number of bytes
+ */
+void get_remote_bytes(remote_frame_t *frame, void *data, size_t size) {
+    if (frame->is_invalid || (size_t) (frame->end - frame->cursor) < size) {
+        frame->is_invalid = true;
+        memset(data, 0, size);
+        return;
+    }
+    memcpy(data, frame->cursor, size);
+    frame->cursor += size;
+}
+
+/*!
+ * @brief get_remote_u8 decodes a byte of a frame
+ */
+uint8_t get_remote_u8(remote_frame_t *frame) {
+    uint8_t value;
+    get_remote_bytes(frame, &value, 1);
+    return value;
+}
+
+/*!
+ * @brief get_remote_u32 decodes a 32 bits integer (big-endian) of a frame
+ */
+uint32_t get_remote_u32(remote_frame_t *frame) {
+    unsigned char bytes[4];
+    get_remote_bytes(frame, bytes, sizeof(bytes));
+    return ((uint32_t) bytes[0] << 24) | ((uint32_t) bytes[1] << 16) | ((uint32_t) bytes[2] << 8) | bytes[3];
+}
+
+/*!
+ * @brief get_remote_u64 decodes a 64 bits integer (big-endian) of a frame
+ */
+uint64_t get_remote_u64(remote_frame_t *frame) {
+    uint64_t high = get_remote_u32(frame);
+    return (high << 32) | get_remote_u32(frame);
+}
+
+/*!
+ * @brief get_remote_string decodes a string of a frame
+ * @param frame is a pointer to the frame
+ * @param text receives the string, empty when it is invalid
+ * @param size is the size of text
+ */
+void get_remote_string(remote_frame_t *frame, char *text, size_t size) {
+    uint32_t length = get_remote_u32(frame);
+    if (frame->is_invalid || length >= size) {
+        frame->is_invalid = true;
+        text[0] = '\0';
+        return;
+    }
+    get_remote_bytes(frame, text, length);
+    text[length] = '\0';
+}
+
+/*!
+ * @brief put_remote_entry adds a destination entry to the output buffer (receiver)
+ * @param channel is a pointer to the channel
+ * @param relative is the path of the entry relative to the destination root
+ * @param entry is a pointer to the entry
+ * @param has_md5 is true to send its MD5 sum
+ */
+void put_remote_entry(remote_channel_t *channel, char *relative, files_list_entry_t *entry, bool has_md5) {
+    if (begin_remote_frame(channel, REMOTE_ENTRY, REMOTE_MAX_FRAME) == -1) {
+        return;
+    }
+    put_remote_string(channel, relative);
+    put_remote_u8(channel, (uint8_t) entry->entry_type);
+    put_remote_u32(channel, (uint32_t) entry->mode);
+    put_remote_u64(channel, entry->size);
+    put_remote_u64(channel, (uint64_t) entry->mtime.tv_sec);
+    put_remote_u32(channel, (uint32_t) entry->mtime.tv_nsec);
+    put_remote_u32(channel, (uint32_t) entry->links_count);
+    if (has_md5) {
+        put_remote_bytes(channel, entry->md5sum, sizeof(entry->md5sum));
+    }
+    end_remote_frame(channel);
+}
+
+/*!
+ * @brief digest_remote_block computes the MD5 sum of a block of a delta-encoded file
+ * @param data is a pointer to the block
+ * @param size is the size of the block (REMOTE_DELTA_BLOCK_SIZE, less for the last one)
+ * @param md5sum receives the 16 bytes of the sum
+ */
+void digest_remote_block(const void *data, size_t size, uint8_t *md5sum) {
+    unsigned char sum[EVP_MAX_MD_SIZE];
+    if (EVP_Digest(data, size, sum, NULL, EVP_md5(), NULL) != 1) {
+        memset(sum, 0, 16);
+    }
+    memcpy(md5sum, sum, 16);
+}
+
+/*!
+ * @brief send_rules_file sends the rules of a filter rules file (@see filters.c for their syntax)
+ * The receiver cannot read the files of the client: their rules are sent one by one.
+ * @param connection is a pointer to the connection
+ * @param path is the path of the rules file
+ * @return 0 in case of success, -1 else
+ */
+static int send_rules_file(remote_connection_t *connection, char *path) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        perror("Cannot open the filter rules file");
+        return -1;
+    }
+    char line[PATH_SIZE + 4];
+    char rule[PATH_SIZE + 8];
+    int result = 0;
+    while (result == 0 && fgets(line, sizeof(line), file) != NULL) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#') {
+            continue;
+        }
+        // A line without prefix excludes
+        bool has_kind = (line[0] == '+' || line[0] == '-') && line[1] == ' ';
+        snprintf(rule, sizeof(rule), "%s%s", has_kind ? "" : "- ", line);
+        result = begin_remote_frame(&connection->channel, REMOTE_RULE, REMOTE_MAX_FRAME);
+        put_remote_string(&connection->channel, rule);
+        end_remote_frame(&connection->channel);
+    }
+    fclose(file);
+    return result;
+}
+
+/*!
+ * @brief connect_to_receiver opens the connection to the receiver of a remote destination
+ * The filter rules are sent first, then the options: the receiver starts listing its tree.
+ * @param the_config is a pointer to the configuration (the_config->destination is the address)
+ * @return a pointer to the connection, NULL in case of error
+ */
+remote_connection_t *connect_to_receiver(configuration_t *the_config) {
+    int fd = open_remote_socket(the_config->destination, false);
+    if (fd == -1) {
+        return NULL;
+    }
+    remote_connection_t *connection = calloc(1, sizeof(remote_connection_t));
+    if (connection == NULL || init_remote_channel(&connection->channel, fd, true) == -1) {
+        if (connection == NULL) {
+            printf("Error when allocating memory in the function connect_to_receiver of the file remote.c\n");
+        }
+        free(connection);
+        close(fd);
+        return NULL;
+    }
+    connection->source_root = the_config->source;
+    connection->destination_root = the_config->destination;
+    connection->has_md5 = the_config->uses_md5;
+    connection->uses_delta = the_config->uses_delta;
+
+    int result = 0;
+    for (size_t i = 0; i < the_config->filter_rules_count && result == 0; ++i) {
+        char *rule = the_config->filter_rules[i];
+        if (rule[0] == '.') {
+            result = send_rules_file(connection, rule + 2);
+        } else {
+            result = begin_remote_frame(&connection->channel, REMOTE_RULE, REMOTE_MAX_FRAME);
+            put_remote_string(&connection->channel, rule);
+            end_remote_frame(&connection->channel);
+        }
+    }
+    if (result == 0 && begin_remote_frame(&connection->channel, REMOTE_HELLO, 8) == 0) {
+        put_remote_u32(&connection->channel, REMOTE_PROTOCOL_VERSION);
+        put_remote_u8(&connection->channel, connection->has_md5);
+        end_remote_frame(&connection->channel);
+        result = flush_remote_channel(&connection->channel);
+    }
+    if (result == -1 || connection->channel.is_broken) {
+        clear_remote_channel(&connection->channel);
+        free(connection);
+        return NULL;
+    }
+    return connection;
+}
+
+/*!
+ * @brief process_frame handles a frame sent by the receiver
+ * @param connection is a pointer to the connection
+ * @param frame is a pointer to the frame
+ * @return 0 in case of success, -1 else
+ */
+static int process_frame(remote_connection_t *connection, remote_frame_t *frame) {
+    if (frame->type == REMOTE_ENTRY) {
+        files_list_entry_t *entry = calloc(1, sizeof(files_list_entry_t));
+        if (entry == NULL) {
+            printf("Error when allocating memory in the function process_frame of the file remote.c\n");
+            return -1;
+        }
+        char relative[PATH_SIZE];
+        get_remote_string(frame, relative, sizeof(relative));
+        entry->entry_type = (get_remote_u8(frame) == DOSSIER) ? DOSSIER : FICHIER;
+        entry->mode = (mode_t) get_remote_u32(frame);
+        entry->size = get_remote_u64(frame);
+        entry->mtime.tv_sec = (time_t) get_remote_u64(frame);
+        entry->mtime.tv_nsec = (long) get_remote_u32(frame);
+        entry->links_count = (nlink_t) get_remote_u32(frame);
+        if (connection->has_md5) {
+            get_remote_bytes(frame, entry->md5sum, sizeof(entry->md5sum));
+        }
+        if (frame->is_invalid || concat_path(entry->path_and_name, connection->destination_root, relative) == NULL) {
+            free(entry);
+            frame->is_invalid = true;
+        } else {
+            add_entry_to_tail(&connection->entries, entry);
+        }
+    } else if (frame->type == REMOTE_LIST_END) {
+        connection->is_listed = true;
+    } else if (frame->type == REMOTE_SIGNATURES && connection->deltas_head != NULL) {
+        remote_delta_t *delta = connection->deltas_head;
+        uint32_t count = get_remote_u32(frame);
+        bool is_last = get_remote_u8(frame) != 0;
+        uint8_t *sums = (count > REMOTE_SIGNATURES_PER_FRAME) ? NULL : realloc(delta->sums, (delta->sums_count + count) * 16 + 1);
+        if (sums == NULL) {
+            printf("Error when allocating memory in the function process_frame of the file remote.c\n");
+            return -1;
+        }
+        delta->sums = sums;
+        get_remote_bytes(frame, delta->sums + delta->sums_count * 16, count * 16);
+        delta->sums_count += count;
+        delta->is_ready = is_last;
+    } else if (frame->type == REMOTE_BYE_OK) {
+        connection->failures = get_remote_u64(frame);
+        connection->deleted = get_remote_u64(frame);
+        connection->is_done = true;
+    } else {
+        frame->is_invalid = true;
+    }
+    if (frame->is_invalid) {
+        printf("Invalid frame received from the receiver\n");
+        connection->channel.is_broken = true;
+        return -1;
+    }
+    return 0;
+}
+
+/*!
+ * @brief read_block reads a block of a file, up to its end
+ * @return the number of bytes read (less than size at the end of the file), -1 in case of error
+ */
+static ssize_t read_block(int fd, unsigned char *buffer, size_t size) {
+    size_t filled = 0;
+    while (filled < size) {
+        ssize_t result = read(fd, buffer + filled, size - filled);
+        if (result == -1 && errno == EINTR) {
+            continue;
+        }
+        if (result <= 0) {
+            return (result == -1) ? -1 : (ssize_t) filled;
+        }
+        filled += (size_t) result;
+    }
+    return (ssize_t) filled;
+}
+
+/*!
+ * @brief begin_file_frame starts the frame announcing a file, with its path, mode, mtime and size
+ * @param connection is a pointer to the connection
+ * @param type is REMOTE_FILE or REMOTE_DELTA_FILE
+ * @param entry is a pointer to the source file
+ * @param data_size is the size of the raw data following the frame, in the same buffer
+ * @return 0 in case of success, -1 else
+ */
+static int begin_file_frame(remote_connection_t *connection, uint8_t type, files_list_entry_t *entry, size_t data_size) {
+    if (begin_remote_frame(&connection->channel, type, REMOTE_MAX_FRAME + data_size) == -1) {
+        return -1;
+    }
+    put_remote_string(&connection->channel, relative_path(entry->path_and_name, connection->source_root));
+    put_remote_u32(&connection->channel, (uint32_t) entry->mode);
+    put_remote_u64(&connection->channel, (uint64_t) entry->mtime.tv_sec);
+    put_remote_u32(&connection->channel, (uint32_t) entry->mtime.tv_nsec);
+    put_remote_u64(&connection->channel, entry->size);
+    end_remote_frame(&connection->channel);
+    return 0;
+}
+
+/*!
+ * @brief end_file sends the end of a file
+ * @param connection is a pointer to the connection
+ * @param is_complete is false when the source file could not be read completely (the receiver drops it)
+ * @return 0 in case of success, -1 else
+ */
+static int end_file(remote_connection_t *connection, bool is_complete) {
+    if (begin_remote_frame(&connection->channel, REMOTE_FILE_END, 1) == -1) {
+        return -1;
+    }
+    put_remote_u8(&connection->channel, is_complete);
+    end_remote_frame(&connection->channel);
+    return 0;
+}
+
+/*!
+ * @brief send_whole_file sends a source file with all its data
+ * A small file is read into the output buffer, after its frame, so that it is batched with the next
+ * frames. The data of a larger file is sent with sendfile. The data of a file that shrank is padded
+ * with zeros, and the file is flagged as incomplete.
+ * @param connection is a pointer to the connection
+ * @param entry is a pointer to the source file
+ * @return 0 in case of success (or when the source cannot be read), -1 if the connection failed
+ */
+static int send_whole_file(remote_connection_t *connection, files_list_entry_t *entry) {
+    int source_fd = open(entry->path_and_name, O_RDONLY);
+    if (source_fd == -1) {
+        perror("Cannot open source file");
+        return 0;
+    }
+    struct timespec start;
+    instrument_begin(&start);
+    remote_channel_t *channel = &connection->channel;
+    bool is_small = entry->size <= REMOTE_DELTA_BLOCK_SIZE;
+    if (begin_file_frame(connection, REMOTE_FILE, entry, is_small ? entry->size : 0) == -1) {
+        close(source_fd);
+        return -1;
+    }
+
+    uint64_t sent = 0;
+    if (is_small) {
+        ssize_t read_size = read_block(source_fd, channel->output + channel->output_size, entry->size);
+        sent = (read_size > 0) ? (uint64_t) read_size : 0;
+        channel->output_size += entry->size;
+    } else if (flush_remote_channel(channel) == 0) {
+        off_t offset = 0;
+        while ((uint64_t) offset < entry->size && !channel->is_broken) {
+            ssize_t result = sendfile(channel->fd, source_fd, &offset, entry->size - (uint64_t) offset);
+            if (result == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                wait_for_output(channel);
+            } else if (result == 0 || (result == -1 && errno != EINTR)) {
+                if (result == -1) {
+                    perror("Cannot copy file");
+                }
+                break;
+            }
+        }
+        sent = (uint64_t) offset;
+    }
+    if (sent < entry->size) {
+        // The receiver expects the announced size
+        unsigned char zeros[4096] = {0};
+        if (is_small) {
+            memset(channel->output + channel->output_size - (entry->size - sent), 0, entry->size - sent);
+        }
+        for (uint64_t padded = sent; !is_small && padded < entry->size && !channel->is_broken; padded += sizeof(zeros)) {
+            send_raw(channel, zeros, (entry->size - padded < sizeof(zeros)) ? entry->size - padded : sizeof(zeros));
+        }
+    }
+    close(source_fd);
+    if (end_file(connection, sent == entry->size) == -1) {
+        return -1;
+    }
+    instrument_end_path(STAGE_COPY, &start, sent, entry->path_and_name);
+    return 0;
+}
+
+/*!
+ * @brief send_delta_file sends a source file as the blocks of the destination file it keeps, and the
+ * data of the other ones
+ * The blocks are compared at the same offsets: a modified block is sent, but data inserted or removed
+ * in the middle of the file makes the following blocks differ.
+ * @param connection is a pointer to the connection
+ * @param delta is a pointer to the source file, with the MD5 sums of the blocks of its destination file
+ * @return 0 in case of success (or when the source cannot be read), -1 if the connection failed
+ */
+static int send_delta_file(remote_connection_t *connection, remote_delta_t *delta) {
+    int source_fd = open(delta->entry.path_and_name, O_RDONLY);
+    unsigned char *block = malloc(REMOTE_DELTA_BLOCK_SIZE);
+    if (source_fd == -1 || block == NULL) {
+        if (source_fd == -1) {
+            perror("Cannot open source file");
+        } else {
+            printf("Error when allocating memory in the function send_delta_file of the file remote.c\n");
+            close(source_fd);
+        }
+        free(block);
+        return 0;
+    }
+    struct timespec start;
+    instrument_begin(&start);
+    remote_channel_t *channel = &connection->channel;
+    int result = begin_file_frame(connection, REMOTE_DELTA_FILE, &delta->entry, 0);
+
+    // Runs of kept blocks are sent as a single REMOTE_COPY
+    uint64_t index = 0, run_start = 0, total = 0, sent = 0;
+    uint32_t run_length = 0;
+    ssize_t read_size = 0;
+    while (result == 0 && (read_size = read_block(source_fd, block, REMOTE_DELTA_BLOCK_SIZE)) > 0) {
+        uint8_t md5sum[16];
+        digest_remote_block(block, (size_t) read_size, md5sum);
+        bool is_kept = index < delta->sums_count && memcmp(md5sum, delta->sums + index * 16, 16) == 0;
+        if (is_kept && run_length == 0) {
+            run_start = index;
+        }
+        run_length += is_kept ? 1 : 0;
+        if ((!is_kept || read_size < REMOTE_DELTA_BLOCK_SIZE) && run_length > 0) {
+            result = begin_remote_frame(channel, REMOTE_COPY, 12);
+            put_remote_u64(channel, run_start);
+            put_remote_u32(channel, run_length);
+            end_remote_frame(channel);
+            run_length = 0;
+        }
+        if (!is_kept && result == 0) {
+            result = begin_remote_frame(channel, REMOTE_DATA, (size_t) read_size);
+            put_remote_bytes(channel, block, (size_t) read_size);
+            end_remote_frame(channel);
+            sent += (uint64_t) read_size;
+        }
+        total += (uint64_t) read_size;
+        ++index;
+        if (read_size < REMOTE_DELTA_BLOCK_SIZE) {
+            break;
+        }
+    }
+    if (result == 0 && run_length > 0) {
+        result = begin_remote_frame(channel, REMOTE_COPY, 12);
+        put_remote_u64(channel, run_start);
+        put_remote_u32(channel, run_length);
+        end_remote_frame(channel);
+    }
+    if (read_size == -1) {
+        perror("Cannot copy file");
+    }
+    free(block);
+    close(source_fd);
+    if (result == -1 || end_file(connection, read_size != -1 && total == delta->entry.size) == -1) {
+        return -1;
+    }
+    instrument_end_path(STAGE_COPY, &start, sent, delta->entry.path_and_name);
+    return 0;
+}
+
+/*!
+ * @brief send_ready_deltas sends the delta-encoded files whose signatures were received, in order
+ * @param connection is a pointer to the connection
+ * @return 0 in case of success, -1 else
+ */
+static int send_ready_deltas(remote_connection_t *connection) {
+    while (connection->deltas_head != NULL && connection->deltas_head->is_ready) {
+        remote_delta_t *delta = connection->deltas_head;
+        connection->deltas_head = delta->next;
+        if (connection->deltas_head == NULL) {
+            connection->deltas_tail = NULL;
+        }
+        int result = send_delta_file(connection, delta);
+        free(delta->sums);
+        free(delta);
+        if (result == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*!
+ * @brief receive_frame handles the next frame of the receiver, waiting for it if needed
+ * The buffered commands are sent before waiting: the receiver may need them to answer.
+ * @param connection is a pointer to the connection
+ * @return 0 in case of success, -1 else
+ */
+static int receive_frame(remote_connection_t *connection) {
+    remote_frame_t frame;
+    if ((buffered_frame_size(&connection->channel) == 0 && flush_remote_channel(&connection->channel) == -1) ||
+        read_remote_frame(&connection->channel, &frame) == -1 || process_frame(connection, &frame) == -1) {
+        return -1;
+    }
+    return send_ready_deltas(connection);
+}
+
+/*!
+ * @brief process_buffered_frames handles the frames of the receiver already read (while writing)
+ * @param connection is a pointer to the connection
+ * @return 0 in case of success, -1 else
+ */
+static int process_buffered_frames(remote_connection_t *connection) {
+    ssize_t size;
+    while ((size = buffered_frame_size(&connection->channel)) > 0) {
+        if (receive_frame(connection) == -1) {
+            return -1;
+        }
+    }
+    return (size == -1 || connection->channel.is_broken) ? -1 : 0;
+}
+
+/*!
+ * @brief receive_remote_entry gives the next entry of the remote destination
+ * @param connection is a pointer to the connection
+ * @param entry receives the entry, its path starts with the address of the receiver
+ * @return 1 when an entry was received, 0 at the end of the destination tree, -1 in case of error
+ */
+int receive_remote_entry(remote_connection_t *connection, files_list_entry_t *entry) {
+    while (connection->entries.head == NULL && !connection->is_listed) {
+        if (receive_frame(connection) == -1) {
+            return -1;
+        }
+    }
+    files_list_entry_t *received = remove_head_entry(&connection->entries);
+    if (received == NULL) {
+        return 0;
+    }
+    memcpy(entry, received, sizeof(files_list_entry_t));
+    entry->next = NULL;
+    entry->prev = NULL;
+    free(received);
+    return 1;
+}
+
+/*!
+ * @brief send_remote_directory makes the receiver create a directory (or set its mode when it exists)
+ * @param connection is a pointer to the connection
+ * @param entry is a pointer to the source directory
+ * @return 0 in case of success, -1 if the connection failed
+ */
+int send_remote_directory(remote_connection_t *connection, files_list_entry_t *entry) {
+    if (begin_remote_frame(&connection->channel, REMOTE_MKDIR, REMOTE_MAX_FRAME) == -1) {
+        return -1;
+    }
+    put_remote_string(&connection->channel, relative_path(entry->path_and_name, connection->source_root));
+    put_remote_u32(&connection->channel, (uint32_t) entry->mode);
+    end_remote_frame(&connection->channel);
+    return process_buffered_frames(connection);
+}
+
+/*!
+ * @brief send_remote_file sends a source file to the receiver
+ * With --delta, a file replacing a destination file of at least one block is delta-encoded: the MD5
+ * sums of the blocks of the destination file are requested, and the file is sent when they arrive,
+ * without waiting for them meanwhile (@see send_delta_file).
+ * @param connection is a pointer to the connection
+ * @param entry is a pointer to the source file
+ * @param dest_entry is a pointer to the destination file it replaces, NULL if none
+ * @return 0 in case of success, -1 if the connection failed
+ */
+int send_remote_file(remote_connection_t *connection, files_list_entry_t *entry, files_list_entry_t *dest_entry) {
+    if (connection->uses_delta && dest_entry != NULL && dest_entry->entry_type == FICHIER &&
+        entry->size >= REMOTE_DELTA_BLOCK_SIZE && dest_entry->size >= REMOTE_DELTA_BLOCK_SIZE) {
+        remote_delta_t *delta = calloc(1, sizeof(remote_delta_t));
+        if (delta == NULL) {
+            printf("Error when allocating memory in the function send_remote_file of the file remote.c\n");
+            return -1;
+        }
+        memcpy(&delta->entry, entry, sizeof(files_list_entry_t));
+        if (connection->deltas_tail != NULL) {
+            connection->deltas_tail->next = delta;
+        } else {
+            connection->deltas_head = delta;
+        }
+        connection->deltas_tail = delta;
+        if (begin_remote_frame(&connection->channel, REMOTE_SIGNATURES_REQUEST, REMOTE_MAX_FRAME) == -1) {
+            return -1;
+        }
+        put_remote_string(&connection->channel, relative_path(entry->path_and_name, connection->source_root));
+        end_remote_frame(&connection->channel);
+        return process_buffered_frames(connection);
+    }
+    if (send_whole_file(connection, entry) == -1) {
+        return -1;
+    }
+    return process_buffered_frames(connection);
+}
+
+/*!
+ * @brief send_remote_metadata makes the receiver set the mode (and the mtime of a file) of an entry
+ * @param connection is a pointer to the connection
+ * @param entry is a pointer to the source entry
+ * @return 0 in case of success, -1 if the connection failed
+ */
+int send_remote_metadata(remote_connection_t *connection, files_list_entry_t *entry) {
+    if (begin_remote_frame(&connection->channel, REMOTE_METADATA, REMOTE_MAX_FRAME) == -1) {
+        return -1;
+    }
+    put_remote_string(&connection->channel, relative_path(entry->path_and_name, connection->source_root));
+    put_remote_u32(&connection->channel, (uint32_t) entry->mode);
+    // The mtime of a directory follows its content
+    put_remote_u8(&connection->channel, entry->entry_type == FICHIER);
+    put_remote_u64(&connection->channel, (uint64_t) entry->mtime.tv_sec);
+    put_remote_u32(&connection->channel, (uint32_t) entry->mtime.tv_nsec);
+    end_remote_frame(&connection->channel);
+    return process_buffered_frames(connection);
+}
+
+/*!
+ * @brief is_deleted_with_directory tells if an extraneous entry is deleted with a directory already
+ * deleted: the receiver lists the content of the directories missing from the source, and deletes it
+ * with them. The directory is remembered for its content, which follows it.
+ * @param connection is a pointer to the connection
+ * @param relative is the path of the entry relative to the destination root
+ * @param is_directory is true for a directory
+ * @return true if the entry is in the last deleted directory
+ */
+bool is_deleted_with_directory(remote_connection_t *connection, char *relative, bool is_directory) {
+    size_t length = strlen(connection->deleted_directory);
+    if (length > 0 && strncmp(relative, connection->deleted_directory, length) == 0 && relative[length] == '/') {
+        return true;
+    }
+    if (is_directory) {
+        snprintf(connection->deleted_directory, sizeof(connection->deleted_directory), "%s", relative);
+    }
+    return false;
+}
+
+/*!
+ * @brief send_remote_deletion makes the receiver delete an entry (@see delete.c)
+ * @param connection is a pointer to the connection
+ * @param relative is the path of the entry relative to the destination root
+ * @param is_directory is true for a directory
+ * @param is_replaced is true when the next command creates an entry with the same path: the
+ * receiver completes the deletion first
+ * @return 0 in case of success, -1 if the connection failed
+ */
+int send_remote_deletion(remote_connection_t *connection, char *relative, bool is_directory, bool is_replaced) {
+    if (begin_remote_frame(&connection->channel, REMOTE_DELETE, REMOTE_MAX_FRAME) == -1) {
+        return -1;
+    }
+    put_remote_string(&connection->channel, relative);
+    put_remote_u8(&connection->channel, is_directory);
+    put_remote_u8(&connection->channel, is_replaced);
+    end_remote_frame(&connection->channel);
+    return process_buffered_frames(connection);
+}
+
+/*!
+ * @brief disconnect_from_receiver sends the last commands, and waits until the receiver applied them all
+ * @param connection is a pointer to the connection, freed
+ * @param deleted_count receives the number of entries deleted by the receiver
+ * @return 0 in case of success, -1 if commands failed or the connection was lost
+ */
+int disconnect_from_receiver(remote_connection_t *connection, uint64_t *deleted_count) {
+    // The delta-encoded files are sent once their signatures arrive
+    while (connection->deltas_head != NULL && !connection->channel.is_broken) {
+        receive_frame(connection);
+    }
+    if (!connection->channel.is_broken && begin_remote_frame(&connection->channel, REMOTE_BYE, 0) == 0) {
+        end_remote_frame(&connection->channel);
+    }
+    while (!connection->is_done && !connection->channel.is_broken) {
+        receive_frame(connection);
+    }
+
+    int result = 0;
+    *deleted_count = connection->deleted;
+    if (!connection->is_done) {
+        printf("The connection to %s was lost before all the commands were applied\n", connection->destination_root);
+        result = -1;
+    } else if (connection->failures > 0) {
+        printf("%llu commands failed on %s\n", (unsigned long long) connection->failures, connection->destination_root);
+        result = -1;
+    }
+    while (connection->deltas_head != NULL) {
+        remote_delta_t *delta = connection->deltas_head;
+        connection->deltas_head = delta->next;
+        free(delta->sums);
+        free(delta);
+    }
+    clear_files_list(&connection->entries);
+    clear_remote_channel(&connection->channel);
+    free(connection);
+    return result;
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include "configuration.h"
+#include "files-list.h"
+#include "defines.h"
+
+// A remote destination is given as unix:<socket path> or tcp:<host>:<port>, and served by LP25 --serve
+#define REMOTE_UNIX_PREFIX "unix:"
+#define REMOTE_TCP_PREFIX "tcp:"
+#define REMOTE_PROTOCOL_VERSION 1
+// Frames are gathered in a buffer of this size before they are written to the socket
+#define REMOTE_BUFFER_SIZE (256 * 1024)
+// Header of a frame: size of its payload (32 bits) and its type (8 bits)
+#define REMOTE_HEADER_SIZE 5
+// Largest frame holding a path
+#define REMOTE_MAX_FRAME (PATH_SIZE + 64)
+// Files are delta-encoded by blocks of this size (--delta), their MD5 sums are sent by frames of this count
+#define REMOTE_DELTA_BLOCK_SIZE (64 * 1024)
+#define REMOTE_SIGNATURES_PER_FRAME 4096
+#define REMOTE_MAX_PAYLOAD (REMOTE_DELTA_BLOCK_SIZE + REMOTE_MAX_FRAME)
+
+// Frames of the protocol: all the integers are big-endian, the paths are relative to the roots
+typedef enum {
+    REMOTE_HELLO = 1, // Client: version, whether MD5 sums are used (after the filter rules)
+    REMOTE_RULE, // Client: a filter rule (@see filters.c)
+    REMOTE_ENTRY, // Receiver: a destination entry, in the order of path_compare
+    REMOTE_LIST_END, // Receiver: the destination was completely listed
+    REMOTE_MKDIR, // Client: path, mode
+    REMOTE_FILE, // Client: path, mode, mtime, size, followed by the raw data of the file
+    REMOTE_DELTA_FILE, // Client: path, mode, mtime, size, followed by REMOTE_DATA and REMOTE_COPY frames
+    REMOTE_DATA, // Client: data of a delta-encoded file
+    REMOTE_COPY, // Client: blocks of the current destination file kept by a delta-encoded file
+    REMOTE_FILE_END, // Client: end of a file, and whether all its data was read
+    REMOTE_METADATA, // Client: path, mode, mtime (only for files)
+    REMOTE_DELETE, // Client: path, whether it is a directory, whether it is replaced by the next command
+    REMOTE_SIGNATURES_REQUEST, // Client: path of a destination file to delta-encode
+    REMOTE_SIGNATURES, // Receiver: MD5 sums of the blocks of the destination file, the last frame is flagged
+    REMOTE_BYE, // Client: no more commands
+    REMOTE_BYE_OK // Receiver: all the commands were applied, count of failures and of deleted entries
+} remote_frame_type_t;
+
+// Buffered end of a connection
+typedef struct {
+    int fd;
+    unsigned char *output; // Frames not written yet (REMOTE_BUFFER_SIZE bytes)
+    size_t output_size;
+    size_t frame_start; // Start of the frame being built in output
+    unsigned char *input; // Bytes received and not decoded yet
+    size_t input_start;
+    size_t input_end;
+    size_t input_capacity;
+    bool drains_input; // Set for a non-blocking socket: while it waits to write, the input is read
+    bool is_broken;
+} remote_channel_t;
+
+// A received frame, decoded field by field
+typedef struct {
+    uint8_t type;
+    unsigned char *cursor;
+    unsigned char *end;
+    bool is_invalid; // Set when a field goes past the end of the frame
+} remote_frame_t;
+
+typedef struct remote_delta_s remote_delta_t;
+
+// Client side of a remote destination
+typedef struct {
+    remote_channel_t channel;
+    char *source_root;
+    char *destination_root; // Address of the receiver, prefixed to the paths of its entries
+    bool has_md5;
+    bool uses_delta;
+    files_list_t entries; // Destination entries received and not requested yet
+    bool is_listed; // Set when the receiver listed its whole tree
+    remote_delta_t *deltas_head; // Files waiting for the signatures of their destination file, in order
+    remote_delta_t *deltas_tail;
+    char deleted_directory[PATH_SIZE]; // Last deleted directory: the receiver deletes its content with it (@see is_deleted_with_directory)
+    bool is_done; // Set when REMOTE_BYE_OK was received
+    uint64_t failures; // Counts of REMOTE_BYE_OK
+    uint64_t deleted;
+} remote_connection_t;
+
+bool is_remote_address(char *path);
+int open_remote_socket(char *address, bool is_server);
+int init_remote_channel(remote_channel_t *channel, int fd, bool drains_input);
+void clear_remote_channel(remote_channel_t *channel);
+int flush_remote_channel(remote_channel_t *channel);
+int begin_remote_frame(remote_channel_t *channel, uint8_t type, size_t payload_size);
+void put_remote_u8(remote_channel_t *channel, uint8_t value);
+void put_remote_u32(remote_channel_t *channel, uint32_t value);
+void put_remote_u64(remote_channel_t *channel, uint64_t value);
+void put_remote_bytes(remote_channel_t *channel, const void *data, size_t size);
+void put_remote_string(remote_channel_t *channel, const char *text);
+void end_remote_frame(remote_channel_t *channel);
+int read_remote_frame(remote_channel_t *channel, remote_frame_t *frame);
+ssize_t read_remote_raw(remote_channel_t *channel, size_t size, unsigned char **data);
+uint8_t get_remote_u8(remote_frame_t *frame);
+uint32_t get_remote_u32(remote_frame_t *frame);
+uint64_t get_remote_u64(remote_frame_t *frame);
+void get_remote_bytes(remote_frame_t *frame, void *data, size_t size);
+void get_remote_string(remote_frame_t *frame, char *text, size_t size);
+void put_remote_entry(remote_channel_t *channel, char *relative, files_list_entry_t *entry, bool has_md5);
+void digest_remote_block(const void *data, size_t size, uint8_t *md5sum);
+
+remote_connection_t *connect_to_receiver(configuration_t *the_config);
+int receive_remote_entry(remote_connection_t *connection, files_list_entry_t *entry);
+int send_remote_directory(remote_connection_t *connection, files_list_entry_t *entry);
+int send_remote_file(remote_connection_t *connection, files_list_entry_t *entry, files_list_entry_t *dest_entry);
+int send_remote_metadata(remote_connection_t *connection, files_list_entry_t *entry);
+bool is_deleted_with_directory(remote_connection_t *connection, char *relative, bool is_directory);
+int send_remote_deletion(remote_connection_t *connection, char *relative, bool is_directory, bool is_replaced);
+int disconnect_from_receiver(remote_connection_t *connection, uint64_t *deleted_count);
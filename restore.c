@@ -0,0 +1,81 @@
+#include "restore.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "compress.h"
+#include "pack-store.h"
+#include "files-list.h"
+#include "sync.h"
+#include "utility.h"
+
+/*
+ * A restore rebuilds the source tree from a destination written by lp25 (the source_dir of --restore)
+ * into a target directory (its destination_dir). The tree is listed as for a run, without MD5 sums:
+ * directories are created, compressed files (@see compress.c) are decompressed, and the other files
+ * are copied as they are. The files of the pack store (@see pack-store.c) are then extracted into the
+ * restored directories. The state of lp25 in the backup (.lp25-*) is never restored.
+ */
+
+/*!
+ * @brief restore_entry restores an entry of the backup into the target directory
+ * @param entry is a pointer to the entry of the backup
+ * @param the_config is a pointer to the configuration
+ * @param restored_bytes is a pointer to the counter of the bytes restored
+ * @return 0 in case of success, -1 else
+ */
+static int restore_entry(files_list_entry_t *entry, configuration_t *the_config, uint64_t *restored_bytes) {
+    compressed_header_t header;
+    if (entry->entry_type == DOSSIER || read_compressed_header(entry->path_and_name, &header) == -1) {
+        // Directories and uncompressed files are copied with their access modes and mtime
+        copy_entry_to_destination(entry, the_config);
+        *restored_bytes += (entry->entry_type == FICHIER) ? entry->size : 0;
+        return 0;
+    }
+
+    char output_path[PATH_SIZE];
+    if (concat_path(output_path, the_config->destination, relative_path(entry->path_and_name, the_config->source)) == NULL) {
+        printf("The restored path of %s is too long\n", entry->path_and_name);
+        return -1;
+    }
+    int64_t restored = decompress_file(entry->path_and_name, output_path);
+    if (restored == -1) {
+        return -1;
+    }
+    *restored_bytes += (uint64_t) restored;
+    return 0;
+}
+
+/*!
+ * @brief restore_backup restores a backup (the source of the configuration) into a target directory
+ * (its destination)
+ * @param the_config is a pointer to the configuration
+ * @return 0 in case of success, -1 if an entry could not be restored
+ */
+int restore_backup(configuration_t *the_config) {
+    files_list_t backup = {NULL, NULL};
+    make_files_list(&backup, the_config->source, false);
+
+    int result = 0;
+    uint64_t files_count = 0, restored_bytes = 0;
+    for (files_list_entry_t *cursor = backup.head; cursor != NULL; cursor = cursor->next) {
+        if (the_config->uses_verbose) {
+            printf("restore %s\n", cursor->path_and_name);
+        }
+        if (restore_entry(cursor, the_config, &restored_bytes) == -1) {
+            result = -1;
+        } else if (cursor->entry_type == FICHIER) {
+            ++files_count;
+        }
+    }
+    clear_files_list(&backup);
+
+    int64_t packed_count = extract_pack_store(the_config->source, the_config->destination, the_config->uses_verbose, &restored_bytes);
+    if (packed_count == -1) {
+        result = -1;
+    } else {
+        files_count += (uint64_t) packed_count;
+    }
+    printf("Restored %llu files (%.1f MiB) from %s into %s\n", (unsigned long long) files_count,
+           (double) restored_bytes / (1024.0 * 1024.0), the_config->source, the_config->destination);
+    return result;
+}
@@ -0,0 +1,5 @@
+#pragma once
+
+#include "configuration.h"
+
+int restore_backup(configuration_t *the_config);
@@ -0,0 +1,568 @@
+#include "spill.h"
+#include "utility.h"
+#include "defines.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+// Everything stored in a spooled entry, except its path and its links
+typedef struct {
+    timespec mtime;
+    uint64_t size;
+    uint8_t md5sum[16];
+    file_type_t entry_type;
+    mode_t mode;
+    dev_t device;
+    ino_t inode;
+    nlink_t links_count;
+    uint32_t path_length; // Bytes of the path following the header, without its '\0'
+} spooled_entry_t;
+
+/*!
+ * @brief open_spill_file creates an anonymous temporary file, removed when it is closed
+ * @return the file opened for reading and writing, NULL in case of error
+ */
+FILE *open_spill_file() {
+    char *directory = getenv("TMPDIR");
+    char template[PATH_SIZE];
+    if (directory == NULL || directory[0] == '\0') {
+        directory = SPILL_DEFAULT_DIRECTORY;
+    }
+    if (concat_path(template, directory, RESERVED_NAME_PREFIX "spill-XXXXXX") == NULL) {
+        return NULL;
+    }
+    int fd = mkstemp(template);
+    if (fd == -1) {
+        perror("Cannot create a temporary file");
+        return NULL;
+    }
+    unlink(template);
+    FILE *file = fdopen(fd, "w+");
+    if (file == NULL) {
+        perror("Cannot open a temporary file");
+        close(fd);
+    }
+    return file;
+}
+
+/*!
+ * @brief init_name_sorter prepares an empty sorter
+ * @param sorter is a pointer to the sorter
+ * @param budget is the memory, in bytes, of the names kept in memory before they are written to a run
+ * @return 0 in case of success, -1 else
+ */
+int init_name_sorter(name_sorter_t *sorter, size_t budget) {
+    if (sorter == NULL) {
+        return -1;
+    }
+    memset(sorter, 0, sizeof(name_sorter_t));
+    sorter->budget = (budget < SPILL_MIN_BUDGET) ? SPILL_MIN_BUDGET : budget;
+    return 0;
+}
+
+// Records being sorted by qsort (@see compare_records)
+static char *sorted_records = NULL;
+
+/*!
+ * @brief compare_records compares two records of the sorter by their names
+ * @param lhs is a pointer to the offset of the first record
+ * @param rhs is a pointer to the offset of the second record
+ * @return the result of path_compare on their names
+ */
+static int compare_records(const void *lhs, const void *rhs) {
+    return path_compare(sorted_records + *(const size_t *) lhs + 1, sorted_records + *(const size_t *) rhs + 1);
+}
+
+/*!
+ * @brief sort_records sorts the records held in memory
+ * @param sorter is a pointer to the sorter
+ */
+static void sort_records(name_sorter_t *sorter) {
+    sorted_records = sorter->records;
+    qsort(sorter->offsets, sorter->count, sizeof(size_t), compare_records);
+    sorted_records = NULL;
+}
+
+/*!
+ * @brief add_run adds an empty run to a sorter
+ * @param sorter is a pointer to the sorter
+ * @return a pointer to the run, whose file is open, NULL in case of error
+ */
+static sorted_run_t *add_run(name_sorter_t *sorter) {
+    sorted_run_t *new_runs = realloc(sorter->runs, (sorter->runs_count + 1) * sizeof(sorted_run_t));
+    if (new_runs == NULL) {
+        printf("Error when allocating memory in the function add_run of the file spill.c\n");
+        return NULL;
+    }
+    sorter->runs = new_runs;
+    sorted_run_t *run = &sorter->runs[sorter->runs_count];
+    memset(run, 0, sizeof(sorted_run_t));
+    run->file = open_spill_file();
+    if (run->file == NULL) {
+        return NULL;
+    }
+    ++sorter->runs_count;
+    return run;
+}
+
+/*!
+ * @brief spill_records writes the records held in memory as a new sorted run
+ * @param sorter is a pointer to the sorter
+ * @return 0 in case of success, -1 else
+ */
+static int spill_records(name_sorter_t *sorter) {
+    sorted_run_t *run = add_run(sorter);
+    if (run == NULL) {
+        return -1;
+    }
+    sort_records(sorter);
+    for (size_t i = 0; i < sorter->count; ++i) {
+        char *record = sorter->records + sorter->offsets[i];
+        size_t record_size = strlen(record + 1) + 2;
+        if (fwrite(record, 1, record_size, run->file) != record_size) {
+            perror("Cannot write a sorted run");
+            return -1;
+        }
+    }
+    sorter->spilled_count += sorter->count;
+    sorter->records_size = 0;
+    sorter->count = 0;
+    return 0;
+}
+
+/*!
+ * @brief add_sorted_name adds the name of an entry to a sorter
+ * The names are written to a new run once the memory they use reaches the budget of the sorter.
+ * @param sorter is a pointer to the sorter
+ * @param name is the name of the entry
+ * @param is_directory is true for a directory
+ * @return 0 in case of success, -1 else
+ */
+int add_sorted_name(name_sorter_t *sorter, const char *name, bool is_directory) {
+    if (sorter == NULL || name == NULL) {
+        return -1;
+    }
+
+    size_t record_size = strlen(name) + 2;
+    if (sorter->count > 0 && sorter->records_size + record_size + (sorter->count + 1) * sizeof(size_t) > sorter->budget) {
+        if (spill_records(sorter) == -1) {
+            return -1;
+        }
+    }
+    if (sorter->records_size + record_size > sorter->records_capacity) {
+        size_t new_capacity = (sorter->records_capacity == 0) ? 4096 : sorter->records_capacity * 2;
+        while (new_capacity < sorter->records_size + record_size) {
+            new_capacity *= 2;
+        }
+        char *new_records = realloc(sorter->records, new_capacity);
+        if (new_records == NULL) {
+            printf("Error when allocating memory in the function add_sorted_name of the file spill.c\n");
+            return -1;
+        }
+        sorter->records = new_records;
+        sorter->records_capacity = new_capacity;
+    }
+    if (sorter->count == sorter->offsets_capacity) {
+        size_t new_capacity = (sorter->offsets_capacity == 0) ? 256 : sorter->offsets_capacity * 2;
+        size_t *new_offsets = realloc(sorter->offsets, new_capacity * sizeof(size_t));
+        if (new_offsets == NULL) {
+            printf("Error when allocating memory in the function add_sorted_name of the file spill.c\n");
+            return -1;
+        }
+        sorter->offsets = new_offsets;
+        sorter->offsets_capacity = new_capacity;
+    }
+
+    char *record = sorter->records + sorter->records_size;
+    record[0] = is_directory ? 'd' : 'f';
+    memcpy(record + 1, name, record_size - 1);
+    sorter->offsets[sorter->count++] = sorter->records_size;
+    sorter->records_size += record_size;
+    return 0;
+}
+
+/*!
+ * @brief read_run_record reads the next record of a run
+ * @param run is a pointer to the run
+ * @return 1 if a record was read, 0 at the end of the run, -1 in case of error
+ */
+static int read_run_record(sorted_run_t *run) {
+    int type = getc(run->file);
+    if (type == EOF) {
+        return ferror(run->file) ? -1 : 0;
+    }
+    run->is_directory = (type == 'd');
+    size_t length = 0;
+    int c;
+    while ((c = getc(run->file)) != EOF && c != '\0') {
+        if (length < PATH_SIZE - 1) {
+            run->name[length++] = (char) c;
+        }
+    }
+    run->name[length] = '\0';
+    return (c == EOF) ? -1 : 1;
+}
+
+/*!
+ * @brief rewind_run prepares a written run to be read from its start
+ * @param run is a pointer to the run
+ * @return 0 in case of success, -1 else
+ */
+static int rewind_run(sorted_run_t *run) {
+    if (fflush(run->file) != 0 || fseeko(run->file, 0, SEEK_SET) != 0) {
+        perror("Cannot read a sorted run");
+        return -1;
+    }
+    return 0;
+}
+
+/*!
+ * @brief close_run releases a run
+ * @param run is a pointer to the run
+ */
+static void close_run(sorted_run_t *run) {
+    if (run->file != NULL) {
+        fclose(run->file);
+        run->file = NULL;
+    }
+}
+
+/*!
+ * @brief sift_down restores the order of the heap of runs from one of its nodes
+ * @param sorter is a pointer to the sorter
+ * @param node is the index of the node in the heap
+ */
+static void sift_down(name_sorter_t *sorter, int node) {
+    while (true) {
+        int smallest = node;
+        for (int child = 2 * node + 1; child <= 2 * node + 2 && child < sorter->heap_size; ++child) {
+            if (path_compare(sorter->runs[sorter->heap[child]].name, sorter->runs[sorter->heap[smallest]].name) < 0) {
+                smallest = child;
+            }
+        }
+        if (smallest == node) {
+            return;
+        }
+        int swapped = sorter->heap[node];
+        sorter->heap[node] = sorter->heap[smallest];
+        sorter->heap[smallest] = swapped;
+        node = smallest;
+    }
+}
+
+/*!
+ * @brief start_merge makes the heap of a range of runs, each one positioned on its first record
+ * @param sorter is a pointer to the sorter
+ * @param first is the index of the first run of the range
+ * @param count is the number of runs of the range
+ * @return 0 in case of success, -1 else
+ */
+static int start_merge(name_sorter_t *sorter, int first, int count) {
+    int *new_heap = realloc(sorter->heap, count * sizeof(int));
+    if (new_heap == NULL) {
+        printf("Error when allocating memory in the function start_merge of the file spill.c\n");
+        return -1;
+    }
+    sorter->heap = new_heap;
+    sorter->heap_size = 0;
+    for (int i = first; i < first + count; ++i) {
+        if (rewind_run(&sorter->runs[i]) == -1) {
+            return -1;
+        }
+        int result = read_run_record(&sorter->runs[i]);
+        if (result == -1) {
+            return -1;
+        }
+        if (result == 1) {
+            sorter->heap[sorter->heap_size++] = i;
+        }
+    }
+    for (int node = sorter->heap_size / 2 - 1; node >= 0; --node) {
+        sift_down(sorter, node);
+    }
+    return 0;
+}
+
+/*!
+ * @brief pop_merge returns the smallest record of the merged runs
+ * @param sorter is a pointer to the sorter
+ * @param name is where the name is copied (PATH_SIZE bytes)
+ * @param is_directory is where the type is copied
+ * @return 1 if a record was returned, 0 when the runs are exhausted, -1 in case of error
+ */
+static int pop_merge(name_sorter_t *sorter, char *name, bool *is_directory) {
+    if (sorter->heap_size == 0) {
+        return 0;
+    }
+    sorted_run_t *run = &sorter->runs[sorter->heap[0]];
+    strcpy(name, run->name);
+    *is_directory = run->is_directory;
+    int result = read_run_record(run);
+    if (result == -1) {
+        perror("Cannot read a sorted run");
+        return -1;
+    }
+    if (result == 0) {
+        sorter->heap[0] = sorter->heap[--sorter->heap_size];
+    }
+    sift_down(sorter, 0);
+    return 1;
+}
+
+/*!
+ * @brief finish_name_sorter ends the additions and prepares the sorter to return the names in order
+ * When there are more runs than the budget can read at once, groups of runs are first merged into
+ * longer runs.
+ * @param sorter is a pointer to the sorter
+ * @return 0 in case of success, -1 else
+ */
+int finish_name_sorter(name_sorter_t *sorter) {
+    if (sorter == NULL) {
+        return -1;
+    }
+    if (sorter->runs_count == 0) {
+        sort_records(sorter);
+        sorter->next = 0;
+        return 0;
+    }
+    if (sorter->count > 0 && spill_records(sorter) == -1) {
+        return -1;
+    }
+    free(sorter->records);
+    free(sorter->offsets);
+    sorter->records = NULL;
+    sorter->offsets = NULL;
+    sorter->records_capacity = 0;
+    sorter->offsets_capacity = 0;
+
+    int fan_in = (int) (sorter->budget / SPILL_RUN_MEMORY);
+    if (fan_in < 2) {
+        fan_in = 2;
+    }
+    int first = 0;
+    while (sorter->runs_count - first > fan_in) {
+        if (start_merge(sorter, first, fan_in) == -1) {
+            return -1;
+        }
+        sorted_run_t *merged = add_run(sorter);
+        if (merged == NULL) {
+            return -1;
+        }
+        char name[PATH_SIZE];
+        bool is_directory;
+        int result;
+        while ((result = pop_merge(sorter, name, &is_directory)) == 1) {
+            size_t name_size = strlen(name) + 1;
+            if (putc(is_directory ? 'd' : 'f', merged->file) == EOF || fwrite(name, 1, name_size, merged->file) != name_size) {
+                perror("Cannot write a sorted run");
+                return -1;
+            }
+        }
+        if (result == -1) {
+            return -1;
+        }
+        for (int i = first; i < first + fan_in; ++i) {
+            close_run(&sorter->runs[i]);
+        }
+        first += fan_in;
+    }
+    return start_merge(sorter, first, sorter->runs_count - first);
+}
+
+/*!
+ * @brief next_sorted_name returns the next name of a finished sorter
+ * @param sorter is a pointer to the sorter
+ * @param name is where the name is copied (PATH_SIZE bytes)
+ * @param is_directory is where the type is copied
+ * @return 1 if a name was returned, 0 when all the names were returned, -1 in case of error
+ */
+int next_sorted_name(name_sorter_t *sorter, char *name, bool *is_directory) {
+    if (sorter == NULL || name == NULL || is_directory == NULL) {
+        return -1;
+    }
+    if (sorter->runs_count > 0) {
+        return pop_merge(sorter, name, is_directory);
+    }
+    if (sorter->next == sorter->count) {
+        return 0;
+    }
+    char *record = sorter->records + sorter->offsets[sorter->next++];
+    *is_directory = (record[0] == 'd');
+    strcpy(name, record + 1);
+    return 1;
+}
+
+/*!
+ * @brief clear_name_sorter releases the memory and the temporary files of a sorter
+ * @param sorter is a pointer to the sorter
+ */
+void clear_name_sorter(name_sorter_t *sorter) {
+    if (sorter == NULL) {
+        return;
+    }
+    for (int i = 0; i < sorter->runs_count; ++i) {
+        close_run(&sorter->runs[i]);
+    }
+    free(sorter->runs);
+    free(sorter->heap);
+    free(sorter->records);
+    free(sorter->offsets);
+    memset(sorter, 0, sizeof(name_sorter_t));
+}
+
+/*!
+ * @brief init_entry_spool prepares an empty spool
+ * @param spool is a pointer to the spool
+ * @param capacity is the number of entries kept in memory (at least 1), SIZE_MAX to never spill them
+ */
+void init_entry_spool(entry_spool_t *spool, size_t capacity) {
+    if (spool == NULL) {
+        return;
+    }
+    memset(spool, 0, sizeof(entry_spool_t));
+    spool->capacity = (capacity == 0) ? 1 : capacity;
+}
+
+/*!
+ * @brief spool_entry adds an entry to a spool, in memory while the oldest entries fit in its capacity,
+ * else to its file
+ * @param spool is a pointer to the spool
+ * @param entry is a pointer to the entry, owned by the spool afterwards
+ * @return 0 in case of success, -1 else (the entry is lost)
+ */
+int spool_entry(entry_spool_t *spool, files_list_entry_t *entry) {
+    if (spool == NULL || entry == NULL) {
+        free(entry);
+        return -1;
+    }
+    if (spool->spilled_count == 0 && spool->count < spool->capacity) {
+        entry->next = NULL;
+        entry->prev = NULL;
+        add_entry_to_tail(&spool->entries, entry);
+        ++spool->count;
+        return 0;
+    }
+
+    if (spool->file == NULL && (spool->file = open_spill_file()) == NULL) {
+        free(entry);
+        return -1;
+    }
+    spooled_entry_t header;
+    memset(&header, 0, sizeof(spooled_entry_t));
+    header.mtime = entry->mtime;
+    header.size = entry->size;
+    memcpy(header.md5sum, entry->md5sum, sizeof(header.md5sum));
+    header.entry_type = entry->entry_type;
+    header.mode = entry->mode;
+    header.device = entry->device;
+    header.inode = entry->inode;
+    header.links_count = entry->links_count;
+    header.path_length = (uint32_t) strlen(entry->path_and_name);
+    if (fseeko(spool->file, spool->write_offset, SEEK_SET) != 0 ||
+        fwrite(&header, sizeof(spooled_entry_t), 1, spool->file) != 1 ||
+        fwrite(entry->path_and_name, 1, header.path_length, spool->file) != header.path_length) {
+        perror("Cannot write a spooled entry");
+        free(entry);
+        return -1;
+    }
+    spool->write_offset += (off_t) (sizeof(spooled_entry_t) + header.path_length);
+    ++spool->spilled_count;
+    free(entry);
+    return 0;
+}
+
+/*!
+ * @brief read_spooled_entries moves the oldest spilled entries of a spool to its memory
+ * @param spool is a pointer to the spool, whose memory holds no entry
+ * @return 0 in case of success, -1 else
+ */
+static int read_spooled_entries(entry_spool_t *spool) {
+    if (fflush(spool->file) != 0 || fseeko(spool->file, spool->read_offset, SEEK_SET) != 0) {
+        perror("Cannot read the spooled entries");
+        return -1;
+    }
+    while (spool->spilled_count > 0 && spool->count < spool->capacity) {
+        spooled_entry_t header;
+        if (fread(&header, sizeof(spooled_entry_t), 1, spool->file) != 1 || header.path_length >= PATH_SIZE) {
+            perror("Cannot read a spooled entry");
+            return -1;
+        }
+        files_list_entry_t *entry = calloc(1, sizeof(files_list_entry_t));
+        if (entry == NULL) {
+            printf("Error when allocating memory in the function read_spooled_entries of the file spill.c\n");
+            return -1;
+        }
+        if (fread(entry->path_and_name, 1, header.path_length, spool->file) != header.path_length) {
+            perror("Cannot read a spooled entry");
+            free(entry);
+            return -1;
+        }
+        entry->mtime = header.mtime;
+        entry->size = header.size;
+        memcpy(entry->md5sum, header.md5sum, sizeof(header.md5sum));
+        entry->entry_type = header.entry_type;
+        entry->mode = header.mode;
+        entry->device = header.device;
+        entry->inode = header.inode;
+        entry->links_count = header.links_count;
+        add_entry_to_tail(&spool->entries, entry);
+        ++spool->count;
+        --spool->spilled_count;
+        spool->read_offset += (off_t) (sizeof(spooled_entry_t) + header.path_length);
+    }
+    if (spool->spilled_count == 0) {
+        // The file is empty again: its blocks are released and it is written from its start
+        spool->read_offset = 0;
+        spool->write_offset = 0;
+        if (ftruncate(fileno(spool->file), 0) == -1) {
+            perror("Cannot truncate the spooled entries");
+        }
+    }
+    return 0;
+}
+
+/*!
+ * @brief unspool_entry removes the oldest entry of a spool
+ * @param spool is a pointer to the spool
+ * @return a pointer to the entry, to be freed by the caller, NULL if the spool is empty or in case of error
+ */
+files_list_entry_t *unspool_entry(entry_spool_t *spool) {
+    if (spool == NULL) {
+        return NULL;
+    }
+    if (spool->entries.head == NULL && spool->spilled_count > 0 && read_spooled_entries(spool) == -1) {
+        // The spilled entries cannot be read back: they are dropped
+        spool->spilled_count = 0;
+    }
+    files_list_entry_t *entry = remove_head_entry(&spool->entries);
+    if (entry != NULL) {
+        --spool->count;
+    }
+    return entry;
+}
+
+/*!
+ * @brief is_spool_empty tells if a spool holds no entry
+ * @param spool is a pointer to the spool
+ * @return true if it is empty
+ */
+bool is_spool_empty(entry_spool_t *spool) {
+    return spool == NULL || (spool->entries.head == NULL && spool->spilled_count == 0);
+}
+
+/*!
+ * @brief clear_entry_spool releases the entries and the file of a spool
+ * @param spool is a pointer to the spool
+ */
+void clear_entry_spool(entry_spool_t *spool) {
+    if (spool == NULL) {
+        return;
+    }
+    clear_files_list(&spool->entries);
+    if (spool->file != NULL) {
+        fclose(spool->file);
+    }
+    size_t capacity = spool->capacity;
+    init_entry_spool(spool, capacity);
+}
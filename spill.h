@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include "files-list.h"
+#include "defines.h"
+
+// Temporary files are created in $TMPDIR, or in this directory when it is not set
+#define SPILL_DEFAULT_DIRECTORY "/tmp"
+// Memory of each sorted run read during a merge (mostly its stdio buffer), which limits the runs merged at once
+#define SPILL_RUN_MEMORY (8 * 1024)
+// Smallest memory given to a sorter, whatever the limit
+#define SPILL_MIN_BUDGET (64 * 1024)
+
+// A run of names sorted by path_compare, written to a temporary file
+typedef struct {
+    FILE *file;
+    char name[PATH_SIZE]; // Current record, the smallest of the run not merged yet
+    bool is_directory;
+} sorted_run_t;
+
+// Names of the content of a directory, sorted in memory while they fit in the budget, else by an
+// external merge sort: each full buffer is sorted and written as a run, then the runs are merged
+typedef struct {
+    size_t budget; // Bytes of the records held in memory
+    char *records; // Records not written to a run: type (1 byte), then the name and its '\0'
+    size_t records_size;
+    size_t records_capacity;
+    size_t *offsets; // Start of each record in records, sorted by finish_name_sorter
+    size_t count;
+    size_t offsets_capacity;
+    size_t next; // Next record to return when nothing was spilled
+    sorted_run_t *runs;
+    int runs_count;
+    int *heap; // Indexes of the runs, as a min-heap on their current record
+    int heap_size;
+    uint64_t spilled_count; // Names written to runs, for the statistics
+} name_sorter_t;
+
+// Entries in the order they were added, the oldest ones in memory, the others in a temporary file
+typedef struct {
+    files_list_t entries; // Oldest entries
+    size_t count; // Entries in entries
+    size_t capacity; // Entries kept in memory before the next ones are spilled
+    FILE *file; // Entries spilled after the ones in memory, NULL until the first spill
+    off_t read_offset; // Start of the oldest spilled entry
+    off_t write_offset; // End of the spilled entries
+    uint64_t spilled_count; // Entries in the file, not read back yet
+} entry_spool_t;
+
+FILE *open_spill_file();
+int init_name_sorter(name_sorter_t *sorter, size_t budget);
+int add_sorted_name(name_sorter_t *sorter, const char *name, bool is_directory);
+int finish_name_sorter(name_sorter_t *sorter);
+int next_sorted_name(name_sorter_t *sorter, char *name, bool *is_directory);
+void clear_name_sorter(name_sorter_t *sorter);
+
+void init_entry_spool(entry_spool_t *spool, size_t capacity);
+int spool_entry(entry_spool_t *spool, files_list_entry_t *entry);
+files_list_entry_t *unspool_entry(entry_spool_t *spool);
+bool is_spool_empty(entry_spool_t *spool);
+void clear_entry_spool(entry_spool_t *spool);
@@ -15,10 +15,701 @@
 #include <sys/msg.h>
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include "instrumentation.h"
+#include "file-io.h"
+#include "throttle.h"
+#include "tree-stream.h"
+#include "links-table.h"
+#include "compress.h"
+#include "pack-store.h"
+#include "durability.h"
+#include "checkpoint.h"
+#include "filters.h"
+#include "delete.h"
+#include "fanout.h"
+#include "remote.h"
+#include "plan.h"
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+
+// One side (source or destination) of the streaming comparison
+typedef struct {
+    char *root;
+    files_list_t pending; // Entries listed (and analyzed) but not compared yet, in order
+    entry_spool_t spool; // Entries received from a lister before the pending ones, spilled under a memory limit
+    bool is_complete; // Set when the whole tree was listed
+    tree_stream_t stream; // Used when there are no lister processes
+} stream_side_t;
+
+// How the entries of one side are analyzed
+typedef struct {
+    bool has_md5; // Set when MD5 sums must be computed
+    bool is_compressed; // Set for a compressed destination: the properties are read in the headers
+} analysis_options_t;
+
+/*!
+ * @brief analyze_directory gets the properties of the content of a directory in the main process
+ * @param children is a pointer to the list of the entries of the directory
+ * @param parameters is a pointer to the analysis options of the side, to be cast to an analysis_options_t
+ */
+static void analyze_directory(files_list_t *children, void *parameters) {
+    analysis_options_t *options = (analysis_options_t *) parameters;
+    for (files_list_entry_t *cursor = children->head; cursor != NULL; cursor = cursor->next) {
+        int result = options->is_compressed ? get_compressed_file_stats(cursor) :
+                     options->has_md5 ? get_file_stats(cursor) : get_file_metadata(cursor);
+        if (result == -1) {
+            printf("Error in the function analyze_directory of the file sync.c\n");
+            printf("Cannot get the properties of %s\n", cursor->path_and_name);
+        }
+        display_progress(false);
+    }
+}
+
+/*!
+ * @brief pull_from_stream moves the next entry of a side's tree stream to its pending entries
+ * @param side is a pointer to the side
+ */
+static void pull_from_stream(stream_side_t *side) {
+    files_list_entry_t *entry = next_stream_entry(&side->stream);
+    if (entry == NULL) {
+        side->is_complete = true;
+        return;
+    }
+
+    files_list_entry_t *copy = malloc(sizeof(files_list_entry_t));
+    if (copy == NULL) {
+        printf("Error when allocating memory in the function pull_from_stream of the file sync.c\n");
+        return;
+    }
+    memcpy(copy, entry, sizeof(files_list_entry_t));
+    copy->next = NULL;
+    copy->prev = NULL;
+    add_entry_to_tail(&side->pending, copy);
+}
+
+// Connection to the receiver of a remote destination (@see remote.c), NULL for a local destination
+static remote_connection_t *remote = NULL;
+
+/*!
+ * @brief pull_from_remote moves the next entry listed by the receiver of a remote destination to its pending entries
+ * @param side is a pointer to the side of the remote destination
+ * @return 0 in case of success, -1 if the connection failed
+ */
+static int pull_from_remote(stream_side_t *side) {
+    files_list_entry_t *entry = malloc(sizeof(files_list_entry_t));
+    if (entry == NULL) {
+        printf("Error when allocating memory in the function pull_from_remote of the file sync.c\n");
+        return -1;
+    }
+    int result = receive_remote_entry(remote, entry);
+    if (result == 1) {
+        add_entry_to_tail(&side->pending, entry);
+        return 0;
+    }
+    free(entry);
+    side->is_complete = (result == 0);
+    return result;
+}
+
+/*!
+ * @brief receive_from_listers receives the next entry (or end of list) sent by any lister
+ * The confirmations of the copy workers during a checkpoint are received the same way.
+ * @param source is a pointer to the source side
+ * @param destinations are the destination sides (@see get_destination)
+ * @param msg_queue is the id of the MQ used for communication
+ * @param msg_flags are the flags passed to msgrcv (e.g. IPC_NOWAIT)
+ * @param confirmations is a pointer to the count of checkpoint confirmations, incremented by each one
+ * @return 0 in case of success, 1 if there was no message (IPC_NOWAIT), -1 else
+ */
+static int receive_from_listers(stream_side_t *source, stream_side_t *destinations, int msg_queue, int msg_flags, int *confirmations) {
+    any_message_t message;
+    if (receive_message(msg_queue, &message, MSG_TYPE_TO_MAIN, msg_flags) == -1) {
+        if (errno == ENOMSG) {
+            return 1;
+        }
+        perror("Cannot receive the files lists");
+        return -1;
+    }
+
+    if (message.simple_command.message == COMMAND_CODE_CHECKPOINT_OK) {
+        ++(*confirmations);
+        return 0;
+    }
+
+    // The sender of each message is stored in reply_to
+    int sender = message.list_entry.reply_to;
+    stream_side_t *side = (sender == MSG_TYPE_TO_SOURCE_LISTER) ? source :
+                          (sender >= MSG_TYPE_TO_EXTRA_LISTERS) ? &destinations[1 + sender - MSG_TYPE_TO_EXTRA_LISTERS] : &destinations[0];
+    if (message.list_entry.op_code == COMMAND_CODE_LIST_COMPLETE) {
+        side->is_complete = true;
+    } else if (message.list_entry.op_code == COMMAND_CODE_FILE_ENTRY) {
+        files_list_entry_t *entry = malloc(sizeof(files_list_entry_t));
+        if (entry == NULL) {
+            printf("Error when allocating memory in the function receive_from_listers of the file sync.c\n");
+            return 0;
+        }
+        memcpy(entry, &message.list_entry.payload, sizeof(files_list_entry_t));
+        if (spool_entry(&side->spool, entry) == -1) {
+            printf("Cannot keep the entry %s\n", message.list_entry.payload.path_and_name);
+        }
+    }
+    return 0;
+}
+
+/*!
+ * @brief pull_from_spool moves the oldest entry received from the lister of a side to its pending entries
+ * @param side is a pointer to the side
+ */
+static void pull_from_spool(stream_side_t *side) {
+    files_list_entry_t *entry = unspool_entry(&side->spool);
+    if (entry != NULL) {
+        add_entry_to_tail(&side->pending, entry);
+    }
+}
+
+// Whether clones work from a source filesystem to a destination filesystem, learnt by each process
+#define CLONE_SUPPORT_CACHE_SIZE 8
+
+typedef struct {
+    dev_t source_device;
+    dev_t destination_device;
+    bool is_supported;
+} clone_support_t;
+
+static clone_support_t clone_support[CLONE_SUPPORT_CACHE_SIZE];
+static int clone_support_count = 0;
+
+/*!
+ * @brief clone_file_data makes a destination file share the data blocks of a source file (reflink)
+ * It needs a copy-on-write filesystem (Btrfs, XFS with reflink=1...) holding both files. Once a clone
+ * failed because a pair of filesystems does not support it, no other clone is tried between them.
+ * @param source_fd is the source file
+ * @param dest_fd is the destination file (empty)
+ * @param source_device is the device of the source file (@see get_file_metadata)
+ * @return 0 in case of success, -1 if the data must be copied
+ */
+static int clone_file_data(int source_fd, int dest_fd, dev_t source_device) {
+    struct stat dest_stat;
+    if (fstat(dest_fd, &dest_stat) == -1) {
+        return -1;
+    }
+
+    int index = 0;
+    while (index < clone_support_count && (clone_support[index].source_device != source_device ||
+                                           clone_support[index].destination_device != dest_stat.st_dev)) {
+        ++index;
+    }
+    if (index < clone_support_count && !clone_support[index].is_supported) {
+        return -1;
+    }
+
+    // FICLONE clones the whole file, including its last partial block
+    int result = ioctl(dest_fd, FICLONE, source_fd);
+    bool is_known = (result == 0 || errno == EOPNOTSUPP || errno == ENOTTY || errno == EXDEV || errno == ENOSYS);
+    if (index == clone_support_count && is_known && clone_support_count < CLONE_SUPPORT_CACHE_SIZE) {
+        clone_support[clone_support_count].source_device = source_device;
+        clone_support[clone_support_count].destination_device = dest_stat.st_dev;
+        clone_support[clone_support_count].is_supported = (result == 0);
+        ++clone_support_count;
+    }
+    return result;
+}
+
+// Destination files created or found identical during this run, by source inode and by content, in each destination
+static links_table_t copied_inodes[MAX_DESTINATIONS];
+static links_table_t copied_contents[MAX_DESTINATIONS];
+// Small files of the destination (@see pack-store.c), opened by synchronize when --pack is used
+static pack_store_t pack_store;
+
+/*!
+ * @brief is_linkable tells if a source file may be created from a previous copy instead of being copied
+ * @param entry is a pointer to the source entry
+ * @param the_config is a pointer to the configuration
+ * @return true if the entry is a file with several hard links, or if the dedup mode is enabled
+ */
+static bool is_linkable(files_list_entry_t *entry, configuration_t *the_config) {
+    return entry->entry_type == FICHIER && (entry->links_count > 1 || the_config->dedup_mode != DEDUP_NONE);
+}
+
+/*!
+ * @brief replace_with_link replaces a destination file with a hard link to another one
+ * @param target is the path of the existing file
+ * @param dest_path is the path of the link
+ * @return 0 in case of success, -1 else
+ */
+static int replace_with_link(char *target, char *dest_path) {
+    // The target must have its final name, and its data must be durable before another name refers to it
+    if (is_durable_file_pending(target)) {
+        flush_durable_batch();
+    }
+    char write_path[PATH_SIZE];
+    if (begin_durable_file(dest_path, write_path) == -1 ||
+        (!is_durability_enabled() && unlink(dest_path) == -1 && errno != ENOENT)) {
+        return -1;
+    }
+    int result = link(target, write_path);
+    commit_durable_file(write_path, dest_path, 0, result == 0);
+    return result;
+}
+
+/*!
+ * @brief replace_with_clone replaces a destination file with a clone (reflink) of another one
+ * The clone shares the data blocks of its target, but has its own inode, so it gets the mode and mtime
+ * of the source entry.
+ * @param target is the path of the existing file
+ * @param dest_path is the path of the clone
+ * @param entry is a pointer to the source entry
+ * @return 0 in case of success, -1 else (e.g. when the filesystem does not support reflinks)
+ */
+static int replace_with_clone(char *target, char *dest_path, files_list_entry_t *entry) {
+    if (is_durable_file_pending(target)) {
+        flush_durable_batch();
+    }
+    char write_path[PATH_SIZE];
+    int target_fd = open(target, O_RDONLY);
+    if (target_fd == -1 || begin_durable_file(dest_path, write_path) == -1 ||
+        (!is_durability_enabled() && unlink(dest_path) == -1 && errno != ENOENT)) {
+        if (target_fd != -1) {
+            close(target_fd);
+        }
+        return -1;
+    }
+    int dest_fd = open(write_path, O_WRONLY | O_CREAT | O_TRUNC, entry->mode & 07777);
+    if (dest_fd == -1) {
+        close(target_fd);
+        return -1;
+    }
+
+    struct stat target_stat;
+    int result = (fstat(target_fd, &target_stat) == 0) ? clone_file_data(target_fd, dest_fd, target_stat.st_dev) : -1;
+    if (result == 0) {
+        fchmod(dest_fd, entry->mode & 07777);
+        struct timespec times[2] = {{0, UTIME_OMIT}, entry->mtime};
+        futimens(dest_fd, times);
+    }
+    close(dest_fd);
+    close(target_fd);
+    commit_durable_file(write_path, dest_path, 0, result == 0);
+    return result;
+}
+
+/*!
+ * @brief link_to_previous_copy creates a destination file from a previous copy of the same inode
+ * (hard links of the source), or of the same content (dedup mode), in the same destination
+ * @param entry is a pointer to the source entry
+ * @param destination is the index of the destination (@see get_destination)
+ * @param dest_path is the path of the destination file
+ * @param the_config is a pointer to the configuration
+ * @return true if the file was created, false if it must be copied
+ */
+static bool link_to_previous_copy(files_list_entry_t *entry, int destination, char *dest_path, configuration_t *the_config) {
+    uint64_t key[LINK_KEY_SIZE];
+    link_slot_t *slot;
+    if (entry->links_count > 1) {
+        make_inode_key(key, entry);
+        if ((slot = find_link(&copied_inodes[destination], key)) != NULL && replace_with_link(slot->path, dest_path) == 0) {
+            return true;
+        }
+    }
+
+    if (the_config->dedup_mode == DEDUP_NONE) {
+        return false;
+    }
+    make_content_key(key, entry);
+    if ((slot = find_link(&copied_contents[destination], key)) == NULL) {
+        return false;
+    }
+    if (the_config->dedup_mode == DEDUP_REFLINK) {
+        return replace_with_clone(slot->path, dest_path, entry) == 0;
+    }
+    // A hard link shares the mode and mtime of its target
+    return slot->mode == entry->mode && slot->mtime.tv_sec == entry->mtime.tv_sec &&
+           slot->mtime.tv_nsec == entry->mtime.tv_nsec && replace_with_link(slot->path, dest_path) == 0;
+}
+
+/*!
+ * @brief remember_copy records a destination file holding the inode and the content of a source entry
+ * @param entry is a pointer to the source entry
+ * @param destination is the index of the destination (@see get_destination)
+ * @param dest_path is the path of the destination file
+ * @param the_config is a pointer to the configuration
+ */
+static void remember_copy(files_list_entry_t *entry, int destination, char *dest_path, configuration_t *the_config) {
+    uint64_t key[LINK_KEY_SIZE];
+    link_slot_t *slot;
+    if (entry->links_count > 1) {
+        make_inode_key(key, entry);
+        if ((slot = insert_link(&copied_inodes[destination], key)) != NULL && slot->path == NULL) {
+            slot->path = strdup(dest_path);
+            // A resumed run never lists this file again (@see load_checkpoint_links)
+            record_checkpoint_link(destination, key, relative_path(entry->path_and_name, the_config->source));
+        }
+    }
+    if (the_config->dedup_mode != DEDUP_NONE) {
+        make_content_key(key, entry);
+        if ((slot = insert_link(&copied_contents[destination], key)) != NULL && slot->path == NULL) {
+            slot->path = strdup(dest_path);
+            slot->mode = entry->mode;
+            slot->mtime = entry->mtime;
+        }
+    }
+}
+
+/*!
+ * @brief print_copy displays the copy of a source entry, with its destinations when there are several ones
+ * @param entry is a pointer to the source entry
+ * @param destinations is the set of the destinations needing the entry, bit i for the destination i
+ * @param the_config is a pointer to the configuration
+ */
+static void print_copy(files_list_entry_t *entry, int destinations, configuration_t *the_config) {
+    printf("copy %s", entry->path_and_name);
+    if (get_destinations_count(the_config) > 1) {
+        printf(" ->");
+        for (int i = 0; i < get_destinations_count(the_config); ++i) {
+            if ((destinations & (1 << i)) != 0) {
+                printf(" %s", get_destination(the_config, i));
+            }
+        }
+    }
+    printf("\n");
+}
+
+/*!
+ * @brief relink_previous_copy makes an up to date destination file a hard link to the previous copy of its
+ * source inode, when the destination holds separate copies of source files linked to each other
+ * @param entry is a pointer to the source entry, with several hard links
+ * @param dst_entry is a pointer to the destination entry, with the same content
+ * @param destination is the index of the destination (@see get_destination)
+ * @param the_config is a pointer to the configuration
+ */
+static void relink_previous_copy(files_list_entry_t *entry, files_list_entry_t *dst_entry, int destination, configuration_t *the_config) {
+    uint64_t key[LINK_KEY_SIZE];
+    make_inode_key(key, entry);
+    link_slot_t *slot = find_link(&copied_inodes[destination], key);
+    if (the_config->uses_dry_run || slot == NULL || slot->path == NULL || strcmp(slot->path, dst_entry->path_and_name) == 0) {
+        return;
+    }
+    if (is_durable_file_pending(slot->path)) {
+        flush_durable_batch();
+    }
+    // The destination file is already a link of the group when it has the inode of the previous copy
+    struct stat target_stat;
+    if (lstat(slot->path, &target_stat) == -1 ||
+        (target_stat.st_dev == dst_entry->device && target_stat.st_ino == dst_entry->inode)) {
+        return;
+    }
+    if (replace_with_link(slot->path, dst_entry->path_and_name) == 0 && the_config->uses_verbose) {
+        printf("link %s\n", entry->path_and_name);
+    }
+}
+
+/*!
+ * @brief apply_difference copies a source entry missing from (or different in) some destinations
+ * Directories are created right away, so that their content can be given to the copy workers (if any)
+ * as soon as it is compared. When the MQ is full, the main process copies the file itself.
+ * Files that may be linked (@see is_linkable) are linked to a previous copy in each destination, or
+ * copied by the main process (with a single read for all the destinations missing a previous copy)
+ * so that the next ones can be linked to them.
+ * @param entry is a pointer to the source entry
+ * @param destinations is the set of the destinations needing the entry, bit i for the destination i (@see get_destination)
+ * @param the_config is a pointer to the configuration
+ * @param p_context is a pointer to the processes context
+ */
+static void apply_difference(files_list_entry_t *entry, int destinations, configuration_t *the_config, process_context_t *p_context) {
+    if (the_config->uses_dry_run) {
+        print_copy(entry, destinations, the_config);
+        for (int d = 0; d < get_destinations_count(the_config); ++d) {
+            if ((destinations & (1 << d)) != 0) {
+                record_planned_action(PLAN_COPY, d, entry, relative_path(entry->path_and_name, the_config->source));
+            }
+        }
+        return;
+    }
+
+    if (is_linkable(entry, the_config)) {
+        char dest_paths[MAX_DESTINATIONS][PATH_SIZE];
+        int copied = 0;
+        for (int d = 0; d < get_destinations_count(the_config); ++d) {
+            if ((destinations & (1 << d)) == 0 ||
+                concat_path(dest_paths[d], get_destination(the_config, d), relative_path(entry->path_and_name, the_config->source)) == NULL) {
+                continue;
+            }
+            if (!link_to_previous_copy(entry, d, dest_paths[d], the_config)) {
+                copied |= 1 << d;
+            } else if (the_config->uses_verbose && get_destinations_count(the_config) > 1) {
+                printf("link %s -> %s\n", entry->path_and_name, get_destination(the_config, d));
+            } else if (the_config->uses_verbose) {
+                printf("link %s\n", entry->path_and_name);
+            }
+        }
+        if (copied != 0) {
+            if (the_config->uses_verbose) {
+                print_copy(entry, copied, the_config);
+            }
+            copy_entry_to_destinations(entry, the_config, copied);
+            for (int d = 0; d < get_destinations_count(the_config); ++d) {
+                if ((copied & (1 << d)) != 0) {
+                    remember_copy(entry, d, dest_paths[d], the_config);
+                }
+            }
+        }
+        return;
+    }
+
+    if (the_config->uses_verbose) {
+        print_copy(entry, destinations, the_config);
+    }
+    if (entry->entry_type == FICHIER && p_context->copiers_count > 0 &&
+        send_copy_command(p_context->message_queue_id, MSG_TYPE_TO_COPIERS, entry, destinations, IPC_NOWAIT) == 0) {
+        return;
+    }
+    copy_entry_to_destinations(entry, the_config, destinations);
+}
+
+/*!
+ * @brief update_metadata gives a destination entry the mode and mtime of its source, without touching its data
+ * The metadata of a compressed file is in its header, and a file with several links shares its inode
+ * with other destination files: they are copied again instead (@see apply_difference).
+ * @param entry is a pointer to the source entry
+ * @param dst_entry is a pointer to the destination entry, with the same content
+ * @param destination is the index of the destination (@see get_destination)
+ * @param the_config is a pointer to the configuration
+ * @return 0 in case of success, -1 if the entry must be copied instead
+ */
+static int update_metadata(files_list_entry_t *entry, files_list_entry_t *dst_entry, int destination, configuration_t *the_config) {
+    bool has_same_mtime = entry->mtime.tv_sec == dst_entry->mtime.tv_sec && entry->mtime.tv_nsec == dst_entry->mtime.tv_nsec;
+    if (entry->entry_type == FICHIER &&
+        (dst_entry->links_count > 1 || (!has_same_mtime && the_config->compression != COMPRESSION_NONE))) {
+        return -1;
+    }
+
+    if (the_config->uses_dry_run || the_config->uses_verbose) {
+        printf("update %s\n", entry->path_and_name);
+        if (the_config->uses_dry_run) {
+            record_planned_action(PLAN_UPDATE, destination, entry, relative_path(entry->path_and_name, the_config->source));
+            return 0;
+        }
+    }
+    if (remote != NULL) {
+        // The receiver updates it, a lost connection ends the comparison
+        send_remote_metadata(remote, entry);
+        return 0;
+    }
+    struct timespec start;
+    instrument_begin(&start);
+    int result = 0;
+    if (((entry->mode ^ dst_entry->mode) & 07777) != 0 &&
+        fchmodat(AT_FDCWD, dst_entry->path_and_name, entry->mode & 07777, 0) == -1) {
+        result = -1;
+    }
+    // The mtime of a directory follows its content, only its access modes are kept
+    if (entry->entry_type == FICHIER && !has_same_mtime) {
+        struct timespec times[2] = {{0, UTIME_OMIT}, entry->mtime};
+        if (utimensat(AT_FDCWD, dst_entry->path_and_name, times, 0) == -1) {
+            result = -1;
+        }
+    }
+    instrument_end(STAGE_METADATA, &start, 0);
+    if (result == -1) {
+        perror("Cannot update the metadata");
+    }
+    return result;
+}
+
+/*!
+ * @brief delete_extraneous_entry deletes a destination entry missing from the source (--delete)
+ * The deletion is queued (@see delete.c): the comparison goes on while the entry, and all its content
+ * for a directory, are removed. The content of such a directory was never listed (@see set_stream_counterpart).
+ * The receiver of a remote destination deletes its entries the same way, but it lists the content of
+ * the deleted directories (@see is_deleted_with_directory).
+ * @param entry is a pointer to the destination entry
+ * @param destination is the index of the destination (@see get_destination)
+ * @param the_config is a pointer to the configuration
+ * @param is_replaced is true when the entry is replaced by a source entry of another type: the deletion
+ * is completed before the copy
+ */
+static void delete_extraneous_entry(files_list_entry_t *entry, int destination, configuration_t *the_config, bool is_replaced) {
+    char *relative = relative_path(entry->path_and_name, the_config->destination);
+    if (remote != NULL && is_deleted_with_directory(remote, relative, entry->entry_type == DOSSIER)) {
+        return;
+    }
+    if (the_config->uses_dry_run || the_config->uses_verbose) {
+        printf("delete %s\n", entry->path_and_name);
+        if (the_config->uses_dry_run) {
+            record_planned_action(PLAN_DELETE, destination, entry, relative_path(entry->path_and_name, get_destination(the_config, destination)));
+            return;
+        }
+    }
+    if (remote != NULL) {
+        send_remote_deletion(remote, relative, entry->entry_type == DOSSIER, is_replaced);
+        return;
+    }
+    if (queue_deletion(entry->path_and_name, entry->entry_type == DOSSIER) == -1) {
+        printf("Cannot delete %s\n", entry->path_and_name);
+    }
+    if (is_replaced) {
+        wait_deletions();
+    }
+}
+
+/*!
+ * @brief apply_remote_difference sends a source entry missing from (or different in) a remote destination
+ * to its receiver (@see remote.c)
+ * @param entry is a pointer to the source entry
+ * @param dst_entry is a pointer to the destination entry with the same path (NULL if none), a file
+ * may be delta-encoded against it
+ * @param the_config is a pointer to the configuration
+ */
+static void apply_remote_difference(files_list_entry_t *entry, files_list_entry_t *dst_entry, configuration_t *the_config) {
+    if (the_config->uses_dry_run || the_config->uses_verbose) {
+        print_copy(entry, 1, the_config);
+        if (the_config->uses_dry_run) {
+            record_planned_action(PLAN_COPY, 0, entry, relative_path(entry->path_and_name, the_config->source));
+            return;
+        }
+    }
+    if (entry->entry_type == DOSSIER) {
+        send_remote_directory(remote, entry);
+    } else {
+        send_remote_file(remote, entry, dst_entry);
+    }
+}
+
+/*!
+ * @brief is_packable tells if a source entry is stored in the pack store instead of the destination tree
+ * @param entry is a pointer to the source entry
+ * @param the_config is a pointer to the configuration
+ * @return true for the files smaller than the pack threshold
+ */
+static bool is_packable(files_list_entry_t *entry, configuration_t *the_config) {
+    return entry->entry_type == FICHIER && entry->size < the_config->pack_threshold;
+}
+
+/*!
+ * @brief apply_packed_difference compares a small source file with its record in the pack store, and
+ * packs it when it differs
+ * The pack store is written by the main process only: the packs are appended in order.
+ * @param entry is a pointer to the source entry
+ * @param dst_entry is a pointer to the destination entry with the same path (NULL if none)
+ * @param the_config is a pointer to the configuration
+ */
+static void apply_packed_difference(files_list_entry_t *entry, files_list_entry_t *dst_entry, configuration_t *the_config) {
+    char *relative = relative_path(entry->path_and_name, the_config->source);
+    files_list_entry_t packed;
+    memset(&packed, 0, sizeof(files_list_entry_t));
+    struct timespec start;
+    instrument_begin(&start);
+    // The access modes are only recorded in the index: a file whose modes changed is packed again
+    bool is_different = (find_packed_file(&pack_store, relative, &packed) == -1) ||
+                        mismatch(entry, &packed, the_config->uses_md5) || ((entry->mode ^ packed.mode) & 07777) != 0;
+    instrument_end(STAGE_DIFF, &start, 0);
+    if (!is_different) {
+        return;
+    }
+
+    if (the_config->uses_dry_run || the_config->uses_verbose) {
+        printf("pack %s\n", entry->path_and_name);
+        if (the_config->uses_dry_run) {
+            record_planned_action(PLAN_PACK, 0, entry, relative);
+            return;
+        }
+    }
+    instrument_begin(&start);
+    int64_t packed_bytes = pack_file(&pack_store, entry, relative);
+    instrument_end_path(STAGE_COPY, &start, (packed_bytes > 0) ? (uint64_t) packed_bytes : 0, entry->path_and_name);
+
+    // A copy left in the destination tree by a run without --pack would hide the packed version
+    if (packed_bytes >= 0 && dst_entry != NULL && dst_entry->entry_type == FICHIER) {
+        unlink(dst_entry->path_and_name);
+    }
+}
+
+/*!
+ * @brief send_to_copiers sends a checkpoint message to each copy worker
+ * The MQ may be full of entries for the main process: they are received meanwhile, so that the
+ * listers are never blocked.
+ * @return 0 in case of success, -1 else
+ */
+static int send_to_copiers(stream_side_t *source, stream_side_t *destinations, process_context_t *p_context,
+                           int recipient, char cmd_code, int *confirmations) {
+    int sent = 0;
+    while (sent < p_context->copiers_count) {
+        if (send_checkpoint_message(p_context->message_queue_id, recipient, cmd_code, IPC_NOWAIT) == 0) {
+            ++sent;
+        } else if (errno != EAGAIN && errno != EINTR) {
+            perror("Cannot send a checkpoint message");
+            return -1;
+        } else {
+            int result = receive_from_listers(source, destinations, p_context->message_queue_id, IPC_NOWAIT, confirmations);
+            if (result == -1) {
+                return -1;
+            }
+            if (result == 1) {
+                usleep(1000);
+            }
+        }
+    }
+    return 0;
+}
+
+/*!
+ * @brief make_checkpoint records the progress of the run (@see checkpoint.c)
+ * The copy workers complete and commit the copies they received, then wait until the checkpoint is
+ * written, so that every action up to the cursor is done.
+ * @param cursor is the relative path of the last source entry compared
+ * @param source is a pointer to the source side
+ * @param destinations are the destination sides
+ * @param the_config is a pointer to the configuration
+ * @param p_context is a pointer to the processes context
+ */
+static void make_checkpoint(char *cursor, stream_side_t *source, stream_side_t *destinations,
+                            configuration_t *the_config, process_context_t *p_context) {
+    int confirmations = 0;
+    if (p_context->copiers_count > 0) {
+        if (send_to_copiers(source, destinations, p_context, MSG_TYPE_TO_COPIERS, COMMAND_CODE_CHECKPOINT, &confirmations) == -1) {
+            return;
+        }
+        while (confirmations < p_context->copiers_count) {
+            if (receive_from_listers(source, destinations, p_context->message_queue_id, 0, &confirmations) == -1) {
+                return;
+            }
+        }
+    }
+
+    // The files copied by the main process, and the files packed, are committed as well, and the
+    // deletions queued before the cursor are done
+    bool is_committed = (flush_durable_batch() == 0);
+    if (the_config->uses_delete && !the_config->uses_dry_run) {
+        is_committed = (wait_deletions() == 0) && is_committed;
+    }
+    if (the_config->pack_threshold > 0 && pack_store.records_count > 0) {
+        is_committed = (close_pack_store(&pack_store) == 0) && is_committed;
+        if (open_pack_store(&pack_store, the_config->destination) == -1) {
+            printf("Cannot open the pack store of %s, the small files are copied\n", the_config->destination);
+            the_config->pack_threshold = 0;
+        }
+    }
+    if (is_committed) {
+        write_checkpoint(cursor);
+    }
+
+    if (p_context->copiers_count > 0) {
+        send_to_copiers(source, destinations, p_context, MSG_TYPE_TO_HELD_COPIERS, COMMAND_CODE_CHECKPOINT_DONE, &confirmations);
+    }
+}
 
 /*!
  * @brief synchronize is the main function for synchronization
- * It will build the lists (source and destination), then make a third list with differences, and apply differences to the destination
+ * It is a streaming pipeline: both trees are listed (and analyzed) directory by directory, in order
+ * (@see tree-stream.c), and their entries are compared (merge-join on their paths relative to their
+ * roots) as soon as they arrive. The differences are applied right away, so the first copy does not
+ * wait for the end of the listings, and only the directories being listed are kept in memory.
+ * With several destinations, each one has its own stream, compared to the source on its own: an
+ * entry is copied once to all the destinations needing it (@see copy_entry_to_destinations).
+ * A remote destination is listed and analyzed by its receiver, which sends its entries and applies the
+ * differences sent back (@see remote.c).
  * It must adapt to the parallel or not operation of the program.
  * @param the_config is a pointer to the configuration
  * @param p_context is a pointer to the processes context
@@ -28,30 +719,289 @@ void synchronize(configuration_t *the_config, process_context_t *p_context) {
         return;
     }
 
-    files_list_t src_list = {0}, dst_list = {0};
-
+    // With several destinations, the source is listed and analyzed once, and merged with each of them
+    int destinations_count = get_destinations_count(the_config);
+    stream_side_t source, destinations[MAX_DESTINATIONS];
+    memset(&source, 0, sizeof(stream_side_t));
+    memset(destinations, 0, sizeof(destinations));
+    source.root = the_config->source;
+    for (int d = 0; d < destinations_count; ++d) {
+        destinations[d].root = get_destination(the_config, d);
+    }
+    // Under a memory limit, the entries a lister sent ahead of the others share half of it (@see spill.c)
+    size_t spool_capacity = (the_config->memory_limit == 0) ? SIZE_MAX :
+                            the_config->memory_limit / 2 / (1 + destinations_count) / sizeof(files_list_entry_t);
+    init_entry_spool(&source.spool, spool_capacity);
+    for (int d = 0; d < destinations_count; ++d) {
+        init_entry_spool(&destinations[d].spool, spool_capacity);
+    }
+    analysis_options_t source_options = {the_config->uses_md5, false};
+    analysis_options_t destination_options = {the_config->uses_md5, the_config->compression != COMPRESSION_NONE};
+    bool is_remote = is_remote_address(the_config->destination);
+    // The listers are not started when the receiver cannot be reached
+    if (is_remote && (remote = connect_to_receiver(the_config)) == NULL) {
+        printf("Cannot connect to the receiver %s\n", the_config->destination);
+        return;
+    }
     if (the_config->is_parallel) {
-        make_files_lists_parallel(&src_list, &dst_list, the_config, p_context->message_queue_id);
+        // All the listers work at the same time, their entries are received interleaved
+        if (send_analyze_dir_command(p_context->message_queue_id, MSG_TYPE_TO_SOURCE_LISTER, the_config->source) == -1) {
+            perror("Cannot send the analyze dir commands");
+            return;
+        }
+        for (int d = (is_remote ? 1 : 0); d < destinations_count; ++d) {
+            int lister = (d == 0) ? MSG_TYPE_TO_DESTINATION_LISTER : MSG_TYPE_TO_EXTRA_LISTERS + d - 1;
+            if (send_analyze_dir_command(p_context->message_queue_id, lister, destinations[d].root) == -1) {
+                perror("Cannot send the analyze dir commands");
+                return;
+            }
+        }
     } else {
-        make_files_list(&src_list, the_config->source);
-        make_files_list(&dst_list, the_config->destination);
+        if (open_tree_stream(&source.stream, source.root, analyze_directory, &source_options, the_config->resume_cursor) == -1) {
+            return;
+        }
+        set_stream_memory_limit(&source.stream, (size_t) the_config->memory_limit);
+        for (int d = (is_remote ? 1 : 0); d < destinations_count; ++d) {
+            if (open_tree_stream(&destinations[d].stream, destinations[d].root, analyze_directory, &destination_options, the_config->resume_cursor) == -1) {
+                close_tree_stream(&source.stream);
+                while (d-- > 0) {
+                    close_tree_stream(&destinations[d].stream);
+                }
+                return;
+            }
+            set_stream_counterpart(&destinations[d].stream, source.root);
+            set_stream_memory_limit(&destinations[d].stream, (size_t) the_config->memory_limit);
+        }
+    }
+    if (the_config->pack_threshold > 0 && open_pack_store(&pack_store, the_config->destination) == -1) {
+        printf("Cannot open the pack store of %s, the small files are copied\n", the_config->destination);
+        the_config->pack_threshold = 0;
+    }
+    // The hard links created before the checkpoint are among the entries a resumed run skips
+    if (!is_remote && load_checkpoint_links(copied_inodes, the_config) == -1) {
+        printf("The hard links created before the checkpoint may be copied again\n");
     }
 
-    // Compare lists and synchronize files
-    // ...
-    files_list_entry_t* tempsrc = src_list.head;
-    files_list_entry_t* tempdst = dst_list.head;
+    while (true) {
+        if (source.pending.head == NULL) {
+            pull_from_spool(&source);
+        }
+        for (int d = 0; d < destinations_count; ++d) {
+            if (destinations[d].pending.head == NULL) {
+                pull_from_spool(&destinations[d]);
+            }
+        }
+        // Each side needs its next entry, unless its tree was completely listed
+        bool needs_source = (source.pending.head == NULL && !source.is_complete);
+        bool needs_destination = false;
+        for (int d = 0; d < destinations_count; ++d) {
+            needs_destination = needs_destination || (destinations[d].pending.head == NULL && !destinations[d].is_complete);
+        }
+        if (remote != NULL && remote->channel.is_broken) {
+            break;
+        }
+        if (needs_source || needs_destination) {
+            if (remote != NULL && destinations[0].pending.head == NULL && !destinations[0].is_complete) {
+                if (pull_from_remote(&destinations[0]) == -1) {
+                    break;
+                }
+                continue;
+            }
+            if (the_config->is_parallel) {
+                int confirmations = 0;
+                if (receive_from_listers(&source, destinations, p_context->message_queue_id, 0, &confirmations) == -1) {
+                    break;
+                }
+            } else {
+                if (needs_source) {
+                    pull_from_stream(&source);
+                }
+                for (int d = 0; d < destinations_count; ++d) {
+                    if (destinations[d].pending.head == NULL && !destinations[d].is_complete) {
+                        pull_from_stream(&destinations[d]);
+                    }
+                }
+            }
+            display_progress(false);
+            continue;
+        }
 
-    while(tempsrc != NULL && tempdst != NULL){
-        if(mismatch(tempsrc,tempdst,the_config->uses_md5)){
-            tempdst = tempsrc;
+        struct timespec start;
+        instrument_begin(&start);
+        files_list_entry_t *src_entry = source.pending.head;
+        files_list_entry_t *dst_entries[MAX_DESTINATIONS];
+        int comparisons[MAX_DESTINATIONS];
+        bool is_extraneous = false;
+        for (int d = 0; d < destinations_count; ++d) {
+            dst_entries[d] = destinations[d].pending.head;
+            comparisons[d] = (dst_entries[d] == NULL) ? -1 : (src_entry == NULL) ? 1 :
+                             path_compare(relative_path(src_entry->path_and_name, the_config->source),
+                                          relative_path(dst_entries[d]->path_and_name, destinations[d].root));
+            if (comparisons[d] > 0) {
+                // The destination entry does not exist in the source
+                if (the_config->uses_delete) {
+                    delete_extraneous_entry(dst_entries[d], d, the_config, false);
+                }
+                free(remove_head_entry(&destinations[d].pending));
+                is_extraneous = true;
+            }
         }
-        tempsrc = tempsrc->next;
-        tempdst = tempdst->next;
+        if (is_extraneous) {
+            instrument_end(STAGE_DIFF, &start, 0);
+            continue;
+        }
+        if (src_entry == NULL) {
+            break;
+        }
+
+        files_list_entry_t *dst_entry = (comparisons[0] == 0) ? dst_entries[0] : NULL;
+        if (is_packable(src_entry, the_config)) {
+            instrument_end(STAGE_DIFF, &start, 0);
+            apply_packed_difference(src_entry, dst_entry, the_config);
+            if (is_checkpoint_due()) {
+                make_checkpoint(relative_path(src_entry->path_and_name, the_config->source), &source, destinations, the_config, p_context);
+            }
+            free(remove_head_entry(&source.pending));
+            if (dst_entry != NULL) {
+                free(remove_head_entry(&destinations[0].pending));
+            }
+            display_progress(false);
+            continue;
+        }
+        sync_action_t actions[MAX_DESTINATIONS];
+        for (int d = 0; d < destinations_count; ++d) {
+            actions[d] = (comparisons[d] < 0) ? ACTION_NEW : get_sync_action(src_entry, dst_entries[d], the_config->uses_md5);
+        }
+        instrument_end(STAGE_DIFF, &start, 0);
+
+        // The destinations needing the data get it from a single read of the source file
+        int needing_copy = 0;
+        for (int d = 0; d < destinations_count; ++d) {
+            if (comparisons[d] == 0 && src_entry->entry_type != dst_entries[d]->entry_type && the_config->uses_delete) {
+                // A file replaced by a directory (or the opposite) is deleted before the copy
+                delete_extraneous_entry(dst_entries[d], d, the_config, true);
+            }
+            if (actions[d] == ACTION_METADATA && update_metadata(src_entry, dst_entries[d], d, the_config) == -1) {
+                actions[d] = ACTION_DATA;
+            }
+            if (actions[d] == ACTION_NEW || actions[d] == ACTION_DATA) {
+                needing_copy |= 1 << d;
+            }
+        }
+        if (needing_copy != 0 && remote != NULL) {
+            apply_remote_difference(src_entry, dst_entry, the_config);
+        } else if (needing_copy != 0) {
+            apply_difference(src_entry, needing_copy, the_config, p_context);
+        }
+        for (int d = 0; d < destinations_count; ++d) {
+            if ((needing_copy & (1 << d)) == 0 && comparisons[d] == 0 && remote == NULL && is_linkable(src_entry, the_config)) {
+                if (src_entry->links_count > 1) {
+                    relink_previous_copy(src_entry, dst_entries[d], d, the_config);
+                }
+                // The destination file can be the target of the next links
+                remember_copy(src_entry, d, dst_entries[d]->path_and_name, the_config);
+            }
+        }
+        if (is_checkpoint_due()) {
+            make_checkpoint(relative_path(src_entry->path_and_name, the_config->source), &source, destinations, the_config, p_context);
+        }
+        free(remove_head_entry(&source.pending));
+        for (int d = 0; d < destinations_count; ++d) {
+            if (comparisons[d] == 0) {
+                free(remove_head_entry(&destinations[d].pending));
+            }
+        }
+        display_progress(false);
     }
 
-    clear_files_list(&src_list);
-    clear_files_list(&dst_list);
+    // Nothing is left to resume once all the trees were completely compared
+    bool is_complete = source.is_complete && source.pending.head == NULL && is_spool_empty(&source.spool);
+    clear_files_list(&source.pending);
+    clear_entry_spool(&source.spool);
+    for (int d = 0; d < destinations_count; ++d) {
+        is_complete = is_complete && destinations[d].is_complete && destinations[d].pending.head == NULL && is_spool_empty(&destinations[d].spool);
+        clear_files_list(&destinations[d].pending);
+        clear_entry_spool(&destinations[d].spool);
+    }
+    for (int d = 0; d < destinations_count; ++d) {
+        clear_links_table(&copied_inodes[d]);
+        clear_links_table(&copied_contents[d]);
+    }
+    flush_durable_batch();
+    if (remote != NULL) {
+        // The receiver applies the last commands before it answers
+        uint64_t deleted_count = 0;
+        if (disconnect_from_receiver(remote, &deleted_count) == -1) {
+            is_complete = false;
+        }
+        remote = NULL;
+        if (the_config->uses_delete && !the_config->uses_dry_run && the_config->uses_verbose) {
+            printf("%llu destination entries deleted\n", (unsigned long long) deleted_count);
+        }
+    } else if (the_config->uses_delete && !the_config->uses_dry_run) {
+        clean_deletions();
+        if (the_config->uses_verbose) {
+            printf("%llu destination entries deleted\n", (unsigned long long) get_deleted_count());
+        }
+    }
+    if (the_config->pack_threshold > 0 && close_pack_store(&pack_store) == -1) {
+        printf("The pack index of %s was not updated, its new files will be packed again\n", the_config->destination);
+        is_complete = false;
+    }
+    if (is_complete) {
+        remove_checkpoint();
+    }
+    if (!the_config->is_parallel) {
+        close_tree_stream(&source.stream);
+        for (int d = (is_remote ? 1 : 0); d < destinations_count; ++d) {
+            close_tree_stream(&destinations[d].stream);
+        }
+    }
+}
+
+/*!
+ * @brief make_differences_list builds the list of the source entries to copy to the destination
+ * Both lists are ordered (@see make_list), so they are walked together (merge-join) on their
+ * paths relative to their root.
+ * @param diff_list is a pointer to the list receiving copies of the source entries to copy
+ * @param src_list is a pointer to the source list
+ * @param dst_list is a pointer to the destination list
+ * @param the_config is a pointer to the configuration
+ */
+void make_differences_list(files_list_t *diff_list, files_list_t *src_list, files_list_t *dst_list, configuration_t *the_config) {
+    if (diff_list == NULL || src_list == NULL || dst_list == NULL || the_config == NULL) {
+        return;
+    }
+
+    files_list_entry_t *dst_cursor = dst_list->head;
+    for (files_list_entry_t *src_cursor = src_list->head; src_cursor != NULL; src_cursor = src_cursor->next) {
+        struct timespec start;
+        instrument_begin(&start);
+        char *src_relative = relative_path(src_cursor->path_and_name, the_config->source);
+
+        // Skip the destination entries that do not exist in the source
+        int comparison = -1;
+        while (dst_cursor != NULL &&
+               (comparison = path_compare(src_relative, relative_path(dst_cursor->path_and_name, the_config->destination))) > 0) {
+            dst_cursor = dst_cursor->next;
+        }
+        if (dst_cursor == NULL) {
+            comparison = -1;
+        }
+
+        if (comparison != 0 || mismatch(src_cursor, dst_cursor, the_config->uses_md5)) {
+            files_list_entry_t *difference = malloc(sizeof(files_list_entry_t));
+            if (difference == NULL) {
+                printf("Error when allocating memory in the function make_differences_list of the file sync.c\n");
+                return;
+            }
+            memcpy(difference, src_cursor, sizeof(files_list_entry_t));
+            difference->next = NULL;
+            difference->prev = NULL;
+            add_entry_to_tail(diff_list, difference);
+        }
+        instrument_end(STAGE_DIFF, &start, 0);
+    }
 }
 
 /*!
@@ -66,6 +1016,13 @@ bool mismatch(files_list_entry_t *lhd, files_list_entry_t *rhd, bool has_md5) {
         return true; // Consider mismatch if either entry is NULL
     }
 
+    if (lhd->entry_type != rhd->entry_type) {
+        return true;
+    }
+    if (lhd->entry_type == DOSSIER) {
+        return false; // Directories only need to exist
+    }
+
     if (lhd->size != rhd->size || lhd->mtime.tv_sec != rhd->mtime.tv_sec ||
         lhd->mtime.tv_nsec != rhd->mtime.tv_nsec) {
         return true;
@@ -78,17 +1035,62 @@ bool mismatch(files_list_entry_t *lhd, files_list_entry_t *rhd, bool has_md5) {
     return false;
 }
 
+/*!
+ * @brief get_sync_action tells what a source entry needs in the destination
+ * Unlike mismatch, the content and the metadata are told apart: with MD5 sums, a file whose only mtime
+ * changed (touch) has the same content. Without them, an mtime change may hide a content change, so
+ * the file is copied again. The access modes are compared as well (chmod), for files and directories.
+ * @param source_entry is a pointer to the source entry
+ * @param dest_entry is a pointer to the destination entry with the same path (NULL if none)
+ * @param has_md5 is true when the MD5 sums of both entries are set
+ * @return the action to apply
+ */
+sync_action_t get_sync_action(files_list_entry_t *source_entry, files_list_entry_t *dest_entry, bool has_md5) {
+    if (source_entry == NULL || dest_entry == NULL) {
+        return ACTION_NEW;
+    }
+
+    if (source_entry->entry_type != dest_entry->entry_type) {
+        return ACTION_DATA;
+    }
+    bool has_same_mode = ((source_entry->mode ^ dest_entry->mode) & 07777) == 0;
+    if (source_entry->entry_type == DOSSIER) {
+        return has_same_mode ? ACTION_NONE : ACTION_METADATA;
+    }
+
+    if (source_entry->size != dest_entry->size) {
+        return ACTION_DATA;
+    }
+    if (has_md5 && memcmp(source_entry->md5sum, dest_entry->md5sum, sizeof(source_entry->md5sum)) != 0) {
+        return ACTION_DATA;
+    }
+    if (source_entry->mtime.tv_sec != dest_entry->mtime.tv_sec || source_entry->mtime.tv_nsec != dest_entry->mtime.tv_nsec) {
+        return has_md5 ? ACTION_METADATA : ACTION_DATA;
+    }
+    return has_same_mode ? ACTION_NONE : ACTION_METADATA;
+}
+
 /*!
  * @brief make_files_list buils a files list in no parallel mode
  * @param list is a pointer to the list that will be built
  * @param target_path is the path whose files to list
+ * @param has_md5 a value to enable or disable MD5 sum computation
  */
-void make_files_list(files_list_t *list, char *target_path) {
+void make_files_list(files_list_t *list, char *target_path, bool has_md5) {
     if (list == NULL || target_path == NULL) {
         return;
     }
 
-    make_list(*list, target_path);
+    make_list(list, target_path);
+
+    for (files_list_entry_t *cursor = list->head; cursor != NULL; cursor = cursor->next) {
+        int result = has_md5 ? get_file_stats(cursor) : get_file_metadata(cursor);
+        if (result == -1) {
+            printf("Error in the function make_files_list of the file sync.c\n");
+            printf("Cannot get the properties of %s\n", cursor->path_and_name);
+        }
+        display_progress(false);
+    }
 }
 
 /*!
@@ -102,6 +1104,188 @@ void make_files_lists_parallel(files_list_t *src_list, files_list_t *dst_list, c
     if (src_list == NULL || dst_list == NULL || the_config == NULL) {
         return;
     }
+
+    // Both listers work at the same time
+    if (send_analyze_dir_command(msg_queue, MSG_TYPE_TO_SOURCE_LISTER, the_config->source) == -1 ||
+        send_analyze_dir_command(msg_queue, MSG_TYPE_TO_DESTINATION_LISTER, the_config->destination) == -1) {
+        perror("Cannot send the analyze dir commands");
+        return;
+    }
+
+    // Their (ordered) lists are received interleaved: the sender of each entry is stored in reply_to
+    int lists_complete = 0;
+    any_message_t message;
+    while (lists_complete < 2) {
+        if (receive_message(msg_queue, &message, MSG_TYPE_TO_MAIN, 0) == -1) {
+            perror("Cannot receive the files lists");
+            return;
+        }
+
+        if (message.simple_command.message == COMMAND_CODE_LIST_COMPLETE) {
+            ++lists_complete;
+        } else if (message.list_entry.op_code == COMMAND_CODE_FILE_ENTRY) {
+            files_list_entry_t *entry = malloc(sizeof(files_list_entry_t));
+            if (entry == NULL) {
+                printf("Error when allocating memory in the function make_files_lists_parallel of the file sync.c\n");
+                continue;
+            }
+            memcpy(entry, &message.list_entry.payload, sizeof(files_list_entry_t));
+            entry->next = NULL;
+            entry->prev = NULL;
+            add_entry_to_tail(message.list_entry.reply_to == MSG_TYPE_TO_SOURCE_LISTER ? src_list : dst_list, entry);
+        }
+        display_progress(false);
+    }
+}
+
+/*!
+ * @brief copy_file_by_blocks copies a file through the cache-polite readers and writers (@see file-io.c)
+ * It is used instead of sendfile when the data must bypass the page cache or be throttled, and for
+ * sparse files, whose holes are recreated in the destination.
+ * @param source_entry is a pointer to the entry of the source file
+ * @param dest_path is the path of the destination file
+ * @param uses_reflink is true to clone the data when possible (@see clone_file_data)
+ * @return the number of bytes copied, -1 in case of error
+ */
+static int64_t copy_file_by_blocks(files_list_entry_t *source_entry, char *dest_path, bool uses_reflink) {
+    io_file_t reader, writer;
+    if (open_file_reader(&reader, source_entry->path_and_name) == -1) {
+        perror("Cannot open source file");
+        return -1;
+    }
+    if (open_file_writer(&writer, dest_path, source_entry->mode & 07777) == -1) {
+        perror("Cannot open destination file");
+        close_io_file(&reader);
+        return -1;
+    }
+
+    bool is_failed = false;
+    if (uses_reflink && clone_file_data(reader.fd, writer.fd, source_entry->device) == 0) {
+        writer.offset = source_entry->size;
+    } else {
+        // The holes of the source are kept as holes
+        uint64_t hole_size;
+        ssize_t bytes_read;
+        while ((bytes_read = read_file_data(&reader, &hole_size)) >= 0) {
+            if (hole_size > 0 && skip_file_hole(&writer, hole_size) == -1) {
+                is_failed = true;
+                break;
+            }
+            if (bytes_read == 0) {
+                break;
+            }
+            if (write_file_block(&writer, reader.buffer, (size_t) bytes_read) == -1) {
+                is_failed = true;
+                break;
+            }
+        }
+        if (bytes_read == -1 || finish_file_writer(&writer) == -1) {
+            is_failed = true;
+        }
+    }
+    if (is_failed) {
+        perror("Cannot copy file");
+    }
+
+    // Keep access modes and mtime
+    fchmod(writer.fd, source_entry->mode & 07777);
+    struct timespec times[2] = {{0, UTIME_OMIT}, source_entry->mtime};
+    futimens(writer.fd, times);
+    int64_t copied = (int64_t) writer.offset;
+    close_io_file(&writer);
+    close_io_file(&reader);
+    return is_failed ? -1 : copied;
+}
+
+/*!
+ * @brief send_file_data copies a file with sendfile (the kernel copies the data without user space buffers)
+ * @param source_entry is a pointer to the entry of the source file
+ * @param dest_path is the path of the destination file
+ * @param uses_reflink is true to clone the data when possible (@see clone_file_data)
+ * @return the number of bytes copied, -1 in case of error
+ */
+static int64_t send_file_data(files_list_entry_t *source_entry, char *dest_path, bool uses_reflink) {
+    int source_fd = open(source_entry->path_and_name, O_RDONLY);
+    if (source_fd == -1) {
+        perror("Cannot open source file");
+        return -1;
+    }
+    int dest_fd = open(dest_path, O_WRONLY | O_CREAT | O_TRUNC, source_entry->mode & 07777);
+    if (dest_fd == -1) {
+        perror("Cannot open destination file");
+        close(source_fd);
+        return -1;
+    }
+
+    off_t offset = 0;
+    bool is_failed = false;
+    if (uses_reflink && clone_file_data(source_fd, dest_fd, source_entry->device) == 0) {
+        offset = (off_t) source_entry->size;
+    }
+    while ((uint64_t) offset < source_entry->size) {
+        ssize_t copied = sendfile(dest_fd, source_fd, &offset, source_entry->size - offset);
+        if (copied == -1 && errno == EINTR) {
+            continue;
+        }
+        if (copied <= 0) {
+            if (copied == -1) {
+                perror("Cannot copy file");
+                is_failed = true;
+            }
+            break;
+        }
+    }
+
+    // Keep access modes and mtime
+    fchmod(dest_fd, source_entry->mode & 07777);
+    struct timespec times[2] = {{0, UTIME_OMIT}, source_entry->mtime};
+    futimens(dest_fd, times);
+    close(dest_fd);
+    close(source_fd);
+    return is_failed ? -1 : (int64_t) offset;
+}
+
+/*!
+ * @brief link_to_previous_snapshot hard-links a file of the previous snapshot (--link-dest) into the
+ * destination, when it is the same as the source file
+ * It runs in the copy workers, so the links are created in parallel. The previous file must match the
+ * source (@see mismatch, its MD5 sum is only computed when its size and mtime match), and have the
+ * same access modes, as the link shares its inode. A compressed snapshot gives its MD5 sums in the
+ * headers of its files.
+ * @param source_entry is a pointer to the source file
+ * @param dest_path is the final path of the file
+ * @param write_path is the path to create (@see begin_durable_file)
+ * @param the_config is a pointer to the configuration
+ * @return true if the file was linked, false if it must be copied
+ */
+static bool link_to_previous_snapshot(files_list_entry_t *source_entry, char *dest_path, char *write_path, configuration_t *the_config) {
+    files_list_entry_t previous;
+    memset(&previous, 0, sizeof(files_list_entry_t));
+    struct stat previous_stat;
+    if (concat_path(previous.path_and_name, the_config->link_dest, relative_path(source_entry->path_and_name, the_config->source)) == NULL ||
+        stat(previous.path_and_name, &previous_stat) == -1 || !S_ISREG(previous_stat.st_mode)) {
+        return false;
+    }
+
+    bool is_compressed = the_config->compression != COMPRESSION_NONE;
+    if ((is_compressed ? get_compressed_file_stats(&previous) : get_file_metadata(&previous)) == -1 ||
+        ((previous.mode ^ source_entry->mode) & 07777) != 0 || mismatch(source_entry, &previous, false)) {
+        return false;
+    }
+    if (the_config->uses_md5 && ((!is_compressed && compute_file_digest(&previous) == -1) ||
+                                 mismatch(source_entry, &previous, true))) {
+        return false;
+    }
+
+    // Without durability, the file is created in place: an outdated destination file is replaced
+    if (strcmp(write_path, dest_path) == 0) {
+        unlink(dest_path);
+    }
+    if (link(previous.path_and_name, write_path) == -1) {
+        return false;
+    }
+    commit_durable_file(write_path, dest_path, 0, true);
+    return true;
 }
 
 /*!
@@ -109,6 +1293,10 @@ void make_files_lists_parallel(files_list_t *src_list, files_list_t *dst_list, c
  * It keeps access modes and mtime (@see utimensat)
  * Pay attention to the path so that the prefixes are not repeated from the source to the destination
  * Use sendfile to copy the file, mkdir to create the directory
+ * With the reflink mode, the data is cloned when both filesystems allow it (@see clone_file_data).
+ * With compression, the destination file is written in the compressed format (@see compress_file).
+ * In the durable modes, the file is written under a temporary name, then committed (@see durability.c).
+ * With --link-dest, a file unchanged since the previous snapshot is linked instead (@see link_to_previous_snapshot).
  */
 void copy_entry_to_destination(files_list_entry_t *source_entry, configuration_t *the_config) {
     if (source_entry == NULL || the_config == NULL) {
@@ -117,41 +1305,272 @@ void copy_entry_to_destination(files_list_entry_t *source_entry, configuration_t
 
     // Construct the destination path
     char dest_path[PATH_SIZE];
+    if (concat_path(dest_path, the_config->destination, relative_path(source_entry->path_and_name, the_config->source)) == NULL) {
+        printf("Error in the function copy_entry_to_destination of the file sync.c\n");
+        printf("The destination path of %s is too long\n", source_entry->path_and_name);
+        return;
+    }
+
+    struct timespec start;
+    instrument_begin(&start);
+
+    if (source_entry->entry_type == DOSSIER) {
+        if (mkdir(dest_path, source_entry->mode & 07777) == -1 && errno != EEXIST) {
+            perror("Cannot create directory");
+            return;
+        }
+        chmod(dest_path, source_entry->mode & 07777);
+        commit_durable_directory(dest_path);
+        instrument_end_path(STAGE_COPY, &start, 0, source_entry->path_and_name);
+        return;
+    }
+
+    // A destination file linked to other ones (@see link_to_previous_copy) must not be overwritten in place
+    // (durable copies replace it with a rename)
+    struct stat dest_stat;
+    if (!is_durability_enabled() && lstat(dest_path, &dest_stat) == 0 && S_ISREG(dest_stat.st_mode) && dest_stat.st_nlink > 1) {
+        unlink(dest_path);
+    }
+
+    char write_path[PATH_SIZE];
+    if (begin_durable_file(dest_path, write_path) == -1) {
+        perror("Cannot prepare the copy");
+        return;
+    }
+    if (the_config->link_dest[0] != '\0' && link_to_previous_snapshot(source_entry, dest_path, write_path, the_config)) {
+        instrument_end_path(STAGE_COPY, &start, 0, source_entry->path_and_name);
+        return;
+    }
+    int64_t copied;
+    if (the_config->compression != COMPRESSION_NONE) {
+        copied = compress_file(source_entry, write_path, the_config);
+    } else if (the_config->is_cache_polite || is_throttling_enabled() || is_sparse_file(source_entry->path_and_name)) {
+        // sendfile copies a whole file at once: it can neither bypass the page cache, be throttled, nor skip holes
+        copied = copy_file_by_blocks(source_entry, write_path, the_config->uses_reflink);
+    } else {
+        copied = send_file_data(source_entry, write_path, the_config->uses_reflink);
+    }
+    commit_durable_file(write_path, dest_path, (copied > 0) ? (uint64_t) copied : 0, copied != -1);
+    instrument_end_path(STAGE_COPY, &start, (copied > 0) ? (uint64_t) copied : 0, source_entry->path_and_name);
 }
 
 /*!
- * @brief make_list lists files in a location (it recurses in directories)
- * It doesn't get files properties, only a list of paths
- * This function is used by make_files_list and make_files_list_parallel
- * @param list is a pointer to the list that will be built
- * @param target is the target dir whose content must be listed
+ * @brief copy_entry_to_destinations copies a source entry to a set of destinations
+ * A file needed by several destinations is read once, and written to all of them (@see fanout_copy).
+ * @param source_entry is a pointer to the source entry
+ * @param the_config is a pointer to the configuration
+ * @param destinations is the set of the destinations needing the entry, bit i for the destination i (@see get_destination)
+ */
+void copy_entry_to_destinations(files_list_entry_t *source_entry, configuration_t *the_config, int destinations) {
+    if (source_entry == NULL || the_config == NULL) {
+        return;
+    }
+    if (destinations == 1) {
+        copy_entry_to_destination(source_entry, the_config);
+        return;
+    }
+
+    char paths[MAX_DESTINATIONS][PATH_SIZE];
+    char *dest_paths[MAX_DESTINATIONS];
+    int count = 0;
+    for (int i = 0; i < get_destinations_count(the_config); ++i) {
+        if ((destinations & (1 << i)) == 0) {
+            continue;
+        }
+        if (concat_path(paths[count], get_destination(the_config, i), relative_path(source_entry->path_and_name, the_config->source)) == NULL) {
+            printf("Error in the function copy_entry_to_destinations of the file sync.c\n");
+            printf("The destination path of %s is too long\n", source_entry->path_and_name);
+            continue;
+        }
+        dest_paths[count] = paths[count];
+        ++count;
+    }
+
+    struct timespec start;
+    instrument_begin(&start);
+    if (source_entry->entry_type == DOSSIER) {
+        for (int i = 0; i < count; ++i) {
+            if (mkdir(dest_paths[i], source_entry->mode & 07777) == -1 && errno != EEXIST) {
+                perror("Cannot create directory");
+                continue;
+            }
+            chmod(dest_paths[i], source_entry->mode & 07777);
+        }
+        instrument_end_path(STAGE_COPY, &start, 0, source_entry->path_and_name);
+        return;
+    }
+
+    // A destination file linked to other ones must not be overwritten in place
+    for (int i = 0; i < count; ++i) {
+        struct stat dest_stat;
+        if (lstat(dest_paths[i], &dest_stat) == 0 && S_ISREG(dest_stat.st_mode) && dest_stat.st_nlink > 1) {
+            unlink(dest_paths[i]);
+        }
+    }
+    bool uses_blocks = the_config->is_cache_polite || is_throttling_enabled() || is_sparse_file(source_entry->path_and_name);
+    int64_t copied = (count > 0) ? fanout_copy(source_entry, dest_paths, count, uses_blocks) : 0;
+    instrument_end_path(STAGE_COPY, &start, (copied > 0) ? (uint64_t) copied * (uint64_t) count : 0, source_entry->path_and_name);
+}
+
+/*!
+ * @brief compare_entries_names compares two entries pointers by name, for qsort
+ */
+static int compare_entries_names(const void *lhs, const void *rhs) {
+    const files_list_entry_t *left = *(files_list_entry_t * const *) lhs;
+    const files_list_entry_t *right = *(files_list_entry_t * const *) rhs;
+    return path_compare(left->path_and_name, right->path_and_name);
+}
+
+/*!
+ * @brief list_directory lists the content of a directory (without recursion), sorted by name
+ * It doesn't get files properties, only the paths and whether they are directories
+ * @param list is a pointer to the list receiving the entries (appended at its tail)
+ * @param target is the directory to list
  */
-void make_list(files_list_t list, char *target) {
-    if (&list == NULL || target == NULL) {
+void list_directory(files_list_t *list, char *target) {
+    if (list == NULL || target == NULL) {
         return;
     }
 
+    struct timespec start;
+    instrument_begin(&start);
     DIR *dir = open_dir(target);
     if (dir == NULL) {
         return;
     }
 
+    files_list_entry_t **children = NULL;
+    size_t children_count = 0, children_capacity = 0;
     struct dirent *entry;
     while ((entry = get_next_entry(dir)) != NULL) {
-        // Construct full path and add to list
-        char full_path[PATH_SIZE];
-        snprintf(full_path, PATH_SIZE, "%s/%s", target, entry->d_name);
+        // The state of lp25 in a destination is not part of the backup
+        if (strncmp(entry->d_name, RESERVED_NAME_PREFIX, strlen(RESERVED_NAME_PREFIX)) == 0) {
+            continue;
+        }
 
-        // Create a new files_list_entry_t and add it to the list
-        files_list_entry_t *new_entry = add_file_entry(&list, full_path);
+        if (children_count == children_capacity) {
+            size_t new_capacity = (children_capacity == 0) ? 16 : children_capacity * 2;
+            files_list_entry_t **new_children = realloc(children, new_capacity * sizeof(files_list_entry_t *));
+            if (new_children == NULL) {
+                printf("Error when allocating memory in the function list_directory of the file sync.c\n");
+                break;
+            }
+            children = new_children;
+            children_capacity = new_capacity;
+        }
 
-        // Check if the entry is a directory, and if so, recurse into it
-        if (new_entry != NULL && new_entry->entry_type == DOSSIER) {
-            make_list(list, full_path); // Recurse into the subdirectory
+        // Create a new files_list_entry_t with its full path
+        files_list_entry_t *new_entry = calloc(1, sizeof(files_list_entry_t));
+        if (new_entry == NULL) {
+            printf("Error when allocating memory in the function list_directory of the file sync.c\n");
+            break;
         }
+        if (concat_path(new_entry->path_and_name, target, entry->d_name) == NULL) {
+            free(new_entry);
+            continue;
+        }
+        new_entry->entry_type = is_directory_entry(new_entry->path_and_name, entry) ? DOSSIER : FICHIER;
+        children[children_count++] = new_entry;
+    }
+    closedir(dir);
+
+    qsort(children, children_count, sizeof(files_list_entry_t *), compare_entries_names);
+    for (size_t i = 0; i < children_count; ++i) {
+        add_entry_to_tail(list, children[i]);
+    }
+    free(children);
+    instrument_end_path(STAGE_LISTING, &start, 0, target);
+}
+
+/*!
+ * @brief sort_directory lists the names of the content of a directory in a sorter, which keeps them in
+ * memory or spills them to sorted runs, depending on its budget (@see spill.c)
+ * @param sorter is a pointer to the sorter, finished afterwards
+ * @param target is the directory whose content must be listed
+ * @return 0 in case of success, -1 else
+ */
+int sort_directory(name_sorter_t *sorter, char *target) {
+    if (sorter == NULL || target == NULL) {
+        return -1;
     }
 
+    struct timespec start;
+    instrument_begin(&start);
+    DIR *dir = open_dir(target);
+    if (dir == NULL) {
+        return finish_name_sorter(sorter);
+    }
+
+    char path[PATH_SIZE];
+    struct dirent *entry;
+    int result = 0;
+    while (result == 0 && (entry = get_next_entry(dir)) != NULL) {
+        // The state of lp25 in a destination is not part of the backup
+        if (strncmp(entry->d_name, RESERVED_NAME_PREFIX, strlen(RESERVED_NAME_PREFIX)) == 0) {
+            continue;
+        }
+        if (concat_path(path, target, entry->d_name) == NULL) {
+            continue;
+        }
+        result = add_sorted_name(sorter, entry->d_name, is_directory_entry(path, entry));
+    }
     closedir(dir);
+
+    if (result == 0) {
+        result = finish_name_sorter(sorter);
+    }
+    instrument_end_path(STAGE_LISTING, &start, 0, target);
+    return result;
+}
+
+/*!
+ * @brief make_filtered_list lists the included files of a directory, and recurses in its directories
+ * @param list is a pointer to the list that will be built
+ * @param target is the directory whose content must be listed
+ * @param filter is the filter state of the directory (@see filters.c)
+ */
+static void make_filtered_list(files_list_t *list, char *target, filter_state_t *filter) {
+    files_list_t children = {0};
+    list_directory(&children, target);
+    filter_directory_content(&children, filter);
+    files_list_entry_t *cursor = children.head;
+    while (cursor != NULL) {
+        files_list_entry_t *next = cursor->next;
+        cursor->next = NULL;
+        cursor->prev = NULL;
+        add_entry_to_tail(list, cursor);
+        // Check if the entry is a directory, and if so, recurse into it
+        if (cursor->entry_type == DOSSIER) {
+            filter_state_t child_filter = {NULL, 0, 0};
+            filter_entry(filter, strrchr(cursor->path_and_name, '/') + 1, true, &child_filter);
+            make_filtered_list(list, cursor->path_and_name, &child_filter);
+            clear_filter_state(&child_filter);
+        }
+        cursor = next;
+    }
+}
+
+/*!
+ * @brief make_list lists files in a location (it recurses in directories)
+ * It doesn't get files properties, only a list of paths
+ * This function is used by make_files_list
+ * The content of each directory is sorted before being appended to the list, so the resulting list
+ * is ordered (@see path_compare) without any insertion cost. The entries excluded by the filter
+ * rules are not listed.
+ * @param list is a pointer to the list that will be built
+ * @param target is the target dir whose content must be listed
+ */
+void make_list(files_list_t *list, char *target) {
+    if (list == NULL || target == NULL) {
+        return;
+    }
+
+    filter_state_t filter;
+    if (init_filter_state(&filter) == -1) {
+        return;
+    }
+    make_filtered_list(list, target, &filter);
+    clear_filter_state(&filter);
 }
 
 /*!
@@ -164,11 +1583,30 @@ DIR *open_dir(char *path) {
 }
 
 
+/*!
+ * @brief is_directory_entry tells if an entry returned by get_next_entry is a directory
+ * It relies on d_type when the filesystem provides it, and on stat else.
+ * @param path is the full path of the entry
+ * @param entry is the entry returned by readdir
+ * @return true if the entry is a directory, false else
+ */
+bool is_directory_entry(char *path, struct dirent *entry) {
+    if (entry->d_type == DT_DIR) {
+        return true;
+    }
+    if (entry->d_type != DT_UNKNOWN && entry->d_type != DT_LNK) {
+        return false;
+    }
+    struct stat statbuf;
+    return stat(path, &statbuf) == 0 && S_ISDIR(statbuf.st_mode);
+}
+
 /*!
  * @brief get_next_entry returns the next entry in an already opened dir
  * @param dir is a pointer to the dir (as a result of opendir, @see open_dir)
  * @return a struct dirent pointer to the next relevant entry, NULL if none found (use it to stop iterating)
  * Relevant entries are all regular files and dir, except . and ..
+ * Symbolic links (and entries of unknown type) are kept, they are resolved by stat later.
  */
 struct dirent *get_next_entry(DIR *dir) {
     if (dir == NULL) {
@@ -177,6 +1615,9 @@ struct dirent *get_next_entry(DIR *dir) {
 
     struct dirent *entry;
     while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_type != DT_REG && entry->d_type != DT_DIR && entry->d_type != DT_LNK && entry->d_type != DT_UNKNOWN) {
+            continue;
+        }
         if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
             return entry; // Return the entry if it's not '.' or '..'
         }
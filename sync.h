@@ -4,13 +4,28 @@
 #include "files-list.h"
 #include "configuration.h"
 #include "processes.h"
+#include "spill.h"
 #include <dirent.h>
 
+// What a source entry needs in the destination
+typedef enum {
+    ACTION_NONE, // Up to date
+    ACTION_NEW, // Missing from the destination
+    ACTION_DATA, // Different content: copied again
+    ACTION_METADATA // Same content, different mode or mtime: only the metadata is updated
+} sync_action_t;
+
 void synchronize(configuration_t *the_config, process_context_t *p_context);
-void make_files_list(files_list_t *list, char *target_path);
+void make_files_list(files_list_t *list, char *target_path, bool has_md5);
+void make_differences_list(files_list_t *diff_list, files_list_t *src_list, files_list_t *dst_list, configuration_t *the_config);
 bool mismatch(files_list_entry_t *lhd, files_list_entry_t *rhd, bool has_md5);
+sync_action_t get_sync_action(files_list_entry_t *source_entry, files_list_entry_t *dest_entry, bool has_md5);
 void make_files_lists_parallel(files_list_t *src_list, files_list_t *dst_list, configuration_t *the_config, int msg_queue);
 void copy_entry_to_destination(files_list_entry_t *source_entry, configuration_t *the_config);
-void make_list(files_list_t list, char *target);
+void copy_entry_to_destinations(files_list_entry_t *source_entry, configuration_t *the_config, int destinations);
+void list_directory(files_list_t *list, char *target);
+int sort_directory(name_sorter_t *sorter, char *target);
+void make_list(files_list_t *list, char *target);
 DIR *open_dir(char *path);
+bool is_directory_entry(char *path, struct dirent *entry);
 struct dirent *get_next_entry(DIR *dir);
\ No newline at end of file
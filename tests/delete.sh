@@ -0,0 +1,48 @@
+#!/bin/sh
+# Checks that --delete mirrors the source: extraneous entries and entries whose type changed are replaced,
+# the excluded entries of the destination are kept
+# Usage: delete.sh <LP25 executable>
+set -eu
+LP25=$(realpath "$1")
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+mkdir -p "$WORK/src/now-dir/inner" "$WORK/src/kept"
+printf 'file\n' > "$WORK/src/now-file"
+printf 'inner\n' > "$WORK/src/now-dir/inner/f"
+printf 'kept\n' > "$WORK/src/kept/f"
+
+fail() {
+    echo "delete: $1" >&2
+    cat "$WORK/messages" >&2
+    exit 1
+}
+
+for mode in --no-parallel -n4; do
+    DST="$WORK/dst$mode"
+    # The destination has a directory where the source has a file, and the opposite
+    mkdir -p "$DST/now-file/sub" "$DST/extra-dir/sub" "$DST/kept/cache" "$DST/tmp/sub"
+    printf 'old\n' > "$DST/now-file/sub/f"
+    printf 'old\n' > "$DST/now-dir"
+    printf 'extra\n' > "$DST/extra-dir/sub/f"
+    printf 'extra\n' > "$DST/kept/extra"
+    # Entries matching an exclude rule are not in the source, but they are left alone
+    printf 'excluded\n' > "$DST/kept/cache/f"
+    printf 'excluded\n' > "$DST/notes.keep"
+    printf 'excluded\n' > "$DST/tmp/sub/f"
+
+    "$LP25" --dry-run --delete --exclude '*.keep' --exclude 'tmp/' --exclude '/kept/cache' "$mode" \
+            "$WORK/src" "$DST" > "$WORK/messages"
+    grep -q "^delete .*/extra-dir$" "$WORK/messages" || fail "the dry run does not list the deletions"
+    [ -f "$DST/extra-dir/sub/f" ] && [ -f "$DST/now-dir" ] || fail "the dry run deleted entries"
+
+    "$LP25" --delete --exclude '*.keep' --exclude 'tmp/' --exclude '/kept/cache' "$mode" \
+            "$WORK/src" "$DST" > "$WORK/messages"
+    [ -f "$DST/now-file" ] && [ -d "$DST/now-dir" ] || fail "an entry whose type changed was not replaced ($mode)"
+    [ ! -e "$DST/extra-dir" ] && [ ! -e "$DST/kept/extra" ] || fail "an extraneous entry was kept ($mode)"
+    [ -f "$DST/kept/cache/f" ] && [ -f "$DST/notes.keep" ] && [ -f "$DST/tmp/sub/f" ] ||
+        fail "an excluded entry was deleted ($mode)"
+    rm -rf "$DST/kept/cache" "$DST/notes.keep" "$DST/tmp"
+    diff -r "$WORK/src" "$DST" > /dev/null || fail "the destination is not a mirror of the source ($mode)"
+done
+exit 0
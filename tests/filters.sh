@@ -0,0 +1,54 @@
+#!/bin/sh
+# Checks the exclude/include rules: **, anchored patterns, trailing /, [...] classes and the order of the rules
+# Usage: filters.sh <LP25 executable>
+set -eu
+LP25=$(realpath "$1")
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+mkdir -p "$WORK/src/build" "$WORK/src/sub/deep" "$WORK/src/docs/deep/er" "$WORK/dst" "$WORK/dst-file"
+for f in a.log keep.log b.txt build/out.o sub/build sub/a.log sub/keep.log sub/top.cfg top.cfg \
+         docs/x.tmp docs/deep/y.tmp docs/deep/er/z.tmp docs/z.txt sub/docs.tmp data1.bin data7.bin dataX.bin \
+         sub/deep/data2.bin a.bak important.bak; do
+    printf '%s\n' "$f" > "$WORK/src/$f"
+done
+
+fail() {
+    echo "filters: $1" >&2
+    cat "$WORK/messages" >&2
+    exit 1
+}
+
+# The include rule comes first, so it wins over the exclude rule matching the same name
+"$LP25" --include keep.log --exclude '*.log' --exclude 'build/' --exclude 'docs/**/*.tmp' \
+        --exclude '/top.cfg' --exclude 'data[0-9].bin' --exclude '*.bak' "$WORK/src" "$WORK/dst" > "$WORK/messages"
+
+(cd "$WORK/dst" && find . | LC_ALL=C sort) > "$WORK/found"
+cat > "$WORK/expected" <<'EOF'
+.
+./b.txt
+./dataX.bin
+./docs
+./docs/deep
+./docs/deep/er
+./docs/z.txt
+./keep.log
+./sub
+./sub/build
+./sub/deep
+./sub/docs.tmp
+./sub/keep.log
+./sub/top.cfg
+EOF
+diff "$WORK/expected" "$WORK/found" > /dev/null || {
+    diff "$WORK/expected" "$WORK/found" >&2 || true
+    fail "the entries of the destination are not the ones kept by the rules"
+}
+
+# In a rules file, an include rule after the exclude rule matching the same name comes too late
+printf '# Backups\n- *.bak\n+ important.bak\n+ *.log\n- keep.log\n' > "$WORK/rules"
+"$LP25" --filter-file "$WORK/rules" "$WORK/src" "$WORK/dst-file" > "$WORK/messages"
+[ ! -e "$WORK/dst-file/a.bak" ] && [ ! -e "$WORK/dst-file/important.bak" ] || fail "an include rule after an exclude rule won"
+[ -f "$WORK/dst-file/keep.log" ] && [ -f "$WORK/dst-file/sub/keep.log" ] || fail "an exclude rule after an include rule won"
+[ -f "$WORK/dst-file/build/out.o" ] && [ -f "$WORK/dst-file/top.cfg" ] || fail "an entry matching no rule was excluded"
+exit 0
@@ -0,0 +1,49 @@
+#!/bin/sh
+# Checks runs with --memory-limit on a directory whose listing does not fit in the limit, with and without --delete
+# Usage: memory-limit.sh <LP25 executable>
+set -eu
+LP25=$(realpath "$1")
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+# About 4 KiB per listed entry: 3000 entries need 12 MiB, the limit is 64 KiB
+mkdir -p "$WORK/src/wide/sub" "$WORK/tmp"
+for i in $(seq 1 3000); do
+    printf '%s\n' "$i" > "$WORK/src/wide/file-$i"
+done
+printf 'deep\n' > "$WORK/src/wide/sub/f"
+export TMPDIR="$WORK/tmp"
+
+fail() {
+    echo "memory-limit: $1" >&2
+    cat "$WORK/messages" >&2
+    exit 1
+}
+
+for mode in --no-parallel -n4; do
+    DST="$WORK/dst$mode"
+    mkdir "$DST"
+    "$LP25" --memory-limit 64k "$mode" "$WORK/src" "$DST" > "$WORK/messages"
+    diff -r "$WORK/src" "$DST" > /dev/null || fail "the copy differs from the source ($mode)"
+
+    # Extraneous entries are spread over the sorted names, and the source changes at both ends
+    for i in 5 1500 2999; do
+        printf 'extra\n' > "$DST/wide/file-$i.extra"
+    done
+    mkdir "$DST/wide/extra-dir"
+    printf 'extra\n' > "$DST/wide/extra-dir/f"
+    printf 'changed %s\n' "$mode" > "$WORK/src/wide/file-1"
+    printf 'changed %s\n' "$mode" > "$WORK/src/wide/file-999"
+    printf 'new\n' > "$WORK/src/wide/zzz-new"
+
+    "$LP25" --memory-limit 64k "$mode" "$WORK/src" "$DST" > "$WORK/messages"
+    [ -f "$DST/wide/file-1500.extra" ] && [ -f "$DST/wide/extra-dir/f" ] || fail "an entry was deleted without --delete ($mode)"
+    [ "$(cat "$DST/wide/file-999")" = "changed $mode" ] && [ -f "$DST/wide/zzz-new" ] || fail "a changed file was not copied ($mode)"
+
+    "$LP25" --memory-limit 64k --delete "$mode" "$WORK/src" "$DST" > "$WORK/messages"
+    diff -r "$WORK/src" "$DST" > /dev/null || fail "the destination is not a mirror of the source after --delete ($mode)"
+
+    [ -z "$(ls -A "$WORK/tmp")" ] || fail "temporary files were left in TMPDIR ($mode)"
+    rm "$WORK/src/wide/zzz-new"
+done
+exit 0
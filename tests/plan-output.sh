@@ -0,0 +1,46 @@
+#!/bin/sh
+# Checks that `--dry-run --plan -` writes a plan that can be parsed on stdout, and nothing else
+# Usage: plan-output.sh <LP25 executable>
+set -eu
+LP25=$(realpath "$1")
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+mkdir -p "$WORK/src/dir" "$WORK/dst/old"
+printf 'new file\n' > "$WORK/src/dir/new"
+printf 'same\n' > "$WORK/src/same"
+cp -p "$WORK/src/same" "$WORK/dst/same"
+printf 'changed, longer\n' > "$WORK/src/changed"
+printf 'changed\n' > "$WORK/dst/changed"
+
+"$LP25" -v --delete --dry-run --plan - "$WORK/src" "$WORK/dst" > "$WORK/plan" 2> "$WORK/messages"
+
+fail() {
+    echo "plan-output: $1" >&2
+    cat "$WORK/plan" >&2
+    exit 1
+}
+
+# Every line of stdout follows the format of the plan (@see plan.c)
+awk '
+    NR == 1 { if ($0 != "lp25-plan 1") exit 1; next }
+    $1 == "source" && NF >= 2 { next }
+    $1 == "destination" && $2 ~ /^[0-9]+$/ { next }
+    ($1 == "copy" || $1 == "update" || $1 == "delete" || $1 == "pack") && $2 ~ /^[0-9]+$/ && ($3 == "f" || $3 == "d") && $4 ~ /^[0-9]+$/ && NF >= 5 { next }
+    $1 == "total" && NF == 4 && $3 ~ /^[0-9]+$/ && $4 ~ /^[0-9]+$/ { next }
+    $1 == "estimate_s" && NF == 2 && ($2 == "unknown" || $2 ~ /^[0-9.]+$/) { last = 1; next }
+    { exit 1 }
+    END { if (!last) exit 1 }
+' "$WORK/plan" || fail "stdout is not a plan"
+
+grep -qx "copy 0 d 0 dir" "$WORK/plan" || fail "the new directory is not planned"
+grep -qx "copy 0 f 9 dir/new" "$WORK/plan" || fail "the new file is not planned"
+grep -qx "copy 0 f 16 changed" "$WORK/plan" || fail "the changed file is not planned"
+grep -qx "delete 0 d 0 old" "$WORK/plan" || fail "the extraneous directory is not planned"
+grep -q "same" "$WORK/plan" && fail "the unchanged file is planned"
+grep -qx "total copy 3 25" "$WORK/plan" || fail "wrong copy totals"
+
+# The messages went to stderr, and the dry run changed nothing
+grep -q "^Plan: 3 copies" "$WORK/messages" || fail "the summary is not on stderr"
+[ ! -e "$WORK/dst/dir" ] && [ -d "$WORK/dst/old" ] || fail "the dry run changed the destination"
+exit 0
@@ -0,0 +1,40 @@
+#!/bin/sh
+# Checks that --restore rebuilds the source tree from a compressed backup and from a packed one
+# Usage: restore.sh <LP25 executable>
+set -eu
+LP25=$(realpath "$1")
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+mkdir -p "$WORK/src/dir/sub" "$WORK/compressed" "$WORK/packed" "$WORK/from-compressed" "$WORK/from-packed"
+seq 1 300000 > "$WORK/src/large"
+for i in 1 2 3 4; do
+    printf 'small file %s\n' "$i" > "$WORK/src/dir/small$i"
+done
+printf 'deeper\n' > "$WORK/src/dir/sub/deep"
+: > "$WORK/src/dir/empty"
+
+fail() {
+    echo "restore: $1" >&2
+    exit 1
+}
+
+"$LP25" --compress zlib "$WORK/src" "$WORK/compressed" > /dev/null
+"$LP25" --pack 1k "$WORK/src" "$WORK/packed" > /dev/null
+# A mode change after the first backup is only a metadata update
+chmod 600 "$WORK/src/large" "$WORK/src/dir/small2"
+"$LP25" --compress zlib "$WORK/src" "$WORK/compressed" > /dev/null
+"$LP25" --pack 1k "$WORK/src" "$WORK/packed" > /dev/null
+[ ! -e "$WORK/packed/dir/small1" ] || fail "the small files are not packed"
+
+"$LP25" --restore "$WORK/compressed" "$WORK/from-compressed" > /dev/null || fail "cannot restore the compressed backup"
+"$LP25" --restore "$WORK/packed" "$WORK/from-packed" > /dev/null || fail "cannot restore the packed backup"
+for restored in from-compressed from-packed; do
+    diff -r "$WORK/src" "$WORK/$restored" > /dev/null || fail "$restored differs from the source"
+    for file in large dir/small1 dir/small2 dir/sub/deep dir/empty; do
+        [ "$(stat -c '%a %Y' "$WORK/src/$file")" = "$(stat -c '%a %Y' "$WORK/$restored/$file")" ] ||
+            fail "the mode or mtime of $file differs in $restored"
+    done
+done
+[ ! -e "$WORK/from-packed/.lp25-pack" ] || fail "the pack store is restored"
+exit 0
@@ -0,0 +1,42 @@
+#!/bin/sh
+# Checks that a run killed after a checkpoint and resumed with --resume completes the backup, and
+# keeps the hard links whose first file was copied before the checkpoint
+# Usage: resume.sh <LP25 executable>
+set -eu
+LP25=$(realpath "$1")
+WORK=$(mktemp -d)
+RUN=""
+trap '[ -z "$RUN" ] || kill -9 "$RUN" 2> /dev/null || true; rm -rf "$WORK"' EXIT
+
+mkdir -p "$WORK/src/a" "$WORK/src/m" "$WORK/src/z" "$WORK/dst"
+printf 'linked\n' > "$WORK/src/a/f"
+ln "$WORK/src/a/f" "$WORK/src/z/g"
+for i in 1 2 3 4 5 6 7 8 9 10; do
+    head -c 1048576 /dev/urandom > "$WORK/src/m/file$i"
+done
+
+fail() {
+    echo "resume: $1" >&2
+    exit 1
+}
+
+# The throttled run makes its first checkpoint after 5 seconds, in the middle of m/, then it is killed
+"$LP25" --no-parallel --write-bandwidth 1m "$WORK/src" "$WORK/dst" > /dev/null &
+RUN=$!
+waited=0
+while [ ! -e "$WORK/dst/.lp25-checkpoint" ] && [ "$waited" -lt 30 ]; do
+    sleep 0.5
+    waited=$((waited + 1))
+done
+kill -9 "$RUN"
+wait "$RUN" 2> /dev/null || true
+RUN=""
+grep -q "^cursor m/" "$WORK/dst/.lp25-checkpoint" || fail "no checkpoint in m/ before the run was killed"
+[ ! -e "$WORK/dst/z/g" ] || fail "the run was killed too late"
+
+"$LP25" --no-parallel --resume "$WORK/src" "$WORK/dst" > "$WORK/messages"
+grep -q "^Resuming after m/" "$WORK/messages" || fail "the run was not resumed"
+diff -r "$WORK/src" "$WORK/dst" > /dev/null || fail "the destination differs from the source"
+[ "$(stat -c %i "$WORK/dst/a/f")" = "$(stat -c %i "$WORK/dst/z/g")" ] || fail "the hard link is not kept by the resumed run"
+[ ! -e "$WORK/dst/.lp25-checkpoint" ] && [ ! -e "$WORK/dst/.lp25-checkpoint-links" ] || fail "the checkpoint is left after a complete run"
+exit 0
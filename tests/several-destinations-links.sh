@@ -0,0 +1,37 @@
+#!/bin/sh
+# Checks that hard links of the source, and files deduplicated by --dedup link, are links in every destination
+# Usage: several-destinations-links.sh <LP25 executable>
+set -eu
+LP25=$(realpath "$1")
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+mkdir -p "$WORK/src/dir" "$WORK/d1" "$WORK/d2" "$WORK/d3"
+printf 'linked\n' > "$WORK/src/a"
+ln "$WORK/src/a" "$WORK/src/dir/b"
+ln "$WORK/src/a" "$WORK/src/c"
+printf 'duplicated\n' > "$WORK/src/e"
+cp -p "$WORK/src/e" "$WORK/src/f"
+# The second destination already holds an unchanged copy, which becomes the target of its links
+cp -p "$WORK/src/a" "$WORK/d2/a"
+# The third one holds separate unchanged copies of two links, which become links again
+cp -p "$WORK/src/a" "$WORK/d3/a"
+cp -p "$WORK/src/a" "$WORK/d3/c"
+
+"$LP25" --dedup link "$WORK/src" "$WORK/d1" "$WORK/d2" "$WORK/d3" > "$WORK/messages"
+
+fail() {
+    echo "several-destinations-links: $1" >&2
+    cat "$WORK/messages" >&2
+    exit 1
+}
+
+for d in d1 d2 d3; do
+    diff -r "$WORK/src" "$WORK/$d" > /dev/null || fail "$d differs from the source"
+    inode=$(stat -c %i "$WORK/$d/a")
+    [ "$(stat -c %i "$WORK/$d/dir/b")" = "$inode" ] && [ "$(stat -c %i "$WORK/$d/c")" = "$inode" ] ||
+        fail "the hard links are not preserved in $d"
+    [ "$(stat -c %i "$WORK/$d/e")" = "$(stat -c %i "$WORK/$d/f")" ] || fail "the duplicates are not linked in $d"
+done
+[ "$(stat -c %i "$WORK/d1/a")" != "$(stat -c %i "$WORK/d2/a")" ] || fail "two destinations share an inode"
+exit 0
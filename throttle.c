@@ -0,0 +1,160 @@
+#define _GNU_SOURCE
+#include "throttle.h"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+// The buckets live in an anonymous shared mapping created before the processes are forked, so that
+// the limits apply to the sum of the I/O of all the processes and not to each of them.
+static throttle_t *buckets = NULL;
+
+// ioprio_set has no glibc wrapper (@see linux/ioprio.h)
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_CLASS_BE 2
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_WHO_PROCESS 1
+
+/*!
+ * @brief set_process_priority applies the I/O class and the nice level of the configuration
+ * Both are inherited by the processes forked afterwards.
+ * @param the_config is a pointer to the configuration
+ * @return 0 in case of success, -1 else
+ */
+static int set_process_priority(configuration_t *the_config) {
+    int result = 0;
+    if (the_config->io_class != IO_CLASS_DEFAULT) {
+        int io_class = (the_config->io_class == IO_CLASS_IDLE) ? IOPRIO_CLASS_IDLE : IOPRIO_CLASS_BE;
+        int io_level = (the_config->io_class == IO_CLASS_IDLE) ? 0 : the_config->io_level;
+        if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, (io_class << IOPRIO_CLASS_SHIFT) | io_level) == -1) {
+            perror("Cannot set the I/O priority");
+            result = -1;
+        }
+    }
+    if (the_config->nice_level != 0) {
+        errno = 0;
+        if (setpriority(PRIO_PROCESS, 0, the_config->nice_level) == -1 && errno != 0) {
+            perror("Cannot set the nice level");
+            result = -1;
+        }
+    }
+    return result;
+}
+
+/*!
+ * @brief init_throttle sets the priority of the process and enables the I/O limits of the configuration
+ * It must be called before the processes are created (@see prepare)
+ * @param the_config is a pointer to the configuration
+ * @return 0 in case of success, -1 else
+ */
+int init_throttle(configuration_t *the_config) {
+    if (the_config == NULL) {
+        return -1;
+    }
+    int result = set_process_priority(the_config);
+    if (buckets != NULL || (the_config->read_bandwidth == 0 && the_config->read_iops == 0 &&
+                            the_config->write_bandwidth == 0 && the_config->write_iops == 0)) {
+        return result;
+    }
+
+    void *mapping = mmap(NULL, sizeof(throttle_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED) {
+        perror("Cannot allocate the I/O limits");
+        return -1;
+    }
+    buckets = (throttle_t *) mapping;
+    memset(buckets, 0, sizeof(throttle_t));
+    buckets->read_bytes.rate = the_config->read_bandwidth;
+    buckets->read_operations.rate = the_config->read_iops;
+    buckets->write_bytes.rate = the_config->write_bandwidth;
+    buckets->write_operations.rate = the_config->write_iops;
+    return result;
+}
+
+/*!
+ * @brief is_throttling_enabled tells if I/O limits are set
+ * @return true if at least one bucket is limited, false else
+ */
+bool is_throttling_enabled(void) {
+    return buckets != NULL;
+}
+
+/*!
+ * @brief reserve_tokens takes units from a bucket, without waiting
+ * The bucket keeps the instant when the units reserved so far will have been spent at its rate
+ * (generic cell rate algorithm): reserving moves it forward, and the caller must wait until it is
+ * less than THROTTLE_BURST_NS away. A compare and swap keeps this correct between processes.
+ * @param bucket is a pointer to the bucket
+ * @param units is the number of units to take
+ * @param now_ns is the current instant
+ * @return the instant until which the caller must wait
+ */
+static int64_t reserve_tokens(token_bucket_t *bucket, uint64_t units, int64_t now_ns) {
+    if (bucket->rate == 0 || units == 0) {
+        return now_ns;
+    }
+
+    int64_t cost_ns = (int64_t) ((double) units * 1e9 / (double) bucket->rate);
+    int64_t next_ns = __atomic_load_n(&bucket->next_ns, __ATOMIC_RELAXED);
+    int64_t reserved_ns;
+    do {
+        reserved_ns = ((next_ns > now_ns) ? next_ns : now_ns) + cost_ns;
+    } while (!__atomic_compare_exchange_n(&bucket->next_ns, &next_ns, reserved_ns, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    return reserved_ns - THROTTLE_BURST_NS;
+}
+
+/*!
+ * @brief throttle waits until an I/O fits in the limits of its bandwidth and operations buckets
+ * @param bytes_bucket is a pointer to the bandwidth bucket
+ * @param operations_bucket is a pointer to the operations bucket
+ * @param bytes is the size of the I/O
+ */
+static void throttle(token_bucket_t *bytes_bucket, token_bucket_t *operations_bucket, uint64_t bytes) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int64_t now_ns = (int64_t) now.tv_sec * 1000000000LL + now.tv_nsec;
+    int64_t bytes_ready_ns = reserve_tokens(bytes_bucket, bytes, now_ns);
+    int64_t operations_ready_ns = reserve_tokens(operations_bucket, 1, now_ns);
+    int64_t ready_ns = (bytes_ready_ns > operations_ready_ns) ? bytes_ready_ns : operations_ready_ns;
+    if (ready_ns <= now_ns) {
+        return;
+    }
+
+    struct timespec ready = {ready_ns / 1000000000LL, ready_ns % 1000000000LL};
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ready, NULL) == EINTR) {
+    }
+}
+
+/*!
+ * @brief throttle_read accounts a read to the read limits, waiting if they are exceeded
+ * @param bytes is the size of the read
+ */
+void throttle_read(uint64_t bytes) {
+    if (buckets != NULL) {
+        throttle(&buckets->read_bytes, &buckets->read_operations, bytes);
+    }
+}
+
+/*!
+ * @brief throttle_write accounts a write to the write limits, waiting if they are exceeded
+ * @param bytes is the size of the write
+ */
+void throttle_write(uint64_t bytes) {
+    if (buckets != NULL) {
+        throttle(&buckets->write_bytes, &buckets->write_operations, bytes);
+    }
+}
+
+/*!
+ * @brief clean_throttle releases the shared buckets
+ */
+void clean_throttle(void) {
+    if (buckets != NULL) {
+        munmap(buckets, sizeof(throttle_t));
+        buckets = NULL;
+    }
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "configuration.h"
+
+// Tokens that can be spent at once after an idle period, in nanoseconds of the bucket rate
+#define THROTTLE_BURST_NS 100000000LL
+
+typedef struct {
+    uint64_t rate; // Units (bytes or operations) per second, 0 when unlimited
+    int64_t next_ns; // Theoretical instant when all the units reserved so far are spent
+} token_bucket_t;
+
+typedef struct {
+    token_bucket_t read_bytes;
+    token_bucket_t read_operations;
+    token_bucket_t write_bytes;
+    token_bucket_t write_operations;
+} throttle_t;
+
+int init_throttle(configuration_t *the_config);
+bool is_throttling_enabled(void);
+void throttle_read(uint64_t bytes);
+void throttle_write(uint64_t bytes);
+void clean_throttle(void);
@@ -0,0 +1,216 @@
+#define _GNU_SOURCE
+#include "trace.h"
+#include "instrumentation.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+// Like the counters, the buffers live in an anonymous shared mapping created before the processes are
+// forked. Each process claims its own buffer at its first event, and its threads reserve the slots of
+// their events with an atomic increment: recording an event takes no lock. Only the pages of the
+// events actually recorded are allocated.
+static trace_t *trace = NULL;
+
+// Buffer of the current process: -1 until it is claimed, -2 when all the buffers were taken
+static int my_buffer = -1;
+// Cached id of the current thread, 0 until its first event
+static __thread pid_t my_thread_id = 0;
+
+/*!
+ * @brief forget_buffer is called in a forked child: the buffer and the thread id are its parent's
+ */
+static void forget_buffer(void) {
+    my_buffer = -1;
+    my_thread_id = 0;
+}
+
+/*!
+ * @brief init_trace enables the recording of the events of all the processes
+ * It must be called before the processes are created (@see prepare), after init_instrumentation
+ * @return 0 in case of success, -1 else
+ */
+int init_trace(void) {
+    if (trace != NULL) {
+        return 0;
+    }
+
+    void *mapping = mmap(NULL, sizeof(trace_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mapping == MAP_FAILED) {
+        perror("Cannot allocate the trace buffers");
+        return -1;
+    }
+    trace = (trace_t *) mapping;
+    clock_gettime(CLOCK_MONOTONIC, &trace->start);
+    pthread_atfork(NULL, NULL, forget_buffer);
+    return 0;
+}
+
+/*!
+ * @brief claim_buffer gives a buffer to the current process
+ * @param name is the name of the process in the trace
+ */
+static void claim_buffer(const char *name) {
+    uint32_t index = __atomic_fetch_add(&trace->buffers_count, 1, __ATOMIC_RELAXED);
+    if (index >= TRACE_MAX_PROCESSES) {
+        my_buffer = -2;
+        return;
+    }
+    trace_buffer_t *buffer = &trace->buffers[index];
+    buffer->pid = getpid();
+    strncpy(buffer->name, name, TRACE_NAME_SIZE - 1);
+    my_buffer = (int) index;
+}
+
+/*!
+ * @brief set_trace_process_name names the current process in the trace (the main process, a lister...)
+ * @param name is the name of the process
+ */
+void set_trace_process_name(const char *name) {
+    if (trace == NULL || name == NULL) {
+        return;
+    }
+    if (my_buffer == -1) {
+        claim_buffer(name);
+    } else if (my_buffer >= 0) {
+        strncpy(trace->buffers[my_buffer].name, name, TRACE_NAME_SIZE - 1);
+    }
+}
+
+/*!
+ * @brief record_trace_event records a measured operation in the buffer of the current process
+ * Nothing is recorded unless init_trace was called.
+ * @param stage is the stage of the operation (@see stage_t)
+ * @param start is a pointer to the instant the operation started
+ * @param end is a pointer to the instant the operation ended
+ * @param bytes is the amount of data processed by the operation
+ * @param path is the file (or directory) of the operation, NULL if none. A path too long for the
+ * event keeps its end, after "...", from the start of a UTF-8 character.
+ */
+void record_trace_event(uint32_t stage, struct timespec *start, struct timespec *end, uint64_t bytes, const char *path) {
+    if (trace == NULL) {
+        return;
+    }
+    if (my_buffer == -1) {
+        claim_buffer("process");
+    }
+    if (my_buffer < 0) {
+        return;
+    }
+    if (my_thread_id == 0) {
+        my_thread_id = gettid();
+    }
+
+    trace_buffer_t *buffer = &trace->buffers[my_buffer];
+    uint32_t slot = __atomic_fetch_add(&buffer->count, 1, __ATOMIC_RELAXED);
+    if (slot >= TRACE_EVENTS_PER_PROCESS) {
+        return;
+    }
+    int64_t start_ns = (int64_t) (start->tv_sec - trace->start.tv_sec) * 1000000000LL + (start->tv_nsec - trace->start.tv_nsec);
+    int64_t duration_ns = (int64_t) (end->tv_sec - start->tv_sec) * 1000000000LL + (end->tv_nsec - start->tv_nsec);
+    trace_event_t *event = &buffer->events[slot];
+    event->start_ns = (start_ns > 0) ? (uint64_t) start_ns : 0;
+    event->duration_ns = (duration_ns > 0) ? (uint64_t) duration_ns : 0;
+    event->bytes = bytes;
+    event->thread_id = (uint32_t) my_thread_id;
+    event->stage = stage;
+    size_t length = (path == NULL) ? 0 : strlen(path);
+    if (length < TRACE_PATH_SIZE) {
+        memcpy(event->path, (path == NULL) ? "" : path, length + 1);
+    } else {
+        const char *end_of_path = path + length - (TRACE_PATH_SIZE - 4);
+        while ((*end_of_path & 0xC0) == 0x80) {
+            ++end_of_path;
+        }
+        memcpy(event->path, "...", 3);
+        memcpy(event->path + 3, end_of_path, strlen(end_of_path) + 1);
+    }
+}
+
+/*!
+ * @brief write_json_string writes a string as a JSON string, with its quotes
+ * @param output is the file to write to
+ * @param text is the string to write
+ */
+static void write_json_string(FILE *output, const char *text) {
+    fputc('"', output);
+    for (const unsigned char *cursor = (const unsigned char *) text; *cursor != '\0'; ++cursor) {
+        if (*cursor == '"' || *cursor == '\\') {
+            fprintf(output, "\\%c", *cursor);
+        } else if (*cursor < 0x20) {
+            fprintf(output, "\\u%04x", *cursor);
+        } else {
+            fputc(*cursor, output);
+        }
+    }
+    fputc('"', output);
+}
+
+/*!
+ * @brief write_trace merges the buffers of all the processes into a Chrome trace (JSON), which can be
+ * opened in Perfetto or chrome://tracing
+ * It must be called once the other processes have exited (@see clean_processes).
+ * @param path is the path of the file to write, "-" for stdout
+ * @return 0 in case of success, -1 else
+ */
+int write_trace(char *path) {
+    if (trace == NULL || path == NULL) {
+        return -1;
+    }
+
+    FILE *output = (strcmp(path, "-") == 0) ? stdout : fopen(path, "w");
+    if (output == NULL) {
+        perror("Cannot open the trace file");
+        return -1;
+    }
+
+    uint64_t dropped = 0;
+    uint32_t buffers_count = (trace->buffers_count < TRACE_MAX_PROCESSES) ? trace->buffers_count : TRACE_MAX_PROCESSES;
+    fprintf(output, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    for (uint32_t b = 0; b < buffers_count; ++b) {
+        trace_buffer_t *buffer = &trace->buffers[b];
+        fprintf(output, "%s{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, \"args\": {\"name\": \"%s\"}}",
+                (b > 0) ? ",\n" : "", (int) buffer->pid, buffer->name);
+        uint32_t count = (buffer->count < TRACE_EVENTS_PER_PROCESS) ? buffer->count : TRACE_EVENTS_PER_PROCESS;
+        dropped += buffer->count - count;
+        for (uint32_t i = 0; i < count; ++i) {
+            trace_event_t *event = &buffer->events[i];
+            fprintf(output, ",\n{\"name\": \"%s\", \"cat\": \"lp25\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": %d, \"tid\": %u",
+                    get_stage_name((stage_t) event->stage), (double) event->start_ns / 1e3, (double) event->duration_ns / 1e3,
+                    (int) buffer->pid, event->thread_id);
+            if (event->bytes > 0 || event->path[0] != '\0') {
+                fprintf(output, ", \"args\": {\"bytes\": %lu", (unsigned long) event->bytes);
+                if (event->path[0] != '\0') {
+                    fprintf(output, ", \"path\": ");
+                    write_json_string(output, event->path);
+                }
+                fprintf(output, "}");
+            }
+            fprintf(output, "}");
+        }
+    }
+    fprintf(output, "\n], \"otherData\": {\"dropped_events\": %lu}}\n", (unsigned long) dropped);
+
+    if (output != stdout) {
+        fclose(output);
+    }
+    if (dropped > 0) {
+        fprintf(stderr, "%lu trace events were dropped (%d per process at most)\n", (unsigned long) dropped, TRACE_EVENTS_PER_PROCESS);
+    }
+    if (trace->buffers_count > TRACE_MAX_PROCESSES) {
+        fprintf(stderr, "The events of %u processes were not traced (%d processes at most)\n",
+                trace->buffers_count - TRACE_MAX_PROCESSES, TRACE_MAX_PROCESSES);
+    }
+    return 0;
+}
+
+/*!
+ * @brief clean_trace releases the buffers
+ */
+void clean_trace(void) {
+    if (trace != NULL) {
+        munmap(trace, sizeof(trace_t));
+        trace = NULL;
+    }
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+// Processes that can record events, and events kept per process (the next ones are counted as dropped)
+#define TRACE_MAX_PROCESSES 64
+#define TRACE_EVENTS_PER_PROCESS (64 * 1024)
+#define TRACE_NAME_SIZE 32
+// Longer paths keep their end (@see record_trace_event)
+#define TRACE_PATH_SIZE 128
+
+// A measured operation (@see instrument_end)
+typedef struct {
+    uint64_t start_ns; // Since the start of the trace
+    uint64_t duration_ns;
+    uint64_t bytes;
+    uint32_t thread_id;
+    uint32_t stage; // @see stage_t
+    char path[TRACE_PATH_SIZE]; // File (or directory) of the operation, empty if none
+} trace_event_t;
+
+// Events of one process, written by its threads only, read by the main process at exit
+typedef struct {
+    pid_t pid;
+    char name[TRACE_NAME_SIZE];
+    uint32_t count; // Events reserved, more than TRACE_EVENTS_PER_PROCESS when some were dropped
+    trace_event_t events[TRACE_EVENTS_PER_PROCESS];
+} trace_buffer_t;
+
+typedef struct {
+    struct timespec start;
+    uint32_t buffers_count; // Buffers claimed by the processes
+    trace_buffer_t buffers[TRACE_MAX_PROCESSES];
+} trace_t;
+
+int init_trace(void);
+void set_trace_process_name(const char *name);
+void record_trace_event(uint32_t stage, struct timespec *start, struct timespec *end, uint64_t bytes, const char *path);
+int write_trace(char *path);
+void clean_trace(void);
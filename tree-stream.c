@@ -0,0 +1,328 @@
+#include "tree-stream.h"
+#include "sync.h"
+#include "utility.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// Smallest batch of entries loaded at once under a memory limit
+#define STREAM_MIN_BATCH_SIZE 16
+
+// A tree stream emits the entries of a tree in the order of make_list (@see path_compare), listing
+// each directory only when its first entry is needed. Only the content of the directories between
+// the root and the current entry is kept, so its memory is bounded by the width and the depth of the
+// tree instead of its number of entries.
+// Under a memory limit, the content of a directory is loaded by batches: its names are sorted first,
+// on disk when they do not fit in memory (@see spill.c), then each batch is analyzed when it is reached.
+
+/*!
+ * @brief skip_finished_entries drops the entries of a directory content that a resumed run already
+ * handled, i.e. those up to the resume point, except the directories holding it (the entries after
+ * it are in their content). Dropped directories are never listed.
+ * @param stream is a pointer to the stream
+ * @param children is the sorted content of a directory
+ */
+static void skip_finished_entries(tree_stream_t *stream, files_list_t *children) {
+    size_t resume_length = strlen(stream->resume_after);
+    while (children->head != NULL) {
+        files_list_entry_t *entry = children->head;
+        char *relative = relative_path(entry->path_and_name, stream->root);
+        int comparison = path_compare(relative, stream->resume_after);
+        if (comparison > 0) {
+            return;
+        }
+        if (entry->entry_type == DOSSIER) {
+            size_t length = strlen(relative);
+            if (comparison == 0 ||
+                (length < resume_length && strncmp(relative, stream->resume_after, length) == 0 && stream->resume_after[length] == '/')) {
+                return;
+            }
+        }
+        children->head = entry->next;
+        if (children->head != NULL) {
+            children->head->prev = NULL;
+        } else {
+            children->tail = NULL;
+        }
+        free(entry);
+    }
+}
+
+/*!
+ * @brief prepare_children filters and analyzes the children of a level, then makes them the next entries
+ * The excluded entries are dropped before the analysis, and the excluded directories are never listed.
+ * @param stream is a pointer to the stream
+ * @param level is a pointer to the level, whose children were just listed
+ */
+static void prepare_children(tree_stream_t *stream, stream_level_t *level) {
+    filter_directory_content(&level->children, &level->filter);
+    if (stream->resume_after != NULL) {
+        skip_finished_entries(stream, &level->children);
+    }
+    if (stream->analyze != NULL) {
+        stream->analyze(&level->children, stream->parameters);
+    }
+    level->next = level->children.head;
+}
+
+/*!
+ * @brief get_level_budget computes the memory given to the deepest level of a stream
+ * Each level gets half the memory of its parent, so that the names being sorted and the batches of
+ * all the levels stay within the limit.
+ * @param stream is a pointer to the stream, with a memory limit
+ * @return the budget in bytes
+ */
+static size_t get_level_budget(tree_stream_t *stream) {
+    int shift = (stream->depth - 1 < 32) ? stream->depth - 1 : 32;
+    return (stream->memory_limit / 4) >> shift;
+}
+
+/*!
+ * @brief release_sorter releases the sorter of a level, once all its names were loaded
+ * @param level is a pointer to the level
+ */
+static void release_sorter(stream_level_t *level) {
+    if (level->sorter != NULL) {
+        clear_name_sorter(level->sorter);
+        free(level->sorter);
+        level->sorter = NULL;
+    }
+    free(level->path);
+    level->path = NULL;
+}
+
+/*!
+ * @brief load_next_children replaces the children of a level by its next batch of names
+ * The batches are loaded until one of them keeps at least an entry, or until the sorter is exhausted.
+ * @param stream is a pointer to the stream
+ * @param level is a pointer to the level, with a sorter
+ */
+static void load_next_children(tree_stream_t *stream, stream_level_t *level) {
+    size_t batch_size = get_level_budget(stream) / sizeof(files_list_entry_t);
+    if (batch_size < STREAM_MIN_BATCH_SIZE) {
+        batch_size = STREAM_MIN_BATCH_SIZE;
+    }
+
+    clear_files_list(&level->children);
+    char name[PATH_SIZE];
+    while (level->children.head == NULL && level->sorter != NULL) {
+        for (size_t count = 0; count < batch_size; ++count) {
+            bool is_directory;
+            int result = next_sorted_name(level->sorter, name, &is_directory);
+            if (result != 1) {
+                release_sorter(level);
+                break;
+            }
+            files_list_entry_t *entry = calloc(1, sizeof(files_list_entry_t));
+            if (entry == NULL) {
+                printf("Error when allocating memory in the function load_next_children of the file tree-stream.c\n");
+                release_sorter(level);
+                break;
+            }
+            if (concat_path(entry->path_and_name, level->path, name) == NULL) {
+                free(entry);
+                continue;
+            }
+            entry->entry_type = is_directory ? DOSSIER : FICHIER;
+            add_entry_to_tail(&level->children, entry);
+        }
+        prepare_children(stream, level);
+    }
+    level->next = level->children.head;
+}
+
+/*!
+ * @brief push_directory lists a directory and makes its content (or its first batch) the next entries of the stream
+ * @param stream is a pointer to the stream
+ * @param path is the path of the directory
+ * @param filter is the filter state of the directory, owned by the stream afterwards
+ * @return 0 in case of success, -1 else
+ */
+static int push_directory(tree_stream_t *stream, char *path, filter_state_t *filter) {
+    if (stream->depth == stream->capacity) {
+        int new_capacity = (stream->capacity == 0) ? 16 : stream->capacity * 2;
+        stream_level_t *new_levels = realloc(stream->levels, new_capacity * sizeof(stream_level_t));
+        if (new_levels == NULL) {
+            printf("Error when allocating memory in the function push_directory of the file tree-stream.c\n");
+            clear_filter_state(filter);
+            return -1;
+        }
+        stream->levels = new_levels;
+        stream->capacity = new_capacity;
+    }
+
+    stream_level_t *level = &stream->levels[stream->depth];
+    level->children.head = NULL;
+    level->children.tail = NULL;
+    level->next = NULL;
+    level->filter = *filter;
+    level->sorter = NULL;
+    level->path = NULL;
+    ++stream->depth;
+    if (stream->memory_limit == 0) {
+        list_directory(&level->children, path);
+        prepare_children(stream, level);
+        return 0;
+    }
+
+    level->sorter = malloc(sizeof(name_sorter_t));
+    level->path = strdup(path);
+    if (level->sorter == NULL || level->path == NULL) {
+        printf("Error when allocating memory in the function push_directory of the file tree-stream.c\n");
+        release_sorter(level);
+        return -1;
+    }
+    init_name_sorter(level->sorter, get_level_budget(stream));
+    if (sort_directory(level->sorter, path) == -1) {
+        printf("Cannot sort the content of %s\n", path);
+        release_sorter(level);
+        return -1;
+    }
+    load_next_children(stream, level);
+    return 0;
+}
+
+/*!
+ * @brief open_tree_stream prepares the stream of the entries of a tree (the root itself is not emitted)
+ * The root is listed by the first call of next_stream_entry, with the options set after the opening.
+ * @param stream is a pointer to the stream to open
+ * @param root is the root of the tree
+ * @param analyze is the function getting the properties of each listed directory content (NULL for none)
+ * @param parameters is passed to analyze
+ * @param resume_after is the path, relative to root, up to which the entries are skipped (NULL or
+ * empty to emit the whole tree). It must stay valid until the stream is closed, like root.
+ * @return 0 in case of success, -1 else
+ */
+int open_tree_stream(tree_stream_t *stream, char *root, directory_analyzer_t analyze, void *parameters, char *resume_after) {
+    if (stream == NULL || root == NULL) {
+        return -1;
+    }
+
+    memset(stream, 0, sizeof(tree_stream_t));
+    stream->analyze = analyze;
+    stream->parameters = parameters;
+    stream->root = root;
+    stream->resume_after = (resume_after != NULL && resume_after[0] != '\0') ? resume_after : NULL;
+    return 0;
+}
+
+/*!
+ * @brief set_stream_counterpart restricts the listing to the directories that exist in another tree
+ * The destination stream is compared to the source one: a destination directory missing from the
+ * source is emitted, but its content is never listed (nor analyzed), as none of it can match.
+ * @param stream is a pointer to an open stream
+ * @param counterpart_root is the root of the other tree (NULL to list every directory). It must
+ * stay valid until the stream is closed.
+ */
+void set_stream_counterpart(tree_stream_t *stream, char *counterpart_root) {
+    if (stream != NULL) {
+        stream->counterpart_root = counterpart_root;
+    }
+}
+
+/*!
+ * @brief set_stream_memory_limit bounds the memory of the listed content of the directories
+ * The names of a directory that does not fit are sorted on disk, and its entries are analyzed and
+ * emitted by batches (@see load_next_children).
+ * @param stream is a pointer to an open stream, before its first entry is requested
+ * @param memory_limit is the limit in bytes, 0 to keep the content of each directory in memory
+ */
+void set_stream_memory_limit(tree_stream_t *stream, size_t memory_limit) {
+    if (stream != NULL) {
+        stream->memory_limit = memory_limit;
+    }
+}
+
+/*!
+ * @brief has_counterpart tells if a directory of the stream also exists in the counterpart tree
+ * @param stream is a pointer to the stream
+ * @param path is the path of the directory
+ * @return true if the counterpart is a directory, or if the stream has no counterpart tree
+ */
+static bool has_counterpart(tree_stream_t *stream, char *path) {
+    if (stream->counterpart_root == NULL) {
+        return true;
+    }
+    char counterpart[PATH_SIZE];
+    struct stat counterpart_stat;
+    if (concat_path(counterpart, stream->counterpart_root, relative_path(path, stream->root)) == NULL) {
+        return true;
+    }
+    return stat(counterpart, &counterpart_stat) == 0 && S_ISDIR(counterpart_stat.st_mode);
+}
+
+/*!
+ * @brief next_stream_entry returns the next entry of a tree
+ * @param stream is a pointer to the stream
+ * @return a pointer to the entry, valid until the next call, NULL at the end of the tree
+ */
+files_list_entry_t *next_stream_entry(tree_stream_t *stream) {
+    if (stream == NULL) {
+        return NULL;
+    }
+
+    if (!stream->is_started) {
+        stream->is_started = true;
+        filter_state_t filter;
+        if (init_filter_state(&filter) == -1 || push_directory(stream, stream->root, &filter) == -1) {
+            return NULL;
+        }
+    }
+
+    // The content of a directory comes right after it
+    if (stream->pending_directory != NULL && !has_counterpart(stream, stream->pending_directory->path_and_name)) {
+        stream->pending_directory = NULL;
+    }
+    if (stream->pending_directory != NULL) {
+        files_list_entry_t *directory = stream->pending_directory;
+        stream->pending_directory = NULL;
+        // The rules reached by the directory match the names of its content
+        filter_state_t filter = {NULL, 0, 0};
+        char *name = strrchr(directory->path_and_name, '/');
+        filter_entry(&stream->levels[stream->depth - 1].filter, (name == NULL) ? directory->path_and_name : name + 1, true, &filter);
+        push_directory(stream, directory->path_and_name, &filter);
+    }
+
+    while (stream->depth > 0) {
+        stream_level_t *level = &stream->levels[stream->depth - 1];
+        if (level->next == NULL && level->sorter != NULL) {
+            load_next_children(stream, level);
+        }
+        if (level->next == NULL) {
+            clear_files_list(&level->children);
+            clear_filter_state(&level->filter);
+            --stream->depth;
+            continue;
+        }
+
+        files_list_entry_t *entry = level->next;
+        level->next = entry->next;
+        if (entry->entry_type == DOSSIER) {
+            stream->pending_directory = entry;
+        }
+        return entry;
+    }
+    return NULL;
+}
+
+/*!
+ * @brief close_tree_stream releases the levels of a stream
+ * @param stream is a pointer to the stream
+ */
+void close_tree_stream(tree_stream_t *stream) {
+    if (stream == NULL) {
+        return;
+    }
+
+    while (stream->depth > 0) {
+        --stream->depth;
+        clear_files_list(&stream->levels[stream->depth].children);
+        clear_filter_state(&stream->levels[stream->depth].filter);
+        release_sorter(&stream->levels[stream->depth]);
+    }
+    free(stream->levels);
+    stream->levels = NULL;
+    stream->capacity = 0;
+    stream->pending_directory = NULL;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdbool.h>
+#include "files-list.h"
+#include "filters.h"
+#include "spill.h"
+
+// Gets the properties of the entries of a directory, before they are emitted by the stream
+typedef void (*directory_analyzer_t)(files_list_t *children, void *parameters);
+
+typedef struct {
+    files_list_t children; // Sorted content of a directory
+    files_list_entry_t *next; // Next child to emit
+    filter_state_t filter; // Rules matching the names of the children (@see filters.c)
+    name_sorter_t *sorter; // Names of the children not loaded yet, under a memory limit (NULL else)
+    char *path; // Path of the directory, to load its next children from the sorter
+} stream_level_t;
+
+typedef struct {
+    stream_level_t *levels; // One level per directory between the root and the last emitted entry
+    int depth;
+    int capacity;
+    files_list_entry_t *pending_directory; // Last emitted directory, listed at the next call
+    directory_analyzer_t analyze;
+    void *parameters;
+    char *root;
+    char *resume_after; // Entries up to this relative path are skipped (NULL for none, @see checkpoint.h)
+    char *counterpart_root; // Only the directories also found in this tree are listed (NULL for all)
+    size_t memory_limit; // Bytes of the listed content of the directories, 0 when unlimited
+    bool is_started; // Set once the root was listed, by the first call of next_stream_entry
+} tree_stream_t;
+
+int open_tree_stream(tree_stream_t *stream, char *root, directory_analyzer_t analyze, void *parameters, char *resume_after);
+void set_stream_counterpart(tree_stream_t *stream, char *counterpart_root);
+void set_stream_memory_limit(tree_stream_t *stream, size_t memory_limit);
+files_list_entry_t *next_stream_entry(tree_stream_t *stream);
+void close_tree_stream(tree_stream_t *stream);
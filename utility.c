@@ -1,5 +1,8 @@
-#include "defines.h"
+#include "utility.h"
 #include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <errno.h>
 
 /*!
  * @brief concat_path concatenates suffix to prefix into result
@@ -38,3 +41,93 @@ char *concat_path(char *result, char *prefix, char *suffix) {
 
     return result;
 }
+
+/*!
+ * @brief relative_path gives the part of a path below a root directory
+ * @param path is a path starting with root
+ * @param root is the root directory (with or without a trailing /)
+ * @return a pointer inside path, to its part following root (without leading /)
+ */
+char *relative_path(char *path, char *root) {
+    if (path == NULL || root == NULL) {
+        return path;
+    }
+
+    size_t root_length = strlen(root);
+    char *relative = (strncmp(path, root, root_length) == 0) ? path + root_length : path;
+    while (*relative == '/') {
+        ++relative;
+    }
+    return relative;
+}
+
+/*!
+ * @brief path_compare compares two paths component by component
+ * It behaves like strcmp, except that '/' sorts before any other character, so that a directory
+ * is always immediately followed by its content (e.g. "a", "a/x", "a-b").
+ * This is the order in which make_list produces the files lists.
+ * @param lhs the first path
+ * @param rhs the second path
+ * @return a negative value if lhs comes first, 0 if both are equal, a positive value else
+ */
+int path_compare(const char *lhs, const char *rhs) {
+    const unsigned char *l = (const unsigned char *) lhs;
+    const unsigned char *r = (const unsigned char *) rhs;
+    while (*l != '\0' && *l == *r) {
+        ++l;
+        ++r;
+    }
+    if (*l == *r) {
+        return 0;
+    }
+    // '\0' < '/' < any other character
+    int lc = (*l == '/') ? 1 : (*l == '\0' ? 0 : *l + 1);
+    int rc = (*r == '/') ? 1 : (*r == '\0' ? 0 : *r + 1);
+    return lc - rc;
+}
+
+/*!
+ * @brief elapsed_seconds computes the duration between two instants
+ * @param from the start instant
+ * @param to the end instant
+ * @return the duration in seconds
+ */
+double elapsed_seconds(struct timespec *from, struct timespec *to) {
+    return (double) (to->tv_sec - from->tv_sec) + (double) (to->tv_nsec - from->tv_nsec) / 1e9;
+}
+
+/*!
+ * @brief parse_size converts a number of bytes with an optional k, m or g suffix (powers of 1024)
+ * It parses the sizes (e.g. --pack, --memory-limit) and the rates in bytes per second (--read-bandwidth).
+ * @param text is the text to convert, which must hold nothing else
+ * @param value is a pointer to the converted value
+ * @return 0 in case of success, -1 if the text is not a size, is negative or overflows
+ */
+int parse_size(char *text, uint64_t *value) {
+    char *end;
+    errno = 0;
+    unsigned long long number = strtoull(text, &end, 10);
+    if (errno != 0 || end == text || strchr(text, '-') != NULL) {
+        return -1;
+    }
+    unsigned long long multiplier = 1;
+    switch (tolower((unsigned char) *end)) {
+        case 'g':
+            multiplier *= 1024;
+            // fall through
+        case 'm':
+            multiplier *= 1024;
+            // fall through
+        case 'k':
+            multiplier *= 1024;
+            ++end;
+            break;
+        default:
+            break;
+    }
+    if (*end != '\0' || number > UINT64_MAX / multiplier) {
+        return -1;
+    }
+    *value = (uint64_t) (number * multiplier);
+    return 0;
+}
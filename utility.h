@@ -1,5 +1,11 @@
 #pragma once
 
 #include "defines.h"
+#include <time.h>
+#include <stdint.h>
 
-char *concat_path(char *result, char *prefix, char *suffix);
\ No newline at end of file
+char *concat_path(char *result, char *prefix, char *suffix);
+char *relative_path(char *path, char *root);
+int path_compare(const char *lhs, const char *rhs);
+double elapsed_seconds(struct timespec *from, struct timespec *to);
+int parse_size(char *text, uint64_t *value);